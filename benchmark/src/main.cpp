@@ -0,0 +1,721 @@
+#include "ofMain.h"
+#include "AudioBuffer.h"
+#include "BodyIndexToMask.h"
+#include "ColorConversion.h"
+#include "ConnectedComponents.h"
+#include "CopyWindow.h"
+#include "DepthBackgroundModel.h"
+#include "DepthHoleFiller.h"
+#include "DepthRemapToRange.h"
+#include "DepthTemporalFilter.h"
+#include "DoubleBuffer.h"
+#include "FrameCodec.h"
+#include "FrameQueue.h"
+#include "IcpOdometry.h"
+#include "IrToneMapper.h"
+#include "JointBilateralFilter.h"
+#include "MeshGenerator.h"
+#include "NormalEstimator.h"
+#include "PlaneDetector.h"
+#include "PointOctree.h"
+#include "Scheduler.h"
+#include "SharedFrameRing.h"
+#include "SpscRing.h"
+#include "TsdfVolume.h"
+#include "VoxelGrid.h"
+#include <atomic>
+#include <chrono>
+#include <new>
+
+using namespace ofxKinect2;
+
+//========================================================================
+// Every heap allocation of the process is counted, so a kernel that allocates per frame shows up.
+// Each form of new is paired with its own delete, and the sized ones exist when the compiler uses them, so GCC
+// doesn't see memory from one allocation function freed by another.
+static std::atomic<size_t> numAllocations(0);
+
+static void *allocate(size_t size)
+{
+    numAllocations++;
+    void *pointer = malloc(size ? size : 1);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new(size_t size)
+{
+    return allocate(size);
+}
+
+void *operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+void operator delete(void *pointer) throw()
+{
+    free(pointer);
+}
+
+void operator delete[](void *pointer) throw()
+{
+    free(pointer);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void *pointer, size_t) throw()
+{
+    free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) throw()
+{
+    free(pointer);
+}
+#endif
+
+//========================================================================
+typedef std::chrono::high_resolution_clock Clock;
+
+static const int DEPTH_WIDTH = 512;
+static const int DEPTH_HEIGHT = 424;
+static const int COLOR_WIDTH = 1920;
+static const int COLOR_HEIGHT = 1080;
+
+static double getSeconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Runs the function for at least half a second after a warm-up and prints the time per pixel, the
+ * throughput from the bytes one run reads and writes, and the allocations per run.
+ */
+template<typename Function>
+void run(const string &name, int numPixels, double bytesPerRun, Function function)
+{
+    for (int i = 0; i < 3; i++) {
+        function();
+    }
+
+    const size_t allocations = numAllocations;
+    const Clock::time_point start = Clock::now();
+    int numRuns = 0;
+    do {
+        function();
+        numRuns++;
+    } while (numRuns < 10 || getSeconds(start) < 0.5);
+
+    const double seconds = getSeconds(start) / numRuns;
+    printf("%-48s %9.3f ns/px %8.2f GB/s %8.2f allocs %9.3f ms\n", name.c_str(), seconds * 1e9 / numPixels,
+           bytesPerRun / seconds / 1e9, static_cast<double>(numAllocations - allocations) / numRuns, seconds * 1e3);
+}
+
+//========================================================================
+static void makeDepth(ofShortPixels &depth)
+{
+    depth.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+    for (int y = 0; y < DEPTH_HEIGHT; y++) {
+        for (int x = 0; x < DEPTH_WIDTH; x++) {
+            // A wall with a box in front of it, sensor noise and some holes.
+            const bool isBox = x > 180 && x < 330 && y > 120 && y < 320;
+            const int value = (isBox ? 1500 : 3000 + x) + rand() % 16;
+            depth[y * DEPTH_WIDTH + x] = rand() % 50 == 0 ? 0 : value;
+        }
+    }
+}
+
+static void makeIr(ofShortPixels &ir)
+{
+    ir.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+    for (int y = 0; y < DEPTH_HEIGHT; y++) {
+        for (int x = 0; x < DEPTH_WIDTH; x++) {
+            const bool isBox = x > 180 && x < 330 && y > 120 && y < 320;
+            ir[y * DEPTH_WIDTH + x] = (isBox ? 20000 : 6000) + rand() % 512;
+        }
+    }
+}
+
+static void makeBodyIndex(std::vector<unsigned char> &bodyIndex)
+{
+    bodyIndex.assign(DEPTH_WIDTH * DEPTH_HEIGHT, 255);
+    for (int body = 0; body < 3; body++) {
+        const int centerX = 120 + body * 140;
+        for (int y = 60; y < 400; y++) {
+            for (int x = centerX - 40; x < centerX + 40; x++) {
+                const float dx = (x - centerX) / 40.f;
+                const float dy = (y - 230) / 170.f;
+                if (dx * dx + dy * dy < 1) {
+                    bodyIndex[y * DEPTH_WIDTH + x] = body;
+                }
+            }
+        }
+    }
+}
+
+static void makeYuy2(std::vector<unsigned char> &yuy2)
+{
+    yuy2.resize(COLOR_WIDTH * COLOR_HEIGHT * 2);
+    for (size_t i = 0; i < yuy2.size(); i++) {
+        yuy2[i] = static_cast<unsigned char>((i * 7) ^ (i >> 11));
+    }
+}
+
+//========================================================================
+/**
+ * @brief Filters a flat wall with zero mean noise and checks that the filtered depth settles on the wall, in both
+ * the SIMD loop and its scalar tail (the width isn't a multiple of 8).
+ */
+static bool checkTemporalFilter(Scheduler &scheduler)
+{
+    const int width = 509, height = 64, trueDepth = 2500, noise = 12;
+    ofShortPixels depth;
+    depth.allocate(width, height, 1);
+    DepthTemporalFilter temporalFilter;
+
+    double sum = 0, tailSum = 0;
+    int count = 0, tailCount = 0;
+    for (int frame = 0; frame < 200; frame++) {
+        for (int i = 0; i < width * height; i++) {
+            depth[i] = trueDepth - noise + rand() % (2 * noise + 1);
+        }
+        temporalFilter.update(depth, &scheduler);
+        if (frame < 100) {
+            continue;
+        }
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                sum += depth[y * width + x];
+                count++;
+                if (x >= width - width % 8) {
+                    tailSum += depth[y * width + x];
+                    tailCount++;
+                }
+            }
+        }
+    }
+
+    const double error = sum / count - trueDepth;
+    const double tailError = tailSum / tailCount - trueDepth;
+    const bool isCorrect = std::abs(error) < 0.2 && std::abs(tailError) < 0.2;
+    printf("%-48s %9.3f mm %8.3f mm tail %s\n", "DepthTemporalFilter, settled mean error", error, tailError, isCorrect ? "ok" : "FAILED");
+    return isCorrect;
+}
+
+//========================================================================
+/**
+ * @brief Tone maps IR with a few black and saturated pixels, which puts the high percentile in the last histogram
+ * bucket: the range must stay within 16 bit so the image doesn't map to black.
+ */
+static bool checkToneMapperRange(Scheduler &scheduler)
+{
+    const int width = 64, height = 64;
+    ofShortPixels ir;
+    ir.allocate(width, height, 1);
+    for (int i = 0; i < width * height; i++) {
+        const int kind = i % 25;
+        ir[i] = kind == 0 ? 0 : kind == 1 ? 65535 : 1000 + rand() % 2000;
+    }
+
+    IrToneMapper toneMapper;
+    ofPixels toneMapped;
+    toneMapper.update(ir, toneMapped, &scheduler);
+    int numLit = 0, numMid = 0, numWhite = 0, numSaturated = 0;
+    for (int i = 0; i < width * height; i++) {
+        if (ir[i] == 65535) {
+            numSaturated++;
+            numWhite += toneMapped[i] == 255;
+        }
+        else if (ir[i] > 0) {
+            numMid++;
+            numLit += toneMapped[i] > 0;
+        }
+    }
+
+    const bool isCorrect = numLit == numMid && numWhite == numSaturated;
+    printf("%-48s %9d lit %8d white %s\n", "IrToneMapper, saturated high percentile", numLit, numWhite, isCorrect ? "ok" : "FAILED");
+    return isCorrect;
+}
+
+//========================================================================
+static void benchmarkDepth(Scheduler &scheduler)
+{
+    const int numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+    ofShortPixels depth, ir, filtered;
+    makeDepth(depth);
+    makeIr(ir);
+
+    ofShortPixels remapped;
+    run("depthRemapToRange", numPixels, numPixels * 4., [&]() {
+        depthRemapToRange(depth, remapped, 500, 4500, false);
+    });
+    run("depthRemapToRange, new dst (DepthStream::update)", numPixels, numPixels * 4., [&]() {
+        ofShortPixels pixels;
+        depthRemapToRange(depth, pixels, 500, 4500, false);
+    });
+
+    std::vector<unsigned char> bodyIndex;
+    makeBodyIndex(bodyIndex);
+    ofShortPixels mask;
+    run("bodyIndexToMask (BodyIndexStream::setPixels)", numPixels, numPixels * 3., [&]() {
+        bodyIndexToMask(&bodyIndex[0], DEPTH_WIDTH, DEPTH_HEIGHT, mask);
+    });
+
+    const char *threading[] = { "serial", "scheduler" };
+    for (int i = 0; i < 2; i++) {
+        Scheduler *pool = i == 0 ? nullptr : &scheduler;
+
+        IrToneMapper toneMapper;
+        ofPixels toneMapped;
+        run(string("IrToneMapper (IrStream::setPixels), ") + threading[i], numPixels, numPixels * 3., [&]() {
+            toneMapper.update(ir, toneMapped, pool);
+        });
+
+        DepthHoleFiller holeFiller;
+        run(string("DepthHoleFiller, ") + threading[i], numPixels, numPixels * 8., [&]() {
+            filtered = depth;
+            holeFiller.update(filtered, pool);
+        });
+
+        DepthTemporalFilter temporalFilter;
+        run(string("DepthTemporalFilter, ") + threading[i], numPixels, numPixels * 8., [&]() {
+            filtered = depth;
+            temporalFilter.update(filtered, pool);
+        });
+
+        JointBilateralFilter bilateralFilter;
+        run(string("JointBilateralFilter, ") + threading[i], numPixels, numPixels * 16., [&]() {
+            filtered = depth;
+            bilateralFilter.update(filtered, ir, pool);
+        });
+
+        DepthBackgroundModel backgroundModel;
+        ofPixels foregroundMask;
+        ofShortPixels foreground;
+        run(string("DepthBackgroundModel, ") + threading[i], numPixels, numPixels * 13., [&]() {
+            backgroundModel.update(depth, foregroundMask, foreground, pool);
+        });
+    }
+
+    ofPixels blobMask;
+    blobMask.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+    for (int j = 0; j < numPixels; j++) {
+        blobMask[j] = bodyIndex[j] < 6 || (j / 7) % 13 == 0 ? 255 : 0;
+    }
+    ConnectedComponents components;
+    run("ConnectedComponents", numPixels, numPixels * 3., [&]() {
+        components.update(blobMask, &depth);
+    });
+
+    // Per sample: the five depth pixels read, the point written and read by every hypothesis.
+    PlaneDetector planeDetector;
+    const double planeBytes = numPixels / 64. * (10. + 12.);
+    run("PlaneDetector, search every frame", numPixels, planeBytes, [&]() {
+        planeDetector.reset();
+        planeDetector.update(depth);
+    });
+    run("PlaneDetector, refit of the last plane", numPixels, planeBytes, [&]() {
+        planeDetector.update(depth);
+    });
+}
+
+static void benchmarkMesh(Scheduler &scheduler)
+{
+    const int numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+    ofShortPixels depth;
+    makeDepth(depth);
+
+    ofPixels gray, rgb;
+    gray.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+    rgb.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 3);
+    for (int i = 0; i < numPixels; i++) {
+        gray[i] = i & 0xFF;
+        rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = i & 0xFF;
+    }
+
+    const ofPixels *colors[] = { nullptr, &gray, &rgb };
+    const char *colorNames[] = { "no color", "gray", "rgb" };
+    const int levels[] = { 1, 2, 4 };
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            MeshGenerator generator;
+            generator.setup(70.6f, 60.f);
+            generator.setDownsamplingLevel(levels[j]);
+
+            // Per vertex: the depth and color read, the position and color written.
+            const int numVertices = numPixels / (levels[j] * levels[j]);
+            const double bytes = numVertices * (2. + 12. + (colors[i] ? colors[i]->getNumChannels() + 16. : 0.));
+            run("MeshGenerator::update, " + string(colorNames[i]) + ", level " + ofToString(levels[j]), numPixels, bytes, [&]() {
+                if (colors[i]) {
+                    generator.update(depth, *colors[i]);
+                }
+                else {
+                    generator.update(depth);
+                }
+            });
+        }
+    }
+
+    MeshGenerator generator;
+    generator.setup(70.6f, 60.f);
+    const ofMesh &mesh = generator.update(depth, rgb);
+    const char *threading[] = { "serial", "scheduler" };
+    for (int i = 0; i < 2; i++) {
+        // Per pixel: the depth read, the 10 integral sums written, read back by the column pass and the four
+        // corners, the normal and curvature written.
+        NormalEstimator normalEstimator;
+        run(string("NormalEstimator, ") + threading[i], numPixels, numPixels * (2. + 80. * 3 + 16.), [&]() {
+            normalEstimator.update(depth, i == 0 ? nullptr : &scheduler);
+        });
+
+        VoxelGrid voxelGrid;
+        run(string("VoxelGrid, 20 mm, ") + threading[i], numPixels, numPixels * (12. + 16. + 8.), [&]() {
+            voxelGrid.update(mesh, i == 0 ? nullptr : &scheduler);
+        });
+
+        // Per point: read, its key written and moved by the 3 radix passes, the point written in Morton order.
+        PointOctree octree;
+        run(string("PointOctree::update, ") + threading[i], numPixels, numPixels * (12. + 8. * 7 + 12.), [&]() {
+            octree.update(mesh, i == 0 ? nullptr : &scheduler);
+        });
+
+        // A grid of 1000 20 cm boxes over the scene, like interaction zones.
+        std::vector<PointOctree::Box> boxes;
+        for (int j = 0; j < 1000; j++) {
+            const ofVec3f corner((j % 10) * 300.f - 1500, (j / 10 % 10) * 300.f - 1500, (j / 100) * -400.f - 500);
+            boxes.push_back(PointOctree::Box(corner, corner + ofVec3f(200, 200, 200)));
+        }
+        std::vector<int> counts;
+        run(string("PointOctree::countPoints, 1000 boxes, ") + threading[i], numPixels, 0, [&]() {
+            octree.countPoints(boxes, counts, i == 0 ? nullptr : &scheduler);
+        });
+
+        // Integration reads and writes the visible blocks, 4 bytes per voxel, raycasting reads about a voxel per
+        // step.
+        TsdfVolume tsdfVolume;
+        const ofMatrix4x4 pose;
+        tsdfVolume.integrate(depth, pose, i == 0 ? nullptr : &scheduler);
+        run(string("TsdfVolume::integrate, ") + threading[i], numPixels, tsdfVolume.getNumVisibleBlocks() * TsdfVolume::BLOCK_VOXELS * 8., [&]() {
+            tsdfVolume.integrate(depth, pose, i == 0 ? nullptr : &scheduler);
+        });
+
+        ofShortPixels raycastDepth;
+        run(string("TsdfVolume::raycast, ") + threading[i], numPixels, numPixels * 2., [&]() {
+            tsdfVolume.raycast(pose, raycastDepth, i == 0 ? nullptr : &scheduler);
+        });
+
+        // The frames alternate between the depth and the depth panned by 2 pixels, so every update has a motion to
+        // find. Per pixel and iteration: the point and normal read, the matched point and normal.
+        ofShortPixels panned = depth;
+        for (int y = 0; y < DEPTH_HEIGHT; y++) {
+            for (int x = 0; x < DEPTH_WIDTH; x++) {
+                panned[y * DEPTH_WIDTH + x] = depth[y * DEPTH_WIDTH + std::min(x + 2, DEPTH_WIDTH - 1)];
+            }
+        }
+        IcpOdometry odometry;
+        int frameIndex = 0;
+        run(string("IcpOdometry, ") + threading[i], numPixels, numPixels * 4 * 48., [&]() {
+            odometry.update(frameIndex++ % 2 == 0 ? depth : panned, i == 0 ? nullptr : &scheduler);
+        });
+    }
+}
+
+static void benchmarkColor(Scheduler &scheduler)
+{
+    const int numPixels = COLOR_WIDTH * COLOR_HEIGHT;
+    std::vector<unsigned char> yuy2;
+    makeYuy2(yuy2);
+    std::vector<unsigned char> dst(numPixels * 4);
+
+    const PixelFormat formats[] = { PIXEL_FORMAT_RGBA, PIXEL_FORMAT_BGRA, PIXEL_FORMAT_RGB, PIXEL_FORMAT_GRAY };
+    const char *formatNames[] = { "RGBA", "BGRA", "RGB", "GRAY" };
+    const char *threading[] = { "serial", "scheduler" };
+    for (int i = 0; i < 2; i++) {
+        Scheduler *pool = i == 0 ? nullptr : &scheduler;
+        for (int j = 0; j < 4; j++) {
+            run("convertYuy2 to " + string(formatNames[j]) + ", " + threading[i], numPixels, numPixels * (2. + getNumChannels(formats[j])), [&]() {
+                convertYuy2(&yuy2[0], &dst[0], COLOR_WIDTH, COLOR_HEIGHT, formats[j], pool);
+            });
+        }
+
+        for (int factor = 2; factor <= 4; factor *= 2) {
+            const int width = COLOR_WIDTH / factor;
+            const int height = COLOR_HEIGHT / factor;
+            run("downsampleYuy2 by " + ofToString(factor) + " to RGBA, " + threading[i], numPixels, numPixels * 2. + width * height * 4., [&]() {
+                downsampleYuy2(&yuy2[0], COLOR_WIDTH * 2, &dst[0], width, height, factor, PIXEL_FORMAT_RGBA, pool);
+            });
+        }
+    }
+}
+
+/**
+ * @brief The acquisition work of the depth, body index and color streams on the whole frame and on the bottom quarter
+ * of it, as with Stream::setRoi(). ns/px is per pixel of the whole frame in both.
+ */
+static void benchmarkRoi(Scheduler &scheduler)
+{
+    ofShortPixels depth;
+    makeDepth(depth);
+    std::vector<unsigned char> bodyIndex;
+    makeBodyIndex(bodyIndex);
+    std::vector<unsigned char> yuy2;
+    makeYuy2(yuy2);
+    std::vector<unsigned char> dst(COLOR_WIDTH * COLOR_HEIGHT * 4);
+
+    const char *regions[] = { "whole frame", "floor strip" };
+    for (int i = 0; i < 2; i++) {
+        const int depthY = i == 0 ? 0 : DEPTH_HEIGHT * 3 / 4;
+        const int depthHeight = DEPTH_HEIGHT - depthY;
+        const int numDepthPixels = DEPTH_WIDTH * depthHeight;
+
+        ofShortPixels window, foreground;
+        ofPixels foregroundMask;
+        DepthHoleFiller holeFiller;
+        DepthTemporalFilter temporalFilter;
+        DepthBackgroundModel backgroundModel;
+        run(string("Depth copy and filters, ") + regions[i], DEPTH_WIDTH * DEPTH_HEIGHT, numDepthPixels * 31., [&]() {
+            copyWindow(depth.getPixels(), DEPTH_WIDTH, 0, depthY, DEPTH_WIDTH, depthHeight, 1, window);
+            holeFiller.update(window, &scheduler);
+            temporalFilter.update(window, &scheduler);
+            backgroundModel.update(window, foregroundMask, foreground, &scheduler);
+        });
+
+        ofPixels indices;
+        ofShortPixels mask;
+        run(string("Body index copy and mask, ") + regions[i], DEPTH_WIDTH * DEPTH_HEIGHT, numDepthPixels * 4., [&]() {
+            copyWindow(&bodyIndex[0], DEPTH_WIDTH, 0, depthY, DEPTH_WIDTH, depthHeight, 1, indices);
+            bodyIndexToMask(indices.getPixels(), DEPTH_WIDTH, depthHeight, mask);
+        });
+
+        const int colorY = i == 0 ? 0 : COLOR_HEIGHT * 3 / 4;
+        const int colorHeight = COLOR_HEIGHT - colorY;
+        const int numColorPixels = COLOR_WIDTH * colorHeight;
+        run(string("Color YUY2 to RGBA, ") + regions[i], COLOR_WIDTH * COLOR_HEIGHT, numColorPixels * 6., [&]() {
+            downsampleYuy2(&yuy2[colorY * COLOR_WIDTH * 2], COLOR_WIDTH * 2, &dst[0], COLOR_WIDTH, colorHeight, 1, PIXEL_FORMAT_RGBA, &scheduler);
+        });
+    }
+}
+
+/**
+ * @brief A producer filling and swapping full HD frames as fast as it can while a consumer keeps locking to read
+ * the front buffer, like the acquisition thread and update().
+ */
+static void benchmarkDoubleBuffer()
+{
+    DoubleBuffer<ofPixels> buffer;
+    buffer.allocate(COLOR_WIDTH, COLOR_HEIGHT, 4);
+    std::vector<unsigned char> frame(COLOR_WIDTH * COLOR_HEIGHT * 4, 128);
+    std::mutex mutex;
+    std::atomic<bool> isRunning(true);
+
+    int numSwaps = 0;
+    std::thread producer([&]() {
+        while (isRunning) {
+            memcpy(buffer.getBackBuffer().getPixels(), &frame[0], frame.size());
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer.swap();
+            numSwaps++;
+        }
+    });
+
+    int numReads = 0;
+    double lockWait = 0, maxLockWait = 0;
+    unsigned int checksum = 0;
+    const Clock::time_point start = Clock::now();
+    while (getSeconds(start) < 1) {
+        const Clock::time_point lockStart = Clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        const double wait = getSeconds(lockStart);
+        lockWait += wait;
+        maxLockWait = std::max(maxLockWait, wait);
+        checksum += buffer.getFrontBuffer()[numReads % frame.size()];
+        numReads++;
+    }
+    const double seconds = getSeconds(start);
+    isRunning = false;
+    producer.join();
+
+    printf("%-48s %9.0f swaps/s %8.2f GB/s %8.3f us lock wait, %.3f us max (%u)\n", "DoubleBuffer swap under contention",
+           numSwaps / seconds, numSwaps * frame.size() / seconds / 1e9, lockWait / numReads * 1e6, maxLockWait * 1e6, checksum & 1);
+}
+
+/**
+ * @brief A depth and a color frame through the queue of DELIVERY_MODE_QUEUE: the copy in, and the swap out that
+ * hands the consumer's buffer back to the pool.
+ */
+static void benchmarkFrameQueue()
+{
+    ofShortPixels depth, depthOut;
+    makeDepth(depth);
+    FrameQueue<ofShortPixels> depthQueue;
+    run("FrameQueue push and pop, depth", DEPTH_WIDTH * DEPTH_HEIGHT, DEPTH_WIDTH * DEPTH_HEIGHT * 4., [&]() {
+        depthQueue.push(depth, 0);
+        depthQueue.pop(depthOut);
+    });
+
+    ofPixels color, colorOut;
+    color.allocate(COLOR_WIDTH, COLOR_HEIGHT, 4);
+    FrameQueue<ofPixels> colorQueue;
+    run("FrameQueue push and pop, color RGBA", COLOR_WIDTH * COLOR_HEIGHT, COLOR_WIDTH * COLOR_HEIGHT * 8., [&]() {
+        colorQueue.push(color, 0);
+        colorQueue.pop(colorOut);
+    });
+}
+
+//========================================================================
+static void benchmarkStreaming()
+{
+    const int numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+    ofShortPixels depth, ir, decoded;
+    makeDepth(depth);
+    makeIr(ir);
+    decoded.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+
+    // Buffers reused from frame to frame like the server's pooled packets.
+    std::vector<unsigned char> buffer;
+    const char *names[] = { "depth", "IR" };
+    ofShortPixels *frames[] = { &depth, &ir };
+    for (int i = 0; i < 2; i++) {
+        size_t size = 0;
+        run(string("FrameCodec::encodePixels, ") + names[i], numPixels, numPixels * 2., [&]() {
+            size = FrameCodec::encodePixels(frames[i]->getPixels(), numPixels, buffer, 0);
+        });
+        run(string("FrameCodec::decodePixels, ") + names[i], numPixels, numPixels * 2., [&]() {
+            FrameCodec::decodePixels(&buffer[0], size, decoded.getPixels(), numPixels);
+        });
+        printf("%-48s %9.2f : 1\n", (string("  compression, ") + names[i]).c_str(), numPixels * 2. / size);
+    }
+
+    std::vector<unsigned char> bodyIndex, decodedIndex(numPixels);
+    makeBodyIndex(bodyIndex);
+    size_t size = 0;
+    run("FrameCodec::encodeLabels, body index", numPixels, numPixels, [&]() {
+        size = FrameCodec::encodeLabels(&bodyIndex[0], numPixels, buffer, 0);
+    });
+    run("FrameCodec::decodeLabels, body index", numPixels, numPixels, [&]() {
+        FrameCodec::decodeLabels(&buffer[0], size, &decodedIndex[0], numPixels);
+    });
+    printf("%-48s %9.2f : 1\n", "  compression, body index", static_cast<double>(numPixels) / size);
+}
+
+static void benchmarkSharedMemory()
+{
+    const int numPixels = COLOR_WIDTH * COLOR_HEIGHT;
+    std::vector<unsigned char> frame(numPixels * 2, 128);
+    SharedFrameRing writer, reader;
+    if (!writer.create("ofxKinect2_benchmark", frame.size()) || !reader.open("ofxKinect2_benchmark")) {
+        printf("%-48s unavailable\n", "SharedFrameRing");
+        return;
+    }
+
+    SharedFrameRing::FrameInfo info = SharedFrameRing::FrameInfo();
+    info.dataSize = frame.size();
+    run("SharedFrameRing::write, YUY2 color", numPixels, frame.size(), [&]() {
+        writer.write(info, &frame[0]);
+    });
+
+    // Time from endWrite() to the reader waking up in waitForFrame(), the frame itself is never copied.
+    SharedFrameRing::FrameInfo acquired;
+    if (reader.acquireLatest(acquired)) {
+        reader.release(acquired);
+    }
+    std::atomic<bool> isRunning(true);
+    std::atomic<int64_t> writeTime(0);
+    double wakeup = 0, maxWakeup = 0;
+    int numWakeups = 0;
+    std::thread consumer([&]() {
+        while (isRunning) {
+            if (reader.waitForFrame(100) && reader.acquireLatest(acquired)) {
+                const double latency = (Clock::now().time_since_epoch().count() - writeTime) * Clock::period::num /
+                                       static_cast<double>(Clock::period::den);
+                reader.release(acquired);
+                wakeup += latency;
+                maxWakeup = std::max(maxWakeup, latency);
+                numWakeups++;
+            }
+        }
+    });
+    for (int i = 0; i < 200; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        writer.beginWrite();
+        writeTime = Clock::now().time_since_epoch().count();
+        writer.endWrite(info);
+    }
+    isRunning = false;
+    consumer.join();
+
+    printf("%-48s %9.3f us wakeup, %.3f us max, %d of 200 frames\n", "SharedFrameRing::waitForFrame", wakeup / std::max(numWakeups, 1) * 1e6,
+           maxWakeup * 1e6, numWakeups);
+}
+
+static void benchmarkAudio()
+{
+    // Sub-frames pushed into the ring as soon as there's room while a second thread pops blocks of 64 samples.
+    SpscRing<float> ring;
+    ring.allocate(AudioBuffer::DEFAULT_CAPACITY);
+    std::vector<float> subFrame(AudioBuffer::SUBFRAME_SAMPLES, 0.5f);
+    const uint64_t numSamples = 16 * 1024 * 1024;
+    std::thread consumer([&]() {
+        float samples[64];
+        uint64_t numRead = 0;
+        while (numRead < numSamples) {
+            const size_t count = ring.pop(samples, 64);
+            if (count == 0) {
+                std::this_thread::yield();
+            }
+            numRead += count;
+        }
+    });
+
+    const Clock::time_point start = Clock::now();
+    for (uint64_t numWritten = 0; numWritten < numSamples;) {
+        size_t offset = 0;
+        while (offset < subFrame.size()) {
+            const size_t count = ring.push(&subFrame[offset], subFrame.size() - offset);
+            if (count == 0) {
+                std::this_thread::yield();
+            }
+            offset += count;
+        }
+        numWritten += offset;
+    }
+    consumer.join();
+    const double seconds = getSeconds(start);
+
+    printf("%-48s %9.2f Msamples/s %8.3f ns/sample\n", "SpscRing, 256 in, 64 out", numSamples / seconds / 1e6, seconds * 1e9 / numSamples);
+}
+
+//========================================================================
+int main()
+{
+    Scheduler scheduler;
+    scheduler.setup(std::max<int>(std::thread::hardware_concurrency(), 1));
+    printf("ofxKinect2 kernels, %d worker threads\n\n", scheduler.getNumThreads());
+
+    bool isCorrect = checkTemporalFilter(scheduler);
+    isCorrect = checkToneMapperRange(scheduler) && isCorrect;
+    printf("\n");
+    benchmarkDepth(scheduler);
+    printf("\n");
+    benchmarkMesh(scheduler);
+    printf("\n");
+    benchmarkColor(scheduler);
+    printf("\n");
+    benchmarkRoi(scheduler);
+    printf("\n");
+    benchmarkDoubleBuffer();
+    printf("\n");
+    benchmarkFrameQueue();
+    printf("\n");
+    benchmarkStreaming();
+    printf("\n");
+    benchmarkSharedMemory();
+    printf("\n");
+    benchmarkAudio();
+
+    scheduler.exit();
+    return isCorrect ? 0 : 1;
+}
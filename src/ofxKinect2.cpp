@@ -3,8 +3,14 @@
 // modified from ofxNI2.cpp of ofxNI2 by @satoruhiga
 
 #include "ofxKinect2.h"
+#include "utils\BodyIndexToMask.h"
+#include "utils\ColorConversion.h"
+#include "utils\CopyWindow.h"
 #include "utils\DepthRemapToRange.h"
+#include "utils\MeshGenerator.h"
+#include "utils\NormalEstimator.h"
 #include <cmath>
+#include <fstream>
 
 namespace ofxKinect2
 {
@@ -16,6 +22,28 @@ void init()
     }
     inited = true;
 }
+
+string getSensorName(SensorType sensorType)
+{
+    switch (sensorType) {
+    case SENSOR_COLOR:
+        return "color";
+    case SENSOR_IR:
+        return "ir";
+    case SENSOR_LONG_EXPOSURE_IR:
+        return "long_exposure_ir";
+    case SENSOR_DEPTH:
+        return "depth";
+    case SENSOR_BODY_INDEX:
+        return "body_index";
+    case SENSOR_BODY:
+        return "body";
+    case SENSOR_AUDIO:
+        return "audio";
+    default:
+        return "unknown";
+    }
+}
 } // namespace ofxKinect2
 
 using namespace ofxKinect2;
@@ -28,8 +56,13 @@ Device::Device()
     : m_Recorder(nullptr)
     , m_IsDepthColorSyncEnabled(false)
     , m_CoordinateMapper(nullptr)
+    , m_NumThreads(ofClamp(std::thread::hardware_concurrency() / 2, 1, 4))
+    , m_ThreadAffinityMask(0)
+    , m_IsSharedMemoryEnabled(false)
+    , m_IsSharedMemoryReader(false)
 {
     m_Device.kinect2 = nullptr;
+    m_ProcessingGraph.setScheduler(&m_Scheduler);
 }
 
 Device::~Device()
@@ -43,6 +76,7 @@ bool Device::setup()
     HRESULT hr = GetDefaultKinectSensor(&m_Device.kinect2);;
     if (SUCCEEDED(hr)) {
         m_Device.kinect2->Open();
+        restartScheduler();
         return true;
     }
     return false;
@@ -58,6 +92,7 @@ bool Device::setup(string kinect2FilePath)
 
 void Device::exit()
 {
+    m_StreamingServer.exit();
     if (m_Device.kinect2) {
         m_Device.kinect2->Close();
     }
@@ -77,6 +112,11 @@ void Device::exit()
         }
     }
     m_Streams.clear();
+    // The stages drop their frames first, the tasks the scheduler still runs on exit then skip them.
+    m_ProcessingGraph.reset();
+    m_Scheduler.exit();
+    m_IsSharedMemoryEnabled = false;
+    m_IsSharedMemoryReader = false;
     if (m_CoordinateMapper) {
         safeRelease(m_CoordinateMapper);
     }
@@ -100,6 +140,10 @@ void Device::update()
 
 bool Device::isOpen() const
 {
+    if (m_IsSharedMemoryReader) {
+        return true;
+    }
+
     if (m_Device.kinect2 == nullptr) {
         return false;
     }
@@ -109,10 +153,78 @@ bool Device::isOpen() const
     return open;
 }
 
+void Device::setNumThreads(int numThreads)
+{
+    m_NumThreads = std::max(numThreads, 0);
+    restartScheduler();
+}
+
+int Device::getNumThreads() const
+{
+    return m_NumThreads;
+}
+
+void Device::setThreadAffinityMask(uint64_t mask)
+{
+    m_ThreadAffinityMask = mask;
+    restartScheduler();
+}
+
+uint64_t Device::getThreadAffinityMask() const
+{
+    return m_ThreadAffinityMask;
+}
+
+Scheduler &Device::getScheduler()
+{
+    return m_Scheduler;
+}
+
+ProcessingGraph &Device::getProcessingGraph()
+{
+    return m_ProcessingGraph;
+}
+
+bool Device::saveMetrics(const string &filePath)
+{
+    const string path = ofToDataPath(filePath);
+    std::ifstream existing(path.c_str());
+    const bool hasHeader = existing.good() && existing.peek() != std::ifstream::traits_type::eof();
+    existing.close();
+
+    std::ofstream file(path.c_str(), std::ios::app);
+    if (!file) {
+        ofLogWarning("ofxKinect2::Device") << "Can't open " << path;
+        return false;
+    }
+
+    if (!hasHeader) {
+        file << StreamMetrics::getCsvHeader() << "\n";
+    }
+    for (size_t i = 0; i < m_Streams.size(); i++) {
+        file << m_Streams[i]->getMetrics().getCsvRow(getSensorName(m_Streams[i]->m_Frame.sensorType)) << "\n";
+    }
+
+    return true;
+}
+
+void Device::restartScheduler()
+{
+    if (!m_Streams.empty()) {
+        ofLogWarning("ofxKinect2::Device") << "Thread settings are applied only before the streams are set up.";
+        return;
+    }
+
+    m_Scheduler.exit();
+    if (m_NumThreads > 0 && isOpen()) {
+        m_Scheduler.setup(m_NumThreads, m_ThreadAffinityMask);
+    }
+}
+
 void Device::setDepthColorSyncEnabled(bool enabled)
 {
     m_IsDepthColorSyncEnabled = enabled;
-    if (enabled) {
+    if (enabled && m_Device.kinect2) {
         HRESULT hr = m_Device.kinect2->get_CoordinateMapper(&m_CoordinateMapper);
         if (FAILED(hr)) {
             ofLogWarning("ofxKinect2::Device") << "Cannot start depth color sync";
@@ -130,6 +242,82 @@ bool Device::isDepthColorSyncEnabled() const
     return m_IsDepthColorSyncEnabled;
 }
 
+bool Device::setStreamingEnabled(bool enabled, int port)
+{
+    if (!enabled) {
+        m_StreamingServer.exit();
+        return true;
+    }
+
+    if (m_StreamingServer.isRunning() && m_StreamingServer.getPort() == port) {
+        return true;
+    }
+    return m_StreamingServer.setup(port);
+}
+
+bool Device::isStreamingEnabled() const
+{
+    return m_StreamingServer.isRunning();
+}
+
+FrameStreamServer &Device::getStreamingServer()
+{
+    return m_StreamingServer;
+}
+
+void Device::setSharedMemoryEnabled(bool enabled, const string &name)
+{
+    if (m_IsSharedMemoryReader) {
+        ofLogWarning("ofxKinect2::Device") << "Frames read from shared memory can't be shared again.";
+        return;
+    }
+
+    // Streams create their ring from the name on their own thread, stop them first and let each one drop its ring
+    // under its lock before the name changes.
+    m_IsSharedMemoryEnabled = false;
+    for (int i = 0; i < m_Streams.size(); i++) {
+        Stream *stream = m_Streams[i];
+        if (stream->lock()) {
+            if (stream->m_SharedRing.isWriter()) {
+                stream->m_SharedRing.close();
+            }
+            stream->unlock();
+        }
+    }
+    m_SharedMemoryName = name;
+    m_IsSharedMemoryEnabled = enabled;
+}
+
+bool Device::isSharedMemoryEnabled() const
+{
+    return m_IsSharedMemoryEnabled;
+}
+
+const string &Device::getSharedMemoryName() const
+{
+    return m_SharedMemoryName;
+}
+
+bool Device::setupFromSharedMemory(const string &name)
+{
+    ofxKinect2::init();
+    if (m_Device.kinect2) {
+        ofLogWarning("ofxKinect2::Device") << "Already open on a sensor.";
+        return false;
+    }
+
+    m_SharedMemoryName = name;
+    m_IsSharedMemoryEnabled = false;
+    m_IsSharedMemoryReader = true;
+    restartScheduler();
+    return true;
+}
+
+bool Device::isSharedMemoryReader() const
+{
+    return m_IsSharedMemoryReader;
+}
+
 DeviceHandle &Device::get()
 {
     return m_Device;
@@ -155,6 +343,23 @@ const ICoordinateMapper *Device::getMapper() const
 //----------------------------------------------------------
 
 Stream::Stream()
+    : m_PollJobId(-1)
+    , m_LastAcquireTime(0)
+    , m_LastPollTime(0)
+    , m_IsReadingSharedMemory(false)
+    , m_LastSharedOpenTime(0)
+    , m_RoiX(0)
+    , m_RoiY(0)
+    , m_RoiWidth(0)
+    , m_RoiHeight(0)
+    , m_IsRoiChanged(false)
+    , m_DeliveryMode(DELIVERY_MODE_LATEST)
+    , m_FrameQueue(nullptr)
+    , m_DeliveryTimestamp(0)
+    , m_IsDeliveryPending(false)
+    , m_IsQueuePending(false)
+    , m_IsProcessingPending(false)
+    , m_QueueWaitStart(0)
 {
 
 }
@@ -166,17 +371,37 @@ Stream::~Stream()
 
 bool Stream::open()
 {
-    startThread();
+    m_Metrics.reset();
+    if (m_Device->m_Scheduler.isRunning()) {
+        m_PollJobId = m_Device->m_Scheduler.addPollJob([this]() {
+            return isPollDue() && acquireFrame();
+        });
+    }
+    else {
+        startThread();
+    }
     return true;
 }
 
 void Stream::close()
 {
+    if (m_PollJobId != -1) {
+        m_Device->m_Scheduler.removePollJob(m_PollJobId);
+        m_PollJobId = -1;
+    }
+    else if (m_IsReadingSharedMemory) {
+        // The thread may be sleeping on the ring, it has to return before the ring is unmapped.
+        waitForThread(true);
+    }
+    else {
+        stopThread();
+    }
+    m_SharedRing.close();
+    m_IsReadingSharedMemory = false;
     m_Frame.frameIndex = 0;
     m_Frame.stride = 0;
     m_Frame.data = nullptr;
     m_Frame.dataSize = 0;
-    stopThread();
 }
 
 void Stream::exit()
@@ -195,6 +420,9 @@ void Stream::exit()
 
 void Stream::update()
 {
+    if (m_IsTextureNeedUpdate) {
+        m_Metrics.addConsumed();
+    }
     m_IsTextureNeedUpdate = false;
 }
 
@@ -207,7 +435,8 @@ bool Stream::isOpen() const
 {
     bool open = (m_StreamHandle.audioBeamFrameReader != nullptr) || (m_StreamHandle.bodyFrameReader != nullptr) ||
                 (m_StreamHandle.bodyIndexFrameReader != nullptr) || (m_StreamHandle.colorFrameReader != nullptr) || (m_StreamHandle.depthFrameReader != nullptr)
-                || (m_StreamHandle.infraredFrameReader != nullptr) || (m_StreamHandle.longExposureInfraredFrameReader != nullptr);
+                || (m_StreamHandle.infraredFrameReader != nullptr) || (m_StreamHandle.longExposureInfraredFrameReader != nullptr)
+                || m_IsReadingSharedMemory;
     return open;
 }
 
@@ -275,6 +504,11 @@ bool Stream::isFrameNew() const
     return m_IsFrameNew;
 }
 
+StreamMetrics &Stream::getMetrics()
+{
+    return m_Metrics;
+}
+
 void Stream::setMirror(bool mirrored)
 {
     m_IsMirror = false;
@@ -285,9 +519,58 @@ bool Stream::isMirror() const
     return m_IsMirror;
 }
 
+void Stream::setRoi(const ofRectangle &roi)
+{
+    if (lock()) {
+        m_Roi = roi;
+        unlock();
+    }
+}
+
+void Stream::clearRoi()
+{
+    setRoi(ofRectangle());
+}
+
+bool Stream::hasRoi() const
+{
+    return m_Roi.width > 0 && m_Roi.height > 0;
+}
+
+ofRectangle Stream::getRoi() const
+{
+    if (m_RoiWidth > 0) {
+        return ofRectangle(m_RoiX, m_RoiY, m_RoiWidth, m_RoiHeight);
+    }
+    return ofRectangle(0, 0, m_Frame.width, m_Frame.height);
+}
+
+bool Stream::setDeliveryMode(DeliveryMode mode, int queueSize, DropPolicy policy)
+{
+    if (mode == DELIVERY_MODE_QUEUE && !m_FrameQueue) {
+        ofLogWarning("ofxKinect2::Stream") << "The " << getSensorName(m_Frame.sensorType) << " stream can't queue its frames.";
+        return false;
+    }
+
+    if (lock()) {
+        m_DeliveryMode = mode;
+        if (m_FrameQueue) {
+            m_FrameQueue->setup(queueSize, policy);
+        }
+        unlock();
+    }
+    return true;
+}
+
+DeliveryMode Stream::getDeliveryMode() const
+{
+    return m_DeliveryMode;
+}
+
 void Stream::draw(float x, float y)
 {
-    draw(x, y, getWidth(), getHeight());
+    const ofRectangle roi = getRoi();
+    draw(x, y, roi.width, roi.height);
 }
 
 void Stream::draw(float x, float y, float w, float h)
@@ -335,6 +618,10 @@ bool Stream::setup(Device &device, SensorType sensorType)
     m_Frame.stride = 0;
     m_Frame.data = nullptr;
     m_Frame.dataSize = 0;
+    for (int i = 0; i < 16; i++) {
+        m_Frame.pose[i] = i % 5 == 0 ? 1.f : 0.f;
+    }
+    m_Frame.isPoseTracked = false;
     m_IsFrameNew = false;
     m_IsTextureNeedUpdate = false;
 
@@ -348,17 +635,93 @@ bool Stream::setup(Device &device, SensorType sensorType)
 void Stream::threadedFunction()
 {
     while (isThreadRunning() != 0) {
-        if (lock()) {
-            if (readFrame()) {
-                m_Kinect2Timestamp = m_Frame.timestamp;
-                m_IsTextureNeedUpdate = true;
+        if (m_IsReadingSharedMemory) {
+            acquireFrame();
+            if (m_SharedRing.isOpen()) {
+                m_SharedRing.waitForFrame(SHARED_MEMORY_WAIT_MILLIS);
             }
-            unlock();
+            else {
+                ofSleepMillis(SHARED_MEMORY_WAIT_MILLIS);
+            }
+        }
+        else if (isPollDue()) {
+            acquireFrame();
+        }
+        else {
+            ofSleepMillis(1);
         }
-        if (m_Frame.mode.fps != 0) {
-            ofSleepMillis(1000.f / m_Frame.mode.fps);
+    }
+}
+
+bool Stream::isPollDue()
+{
+    // Frames come once a period: leave the SDK alone for most of it after a frame, then ask every few
+    // milliseconds until the next one is there.
+    const uint64_t now = ofGetElapsedTimeMillis();
+    const int period = 1000 / (m_Frame.mode.fps != 0 ? m_Frame.mode.fps : SENSOR_FPS);
+    if (now - m_LastAcquireTime < static_cast<uint64_t>(period * 3 / 4) || now - m_LastPollTime < POLL_INTERVAL_MILLIS) {
+        return false;
+    }
+    m_LastPollTime = now;
+    return true;
+}
+
+bool Stream::acquireFrame()
+{
+    // A frame waiting for room in the queue holds back the next one, without blocking the thread.
+    if (m_IsQueuePending && !flushQueuedFrame()) {
+        return false;
+    }
+
+    bool acquired = false;
+    if (lock()) {
+        const uint64_t acquireTicks = StreamMetrics::getHostTicks();
+        const bool isOverwritten = m_IsTextureNeedUpdate;
+        if (readFrame()) {
+            m_Kinect2Timestamp = m_Frame.timestamp;
+            m_IsTextureNeedUpdate = true;
+            m_LastAcquireTime = ofGetElapsedTimeMillis();
+            m_Metrics.addFrame(m_Frame.timestamp, acquireTicks, isOverwritten);
+            acquired = true;
         }
+        unlock();
+    }
+
+    if (m_IsProcessingPending) {
+        m_IsProcessingPending = false;
+        pushProcessingFrame();
+    }
+    if (m_IsDeliveryPending) {
+        m_IsDeliveryPending = false;
+        deliverFrame();
+    }
+    if (m_IsQueuePending) {
+        m_QueueWaitStart = ofGetElapsedTimeMillis();
+        flushQueuedFrame();
+    }
+
+    return acquired;
+}
+
+bool Stream::flushQueuedFrame()
+{
+    if (m_FrameQueue->getDropPolicy() == DROP_POLICY_BLOCK && m_FrameQueue->isFull()
+        && ofGetElapsedTimeMillis() - m_QueueWaitStart < static_cast<uint64_t>(m_FrameQueue->getBlockTimeout())) {
+        return false;
     }
+
+    // Past the block timeout pushSwap() drops the frame and counts it.
+    pushQueuedFrame();
+    m_IsQueuePending = false;
+    return true;
+}
+
+bool Stream::lockForUpdate()
+{
+    const unsigned long long start = ofGetElapsedTimeMicros();
+    const bool locked = lock();
+    m_Metrics.addLockWait(ofGetElapsedTimeMicros() - start);
+    return locked;
 }
 
 bool Stream::readFrame(IMultiSourceFrame *multiFrame)
@@ -366,9 +729,160 @@ bool Stream::readFrame(IMultiSourceFrame *multiFrame)
     return false;
 }
 
+void Stream::deliverFrame()
+{
+
+}
+
+void Stream::pushQueuedFrame()
+{
+
+}
+
+void Stream::pushProcessingFrame()
+{
+
+}
+
 void Stream::setPixels(Frame &frame)
 {
     m_Kinect2Timestamp = frame.timestamp;
+    if (m_Device->isSharedMemoryEnabled() || m_SharedRing.isWriter()) {
+        publishSharedFrame(frame);
+    }
+}
+
+void Stream::updateRoi(int width, int height, int alignment)
+{
+    int x = 0, y = 0, right = width, bottom = height;
+    if (hasRoi()) {
+        x = ofClamp(static_cast<int>(m_Roi.x), 0, width);
+        y = ofClamp(static_cast<int>(m_Roi.y), 0, height);
+        right = ofClamp(static_cast<int>(ceilf(m_Roi.x + m_Roi.width)), x, width);
+        bottom = ofClamp(static_cast<int>(ceilf(m_Roi.y + m_Roi.height)), y, height);
+        x -= x % alignment;
+        right -= (right - x) % alignment;
+    }
+    const bool isEmpty = right <= x || bottom <= y;
+    if (isEmpty) {
+        x = 0;
+        y = 0;
+        right = width;
+        bottom = height;
+    }
+
+    m_IsRoiChanged = x != m_RoiX || y != m_RoiY || right - x != m_RoiWidth || bottom - y != m_RoiHeight;
+    if (isEmpty && m_IsRoiChanged) {
+        ofLogWarning("ofxKinect2::Stream") << "Region of interest is outside the " << width << "x" << height << " frame, using the whole frame.";
+    }
+    m_RoiX = x;
+    m_RoiY = y;
+    m_RoiWidth = right - x;
+    m_RoiHeight = bottom - y;
+}
+
+bool Stream::openSharedMemory()
+{
+    m_IsReadingSharedMemory = true;
+    m_LastSharedOpenTime = 0;
+    return Stream::open();
+}
+
+void Stream::publishSharedFrame(const Frame &frame)
+{
+    if (!m_Device->isSharedMemoryEnabled()) {
+        m_SharedRing.close();
+        return;
+    }
+
+    // Only color comes with a stride, its frame is the sensor image in YUY2 or RGBA whatever the stream outputs.
+    // The others are 16 bit but body index.
+    SharedFrameRing::FrameInfo info;
+    if (frame.stride > 0) {
+        info.width = frame.stride / getNumChannels(frame.mode.pixelFormat);
+        info.height = frame.dataSize / frame.stride;
+        info.dataSize = frame.stride * info.height;
+    }
+    else {
+        info.width = frame.width;
+        info.height = frame.height;
+        info.dataSize = frame.width * frame.height * (frame.sensorType == SENSOR_BODY_INDEX ? 1 : 2);
+    }
+    info.stride = frame.stride;
+    info.pixelFormat = frame.mode.pixelFormat;
+    info.timestamp = frame.timestamp;
+    info.horizontalFieldOfView = frame.horizontalFieldOfView;
+    info.verticalFieldOfView = frame.verticalFieldOfView;
+    info.diagonalFieldOfView = frame.diagonalFieldOfView;
+
+    if (!m_SharedRing.isOpen()) {
+        // A ring closed by write() to grow is retried now and then, its readers may still hold the old one.
+        const string name = m_Device->getSharedMemoryName() + "_" + getSensorName(frame.sensorType);
+        const bool isReplacing = m_SharedRing.getName() == name;
+        const uint64_t now = ofGetElapsedTimeMillis();
+        if (isReplacing && now - m_LastSharedOpenTime < SHARED_MEMORY_RETRY_MILLIS) {
+            return;
+        }
+        m_LastSharedOpenTime = now;
+        if (!m_SharedRing.create(name, info.dataSize)) {
+            if (!isReplacing) {
+                m_Device->m_IsSharedMemoryEnabled = false;
+            }
+            return;
+        }
+    }
+    if (!m_SharedRing.write(info, frame.data)) {
+        m_LastSharedOpenTime = ofGetElapsedTimeMillis();
+    }
+}
+
+bool Stream::readSharedFrame(int downsamplingFactor)
+{
+    if (m_SharedRing.isWriterClosed()) {
+        m_SharedRing.close();
+    }
+    if (!m_SharedRing.isOpen()) {
+        // The writer may not be there yet or restart, look for its ring now and then.
+        const uint64_t now = ofGetElapsedTimeMillis();
+        if (m_LastSharedOpenTime != 0 && now - m_LastSharedOpenTime < SHARED_MEMORY_RETRY_MILLIS) {
+            return false;
+        }
+        m_LastSharedOpenTime = now;
+        if (!m_SharedRing.open(m_Device->getSharedMemoryName() + "_" + getSensorName(m_Frame.sensorType))) {
+            return false;
+        }
+    }
+
+    SharedFrameRing::FrameInfo info;
+    const unsigned char *data = m_SharedRing.acquireLatest(info);
+    if (!data) {
+        return false;
+    }
+
+    // Copy the slot out and check the writer didn't lap it meanwhile, setPixels() must never see a torn frame.
+    m_SharedFrameData.assign(data, data + info.dataSize);
+    if (!m_SharedRing.release(info)) {
+        ofLogVerbose("ofxKinect2::Stream") << "Frame " << info.sequence << " of " << m_SharedRing.getName() << " was overwritten while it was read.";
+        return false;
+    }
+
+    // Point the frame at the copy. Depth owns its frame buffer, give it back after.
+    void *frameData = m_Frame.data;
+    const int frameDataSize = m_Frame.dataSize;
+    m_Frame.timestamp = info.timestamp;
+    m_Frame.width = info.width / downsamplingFactor;
+    m_Frame.height = info.height / downsamplingFactor;
+    m_Frame.stride = info.stride;
+    m_Frame.mode.pixelFormat = static_cast<PixelFormat>(info.pixelFormat);
+    m_Frame.horizontalFieldOfView = info.horizontalFieldOfView;
+    m_Frame.verticalFieldOfView = info.verticalFieldOfView;
+    m_Frame.diagonalFieldOfView = info.diagonalFieldOfView;
+    m_Frame.data = m_SharedFrameData.empty() ? nullptr : &m_SharedFrameData[0];
+    m_Frame.dataSize = info.dataSize;
+    setPixels(m_Frame);
+    m_Frame.data = frameData;
+    m_Frame.dataSize = frameDataSize;
+    return true;
 }
 
 //----------------------------------------------------------
@@ -377,6 +891,10 @@ void Stream::setPixels(Frame &frame)
 
 bool ColorStream::readFrame(IMultiSourceFrame *multiFrame)
 {
+    if (m_IsReadingSharedMemory) {
+        return readSharedFrame(m_DownsamplingFactor);
+    }
+
     bool readed = false;
     if (!m_StreamHandle.colorFrameReader) {
         ofLogWarning("ofxKinect2::ColorStream") << "Stream is not open.";
@@ -401,6 +919,7 @@ bool ColorStream::readFrame(IMultiSourceFrame *multiFrame)
     if (SUCCEEDED(hr)) {
         IFrameDescription *colorFrameDescription = nullptr;
         ColorImageFormat imageFormat = ColorImageFormat_None;
+        int sensorWidth = 0, sensorHeight = 0;
 
         hr = colorFrame->get_RelativeTime((INT64 *)&m_Frame.timestamp);
 
@@ -409,11 +928,11 @@ bool ColorStream::readFrame(IMultiSourceFrame *multiFrame)
         }
 
         if (SUCCEEDED(hr)) {
-            hr = colorFrameDescription->get_Width(&m_Frame.width);
+            hr = colorFrameDescription->get_Width(&sensorWidth);
         }
 
         if (SUCCEEDED(hr)) {
-            hr = colorFrameDescription->get_Height(&m_Frame.height);
+            hr = colorFrameDescription->get_Height(&sensorHeight);
         }
 
         if (SUCCEEDED(hr)) {
@@ -432,17 +951,24 @@ bool ColorStream::readFrame(IMultiSourceFrame *multiFrame)
         }
 
         if (SUCCEEDED(hr)) {
-            if (m_Buffer == nullptr) {
-                m_Buffer = new unsigned char[m_Frame.width * m_Frame.height * 4];
-            }
-            if (imageFormat == ColorImageFormat_Rgba) {
+            // The sensor delivers YUY2. Its buffer is handed to setPixels() as is and converted straight into the
+            // back buffer, only an RGBA stream on a non YUY2 source takes the frame as it comes.
+            m_Frame.width = sensorWidth / m_DownsamplingFactor;
+            m_Frame.height = sensorHeight / m_DownsamplingFactor;
+            if (imageFormat == ColorImageFormat_Yuy2 || (imageFormat == ColorImageFormat_Rgba && m_PixelFormat == PIXEL_FORMAT_RGBA && m_DownsamplingFactor == 1)) {
+                m_Frame.mode.pixelFormat = imageFormat == ColorImageFormat_Yuy2 ? PIXEL_FORMAT_YUY2 : PIXEL_FORMAT_RGBA;
                 hr = colorFrame->AccessRawUnderlyingBuffer((UINT *)&m_Frame.dataSize, reinterpret_cast<BYTE **>(&m_Frame.data));
             }
             else {
+                if (m_Buffer == nullptr) {
+                    m_Buffer = new unsigned char[sensorWidth * sensorHeight * 2];
+                }
+                m_Frame.mode.pixelFormat = PIXEL_FORMAT_YUY2;
                 m_Frame.data = m_Buffer;
-                m_Frame.dataSize = m_Frame.width * m_Frame.height * 4 * sizeof(unsigned char);
-                hr = colorFrame->CopyConvertedFrameDataToArray((UINT)m_Frame.dataSize, reinterpret_cast<BYTE *>(m_Frame.data),  ColorImageFormat_Rgba);
+                m_Frame.dataSize = sensorWidth * sensorHeight * 2 * sizeof(unsigned char);
+                hr = colorFrame->CopyConvertedFrameDataToArray((UINT)m_Frame.dataSize, reinterpret_cast<BYTE *>(m_Frame.data), ColorImageFormat_Yuy2);
             }
+            m_Frame.stride = sensorWidth * getNumChannels(m_Frame.mode.pixelFormat);
         }
 
         if (SUCCEEDED(hr)) {
@@ -460,18 +986,96 @@ bool ColorStream::readFrame(IMultiSourceFrame *multiFrame)
 void ColorStream::setPixels(Frame &frame)
 {
     Stream::setPixels(frame);
-    const unsigned char *src = (const unsigned char *)frame.data;
+    if (frame.mode.pixelFormat != PIXEL_FORMAT_YUY2 && (frame.mode.pixelFormat != m_PixelFormat || m_DownsamplingFactor != 1)) {
+        // Only from shared memory, when the writer takes RGBA frames as they come.
+        ofLogWarning("ofxKinect2::ColorStream") << "Can't convert the shared frames to this format.";
+        return;
+    }
+
+    // YUY2 pixels come in pairs, the window starts and ends on a pair.
+    updateRoi(frame.width, frame.height, 2);
+    const int channels = getNumChannels(m_PixelFormat);
 
-    m_DoubleBuffer.getBackBuffer().setFromPixels(src, frame.width, frame.height, OF_IMAGE_COLOR_ALPHA);
+    // Write the window straight into the back buffer, the SDK buffer is the only other copy of the frame.
+    ofPixels &back = m_DoubleBuffer.getBackBuffer();
+    if (back.getWidth() != m_RoiWidth || back.getHeight() != m_RoiHeight) {
+        back.allocate(m_RoiWidth, m_RoiHeight, channels);
+    }
+    const int srcChannels = getNumChannels(frame.mode.pixelFormat);
+    const unsigned char *src = (const unsigned char *)frame.data + m_RoiY * m_DownsamplingFactor * frame.stride + m_RoiX * m_DownsamplingFactor * srcChannels;
+    unsigned char *dst = back.getPixels();
+    if (frame.mode.pixelFormat == m_PixelFormat) {
+        const int rowSize = m_RoiWidth * channels;
+        for (int y = 0; y < m_RoiHeight; y++) {
+            memcpy(dst + y * rowSize, src + y * frame.stride, rowSize);
+        }
+    }
+    else {
+        downsampleYuy2(src, frame.stride, dst, m_RoiWidth, m_RoiHeight, m_DownsamplingFactor, m_PixelFormat, &m_Device->getScheduler());
+    }
+    if (m_DeliveryMode == DELIVERY_MODE_QUEUE) {
+        copyWindow(dst, m_RoiWidth, 0, 0, m_RoiWidth, m_RoiHeight, channels, m_DeliveryPixels);
+        m_DeliveryTimestamp = frame.timestamp;
+        m_IsQueuePending = true;
+    }
+    if (m_ProcessingSource) {
+        m_ProcessingFrame = m_ProcessingSource->stage(m_DoubleBuffer.getBackBuffer());
+        m_ProcessingTarget = m_ProcessingSource;
+        m_IsProcessingPending = m_ProcessingFrame != nullptr;
+    }
     m_DoubleBuffer.swap();
 }
 
+void ColorStream::pushQueuedFrame()
+{
+    m_QueuedFrames.pushSwap(m_DeliveryPixels, m_DeliveryTimestamp);
+}
+
+void ColorStream::pushProcessingFrame()
+{
+    m_ProcessingTarget->push(m_ProcessingFrame);
+    m_ProcessingFrame.reset();
+}
+
 bool ColorStream::setup(ofxKinect2::Device &device)
 {
     m_Buffer = nullptr;
+    m_PixelFormat = PIXEL_FORMAT_RGBA;
+    m_DownsamplingFactor = 1;
+    m_ProcessingSource = nullptr;
+    m_ProcessingTarget = nullptr;
+    m_FrameQueue = &m_QueuedFrames;
+    m_Frame.mode.resolutionX = COLOR_WIDTH;
+    m_Frame.mode.resolutionY = COLOR_HEIGHT;
     return Stream::setup(device, SENSOR_COLOR);
 }
 
+bool ColorStream::setPixelFormat(PixelFormat format)
+{
+    if (format != PIXEL_FORMAT_RGBA && format != PIXEL_FORMAT_YUY2) {
+        ofLogWarning("ofxKinect2::ColorStream") << "Only RGBA and YUY2 can be acquired, convert with getPixels().";
+        return false;
+    }
+
+    if (isOpen()) {
+        ofLogWarning("ofxKinect2::ColorStream") << "Pixel format must be set before the stream is opened.";
+        return false;
+    }
+
+    if (format == PIXEL_FORMAT_YUY2 && m_DownsamplingFactor != 1) {
+        ofLogWarning("ofxKinect2::ColorStream") << "Downscaled output is always RGBA.";
+        return false;
+    }
+
+    m_PixelFormat = format;
+    return true;
+}
+
+PixelFormat ColorStream::getPixelFormat() const
+{
+    return m_PixelFormat;
+}
+
 void ColorStream::exit()
 {
     Stream::exit();
@@ -488,6 +1092,15 @@ bool ColorStream::open()
         return false;
     }
 
+    if (m_Device->isSharedMemoryReader()) {
+        m_Frame.mode.resolutionX = COLOR_WIDTH / m_DownsamplingFactor;
+        m_Frame.mode.resolutionY = COLOR_HEIGHT / m_DownsamplingFactor;
+        m_Frame.width = m_Frame.mode.resolutionX;
+        m_Frame.height = m_Frame.mode.resolutionY;
+        m_DoubleBuffer.allocate(m_Frame.width, m_Frame.height, getNumChannels(m_PixelFormat));
+        return openSharedMemory();
+    }
+
     IColorFrameSource *colorFrameSource = nullptr;
     HRESULT hr = m_Device->get().kinect2->get_ColorFrameSource(&colorFrameSource);
 
@@ -501,12 +1114,12 @@ bool ColorStream::open()
     if (SUCCEEDED(hr)) {
         int resolutionX, resolutionY = 0;
         hr = colorFrameDescription->get_Width(&resolutionX);
-        hr = colorFrameDescription->get_Width(&resolutionY);
-        m_Frame.mode.resolutionX = resolutionX;
-        m_Frame.mode.resolutionY = resolutionY;
-        m_Frame.width = resolutionX;
-        m_Frame.height = resolutionY;
-        m_DoubleBuffer.allocate(resolutionX, resolutionY, 4);
+        hr = colorFrameDescription->get_Height(&resolutionY);
+        m_Frame.mode.resolutionX = resolutionX / m_DownsamplingFactor;
+        m_Frame.mode.resolutionY = resolutionY / m_DownsamplingFactor;
+        m_Frame.width = m_Frame.mode.resolutionX;
+        m_Frame.height = m_Frame.mode.resolutionY;
+        m_DoubleBuffer.allocate(m_Frame.width, m_Frame.height, getNumChannels(m_PixelFormat));
 
     }
 
@@ -533,43 +1146,79 @@ void ColorStream::close()
 
 void ColorStream::update()
 {
-    if (!m_Texture.isAllocated() || m_Texture.getWidth() != getWidth() || m_Texture.getHeight() != getHeight()) {
-        m_Texture.allocate(getWidth(), getHeight(), GL_RGB);
-    }
+    if (!m_IsTextureNeedUpdate) {
+        return;
+    }
 
-    if (lock()) {
-        m_Texture.loadData(m_DoubleBuffer.getFrontBuffer());
+    bool isYuy2 = false;
+    if (lockForUpdate()) {
+        // The front buffer is the size of the region of interest.
+        const ofPixels &front = m_DoubleBuffer.getFrontBuffer();
+        if (!m_Texture.isAllocated() || m_Texture.getWidth() != front.getWidth() || m_Texture.getHeight() != front.getHeight()) {
+            m_Texture.allocate(front.getWidth(), front.getHeight(), GL_RGB);
+        }
+        // YUY2 is only copied under the lock, the conversion would hold the acquisition for a whole 1080p frame.
+        isYuy2 = front.getNumChannels() == 2;
+        if (isYuy2) {
+            copyWindow(front.getPixels(), front.getWidth(), 0, 0, front.getWidth(), front.getHeight(), 2, m_TextureSource);
+        }
+        else {
+            m_Texture.loadData(front);
+        }
         Stream::update();
         unlock();
     }
+
+    if (isYuy2) {
+        convertColor(m_TextureSource, PIXEL_FORMAT_YUY2, m_TexturePixels, PIXEL_FORMAT_RGBA, &m_Device->getScheduler());
+        m_Texture.loadData(m_TexturePixels);
+    }
 }
 
 bool ColorStream::updateMode()
 {
-    ofLogWarning("ofxKinect2::ColorStream") << "Not supported yet.";
-    return false;
+    const int width = m_Frame.mode.resolutionX;
+    const int height = m_Frame.mode.resolutionY;
+    const int factor = width > 0 ? COLOR_WIDTH / width : 0;
+    const bool isSupported = (factor == 1 || factor == 2 || factor == 4) && width * factor == COLOR_WIDTH && height * factor == COLOR_HEIGHT;
+    if (!isSupported || (factor != 1 && m_PixelFormat == PIXEL_FORMAT_YUY2)) {
+        ofLogWarning("ofxKinect2::ColorStream") << "Unsupported size " << width << "x" << height
+                                                << ", use 1920x1080, 960x540 or 480x270 (RGBA only).";
+        m_Frame.mode.resolutionX = COLOR_WIDTH / m_DownsamplingFactor;
+        m_Frame.mode.resolutionY = COLOR_HEIGHT / m_DownsamplingFactor;
+        return false;
+    }
+
+    if (lock()) {
+        m_DownsamplingFactor = factor;
+        m_Frame.width = width;
+        m_Frame.height = height;
+        m_DoubleBuffer.deallocate();
+        m_DoubleBuffer.allocate(width, height, getNumChannels(m_PixelFormat));
+        unlock();
+    }
+
+    return true;
 }
 
 bool ColorStream::setWidth(int width)
 {
-    bool ret = Stream::setWidth(width);
-    m_DoubleBuffer.deallocate();
-    m_DoubleBuffer.allocate(m_Frame.width, m_Frame.height, 4);
-    return ret;
+    return setSize(width, width * COLOR_HEIGHT / COLOR_WIDTH);
 }
 
 bool ColorStream::setHeight(int height)
 {
-    bool ret = Stream::setHeight(height);
-    m_DoubleBuffer.allocate(m_Frame.width, m_Frame.height, 4);
-    return ret;
+    return setSize(height * COLOR_WIDTH / COLOR_HEIGHT, height);
 }
 
 bool ColorStream::setSize(int width, int height)
 {
-    bool ret = Stream::setSize(width, height);
-    m_DoubleBuffer.allocate(m_Frame.width, m_Frame.height, 4);
-    return ret;
+    return Stream::setSize(width, height);
+}
+
+int ColorStream::getDownsamplingFactor() const
+{
+    return m_DownsamplingFactor;
 }
 
 ofPixels &ColorStream::getPixelsRef()
@@ -577,6 +1226,36 @@ ofPixels &ColorStream::getPixelsRef()
     return m_DoubleBuffer.getFrontBuffer();
 }
 
+bool ColorStream::getPixels(ofPixels &pixels, PixelFormat format)
+{
+    // Only the copy holds the lock, the acquisition doesn't wait for the conversion of a whole frame.
+    std::lock_guard<std::mutex> conversionLock(m_ConversionMutex);
+    PixelFormat sourceFormat = m_PixelFormat;
+    if (lock()) {
+        const ofPixels &front = m_DoubleBuffer.getFrontBuffer();
+        sourceFormat = m_PixelFormat;
+        if (front.isAllocated()) {
+            copyWindow(front.getPixels(), front.getWidth(), 0, 0, front.getWidth(), front.getHeight(), front.getNumChannels(), m_ConversionSource);
+        }
+        unlock();
+    }
+
+    return m_ConversionSource.isAllocated() && convertColor(m_ConversionSource, sourceFormat, pixels, format, &m_Device->getScheduler());
+}
+
+void ColorStream::setProcessingSource(ProcessingSource<ofPixels> *source)
+{
+    if (lock()) {
+        m_ProcessingSource = source;
+        unlock();
+    }
+}
+
+FrameQueue<ofPixels> &ColorStream::getFrameQueue()
+{
+    return m_QueuedFrames;
+}
+
 int ColorStream::getExposureTime() const
 {
     TIMESPAN exposureTime = 0;
@@ -611,6 +1290,10 @@ float ColorStream::getGamma() const
 
 bool DepthStream::readFrame(IMultiSourceFrame *multiFrame)
 {
+    if (m_IsReadingSharedMemory) {
+        return readSharedFrame();
+    }
+
     bool readed = false;
     if (!m_StreamHandle.depthFrameReader) {
         ofLogWarning("ofxKinect2::DepthStream") << "Stream is not open.";
@@ -701,15 +1384,122 @@ void DepthStream::setPixels(Frame &frame)
     Stream::setPixels(frame);
     const unsigned short *pixels = (const unsigned short *)frame.data;
 
-    m_DoubleBuffer.allocate(frame.width, frame.height, 1);
-    m_DoubleBuffer.getBackBuffer().setFromPixels(pixels, frame.width, frame.height, OF_IMAGE_GRAYSCALE);
+    updateRoi(frame.width, frame.height);
+    const int width = m_RoiWidth;
+    const int height = m_RoiHeight;
+    if (m_IsRoiChanged) {
+        // The history of each pixel no longer lines up with the window.
+        m_TemporalFilter.reset();
+        m_BackgroundModel.relearn();
+    }
+
+    copyWindow(pixels, frame.width, m_RoiX, m_RoiY, width, height, 1, m_DoubleBuffer.getBackBuffer());
+    if (m_IsHoleFillingEnabled) {
+        m_HoleFiller.update(m_DoubleBuffer.getBackBuffer(), &m_Device->getScheduler());
+    }
+    if (m_GuideStream && m_GuideStream->lock()) {
+        // Copy the part of the guide under the window so the IR stream isn't blocked while we filter.
+        const ofShortPixels &guide = m_GuideStream->getPixelsRef();
+        const ofRectangle guideRoi = m_GuideStream->getRoi();
+        const int guideX = m_RoiX - static_cast<int>(guideRoi.x);
+        const int guideY = m_RoiY - static_cast<int>(guideRoi.y);
+        const bool isCovered = guideX >= 0 && guideY >= 0 && guideX + width <= guide.getWidth() && guideY + height <= guide.getHeight();
+        if (isCovered) {
+            copyWindow(guide.getPixels(), guide.getWidth(), guideX, guideY, width, height, 1, m_GuidePixels);
+        }
+        m_GuideStream->unlock();
+        if (isCovered) {
+            m_GuidedFilter.update(m_DoubleBuffer.getBackBuffer(), m_GuidePixels, &m_Device->getScheduler());
+        }
+    }
+    if (m_IsTemporalFilterEnabled) {
+        m_TemporalFilter.update(m_DoubleBuffer.getBackBuffer(), &m_Device->getScheduler());
+    }
+    if (m_IsBackgroundSubtractionEnabled) {
+        m_BackgroundModel.update(m_DoubleBuffer.getBackBuffer(), m_ForegroundMask.getBackBuffer(), m_ForegroundPixels.getBackBuffer(),
+                                 &m_Device->getScheduler());
+        m_ForegroundMask.swap();
+        m_ForegroundPixels.swap();
+    }
+    // ICP takes about a frame, deliverFrame() runs it on the staged copy once the lock is released.
+    const bool isOdometryDue = m_IsOdometryEnabled && width == frame.width && height == frame.height;
+    if (m_IsOdometryEnabled && !isOdometryDue && m_IsRoiChanged) {
+        ofLogWarning("ofxKinect2::DepthStream") << "Odometry needs the whole frame, it's paused while there is a region of interest.";
+    }
+    if (isOdometryDue && m_IsOdometryResetPending) {
+        m_Odometry.reset();
+        m_IsOdometryResetPending = false;
+    }
+    if (m_ProcessingSource) {
+        m_ProcessingFrame = m_ProcessingSource->stage(m_DoubleBuffer.getBackBuffer());
+        m_ProcessingTarget = m_ProcessingSource;
+        m_IsProcessingPending = m_ProcessingFrame != nullptr;
+    }
+    const bool isStreamed = m_Device->getStreamingServer().hasSubscribers(SENSOR_DEPTH);
+    if (isStreamed || isOdometryDue || m_DeliveryMode == DELIVERY_MODE_QUEUE) {
+        copyWindow(m_DoubleBuffer.getBackBuffer().getPixels(), width, 0, 0, width, height, 1, m_DeliveryPixels);
+        m_DeliveryTimestamp = frame.timestamp;
+        m_IsPublishPending = isStreamed;
+        m_IsOdometryPending = isOdometryDue;
+        m_IsDeliveryPending = isStreamed || isOdometryDue;
+        m_IsQueuePending = m_DeliveryMode == DELIVERY_MODE_QUEUE;
+    }
     m_DoubleBuffer.swap();
 }
 
+void DepthStream::deliverFrame()
+{
+    // Runs before pushQueuedFrame() swaps the staged copy away.
+    if (m_IsOdometryPending) {
+        m_IsOdometryPending = false;
+        m_Odometry.setup(m_Frame.horizontalFieldOfView, m_Frame.verticalFieldOfView);
+        const bool isTracked = m_Odometry.update(m_DeliveryPixels, &m_Device->getScheduler());
+        const ofMatrix4x4 pose = m_Odometry.getPose();
+        if (lock()) {
+            // A reset asked for while ICP ran wins over this pose.
+            if (!m_IsOdometryResetPending) {
+                for (int i = 0; i < 16; i++) {
+                    m_Frame.pose[i] = pose(i / 4, i % 4);
+                }
+                m_Frame.isPoseTracked = isTracked;
+                m_PoseTimestamp = m_DeliveryTimestamp;
+            }
+            unlock();
+        }
+    }
+    if (m_IsPublishPending) {
+        m_Device->getStreamingServer().publishPixels(SENSOR_DEPTH, m_DeliveryPixels.getPixels(), m_DeliveryPixels.getWidth(),
+                                                     m_DeliveryPixels.getHeight(), m_DeliveryTimestamp);
+    }
+}
+
+void DepthStream::pushQueuedFrame()
+{
+    m_QueuedFrames.pushSwap(m_DeliveryPixels, m_DeliveryTimestamp);
+}
+
+void DepthStream::pushProcessingFrame()
+{
+    m_ProcessingTarget->push(m_ProcessingFrame);
+    m_ProcessingFrame.reset();
+}
+
 bool DepthStream::setup(ofxKinect2::Device &device)
 {
     m_NearValue = 50;
     m_FarValue = 10000;
+    m_IsHoleFillingEnabled = false;
+    m_IsTemporalFilterEnabled = false;
+    m_GuideStream = nullptr;
+    m_IsBackgroundSubtractionEnabled = false;
+    m_IsOdometryEnabled = false;
+    m_IsOdometryResetPending = false;
+    m_IsOdometryPending = false;
+    m_IsPublishPending = false;
+    m_PoseTimestamp = 0;
+    m_ProcessingSource = nullptr;
+    m_ProcessingTarget = nullptr;
+    m_FrameQueue = &m_QueuedFrames;
     return Stream::setup(device, SENSOR_DEPTH);
 }
 
@@ -723,6 +1513,10 @@ bool DepthStream::open()
     m_IsInvert = true;
     m_NearValue = 0;
     m_FarValue = 10000;
+    if (m_Device->isSharedMemoryReader()) {
+        return openSharedMemory();
+    }
+
     IDepthFrameSource *depthFrameSource = nullptr;
     HRESULT hr = m_Device->get().kinect2->get_DepthFrameSource(&depthFrameSource);
 
@@ -759,24 +1553,24 @@ void DepthStream::update()
         return;
     }
 
-    if (!m_Texture.isAllocated() || m_Texture.getWidth() != getWidth() || m_Texture.getHeight() != getHeight()) {
+    if (lockForUpdate()) {
+        // Update the image information
+        ofShortPixels pixels;
+        depthRemapToRange(m_DoubleBuffer.getFrontBuffer(), pixels, m_NearValue, m_FarValue, m_IsInvert);
+        // The front buffer is the size of the region of interest.
+        if (!m_Texture.isAllocated() || m_Texture.getWidth() != pixels.getWidth() || m_Texture.getHeight() != pixels.getHeight()) {
 #if OF_VERSION_MINOR <= 7
-        static ofTextureData data;
-        data.pixelType = GL_UNSIGNED_SHORT;
-        data.glTypeInternal = GL_LUMINANCE16;
-        data.width = getWidth();
-        data.height = getHeight();
+            static ofTextureData data;
+            data.pixelType = GL_UNSIGNED_SHORT;
+            data.glTypeInternal = GL_LUMINANCE16;
+            data.width = pixels.getWidth();
+            data.height = pixels.getHeight();
 
-        m_Texture.allocate(data);
+            m_Texture.allocate(data);
 #elif OF_VERSION_MINOR > 7
-        m_Texture.allocate(getWidth(), getHeight(), GL_RGBA, true, GL_LUMINANCE, GL_UNSIGNED_SHORT);
+            m_Texture.allocate(pixels.getWidth(), pixels.getHeight(), GL_RGBA, true, GL_LUMINANCE, GL_UNSIGNED_SHORT);
 #endif
-    }
-
-    if (lock()) {
-        // Update the image information
-        ofShortPixels pixels;
-        depthRemapToRange(m_DoubleBuffer.getFrontBuffer(), pixels, m_NearValue, m_FarValue, m_IsInvert);
+        }
         m_Texture.loadData(pixels);
         Stream::update();
         unlock();
@@ -884,12 +1678,171 @@ bool DepthStream::getInvert() const
     return m_IsInvert;
 }
 
+void DepthStream::setHoleFillingEnabled(bool enabled)
+{
+    if (lock()) {
+        m_IsHoleFillingEnabled = enabled;
+        unlock();
+    }
+}
+
+bool DepthStream::isHoleFillingEnabled() const
+{
+    return m_IsHoleFillingEnabled;
+}
+
+DepthHoleFiller &DepthStream::getHoleFiller()
+{
+    return m_HoleFiller;
+}
+
+void DepthStream::setTemporalFilterEnabled(bool enabled)
+{
+    if (lock()) {
+        m_IsTemporalFilterEnabled = enabled;
+        m_TemporalFilter.reset();
+        unlock();
+    }
+}
+
+bool DepthStream::isTemporalFilterEnabled() const
+{
+    return m_IsTemporalFilterEnabled;
+}
+
+DepthTemporalFilter &DepthStream::getTemporalFilter()
+{
+    return m_TemporalFilter;
+}
+
+void DepthStream::setGuidedFilterEnabled(IrStream *irStream)
+{
+    if (lock()) {
+        m_GuideStream = irStream;
+        unlock();
+    }
+}
+
+bool DepthStream::isGuidedFilterEnabled() const
+{
+    return m_GuideStream != nullptr;
+}
+
+JointBilateralFilter &DepthStream::getGuidedFilter()
+{
+    return m_GuidedFilter;
+}
+
+void DepthStream::setBackgroundSubtractionEnabled(bool enabled)
+{
+    if (lock()) {
+        m_IsBackgroundSubtractionEnabled = enabled;
+        m_BackgroundModel.relearn();
+        unlock();
+    }
+}
+
+bool DepthStream::isBackgroundSubtractionEnabled() const
+{
+    return m_IsBackgroundSubtractionEnabled;
+}
+
+void DepthStream::relearnBackground()
+{
+    if (lock()) {
+        m_BackgroundModel.relearn();
+        unlock();
+    }
+}
+
+DepthBackgroundModel &DepthStream::getBackgroundModel()
+{
+    return m_BackgroundModel;
+}
+
+ofPixels &DepthStream::getForegroundMaskRef()
+{
+    return m_ForegroundMask.getFrontBuffer();
+}
+
+ofShortPixels &DepthStream::getForegroundPixelsRef()
+{
+    return m_ForegroundPixels.getFrontBuffer();
+}
+
+void DepthStream::setOdometryEnabled(bool enabled)
+{
+    if (lock()) {
+        m_IsOdometryEnabled = enabled;
+        // The acquisition thread owns the odometry, it resets it before the next frame.
+        m_IsOdometryResetPending = true;
+        for (int i = 0; i < 16; i++) {
+            m_Frame.pose[i] = i % 5 == 0 ? 1.f : 0.f;
+        }
+        m_Frame.isPoseTracked = false;
+        m_PoseTimestamp = m_Frame.timestamp;
+        unlock();
+    }
+}
+
+bool DepthStream::isOdometryEnabled() const
+{
+    return m_IsOdometryEnabled;
+}
+
+IcpOdometry &DepthStream::getOdometry()
+{
+    return m_Odometry;
+}
+
+ofMatrix4x4 DepthStream::getPose(uint64_t *timestamp)
+{
+    ofMatrix4x4 pose;
+    if (lock()) {
+        for (int i = 0; i < 16; i++) {
+            pose(i / 4, i % 4) = m_Frame.pose[i];
+        }
+        if (timestamp) {
+            *timestamp = m_PoseTimestamp;
+        }
+        unlock();
+    }
+    return pose;
+}
+
+bool DepthStream::isPoseTracked()
+{
+    bool isTracked = false;
+    if (lock()) {
+        isTracked = m_Frame.isPoseTracked;
+        unlock();
+    }
+    return isTracked;
+}
+
+void DepthStream::setProcessingSource(ProcessingSource<ofShortPixels> *source)
+{
+    if (lock()) {
+        m_ProcessingSource = source;
+        unlock();
+    }
+}
+
+FrameQueue<ofShortPixels> &DepthStream::getFrameQueue()
+{
+    return m_QueuedFrames;
+}
+
 //----------------------------------------------------------
 #pragma mark - BodyIndexStream
 //----------------------------------------------------------
 
 bool BodyIndexStream::readFrame(IMultiSourceFrame *multiFrame)
 {
+    if (m_IsReadingSharedMemory) {
+        return readSharedFrame();
+    }
+
     bool isSuccess = false;
     if (!m_StreamHandle.depthFrameReader) {
         ofLogWarning("ofxKinect2::BodyIndexStream") << "Stream is not open.";
@@ -962,25 +1915,63 @@ void BodyIndexStream::setPixels(Frame &frame)
 {
     Stream::setPixels(frame);
 
+    updateRoi(frame.width, frame.height);
+    const int width = m_RoiWidth;
+    const int height = m_RoiHeight;
     const BYTE *pixels = reinterpret_cast<const BYTE *>(frame.data);
-    ofShortPixels pxs;
-    pxs.allocate(frame.width, frame.height, OF_IMAGE_GRAYSCALE);
-    for (int i = 0; i < frame.dataSize; i++) {
-        if (pixels[i] < 6) {
-            //This pixel belongs to a player
-            pxs.setColor(i, ofColor::black);
-        }
-        else {
-            pxs.setColor(i, ofColor::white);
-        }
+    if (width != frame.width || height != frame.height) {
+        // Gather the window once, the mask and the contours then only see it.
+        copyWindow(pixels, frame.width, m_RoiX, m_RoiY, width, height, 1, m_RoiIndices);
+        pixels = m_RoiIndices.getPixels();
     }
 
-    m_DoubleBuffer.getBackBuffer().setFromPixels(pxs.getPixels(), frame.width, frame.height, OF_IMAGE_GRAYSCALE);
+    bodyIndexToMask(pixels, width, height, m_DoubleBuffer.getBackBuffer());
+    if (m_DeliveryMode == DELIVERY_MODE_QUEUE) {
+        copyWindow(m_DoubleBuffer.getBackBuffer().getPixels(), width, 0, 0, width, height, 1, m_DeliveryPixels);
+        m_DeliveryTimestamp = frame.timestamp;
+        m_IsQueuePending = true;
+    }
+    if (m_ProcessingSource) {
+        m_ProcessingFrame = m_ProcessingSource->stage(m_DoubleBuffer.getBackBuffer());
+        m_ProcessingTarget = m_ProcessingSource;
+        m_IsProcessingPending = m_ProcessingFrame != nullptr;
+    }
     m_DoubleBuffer.swap();
+    if (m_Device->getStreamingServer().hasSubscribers(SENSOR_BODY_INDEX)) {
+        copyWindow(pixels, width, 0, 0, width, height, 1, m_DeliveryLabels);
+        m_DeliveryTimestamp = frame.timestamp;
+        m_IsDeliveryPending = true;
+    }
+
+    if (m_IsContoursEnabled) {
+        m_ContourFinder.update(pixels, width, height, m_Contours.getBackBuffer());
+        m_Contours.swap();
+    }
+}
+
+void BodyIndexStream::deliverFrame()
+{
+    m_Device->getStreamingServer().publishBodyIndex(m_DeliveryLabels.getPixels(), m_DeliveryLabels.getWidth(), m_DeliveryLabels.getHeight(),
+                                                    m_DeliveryTimestamp);
+}
+
+void BodyIndexStream::pushQueuedFrame()
+{
+    m_QueuedFrames.pushSwap(m_DeliveryPixels, m_DeliveryTimestamp);
+}
+
+void BodyIndexStream::pushProcessingFrame()
+{
+    m_ProcessingTarget->push(m_ProcessingFrame);
+    m_ProcessingFrame.reset();
 }
 
 bool BodyIndexStream::setup(ofxKinect2::Device &device)
 {
+    m_IsContoursEnabled = false;
+    m_ProcessingSource = nullptr;
+    m_ProcessingTarget = nullptr;
+    m_FrameQueue = &m_QueuedFrames;
     return Stream::setup(device, SensorType::SENSOR_BODY_INDEX);
 }
 
@@ -999,6 +1990,39 @@ bool BodyIndexStream::getInvert() const
     return m_IsInvert;
 }
 
+void BodyIndexStream::setContoursEnabled(bool enabled)
+{
+    m_IsContoursEnabled = enabled;
+}
+
+bool BodyIndexStream::isContoursEnabled() const
+{
+    return m_IsContoursEnabled;
+}
+
+ContourFinder &BodyIndexStream::getContourFinder()
+{
+    return m_ContourFinder;
+}
+
+const Contours &BodyIndexStream::getContours() const
+{
+    return m_Contours.getFrontBuffer();
+}
+
+void BodyIndexStream::setProcessingSource(ProcessingSource<ofShortPixels> *source)
+{
+    if (lock()) {
+        m_ProcessingSource = source;
+        unlock();
+    }
+}
+
+FrameQueue<ofShortPixels> &BodyIndexStream::getFrameQueue()
+{
+    return m_QueuedFrames;
+}
+
 bool BodyIndexStream::open()
 {
     if (!m_Device->isOpen()) {
@@ -1007,6 +2031,15 @@ bool BodyIndexStream::open()
     }
 
     m_IsInvert = true;
+    if (m_Device->isSharedMemoryReader()) {
+        m_Frame.mode.resolutionX = DEPTH_WIDTH;
+        m_Frame.mode.resolutionY = DEPTH_HEIGHT;
+        m_Frame.width = DEPTH_WIDTH;
+        m_Frame.height = DEPTH_HEIGHT;
+        m_DoubleBuffer.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 4);
+        return openSharedMemory();
+    }
+
     IBodyIndexFrameSource *frameSource = nullptr;
     HRESULT hr = E_FAIL;
 
@@ -1058,56 +2091,301 @@ void BodyIndexStream::update()
         return;
     }
 
-    if (!m_Texture.isAllocated() || m_Texture.getWidth() != getWidth() || m_Texture.getHeight() != getHeight()) {
+    if (lockForUpdate()) {
+        // The front buffer is the size of the region of interest.
+        const ofShortPixels &pixels = m_DoubleBuffer.getFrontBuffer();
+        if (!m_Texture.isAllocated() || m_Texture.getWidth() != pixels.getWidth() || m_Texture.getHeight() != pixels.getHeight()) {
 #if OF_VERSION_MINOR <= 7
-        static ofTextureData data;
+            static ofTextureData data;
 
-        data.pixelType = GL_UNSIGNED_SHORT;
-        data.glTypeInternal = GL_LUMINANCE16;
-        data.width = getWidth();
-        data.height = getHeight();
+            data.pixelType = GL_UNSIGNED_SHORT;
+            data.glTypeInternal = GL_LUMINANCE16;
+            data.width = pixels.getWidth();
+            data.height = pixels.getHeight();
 
-        m_Texture.allocate(data);
+            m_Texture.allocate(data);
 #elif OF_VERSION_MINOR > 7
-        m_Texture.allocate(getWidth(), getHeight(), GL_RGBA, true, GL_LUMINANCE, GL_UNSIGNED_SHORT);
+            m_Texture.allocate(pixels.getWidth(), pixels.getHeight(), GL_RGBA, true, GL_LUMINANCE, GL_UNSIGNED_SHORT);
 #endif
+        }
+        m_Texture.loadData(pixels);
+        unlock();
+    }
+    Stream::update();
+}
+
+bool BodyIndexStream::updateMode()
+{
+    ofLogWarning("ofxKinect2::BodyIndexStream") << "Not supported yet.";
+    return false;
+}
+
+//----------------------------------------------------------
+#pragma mark - IrStream
+//----------------------------------------------------------
+
+bool IrStream::readFrame(IMultiSourceFrame *multiFrame)
+{
+    if (m_IsReadingSharedMemory) {
+        return readSharedFrame();
+    }
+
+    bool readed = false;
+    if (!m_StreamHandle.infraredFrameReader) {
+        ofLogWarning("ofxKinect2::IrStream") << "Stream is not open.";
+        return readed;
+    }
+    Stream::readFrame();
+
+    IInfraredFrame *irFrame = nullptr;
+
+    HRESULT hr = E_FAIL;
+    if (!multiFrame) {
+        hr = m_StreamHandle.infraredFrameReader->AcquireLatestFrame(&irFrame);
+    }
+    else {
+        IInfraredFrameReference *irFrameReference = nullptr;
+        hr = multiFrame->get_InfraredFrameReference(&irFrameReference);
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrameReference->AcquireFrame(&irFrame);
+        }
+
+        safeRelease(irFrameReference);
+    }
+
+    if (SUCCEEDED(hr)) {
+        IFrameDescription *irFrameDescription = nullptr;
+
+        hr = irFrame->get_RelativeTime((INT64 *)&m_Frame.timestamp);
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrame->get_FrameDescription(&irFrameDescription);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrameDescription->get_Width(&m_Frame.width);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrameDescription->get_Height(&m_Frame.height);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrameDescription->get_HorizontalFieldOfView(&m_Frame.horizontalFieldOfView);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrameDescription->get_VerticalFieldOfView(&m_Frame.verticalFieldOfView);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrameDescription->get_DiagonalFieldOfView(&m_Frame.diagonalFieldOfView);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = irFrame->AccessUnderlyingBuffer((UINT *)&m_Frame.dataSize, reinterpret_cast<UINT16 **>(&m_Frame.data));
+        }
+
+        if (SUCCEEDED(hr)) {
+            readed = true;
+            setPixels(m_Frame);
+        }
+        safeRelease(irFrameDescription);
+    }
+
+    safeRelease(irFrame);
+
+    return readed;
+}
+
+void IrStream::setPixels(Frame &frame)
+{
+    Stream::setPixels(frame);
+    const unsigned short *pixels = (const unsigned short *)frame.data;
+
+    updateRoi(frame.width, frame.height);
+    copyWindow(pixels, frame.width, m_RoiX, m_RoiY, m_RoiWidth, m_RoiHeight, 1, m_DoubleBuffer.getBackBuffer());
+    if (m_IsToneMappingEnabled) {
+        m_ToneMapper.update(m_DoubleBuffer.getBackBuffer(), m_ToneMapped.getBackBuffer(), &m_Device->getScheduler());
+        m_ToneMapped.swap();
+    }
+    if (m_ProcessingSource) {
+        m_ProcessingFrame = m_ProcessingSource->stage(m_DoubleBuffer.getBackBuffer());
+        m_ProcessingTarget = m_ProcessingSource;
+        m_IsProcessingPending = m_ProcessingFrame != nullptr;
+    }
+    const bool isStreamed = frame.sensorType == SENSOR_IR && m_Device->getStreamingServer().hasSubscribers(SENSOR_IR);
+    if (isStreamed || m_DeliveryMode == DELIVERY_MODE_QUEUE) {
+        copyWindow(m_DoubleBuffer.getBackBuffer().getPixels(), m_RoiWidth, 0, 0, m_RoiWidth, m_RoiHeight, 1, m_DeliveryPixels);
+        m_DeliveryTimestamp = frame.timestamp;
+        m_IsDeliveryPending = isStreamed;
+        m_IsQueuePending = m_DeliveryMode == DELIVERY_MODE_QUEUE;
+    }
+    m_DoubleBuffer.swap();
+}
+
+void IrStream::deliverFrame()
+{
+    m_Device->getStreamingServer().publishPixels(SENSOR_IR, m_DeliveryPixels.getPixels(), m_DeliveryPixels.getWidth(),
+                                                 m_DeliveryPixels.getHeight(), m_DeliveryTimestamp);
+}
+
+void IrStream::pushQueuedFrame()
+{
+    m_QueuedFrames.pushSwap(m_DeliveryPixels, m_DeliveryTimestamp);
+}
+
+void IrStream::pushProcessingFrame()
+{
+    m_ProcessingTarget->push(m_ProcessingFrame);
+    m_ProcessingFrame.reset();
+}
+
+bool IrStream::setup(ofxKinect2::Device &device)
+{
+    m_ProcessingSource = nullptr;
+    m_ProcessingTarget = nullptr;
+    m_FrameQueue = &m_QueuedFrames;
+    m_IsToneMappingEnabled = false;
+    return Stream::setup(device, SENSOR_IR);
+}
+
+bool IrStream::open()
+{
+    if (!m_Device->isOpen()) {
+        ofLogWarning("ofxKinect2::IrStream") << "No ready Kinect2 found.";
+        return false;
+    }
+
+    if (m_Device->isSharedMemoryReader()) {
+        return openSharedMemory();
+    }
+
+    IInfraredFrameSource *irFrameSource = nullptr;
+    HRESULT hr = E_FAIL;
+
+    hr = m_Device->get().kinect2->get_InfraredFrameSource(&irFrameSource);
+
+    if (SUCCEEDED(hr)) {
+        hr = irFrameSource->OpenReader(&m_StreamHandle.infraredFrameReader);
+    }
+
+    safeRelease(irFrameSource);
+    if (FAILED(hr)) {
+        ofLogWarning("ofxKinect2::IrStream") << "Can't open stream.";
+        return false;
+    }
+
+    return Stream::open();
+}
+
+void IrStream::close()
+{
+    while (!lock()) {
+        printf("IrStream waiting to close\n");
+    }
+    unlock();
+
+    Stream::close();
+    safeRelease(m_StreamHandle.infraredFrameReader);
+}
+
+void IrStream::update()
+{
+    if (!m_IsTextureNeedUpdate) {
+        return;
+    }
+
+    if (lockForUpdate()) {
+        // The raw 16 bit IR sits in the bottom few bits, show it tone mapped.
+        if (!m_IsToneMappingEnabled) {
+            m_ToneMapper.update(m_DoubleBuffer.getFrontBuffer(), m_ToneMapped.getFrontBuffer(), &m_Device->getScheduler());
+        }
+        // The front buffer is the size of the region of interest.
+        const ofPixels &pixels = m_ToneMapped.getFrontBuffer();
+        if (!m_Texture.isAllocated() || m_Texture.getWidth() != pixels.getWidth() || m_Texture.getHeight() != pixels.getHeight()) {
+            m_Texture.allocate(pixels.getWidth(), pixels.getHeight(), GL_LUMINANCE);
+        }
+        m_Texture.loadData(pixels);
+        Stream::update();
+        unlock();
+    }
+}
+
+bool IrStream::updateMode()
+{
+    ofLogWarning("ofxKinect2::IrStream") << "Not supported yet.";
+    return false;
+}
+
+ofShortPixels &IrStream::getPixelsRef()
+{
+    return m_DoubleBuffer.getFrontBuffer();
+}
+
+ofPixels &IrStream::getToneMappedPixelsRef()
+{
+    return m_ToneMapped.getFrontBuffer();
+}
+
+void IrStream::setToneMappingEnabled(bool enabled)
+{
+    if (lock()) {
+        m_IsToneMappingEnabled = enabled;
+        unlock();
     }
+}
+
+bool IrStream::isToneMappingEnabled() const
+{
+    return m_IsToneMappingEnabled;
+}
 
+IrToneMapper &IrStream::getToneMapper()
+{
+    return m_ToneMapper;
+}
+
+void IrStream::setProcessingSource(ProcessingSource<ofShortPixels> *source)
+{
     if (lock()) {
-        m_Texture.loadData(m_DoubleBuffer.getFrontBuffer());
+        m_ProcessingSource = source;
         unlock();
     }
-    Stream::update();
 }
 
-bool BodyIndexStream::updateMode()
+FrameQueue<ofShortPixels> &IrStream::getFrameQueue()
 {
-    ofLogWarning("ofxKinect2::BodyIndexStream") << "Not supported yet.";
-    return false;
+    return m_QueuedFrames;
 }
 
 //----------------------------------------------------------
-#pragma mark - IrStream
+#pragma mark - LongExposureIrStream
 //----------------------------------------------------------
 
-bool IrStream::readFrame(IMultiSourceFrame *multiFrame)
+bool LongExposureIrStream::readFrame(IMultiSourceFrame *multiFrame)
 {
+    if (m_IsReadingSharedMemory) {
+        return readSharedFrame();
+    }
+
     bool readed = false;
-    if (!m_StreamHandle.infraredFrameReader) {
-        ofLogWarning("ofxKinect2::IrStream") << "Stream is not open.";
+    if (!m_StreamHandle.longExposureInfraredFrameReader) {
+        ofLogWarning("ofxKinect2::LongExposureIrStream") << "Stream is not open.";
         return readed;
     }
     Stream::readFrame();
 
-    IInfraredFrame *irFrame = nullptr;
+    ILongExposureInfraredFrame *irFrame = nullptr;
 
     HRESULT hr = E_FAIL;
     if (!multiFrame) {
-        hr = m_StreamHandle.infraredFrameReader->AcquireLatestFrame(&irFrame);
+        hr = m_StreamHandle.longExposureInfraredFrameReader->AcquireLatestFrame(&irFrame);
     }
     else {
-        IInfraredFrameReference *irFrameReference = nullptr;
-        hr = multiFrame->get_InfraredFrameReference(&irFrameReference);
+        ILongExposureInfraredFrameReference *irFrameReference = nullptr;
+        hr = multiFrame->get_LongExposureInfraredFrameReference(&irFrameReference);
 
         if (SUCCEEDED(hr)) {
             hr = irFrameReference->AcquireFrame(&irFrame);
@@ -1161,79 +2439,53 @@ bool IrStream::readFrame(IMultiSourceFrame *multiFrame)
     return readed;
 }
 
-void IrStream::setPixels(Frame &frame)
-{
-    Stream::setPixels(frame);
-    const unsigned short *pixels = (const unsigned short *)frame.data;
-
-    m_DoubleBuffer.allocate(frame.width, frame.height, 1);
-    m_DoubleBuffer.getBackBuffer().setFromPixels(pixels, frame.width, frame.height, OF_IMAGE_GRAYSCALE);
-    m_DoubleBuffer.swap();
-}
-
-bool IrStream::setup(ofxKinect2::Device &device)
+bool LongExposureIrStream::setup(ofxKinect2::Device &device)
 {
-    return Stream::setup(device, SENSOR_IR);
+    if (!IrStream::setup(device)) {
+        return false;
+    }
+    m_Frame.sensorType = SENSOR_LONG_EXPOSURE_IR;
+    return true;
 }
 
-bool IrStream::open()
+bool LongExposureIrStream::open()
 {
     if (!m_Device->isOpen()) {
-        ofLogWarning("ofxKinect2::IrStream") << "No ready Kinect2 found.";
+        ofLogWarning("ofxKinect2::LongExposureIrStream") << "No ready Kinect2 found.";
         return false;
     }
 
-    IInfraredFrameSource *irFrameSource = nullptr;
+    if (m_Device->isSharedMemoryReader()) {
+        return openSharedMemory();
+    }
+
+    ILongExposureInfraredFrameSource *irFrameSource = nullptr;
     HRESULT hr = E_FAIL;
 
-    hr = m_Device->get().kinect2->get_InfraredFrameSource(&irFrameSource);
+    hr = m_Device->get().kinect2->get_LongExposureInfraredFrameSource(&irFrameSource);
 
     if (SUCCEEDED(hr)) {
-        hr = irFrameSource->OpenReader(&m_StreamHandle.infraredFrameReader);
+        hr = irFrameSource->OpenReader(&m_StreamHandle.longExposureInfraredFrameReader);
     }
 
     safeRelease(irFrameSource);
     if (FAILED(hr)) {
-        ofLogWarning("ofxKinect2::IrStream") << "Can't open stream.";
+        ofLogWarning("ofxKinect2::LongExposureIrStream") << "Can't open stream.";
         return false;
     }
 
     return Stream::open();
 }
 
-void IrStream::close()
+void LongExposureIrStream::close()
 {
     while (!lock()) {
-        printf("IrStream waiting to close\n");
+        printf("LongExposureIrStream waiting to close\n");
     }
     unlock();
 
     Stream::close();
-    safeRelease(m_StreamHandle.infraredFrameReader);
-}
-
-void IrStream::update()
-{
-    if (!m_Texture.isAllocated() || m_Texture.getWidth() != getWidth() || m_Texture.getHeight() != getHeight()) {
-        m_Texture.allocate(getWidth(), getHeight(), GL_LUMINANCE);
-    }
-
-    if (lock()) {
-        m_Texture.loadData(m_DoubleBuffer.getFrontBuffer());
-        Stream::update();
-        unlock();
-    }
-}
-
-bool IrStream::updateMode()
-{
-    ofLogWarning("ofxKinect2::IrStream") << "Not supported yet.";
-    return false;
-}
-
-ofShortPixels &IrStream::getPixelsRef()
-{
-    return m_DoubleBuffer.getFrontBuffer();
+    safeRelease(m_StreamHandle.longExposureInfraredFrameReader);
 }
 
 //----------------------------------------------------------
@@ -1507,9 +2759,15 @@ bool BodyStream::readFrame(IMultiSourceFrame *multiFrame)
             hr = bodyFrame->GetAndRefreshBodyData(_countof(ppBodies), ppBodies);
         }
 
+        Vector4 floorClipPlane = { 0, 0, 0, 0 };
+        if (SUCCEEDED(hr)) {
+            hr = bodyFrame->get_FloorClipPlane(&floorClipPlane);
+        }
+
         if (lock()) {
             if (SUCCEEDED(hr)) {
                 readed = true;
+                m_FloorClipPlane = floorClipPlane;
 
                 // Clears the body list
                 for (int b = 0 ; b < m_Bodies.size() ; b++) {
@@ -1551,6 +2809,24 @@ bool BodyStream::readFrame(IMultiSourceFrame *multiFrame)
                 return isBigger;
             };
             std::sort(m_Bodies.begin(), m_Bodies.end(), ascSort);
+
+            // Staged for deliverFrame(), publishing waits for the clients' sockets.
+            if (readed && m_Device->getStreamingServer().hasSubscribers(SENSOR_BODY)) {
+                m_StreamingBodies.resize(m_Bodies.size());
+                for (size_t b = 0; b < m_Bodies.size(); b++) {
+                    BodyData &data = m_StreamingBodies[b];
+                    data.id = m_Bodies[b]->getId();
+                    data.leftHandState = static_cast<unsigned char>(m_Bodies[b]->getLeftHandState());
+                    data.rightHandState = static_cast<unsigned char>(m_Bodies[b]->getRightHandState());
+                    for (int j = 0; j < BodyData::NUM_JOINTS; j++) {
+                        const Joint &joint = m_Bodies[b]->getJoint(j);
+                        data.trackingStates[j] = static_cast<unsigned char>(joint.TrackingState);
+                        data.positions[j].set(joint.Position.X, joint.Position.Y, joint.Position.Z);
+                    }
+                }
+                m_DeliveryTimestamp = m_Frame.timestamp;
+                m_IsDeliveryPending = true;
+            }
         }
 
         for (int i = 0; i < _countof(ppBodies); ++i) {
@@ -1568,8 +2844,15 @@ void BodyStream::setPixels(Frame &frame)
     Stream::setPixels(frame);
 }
 
+void BodyStream::deliverFrame()
+{
+    m_Device->getStreamingServer().publishBodies(m_StreamingBodies, m_DeliveryTimestamp);
+}
+
 bool BodyStream::setup(ofxKinect2::Device &device)
 {
+    const Vector4 floorClipPlane = { 0, 0, 0, 0 };
+    m_FloorClipPlane = floorClipPlane;
     return Stream::setup(device, SENSOR_BODY);
 }
 
@@ -1580,6 +2863,11 @@ bool BodyStream::open()
         return false;
     }
 
+    if (m_Device->isSharedMemoryReader()) {
+        ofLogWarning("ofxKinect2::BodyStream") << "Bodies aren't shared, stream them with Device::setStreamingEnabled().";
+        return false;
+    }
+
     IBodyFrameSource *bodyFrameSource = nullptr;
     HRESULT hr = m_Device->get().kinect2->get_BodyFrameSource(&bodyFrameSource);
 
@@ -1612,7 +2900,7 @@ void BodyStream::close()
 
 void BodyStream::update()
 {
-    if (lock()) {
+    if (lockForUpdate()) {
         for (int i = 0; i < m_Bodies.size(); i++) {
             m_Bodies[i]->update();
         }
@@ -1709,3 +2997,354 @@ ofShortPixels &BodyStream::getPixelsRef()
 {
     return m_DoubleBuffer.getFrontBuffer();
 }
+
+ofVec4f BodyStream::getFloorClipPlane()
+{
+    ofVec4f floorClipPlane;
+    if (lock()) {
+        floorClipPlane.set(m_FloorClipPlane.x, m_FloorClipPlane.y, m_FloorClipPlane.z, m_FloorClipPlane.w);
+        unlock();
+    }
+    return floorClipPlane;
+}
+
+float BodyStream::getSensorTilt()
+{
+    // The camera looks along +z, a sensor looking down sees the floor normal lean towards -z.
+    const ofVec4f floorClipPlane = getFloorClipPlane();
+    return ofRadToDeg(atan2(-floorClipPlane.z, floorClipPlane.y));
+}
+
+//----------------------------------------------------------
+#pragma mark - AudioStream
+//----------------------------------------------------------
+
+bool AudioStream::readFrame(IMultiSourceFrame *multiFrame)
+{
+    bool readed = false;
+    if (m_IsSourceOpen) {
+        // Bounded so a source that is always ready can't hold the thread.
+        AudioBlock subFrame;
+        for (int i = 0; i < 16 && m_Source(subFrame); i++) {
+            write(subFrame);
+            readed = true;
+        }
+        return readed;
+    }
+
+    if (!m_StreamHandle.audioBeamFrameReader) {
+        ofLogWarning("ofxKinect2::AudioStream") << "Stream is not open.";
+        return readed;
+    }
+
+    // The frames since the last call, the sensor forms a single beam whose frame holds them as sub-frames.
+    IAudioBeamFrameList *frameList = nullptr;
+    IAudioBeamFrame *frame = nullptr;
+    UINT numBeams = 0, numSubFrames = 0;
+    HRESULT hr = m_StreamHandle.audioBeamFrameReader->AcquireLatestBeamFrames(&frameList);
+
+    if (SUCCEEDED(hr)) {
+        hr = frameList->get_BeamCount(&numBeams);
+    }
+
+    if (SUCCEEDED(hr) && numBeams > 0) {
+        hr = frameList->OpenAudioBeamFrame(0, &frame);
+    }
+
+    if (SUCCEEDED(hr) && frame) {
+        hr = frame->get_SubFrameCount(&numSubFrames);
+    }
+
+    for (UINT i = 0; SUCCEEDED(hr) && i < numSubFrames; i++) {
+        IAudioBeamSubFrame *subFrame = nullptr;
+        AudioBlock block;
+        UINT numBytes = 0;
+        BYTE *buffer = nullptr;
+        hr = frame->GetSubFrame(i, &subFrame);
+
+        if (SUCCEEDED(hr)) {
+            hr = subFrame->get_RelativeTime((INT64 *)&block.timestamp);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = subFrame->get_BeamAngle(&block.beamAngle);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = subFrame->get_BeamAngleConfidence(&block.beamConfidence);
+        }
+
+        if (SUCCEEDED(hr)) {
+            hr = subFrame->AccessUnderlyingBuffer(&numBytes, &buffer);
+        }
+
+        if (SUCCEEDED(hr)) {
+            block.samples = reinterpret_cast<const float *>(buffer);
+            block.numSamples = numBytes / sizeof(float);
+            write(block);
+            readed = true;
+        }
+        safeRelease(subFrame);
+    }
+
+    safeRelease(frame);
+    safeRelease(frameList);
+
+    return readed;
+}
+
+void AudioStream::write(const AudioBlock &subFrame)
+{
+    m_Buffer.write(subFrame);
+    m_LatestBeam.timestamp = subFrame.timestamp;
+    m_LatestBeam.angle = subFrame.beamAngle;
+    m_LatestBeam.confidence = subFrame.beamConfidence;
+    m_Frame.timestamp = subFrame.timestamp;
+    m_IsDeliveryPending = m_Buffer.hasReadyBlocks();
+}
+
+void AudioStream::deliverFrame()
+{
+    m_Buffer.deliverBlocks();
+}
+
+bool AudioStream::setup(ofxKinect2::Device &device)
+{
+    m_IsSourceOpen = false;
+    m_LatestBeam.timestamp = 0;
+    m_LatestBeam.angle = 0;
+    m_LatestBeam.confidence = 0;
+    m_Beam = m_LatestBeam;
+    if (!Stream::setup(device, SENSOR_AUDIO)) {
+        return false;
+    }
+
+    // Poll twice per sub-frame, samples wait at most 8 ms for the acquisition thread.
+    m_Frame.mode.fps = 2 * AudioBuffer::SAMPLE_RATE / AudioBuffer::SUBFRAME_SAMPLES;
+    return true;
+}
+
+bool AudioStream::open()
+{
+    if (!m_Device->isOpen()) {
+        ofLogWarning("ofxKinect2::AudioStream") << "No ready Kinect2 found.";
+        return false;
+    }
+
+    m_Buffer.allocate(m_Buffer.getCapacity());
+    if (m_Source) {
+        m_IsSourceOpen = true;
+        return Stream::open();
+    }
+
+    if (m_Device->isSharedMemoryReader()) {
+        ofLogWarning("ofxKinect2::AudioStream") << "Audio isn't shared, give the stream a source.";
+        return false;
+    }
+
+    IAudioSource *audioSource = nullptr;
+    HRESULT hr = m_Device->get().kinect2->get_AudioSource(&audioSource);
+
+    if (SUCCEEDED(hr)) {
+        hr = audioSource->OpenReader(&m_StreamHandle.audioBeamFrameReader);
+    }
+
+    safeRelease(audioSource);
+    if (FAILED(hr)) {
+        ofLogWarning("ofxKinect2::AudioStream") << "Can't open stream.";
+        return false;
+    }
+
+    return Stream::open();
+}
+
+void AudioStream::close()
+{
+    while (!lock()) {
+        printf("AudioStream waiting to close\n");
+    }
+    unlock();
+
+    Stream::close();
+    safeRelease(m_StreamHandle.audioBeamFrameReader);
+    m_IsSourceOpen = false;
+}
+
+void AudioStream::update()
+{
+    if (lockForUpdate()) {
+        m_Beam = m_LatestBeam;
+        Stream::update();
+        unlock();
+    }
+}
+
+bool AudioStream::updateMode()
+{
+    // Only the polling rate changes, the sensor always delivers 16 kHz.
+    return true;
+}
+
+bool AudioStream::isOpen() const
+{
+    return Stream::isOpen() || m_IsSourceOpen;
+}
+
+void AudioStream::setSource(Source source)
+{
+    if (isOpen()) {
+        ofLogWarning("ofxKinect2::AudioStream") << "Source must be set before the stream is opened.";
+        return;
+    }
+    m_Source = source;
+}
+
+AudioStream::Source AudioStream::createToneSource(float frequency, float beamAngle, float amplitude)
+{
+    struct Tone {
+        std::vector<float> samples;
+        uint64_t start, numSamples;
+        double phase;
+    };
+    std::shared_ptr<Tone> tone = std::make_shared<Tone>();
+    tone->samples.resize(AudioBuffer::SUBFRAME_SAMPLES);
+    tone->start = 0;
+    tone->numSamples = 0;
+    tone->phase = 0;
+
+    return [=](AudioBlock &subFrame) -> bool {
+        const uint64_t now = StreamMetrics::getHostTicks();
+        if (tone->start == 0) {
+            tone->start = now;
+        }
+
+        // Like the sensor, a sub-frame is ready once its last sample is in the past.
+        const uint64_t timestamp = tone->start + AudioBuffer::getTicks(tone->numSamples);
+        if (timestamp + AudioBuffer::getTicks(AudioBuffer::SUBFRAME_SAMPLES) > now) {
+            return false;
+        }
+
+        const double step = TWO_PI * frequency / AudioBuffer::SAMPLE_RATE;
+        for (int i = 0; i < AudioBuffer::SUBFRAME_SAMPLES; i++) {
+            tone->samples[i] = amplitude * static_cast<float>(sin(tone->phase));
+            tone->phase = fmod(tone->phase + step, TWO_PI);
+        }
+        tone->numSamples += AudioBuffer::SUBFRAME_SAMPLES;
+
+        subFrame.timestamp = timestamp;
+        subFrame.beamAngle = beamAngle;
+        subFrame.beamConfidence = 1;
+        subFrame.samples = &tone->samples[0];
+        subFrame.numSamples = AudioBuffer::SUBFRAME_SAMPLES;
+        return true;
+    };
+}
+
+void AudioStream::setBufferSize(int numSamples)
+{
+    if (isOpen()) {
+        ofLogWarning("ofxKinect2::AudioStream") << "Buffer size must be set before the stream is opened.";
+        return;
+    }
+    m_Buffer.allocate(numSamples);
+}
+
+int AudioStream::getBufferSize() const
+{
+    return m_Buffer.getCapacity();
+}
+
+void AudioStream::setBlockCallback(int blockSize, std::function<void(const AudioBlock &)> callback)
+{
+    if (isOpen()) {
+        ofLogWarning("ofxKinect2::AudioStream") << "Block callback must be set before the stream is opened.";
+        return;
+    }
+    m_Buffer.setBlockCallback(blockSize, callback);
+}
+
+int AudioStream::readSamples(float *samples, int maxSamples)
+{
+    return m_Buffer.read(samples, maxSamples);
+}
+
+int AudioStream::readBeams(AudioBuffer::BeamData *beams, int maxBeams)
+{
+    return m_Buffer.readBeams(beams, maxBeams);
+}
+
+float AudioStream::getBeamAngle() const
+{
+    return m_Beam.angle;
+}
+
+float AudioStream::getBeamConfidence() const
+{
+    return m_Beam.confidence;
+}
+
+AudioBuffer &AudioStream::getBuffer()
+{
+    return m_Buffer;
+}
+
+//----------------------------------------------------------
+#pragma mark - MeshGenerator
+//----------------------------------------------------------
+
+void MeshGenerator::setup(DepthStream &depthStream)
+{
+    setup(depthStream.getHorizontalFieldOfView(), depthStream.getVerticalFieldOfView());
+    const ofRectangle roi = depthStream.getRoi();
+    setRoi(roi.x, roi.y, depthStream.getWidth(), depthStream.getHeight());
+}
+
+//----------------------------------------------------------
+#pragma mark - NormalEstimator
+//----------------------------------------------------------
+
+void NormalEstimator::setup(DepthStream &depthStream)
+{
+    setup(depthStream.getHorizontalFieldOfView(), depthStream.getVerticalFieldOfView());
+    const ofRectangle roi = depthStream.getRoi();
+    setRoi(roi.x, roi.y, depthStream.getWidth(), depthStream.getHeight());
+}
+
+//----------------------------------------------------------
+#pragma mark - PlaneDetector
+//----------------------------------------------------------
+
+void PlaneDetector::setup(DepthStream &depthStream)
+{
+    setup(depthStream.getHorizontalFieldOfView(), depthStream.getVerticalFieldOfView());
+    const ofRectangle roi = depthStream.getRoi();
+    setRoi(roi.x, roi.y, depthStream.getWidth(), depthStream.getHeight());
+}
+
+//----------------------------------------------------------
+#pragma mark - TsdfVolume
+//----------------------------------------------------------
+
+void TsdfVolume::setup(DepthStream &depthStream)
+{
+    const ofRectangle roi = depthStream.getRoi();
+    if (roi.width != depthStream.getWidth() || roi.height != depthStream.getHeight()) {
+        ofLogWarning("ofxKinect2::TsdfVolume") << "Needs the whole depth frame, clear the stream's region of interest first.";
+        return;
+    }
+    setup(depthStream.getHorizontalFieldOfView(), depthStream.getVerticalFieldOfView());
+}
+
+//----------------------------------------------------------
+#pragma mark - IcpOdometry
+//----------------------------------------------------------
+
+void IcpOdometry::setup(DepthStream &depthStream)
+{
+    const ofRectangle roi = depthStream.getRoi();
+    if (roi.width != depthStream.getWidth() || roi.height != depthStream.getHeight()) {
+        ofLogWarning("ofxKinect2::IcpOdometry") << "Needs the whole depth frame, clear the stream's region of interest first.";
+        return;
+    }
+    setup(depthStream.getHorizontalFieldOfView(), depthStream.getVerticalFieldOfView());
+}
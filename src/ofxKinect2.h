@@ -5,21 +5,47 @@
 #define OFX_KINECT2_H
 #include "ofMain.h"
 #include "ofxKinect2Types.h"
+#include "utils/AudioBuffer.h"
+#include "utils/BlobTracker.h"
+#include "utils/ContourFinder.h"
+#include "utils/DepthBackgroundModel.h"
+#include "utils/DepthHoleFiller.h"
+#include "utils/DepthTemporalFilter.h"
 #include "utils/DoubleBuffer.h"
+#include "utils/FrameQueue.h"
+#include "utils/FrameStreamServer.h"
+#include "utils/IcpOdometry.h"
+#include "utils/IrToneMapper.h"
+#include "utils/JointBilateralFilter.h"
+#include "utils/NormalEstimator.h"
+#include "utils/PlaneDetector.h"
+#include "utils/PointOctree.h"
+#include "utils/ProcessingGraph.h"
+#include "utils/Scheduler.h"
+#include "utils/SharedFrameRing.h"
+#include "utils/StreamMetrics.h"
+#include "utils/TsdfVolume.h"
+#include "utils/VoxelGrid.h"
 #include <array>
 #include <assert.h>
+#include <atomic>
+#include <mutex>
 
 namespace ofxKinect2
 {
 static const int DEPTH_WIDTH = 512;
 static const int DEPTH_HEIGHT = 424;
+static const int COLOR_WIDTH = 1920;
+static const int COLOR_HEIGHT = 1080;
 typedef unsigned int BodyIndex;
 
 void init();
+string getSensorName(SensorType sensorType);
 class Device;
 class Stream;
 
 class IrStream;
+class LongExposureIrStream;
 class ColorStream;
 class DepthStream;
 class BodyIndexStream;
@@ -27,7 +53,10 @@ class BodyIndexStream;
 class Body;
 class BodyStream;
 
+class AudioStream;
+
 class Recorder;
+class Scheduler;
 
 template<class Interface>
 inline void safeRelease(Interface *&interfaceToRelease)
@@ -58,9 +87,58 @@ public:
     void update();
 
     bool isOpen() const;
+
+    /**
+     * @brief Sets the number of worker threads that acquire and process frames for all the streams.
+     * 0 falls back to one thread per stream. Takes effect when no stream is registered.
+     */
+    void setNumThreads(int numThreads);
+    int getNumThreads() const;
+
+    /**
+     * @brief Pins the workers to the cores set in the mask, 0 lets the OS decide.
+     */
+    void setThreadAffinityMask(uint64_t mask);
+    uint64_t getThreadAffinityMask() const;
+
+    Scheduler &getScheduler();
+
+    /**
+     * @brief Stage graph whose stages run on the scheduler, connect a stream to it with setProcessingSource().
+     */
+    ProcessingGraph &getProcessingGraph();
+
+    /**
+     * @brief Appends a row of metrics per open stream to the CSV file, writing the header if the file is new.
+     */
+    bool saveMetrics(const string &filePath);
+
     void setDepthColorSyncEnabled(bool enabled = true);
     bool isDepthColorSyncEnabled() const;
 
+    /**
+     * @brief Publishes the depth, IR, body index and body frames of the open streams to the subscribers connecting
+     * on the port, see FrameStreamServer. Frames are only encoded for the types someone subscribed to.
+     */
+    bool setStreamingEnabled(bool enabled = true, int port = FrameStreamServer::DEFAULT_PORT);
+    bool isStreamingEnabled() const;
+    FrameStreamServer &getStreamingServer();
+
+    /**
+     * @brief Writes the raw color, depth, IR and body index frames of the open streams into shared memory rings
+     * named <name>_<sensor>, other processes open them with setupFromSharedMemory().
+     */
+    void setSharedMemoryEnabled(bool enabled = true, const string &name = "ofxKinect2");
+    bool isSharedMemoryEnabled() const;
+    const string &getSharedMemoryName() const;
+
+    /**
+     * @brief Opens the device on the rings another process shares instead of a sensor. The color, depth, IR and
+     * body index streams then hand the frames in the rings to their pipeline without copying them.
+     */
+    bool setupFromSharedMemory(const string &name = "ofxKinect2");
+    bool isSharedMemoryReader() const;
+
     DeviceHandle &get();
     const DeviceHandle &get() const;
 
@@ -73,6 +151,21 @@ protected:
     std::vector<ofxKinect2::Stream *> m_Streams;
     bool m_IsDepthColorSyncEnabled;
     Recorder *m_Recorder;
+
+    Scheduler m_Scheduler;
+    ProcessingGraph m_ProcessingGraph;
+    int m_NumThreads;
+    uint64_t m_ThreadAffinityMask;
+
+    FrameStreamServer m_StreamingServer;
+
+    /** @brief Cleared by the acquisition threads when a ring can't be created. */
+    std::atomic<bool> m_IsSharedMemoryEnabled;
+    bool m_IsSharedMemoryReader;
+    string m_SharedMemoryName;
+
+protected:
+    void restartScheduler();
 };
 
 class ofxKinect2::Recorder
@@ -95,7 +188,7 @@ public:
     virtual void update();
     virtual bool updateMode();
 
-    bool isOpen() const;
+    virtual bool isOpen() const;
 
     virtual bool setSize(int width, int height);
     ofTexture &getTextureReference();
@@ -115,9 +208,36 @@ public:
 
     bool isFrameNew() const;
 
+    /**
+     * @brief Frame counters, latencies and effective fps since the stream was opened.
+     */
+    StreamMetrics &getMetrics();
+
     void setMirror(bool mirrored = true);
     bool isMirror() const;
 
+    /**
+     * @brief Restricts the stream to a window of its frame, in output pixels (color after downsampling). Only the
+     * window is copied, converted and filtered, and the pixels and texture are its size.
+     */
+    void setRoi(const ofRectangle &roi);
+    void clearRoi();
+    bool hasRoi() const;
+    /**
+     * @brief Where the pixels sit in the full frame: the window clipped to the frame, the whole frame without one.
+     */
+    ofRectangle getRoi() const;
+
+    /**
+     * @brief DELIVERY_MODE_LATEST (default) only keeps the latest frame, a frame not read before the next one is
+     * lost. DELIVERY_MODE_QUEUE also copies every frame into a FIFO of queueSize pooled frames that a consumer
+     * thread drains with getFrameQueue().pop(), see FrameQueue for the drop policies. DROP_POLICY_BLOCK holds the
+     * acquisition of the stream while the queue is full, update(), draw() and the Scheduler workers don't wait.
+     * The color, depth, IR and body index streams can queue.
+     */
+    bool setDeliveryMode(DeliveryMode mode, int queueSize = FrameQueueBase::DEFAULT_CAPACITY, DropPolicy policy = DROP_POLICY_OLDEST);
+    DeliveryMode getDeliveryMode() const;
+
     void draw(float x = 0, float y = 0);
     virtual void draw(float x, float y, float w, float h);
 
@@ -137,6 +257,13 @@ public:
     }
 
 protected:
+    static const int SHARED_MEMORY_WAIT_MILLIS = 100;
+    static const int SHARED_MEMORY_RETRY_MILLIS = 500;
+    /** @brief Rate of the video streams, for the polling when no fps is set. */
+    static const int SENSOR_FPS = 30;
+    /** @brief Time between two polls while a frame is due. */
+    static const int POLL_INTERVAL_MILLIS = 2;
+
     Frame m_Frame;
     StreamHandle m_StreamHandle;
     CameraSettingsHandle m_CameraSettings;
@@ -149,12 +276,65 @@ protected:
     ofTexture m_Texture;
     Device *m_Device;
 
+    int m_PollJobId;
+    uint64_t m_LastAcquireTime, m_LastPollTime;
+
+    StreamMetrics m_Metrics;
+
+    SharedFrameRing m_SharedRing;
+    /** @brief The frame readSharedFrame() copied out of the ring. */
+    std::vector<unsigned char> m_SharedFrameData;
+    bool m_IsReadingSharedMemory;
+    uint64_t m_LastSharedOpenTime;
+
+    ofRectangle m_Roi;
+    int m_RoiX, m_RoiY, m_RoiWidth, m_RoiHeight;
+    bool m_IsRoiChanged;
+
+    DeliveryMode m_DeliveryMode;
+    FrameQueueBase *m_FrameQueue;
+    /** @brief Set by setPixels() when it staged a frame for deliverFrame(), pushQueuedFrame() or pushProcessingFrame(). */
+    uint64_t m_DeliveryTimestamp;
+    bool m_IsDeliveryPending, m_IsQueuePending, m_IsProcessingPending;
+    /** @brief When the staged frame found a full DROP_POLICY_BLOCK queue. */
+    uint64_t m_QueueWaitStart;
+
 protected:
     Stream();
     void threadedFunction();
+    bool acquireFrame();
+    bool isPollDue();
+    bool lockForUpdate();
     bool setup(Device &device, SensorType sensorType);
     virtual bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
     virtual void setPixels(Frame &frame);
+    /**
+     * @brief Hands the frame staged by setPixels() to the consumers that may block, on the acquisition thread once
+     * the lock is released, so they hold back the acquisition but never update() or draw().
+     */
+    virtual void deliverFrame();
+    /**
+     * @brief Swaps the frame staged by setPixels() into the frame queue, once the lock is released too.
+     */
+    virtual void pushQueuedFrame();
+    /**
+     * @brief Passes the frame setPixels() staged to the processing graph, once the lock is released too, the stages
+     * run inline without a scheduler.
+     */
+    virtual void pushProcessingFrame();
+    /**
+     * @brief Pushes the staged frame, false while a full DROP_POLICY_BLOCK queue holds it back and the block timeout
+     * hasn't passed. The thread never waits, the stream just doesn't acquire meanwhile.
+     */
+    bool flushQueuedFrame();
+    /**
+     * @brief Clips the window to a width x height frame, x and width rounded to multiples of alignment.
+     */
+    void updateRoi(int width, int height, int alignment = 1);
+
+    bool openSharedMemory();
+    void publishSharedFrame(const Frame &frame);
+    bool readSharedFrame(int downsamplingFactor = 1);
 };
 
 //----------------------------------------------------------
@@ -171,12 +351,43 @@ public:
     void update();
     bool updateMode();
 
+    /**
+     * @brief Selects the output resolution: 1920x1080, 960x540 or 480x270. The smaller sizes are box-downsampled
+     * on the acquisition thread and are always RGBA. setWidth() and setHeight() keep the aspect ratio.
+     */
     bool setWidth(int v);
     bool setHeight(int v);
     bool setSize(int width, int height);
+    int getDownsamplingFactor() const;
+
+    /**
+     * @brief PIXEL_FORMAT_RGBA (default) converts every frame in the SDK, PIXEL_FORMAT_YUY2 keeps the raw
+     * sensor buffer and leaves the conversion to getPixels(). Call before open().
+     */
+    bool setPixelFormat(PixelFormat format);
+    PixelFormat getPixelFormat() const;
 
+    /**
+     * @brief The latest frame in the stream's pixel format, 2 channels per pixel in YUY2 mode.
+     */
     ofPixels &getPixelsRef();
 
+    /**
+     * @brief Converts the latest frame to PIXEL_FORMAT_RGBA, PIXEL_FORMAT_BGRA, PIXEL_FORMAT_RGB or
+     * PIXEL_FORMAT_GRAY.
+     */
+    bool getPixels(ofPixels &pixels, PixelFormat format);
+
+    /**
+     * @brief Pushes a copy of every frame into the processing graph, nullptr disconnects.
+     */
+    void setProcessingSource(ProcessingSource<ofPixels> *source);
+
+    /**
+     * @brief The frames queued in DELIVERY_MODE_QUEUE, in the stream's pixel format.
+     */
+    FrameQueue<ofPixels> &getFrameQueue();
+
     int getExposureTime() const;
     int getFrameInterval() const;
     float getGain() const;
@@ -185,10 +396,24 @@ public:
 protected:
     DoubleBuffer<ofPixels> m_DoubleBuffer;
     unsigned char *m_Buffer;
+    PixelFormat m_PixelFormat;
+    int m_DownsamplingFactor;
+    ofPixels m_TextureSource, m_TexturePixels;
+    /** @brief The frame getPixels() converts, copied under the lock. */
+    std::mutex m_ConversionMutex;
+    ofPixels m_ConversionSource;
+    ProcessingSource<ofPixels> *m_ProcessingSource;
+    /** @brief The frame setPixels() staged for pushProcessingFrame() and the source it was staged for. */
+    ProcessingSource<ofPixels> *m_ProcessingTarget;
+    ProcessingSource<ofPixels>::Frame m_ProcessingFrame;
+    FrameQueue<ofPixels> m_QueuedFrames;
+    ofPixels m_DeliveryPixels;
 
 protected:
     bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
     void setPixels(Frame &frame);
+    void pushQueuedFrame();
+    void pushProcessingFrame();
 };
 
 //----------------------------------------------------------
@@ -221,15 +446,116 @@ public:
     void setInvert(float invert);
     bool getInvert() const;
 
+    /**
+     * @brief Fills the short holes of every frame on the acquisition thread, see DepthHoleFiller.
+     */
+    void setHoleFillingEnabled(bool enabled = true);
+    bool isHoleFillingEnabled() const;
+    DepthHoleFiller &getHoleFiller();
+
+    /**
+     * @brief Smooths the depth over time on the acquisition thread, see DepthTemporalFilter.
+     */
+    void setTemporalFilterEnabled(bool enabled = true);
+    bool isTemporalFilterEnabled() const;
+    DepthTemporalFilter &getTemporalFilter();
+
+    /**
+     * @brief Smooths the depth without blurring across the edges of the IR image, see JointBilateralFilter.
+     * Runs after hole filling and before the temporal filter, pass nullptr to disable it.
+     */
+    void setGuidedFilterEnabled(IrStream *irStream);
+    bool isGuidedFilterEnabled() const;
+    JointBilateralFilter &getGuidedFilter();
+
+    /**
+     * @brief Learns the empty scene and separates what's in front of it on every frame, see DepthBackgroundModel.
+     * Enabling it starts learning again, keep the scene empty for the first frames.
+     */
+    void setBackgroundSubtractionEnabled(bool enabled = true);
+    bool isBackgroundSubtractionEnabled() const;
+    void relearnBackground();
+    DepthBackgroundModel &getBackgroundModel();
+
+    /**
+     * @brief 255 where there is foreground, 0 elsewhere.
+     */
+    ofPixels &getForegroundMaskRef();
+    /**
+     * @brief The depth with the background set to 0.
+     */
+    ofShortPixels &getForegroundPixelsRef();
+
+    /**
+     * @brief Tracks the sensor motion from frame to frame on the acquisition thread, see IcpOdometry. Runs on the
+     * filtered depth once the lock is released, so the pose lands shortly after the pixels. Enabling it puts the pose
+     * back to identity.
+     */
+    void setOdometryEnabled(bool enabled = true);
+    bool isOdometryEnabled() const;
+    IcpOdometry &getOdometry();
+
+    /**
+     * @brief Camera to world pose of the latest tracked frame, with the frame's timestamp in 100 ns ticks if asked.
+     */
+    ofMatrix4x4 getPose(uint64_t *timestamp = nullptr);
+    /**
+     * @brief False when the latest frame couldn't be aligned, its pose is then the last tracked one.
+     */
+    bool isPoseTracked();
+
+    /**
+     * @brief Pushes a copy of every frame into the processing graph, nullptr disconnects.
+     */
+    void setProcessingSource(ProcessingSource<ofShortPixels> *source);
+
+    /**
+     * @brief The filtered frames queued in DELIVERY_MODE_QUEUE, as getPixelsRef() gives them.
+     */
+    FrameQueue<ofShortPixels> &getFrameQueue();
+
 protected:
     DoubleBuffer<ofShortPixels> m_DoubleBuffer;
 
     float m_NearValue, m_FarValue;
     bool m_IsInvert;
 
+    bool m_IsHoleFillingEnabled;
+    DepthHoleFiller m_HoleFiller;
+
+    bool m_IsTemporalFilterEnabled;
+    DepthTemporalFilter m_TemporalFilter;
+
+    IrStream *m_GuideStream;
+    JointBilateralFilter m_GuidedFilter;
+    ofShortPixels m_GuidePixels;
+
+    bool m_IsBackgroundSubtractionEnabled;
+    DepthBackgroundModel m_BackgroundModel;
+    DoubleBuffer<ofPixels> m_ForegroundMask;
+    DoubleBuffer<ofShortPixels> m_ForegroundPixels;
+
+    bool m_IsOdometryEnabled;
+    IcpOdometry m_Odometry;
+    /** @brief setOdometryEnabled() asks the acquisition thread to reset the odometry. */
+    bool m_IsOdometryResetPending;
+    /** @brief What deliverFrame() does with the staged frame. */
+    bool m_IsOdometryPending, m_IsPublishPending;
+    uint64_t m_PoseTimestamp;
+
+    ProcessingSource<ofShortPixels> *m_ProcessingSource;
+    /** @brief The frame setPixels() staged for pushProcessingFrame() and the source it was staged for. */
+    ProcessingSource<ofShortPixels> *m_ProcessingTarget;
+    ProcessingSource<ofShortPixels>::Frame m_ProcessingFrame;
+    FrameQueue<ofShortPixels> m_QueuedFrames;
+    ofShortPixels m_DeliveryPixels;
+
 protected:
     bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
     void setPixels(Frame &frame);
+    void deliverFrame();
+    void pushQueuedFrame();
+    void pushProcessingFrame();
 };
 
 //----------------------------------------------------------
@@ -250,13 +576,48 @@ public:
     void setInvert(float invert);
     bool getInvert() const;
 
+    /**
+     * @brief Traces the outline of every body straight from the body index data on the acquisition thread,
+     * see ContourFinder.
+     */
+    void setContoursEnabled(bool enabled = true);
+    bool isContoursEnabled() const;
+    ContourFinder &getContourFinder();
+    const Contours &getContours() const;
+
+    /**
+     * @brief Pushes a copy of every frame into the processing graph, nullptr disconnects.
+     */
+    void setProcessingSource(ProcessingSource<ofShortPixels> *source);
+
+    /**
+     * @brief The masks queued in DELIVERY_MODE_QUEUE.
+     */
+    FrameQueue<ofShortPixels> &getFrameQueue();
+
 protected:
     DoubleBuffer<ofShortPixels> m_DoubleBuffer;
     bool m_IsInvert;
+    ofPixels m_RoiIndices;
+
+    bool m_IsContoursEnabled;
+    ContourFinder m_ContourFinder;
+    DoubleBuffer<Contours> m_Contours;
+
+    ProcessingSource<ofShortPixels> *m_ProcessingSource;
+    /** @brief The frame setPixels() staged for pushProcessingFrame() and the source it was staged for. */
+    ProcessingSource<ofShortPixels> *m_ProcessingTarget;
+    ProcessingSource<ofShortPixels>::Frame m_ProcessingFrame;
+    FrameQueue<ofShortPixels> m_QueuedFrames;
+    ofShortPixels m_DeliveryPixels;
+    ofPixels m_DeliveryLabels;
 
 protected:
     bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
     void setPixels(Frame &frame);
+    void deliverFrame();
+    void pushQueuedFrame();
+    void pushProcessingFrame();
 };
 
 //----------------------------------------------------------
@@ -274,13 +635,71 @@ public:
 
     ofShortPixels &getPixelsRef();
 
+    /**
+     * @brief The frame through the tone mapper, 8 bit. Mapped on the acquisition thread while tone mapping is
+     * enabled, by update() for the texture otherwise.
+     */
+    ofPixels &getToneMappedPixelsRef();
+
+    /**
+     * @brief Maps every frame to 8 bit as it's acquired, for trackers that want getToneMappedPixelsRef() each frame.
+     */
+    void setToneMappingEnabled(bool enabled = true);
+    bool isToneMappingEnabled() const;
+
+    /**
+     * @brief Percentiles, gamma and smoothing of the 8 bit image and the texture.
+     */
+    IrToneMapper &getToneMapper();
+
+    /**
+     * @brief Pushes a copy of every frame into the processing graph, nullptr disconnects.
+     */
+    void setProcessingSource(ProcessingSource<ofShortPixels> *source);
+
+    /**
+     * @brief The raw 16 bit frames queued in DELIVERY_MODE_QUEUE.
+     */
+    FrameQueue<ofShortPixels> &getFrameQueue();
+
 protected:
     DoubleBuffer<ofShortPixels> m_DoubleBuffer;
+    ProcessingSource<ofShortPixels> *m_ProcessingSource;
+    /** @brief The frame setPixels() staged for pushProcessingFrame() and the source it was staged for. */
+    ProcessingSource<ofShortPixels> *m_ProcessingTarget;
+    ProcessingSource<ofShortPixels>::Frame m_ProcessingFrame;
+    FrameQueue<ofShortPixels> m_QueuedFrames;
+    ofShortPixels m_DeliveryPixels;
+
+    IrToneMapper m_ToneMapper;
+    DoubleBuffer<ofPixels> m_ToneMapped;
+    bool m_IsToneMappingEnabled;
 
 protected:
     bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
     void setPixels(Frame &frame);
+    void deliverFrame();
+    void pushQueuedFrame();
+    void pushProcessingFrame();
+
+};
+
+//----------------------------------------------------------
+#pragma mark - LongExposureIrStream
+//----------------------------------------------------------
+/**
+ * @brief The IR image integrated over a longer exposure, less noisy but it smears what moves. Same output as
+ * IrStream.
+ */
+class ofxKinect2::LongExposureIrStream : public ofxKinect2::IrStream
+{
+public:
+    bool setup(ofxKinect2::Device &device);
+    bool open();
+    void close();
 
+protected:
+    bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
 };
 
 //----------------------------------------------------------
@@ -360,14 +779,98 @@ public:
     ofShortPixels &getPixelsRef();
     ofShortPixels getPixelsRef(int _near, int _far, bool invert = false);
 
+    /**
+     * @brief The floor the SDK found behind the bodies, in camera space meters: x, y, z is the normal and w the
+     * height of the sensor. All 0 until the SDK has seen the floor. See PlaneDetector to find it from the depth.
+     */
+    ofVec4f getFloorClipPlane();
+
+    /**
+     * @brief Pitch of the sensor in degrees from the floor clip plane, positive when it looks down.
+     */
+    float getSensorTilt();
+
 protected:
     DoubleBuffer<ofShortPixels> m_DoubleBuffer;
     std::vector<Body *> m_Bodies;
+    Vector4 m_FloorClipPlane;
+    std::vector<BodyData> m_StreamingBodies;
 
 protected:
     bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
     void setPixels(Frame &frame);
+    void deliverFrame();
+
+};
 
+//----------------------------------------------------------
+#pragma mark - AudioStream
+//----------------------------------------------------------
+class ofxKinect2::AudioStream : public Stream
+{
+public:
+    /**
+     * @brief Fills a block with the next sub-frame, false when none is ready. The samples must stay valid until the
+     * next call.
+     */
+    typedef std::function<bool(AudioBlock &subFrame)> Source;
+
+    bool setup(ofxKinect2::Device &device);
+    bool open();
+    void close();
+
+    void update();
+    bool updateMode();
+
+    bool isOpen() const;
+
+    /**
+     * @brief Takes the sub-frames from the source instead of the sensor, a recording or createToneSource(). Set
+     * it before open().
+     */
+    void setSource(Source source);
+
+    /**
+     * @brief A sine wave paced by the host clock, one sub-frame every 16 ms from a beam that doesn't move.
+     */
+    static Source createToneSource(float frequency, float beamAngle = 0, float amplitude = 0.5f);
+
+    /**
+     * @brief Samples the ring holds, the new ones are dropped while it's full. Set it before open().
+     */
+    void setBufferSize(int numSamples);
+    int getBufferSize() const;
+
+    /**
+     * @brief Calls back with blocks of blockSize samples from the acquisition thread once the stream lock is released,
+     * a slow callback still delays the next sub-frames. Set it before open().
+     */
+    void setBlockCallback(int blockSize, std::function<void(const AudioBlock &)> callback);
+
+    /**
+     * @brief Pops the oldest samples of the ring, from one thread only.
+     */
+    int readSamples(float *samples, int maxSamples);
+    int readBeams(AudioBuffer::BeamData *beams, int maxBeams);
+
+    /**
+     * @brief Beam of the last sub-frame when update() ran, in radians, 0 in front of the sensor.
+     */
+    float getBeamAngle() const;
+    float getBeamConfidence() const;
+
+    AudioBuffer &getBuffer();
+
+protected:
+    AudioBuffer m_Buffer;
+    Source m_Source;
+    bool m_IsSourceOpen;
+    AudioBuffer::BeamData m_LatestBeam, m_Beam;
+
+protected:
+    bool readFrame(IMultiSourceFrame *multiFrame = nullptr);
+    void write(const AudioBlock &subFrame);
+    void deliverFrame();
 };
 
 #endif //OFX_KINECT2_H
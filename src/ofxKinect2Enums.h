@@ -31,7 +31,9 @@ enum PixelFormat {
     PIXEL_FORMAT_YUV = 2,
     PIXEL_FORMAT_BGRA = 3,
     PIXEL_FORMAT_BAYER = 4,
-    PIXEL_FORMAT_YUY2 = 5
+    PIXEL_FORMAT_YUY2 = 5,
+    PIXEL_FORMAT_RGB = 6,
+    PIXEL_FORMAT_GRAY = 7
 };
 
 enum DeviceState {
@@ -39,6 +41,17 @@ enum DeviceState {
     DEVICE_STATE_ERROR = 1,
     DEVICE_STATE_NOT_READY = 2
 };
+
+enum DropPolicy {
+    DROP_POLICY_OLDEST = 0,
+    DROP_POLICY_NEWEST = 1,
+    DROP_POLICY_BLOCK = 2
+};
+
+enum DeliveryMode {
+    DELIVERY_MODE_LATEST = 0,
+    DELIVERY_MODE_QUEUE = 1
+};
 } // namespace ofxKinect2
 
 #endif // _OFX_KINECT2_ENUMS_H_
@@ -52,6 +52,10 @@ typedef struct {
 
     Mode mode;
     int stride;
+
+    // Camera to world pose of the depth camera when DepthStream odometry runs, the 16 values of an ofMatrix4x4.
+    float pose[16];
+    bool isPoseTracked;
 } Frame;
 
 typedef struct {
@@ -0,0 +1,235 @@
+#pragma once
+#include "ofMain.h"
+#include "SpscRing.h"
+#include "StreamMetrics.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+namespace ofxKinect2
+{
+struct AudioBlock;
+class AudioBuffer;
+} // namespace ofxKinect2
+
+/**
+ * @brief A run of mono samples at 16 kHz. timestamp is the capture time of the first sample in the 100 ns ticks
+ * of StreamMetrics::getHostTicks(), the beam angle is in radians and its confidence from 0 to 1.
+ */
+struct ofxKinect2::AudioBlock {
+    uint64_t timestamp;
+    float beamAngle;
+    float beamConfidence;
+    const float *samples;
+    int numSamples;
+};
+
+/**
+ * @brief Takes the sub-frames of the audio beam from the acquisition thread and hands them on, through a lock-free
+ * ring to one reader thread and in fixed size blocks to a callback. write() only queues the blocks, the writer calls
+ * deliverBlocks() when it holds no lock.
+ */
+class ofxKinect2::AudioBuffer
+{
+public:
+    static const int SAMPLE_RATE = 16000;
+    /** @brief The sensor delivers 16 ms sub-frames. */
+    static const int SUBFRAME_SAMPLES = 256;
+    static const int DEFAULT_CAPACITY = 2048;
+
+    struct BeamData {
+        /** @brief Capture time of the sub-frame. */
+        uint64_t timestamp;
+        float angle;
+        float confidence;
+    };
+
+    AudioBuffer()
+        : m_BlockSize(0)
+    {
+        allocate(DEFAULT_CAPACITY);
+    }
+
+    /**
+     * @brief Empties the buffer, the rings round the capacity up to a power of 2. Nothing may read or write.
+     */
+    void allocate(int capacity)
+    {
+        m_Samples.allocate(std::max(capacity, static_cast<int>(SUBFRAME_SAMPLES)));
+        m_Beams.allocate(std::max(capacity / SUBFRAME_SAMPLES, 16));
+        m_BlockSamples.clear();
+        m_ReadySamples.clear();
+        m_ReadyBlocks.clear();
+        m_NextTimestamp = 0;
+        m_NumOverrunSamples = 0;
+        m_NumLostSamples = 0;
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_CallbackLatency.reset();
+    }
+
+    int getCapacity() const
+    {
+        return static_cast<int>(m_Samples.getCapacity());
+    }
+
+    /**
+     * @brief Calls back with blocks of blockSize samples from deliverBlocks(), 0 stops the calls. Set it while
+     * nothing writes.
+     */
+    void setBlockCallback(int blockSize, std::function<void(const AudioBlock &)> callback)
+    {
+        m_BlockSize = callback ? std::max(blockSize, 1) : 0;
+        m_BlockCallback = callback;
+        m_BlockSamples.clear();
+        m_BlockSamples.reserve(m_BlockSize);
+        m_ReadySamples.clear();
+        m_ReadyBlocks.clear();
+    }
+
+    /**
+     * @brief Writer side, queues a sub-frame and the blocks it completes for deliverBlocks().
+     */
+    void write(const AudioBlock &subFrame)
+    {
+        const uint64_t duration = getTicks(subFrame.numSamples);
+        if (m_NextTimestamp != 0 && subFrame.timestamp > m_NextTimestamp + getTicks(SUBFRAME_SAMPLES) / 2) {
+            m_NumLostSamples += (subFrame.timestamp - m_NextTimestamp) * SAMPLE_RATE / StreamMetrics::TICKS_PER_SECOND;
+        }
+        m_NextTimestamp = subFrame.timestamp + duration;
+
+        m_NumOverrunSamples += subFrame.numSamples - m_Samples.push(subFrame.samples, subFrame.numSamples);
+        BeamData beam;
+        beam.timestamp = subFrame.timestamp;
+        beam.angle = subFrame.beamAngle;
+        beam.confidence = subFrame.beamConfidence;
+        m_Beams.push(&beam, 1);
+
+        if (m_BlockSize > 0) {
+            writeBlocks(subFrame);
+        }
+    }
+
+    bool hasReadyBlocks() const
+    {
+        return !m_ReadyBlocks.empty();
+    }
+
+    /**
+     * @brief Writer side, calls back with the blocks write() completed since the last call.
+     */
+    void deliverBlocks()
+    {
+        for (size_t i = 0; i < m_ReadyBlocks.size(); i++) {
+            AudioBlock &block = m_ReadyBlocks[i];
+            block.samples = &m_ReadySamples[i * m_BlockSize];
+            const uint64_t captureTicks = block.timestamp + getTicks(m_BlockSize);
+            const uint64_t now = StreamMetrics::getHostTicks();
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_CallbackLatency.add(now > captureTicks ? (now - captureTicks) / 10 : 0);
+            }
+            m_BlockCallback(block);
+        }
+        m_ReadySamples.clear();
+        m_ReadyBlocks.clear();
+    }
+
+    /**
+     * @brief Reader side, the oldest samples not read yet. Only one thread may read.
+     */
+    int read(float *samples, int maxSamples)
+    {
+        return static_cast<int>(m_Samples.pop(samples, maxSamples));
+    }
+
+    /**
+     * @brief Reader side, the beam of each sub-frame not read yet.
+     */
+    int readBeams(BeamData *beams, int maxBeams)
+    {
+        return static_cast<int>(m_Beams.pop(beams, maxBeams));
+    }
+
+    /**
+     * @brief Samples waiting in the ring, divide by SAMPLE_RATE for the latency it adds.
+     */
+    int getNumQueuedSamples() const
+    {
+        return static_cast<int>(m_Samples.getSize());
+    }
+
+    /**
+     * @brief Samples dropped because the reader didn't keep up.
+     */
+    uint64_t getNumOverrunSamples() const
+    {
+        return m_NumOverrunSamples;
+    }
+
+    /**
+     * @brief Samples the source never delivered, from the gaps between the sub-frames.
+     */
+    uint64_t getNumLostSamples() const
+    {
+        return m_NumLostSamples;
+    }
+
+    /**
+     * @brief From the capture of the last sample of a block to its callback.
+     */
+    LatencyHistogram getCallbackLatency()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_CallbackLatency;
+    }
+
+    static uint64_t getTicks(uint64_t numSamples)
+    {
+        return numSamples * StreamMetrics::TICKS_PER_SECOND / SAMPLE_RATE;
+    }
+
+protected:
+    SpscRing<float> m_Samples;
+    SpscRing<BeamData> m_Beams;
+
+    int m_BlockSize;
+    std::function<void(const AudioBlock &)> m_BlockCallback;
+    std::vector<float> m_BlockSamples;
+    AudioBlock m_Block;
+    /** @brief The completed blocks waiting for deliverBlocks(), their samples back to back. */
+    std::vector<float> m_ReadySamples;
+    std::vector<AudioBlock> m_ReadyBlocks;
+
+    uint64_t m_NextTimestamp;
+    /** @brief Written by the writer, read from any thread. */
+    std::atomic<uint64_t> m_NumOverrunSamples, m_NumLostSamples;
+
+    std::mutex m_Mutex;
+    LatencyHistogram m_CallbackLatency;
+
+protected:
+    void writeBlocks(const AudioBlock &subFrame)
+    {
+        int offset = 0;
+        while (offset < subFrame.numSamples) {
+            if (m_BlockSamples.empty()) {
+                m_Block.timestamp = subFrame.timestamp + getTicks(offset);
+            }
+            const int count = std::min(subFrame.numSamples - offset, m_BlockSize - static_cast<int>(m_BlockSamples.size()));
+            m_BlockSamples.insert(m_BlockSamples.end(), subFrame.samples + offset, subFrame.samples + offset + count);
+            offset += count;
+            if (static_cast<int>(m_BlockSamples.size()) < m_BlockSize) {
+                break;
+            }
+
+            // Blocks that don't line up with the sub-frames take the beam of the one they end in.
+            m_Block.beamAngle = subFrame.beamAngle;
+            m_Block.beamConfidence = subFrame.beamConfidence;
+            m_Block.samples = nullptr;
+            m_Block.numSamples = m_BlockSize;
+            m_ReadyBlocks.push_back(m_Block);
+            m_ReadySamples.insert(m_ReadySamples.end(), m_BlockSamples.begin(), m_BlockSamples.end());
+            m_BlockSamples.clear();
+        }
+    }
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include "ofMain.h"
+#include "ConnectedComponents.h"
+
+namespace ofxKinect2
+{
+class BlobTracker;
+} // namespace ofxKinect2
+
+/**
+ * @brief Gives the blobs of consecutive frames stable ids. Blobs are matched to the tracks of the previous frames
+ * greedily, closest centroids first, within maxDistance pixels. A track that isn't matched is kept for
+ * maxMissingFrames frames so a blob that drops out for a frame gets its id back.
+ */
+class ofxKinect2::BlobTracker
+{
+public:
+    BlobTracker()
+        : m_MaxDistance(40.f)
+        , m_MaxMissingFrames(5)
+        , m_NextId(0)
+    {
+
+    }
+
+    /**
+     * @brief Sets the id and age of the blobs.
+     */
+    void update(std::vector<Blob> &blobs)
+    {
+        // Every track and blob pair that is close enough, sorted by distance.
+        m_Pairs.clear();
+        const float maxDistance = m_MaxDistance * m_MaxDistance;
+        for (size_t i = 0; i < m_Tracks.size(); i++) {
+            // Let the tracks that moved keep moving the same way.
+            const ofVec2f predicted = m_Tracks[i].blob.centroid + m_Tracks[i].velocity * (m_Tracks[i].missingFrames + 1);
+            for (size_t j = 0; j < blobs.size(); j++) {
+                const float distance = predicted.squareDistance(blobs[j].centroid);
+                if (distance <= maxDistance) {
+                    Pair pair = { distance, static_cast<int>(i), static_cast<int>(j) };
+                    m_Pairs.push_back(pair);
+                }
+            }
+        }
+        std::sort(m_Pairs.begin(), m_Pairs.end(), [](const Pair & a, const Pair & b) {
+            return a.distance < b.distance;
+        });
+
+        m_IsTrackMatched.assign(m_Tracks.size(), false);
+        m_IsBlobMatched.assign(blobs.size(), false);
+        for (size_t i = 0; i < m_Pairs.size(); i++) {
+            const Pair &pair = m_Pairs[i];
+            if (m_IsTrackMatched[pair.track] || m_IsBlobMatched[pair.blob]) {
+                continue;
+            }
+
+            m_IsTrackMatched[pair.track] = true;
+            m_IsBlobMatched[pair.blob] = true;
+
+            Track &track = m_Tracks[pair.track];
+            Blob &blob = blobs[pair.blob];
+            blob.id = track.blob.id;
+            blob.age = track.blob.age + 1;
+            track.velocity = (blob.centroid - track.blob.centroid) / (track.missingFrames + 1);
+            track.blob = blob;
+            track.missingFrames = 0;
+        }
+
+        // Forget the tracks that have been missing for too long, start new ones for the new blobs.
+        size_t numTracks = 0;
+        for (size_t i = 0; i < m_Tracks.size(); i++) {
+            if (!m_IsTrackMatched[i] && ++m_Tracks[i].missingFrames > m_MaxMissingFrames) {
+                continue;
+            }
+            m_Tracks[numTracks++] = m_Tracks[i];
+        }
+        m_Tracks.resize(numTracks);
+
+        for (size_t i = 0; i < blobs.size(); i++) {
+            if (m_IsBlobMatched[i]) {
+                continue;
+            }
+
+            blobs[i].id = m_NextId++;
+            blobs[i].age = 0;
+            Track track;
+            track.blob = blobs[i];
+            track.missingFrames = 0;
+            m_Tracks.push_back(track);
+        }
+    }
+
+    void clear()
+    {
+        m_Tracks.clear();
+    }
+
+    void setMaxDistance(float pixels)
+    {
+        m_MaxDistance = pixels;
+    }
+
+    float getMaxDistance() const
+    {
+        return m_MaxDistance;
+    }
+
+    void setMaxMissingFrames(int numFrames)
+    {
+        m_MaxMissingFrames = numFrames;
+    }
+
+    int getMaxMissingFrames() const
+    {
+        return m_MaxMissingFrames;
+    }
+
+protected:
+    struct Track {
+        Blob blob;
+        ofVec2f velocity;
+        int missingFrames;
+    };
+
+    struct Pair {
+        float distance;
+        int track, blob;
+    };
+
+    float m_MaxDistance;
+    int m_MaxMissingFrames, m_NextId;
+    std::vector<Track> m_Tracks;
+    std::vector<Pair> m_Pairs;
+    std::vector<bool> m_IsTrackMatched, m_IsBlobMatched;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "ofMain.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+/**
+ * @brief Turns the body index bytes (0 - 5 for the bodies, 255 elsewhere) into the BodyIndexStream image: 0 on the
+ * bodies, 65535 elsewhere.
+ */
+inline void bodyIndexToMask(const unsigned char *bodyIndices, int width, int height, ofShortPixels &dst)
+{
+    if (!dst.isAllocated() || dst.getWidth() != width || dst.getHeight() != height || dst.getNumChannels() != 1) {
+        dst.allocate(width, height, 1);
+    }
+
+    const int numPixels = width * height;
+    unsigned short *dstPixels = dst.getPixels();
+    int i = 0;
+#if defined(OFX_KINECT2_SSE2)
+    const __m128i maxBody = _mm_set1_epi8(5);
+    for (; i + 16 <= numPixels; i += 16) {
+        const __m128i indices = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bodyIndices + i));
+        // Unsigned index <= 5 <=> min(index, 5) == index, the body bytes become 0 and the rest 0xFF.
+        const __m128i isBackground = _mm_xor_si128(_mm_cmpeq_epi8(_mm_min_epu8(indices, maxBody), indices), _mm_set1_epi8(-1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dstPixels + i), _mm_unpacklo_epi8(isBackground, isBackground));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dstPixels + i + 8), _mm_unpackhi_epi8(isBackground, isBackground));
+    }
+#endif
+
+    for (; i < numPixels; i++) {
+        dstPixels[i] = bodyIndices[i] < 6 ? 0 : 65535;
+    }
+}
+} // namespace ofxKinect2
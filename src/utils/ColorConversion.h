@@ -0,0 +1,404 @@
+#pragma once
+#include "ofMain.h"
+#include "ofxKinect2Enums.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+inline int getNumChannels(PixelFormat format)
+{
+    switch (format) {
+    case PIXEL_FORMAT_RGBA:
+    case PIXEL_FORMAT_BGRA:
+        return 4;
+    case PIXEL_FORMAT_RGB:
+        return 3;
+    case PIXEL_FORMAT_YUY2:
+        return 2;
+    case PIXEL_FORMAT_GRAY:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+inline unsigned char clampToByte(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : static_cast<unsigned char>(value));
+}
+
+// Full range BT.601 in 6 bit fixed point, the SIMD kernels use the exact same arithmetic.
+inline void yuvToRgb(int y, int u, int v, unsigned char &r, unsigned char &g, unsigned char &b)
+{
+    y <<= 6;
+    u -= 128;
+    v -= 128;
+    r = clampToByte((y + 90 * v + 32) >> 6);
+    g = clampToByte((y - 22 * u - 46 * v + 32) >> 6);
+    b = clampToByte((y + 113 * u + 32) >> 6);
+}
+
+#if defined(OFX_KINECT2_SSE2)
+/**
+ * @brief Converts 8 pixels of 16 bit Y, U, V lanes to 16 bit R, G, B lanes.
+ */
+inline void yuvToRgb16(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    y = _mm_add_epi16(_mm_slli_epi16(y, 6), _mm_set1_epi16(32));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    r = _mm_srai_epi16(_mm_add_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(90))), 6);
+    g = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(22))), _mm_mullo_epi16(v, _mm_set1_epi16(46))), 6);
+    b = _mm_srai_epi16(_mm_add_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(113))), 6);
+}
+
+/**
+ * @brief Converts 8 YUY2 pixels (16 bytes) to 16 bit R, G, B lanes.
+ */
+inline void yuy2ToRgb16(__m128i yuy2, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    const __m128i y = _mm_and_si128(yuy2, lowByte);
+    const __m128i uv = _mm_srli_epi16(yuy2, 8);
+
+    // uv holds U0 V0 U1 V1..., spread each chroma sample over the two pixels that share it.
+    __m128i u = _mm_and_si128(uv, _mm_set1_epi32(0x0000FFFF));
+    u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+    __m128i v = _mm_srli_epi32(uv, 16);
+    v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+    yuvToRgb16(y, u, v, r, g, b);
+}
+
+/**
+ * @brief Interleaves 8 pixels of 16 bit R, G, B lanes and stores them as RGBA, or BGRA if swapRB is set.
+ */
+inline void storeRgba8Pixels(unsigned char *dst, __m128i r, __m128i g, __m128i b, bool swapRB)
+{
+    if (swapRB) {
+        std::swap(r, b);
+    }
+
+    const __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+    const __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8(static_cast<char>(0xFF)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+/**
+ * @brief Splits 4 YUY2 pairs into 32 bit lanes holding Y0 + Y1, U and V of each pair.
+ */
+inline void splitYuy2Pairs(__m128i yuy2, __m128i &ySum, __m128i &u, __m128i &v)
+{
+    const __m128i lowByte = _mm_set1_epi32(0x000000FF);
+    ySum = _mm_add_epi32(_mm_and_si128(yuy2, lowByte), _mm_and_si128(_mm_srli_epi32(yuy2, 16), lowByte));
+    u = _mm_and_si128(_mm_srli_epi32(yuy2, 8), lowByte);
+    v = _mm_srli_epi32(yuy2, 24);
+}
+
+/**
+ * @brief Sums 4 YUY2 pairs over numRows rows into 32 bit lanes, so the caller rounds once like the scalar path.
+ */
+inline void sumYuy2Pairs(const unsigned char *src, int srcStride, int numRows, __m128i &ySum, __m128i &uSum, __m128i &vSum)
+{
+    splitYuy2Pairs(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), ySum, uSum, vSum);
+    for (int row = 1; row < numRows; row++) {
+        __m128i y, u, v;
+        splitYuy2Pairs(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + row * srcStride)), y, u, v);
+        ySum = _mm_add_epi32(ySum, y);
+        uSum = _mm_add_epi32(uSum, u);
+        vSum = _mm_add_epi32(vSum, v);
+    }
+}
+
+/**
+ * @brief Converts 16 YUY2 pixels to four registers of 4 interleaved 8 bit pixels each.
+ */
+inline void yuy2ToRgba16Pixels(const unsigned char *src, bool swapRB, __m128i rgba[4])
+{
+    __m128i r0, g0, b0, r1, g1, b1;
+    yuy2ToRgb16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), r0, g0, b0);
+    yuy2ToRgb16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16)), r1, g1, b1);
+
+    __m128i r = _mm_packus_epi16(r0, r1);
+    const __m128i g = _mm_packus_epi16(g0, g1);
+    __m128i b = _mm_packus_epi16(b0, b1);
+    const __m128i a = _mm_set1_epi8(static_cast<char>(0xFF));
+    if (swapRB) {
+        std::swap(r, b);
+    }
+
+    const __m128i rgLow = _mm_unpacklo_epi8(r, g);
+    const __m128i rgHigh = _mm_unpackhi_epi8(r, g);
+    const __m128i baLow = _mm_unpacklo_epi8(b, a);
+    const __m128i baHigh = _mm_unpackhi_epi8(b, a);
+    rgba[0] = _mm_unpacklo_epi16(rgLow, baLow);
+    rgba[1] = _mm_unpackhi_epi16(rgLow, baLow);
+    rgba[2] = _mm_unpacklo_epi16(rgHigh, baHigh);
+    rgba[3] = _mm_unpackhi_epi16(rgHigh, baHigh);
+}
+#endif
+
+inline void yuy2RowToRgba(const unsigned char *src, unsigned char *dst, int width, bool swapRB)
+{
+    int x = 0;
+#if defined(OFX_KINECT2_SSE2)
+    for (; x + 16 <= width; x += 16) {
+        __m128i rgba[4];
+        yuy2ToRgba16Pixels(src + x * 2, swapRB, rgba);
+        for (int i = 0; i < 4; i++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4 + i * 16), rgba[i]);
+        }
+    }
+#endif
+
+    for (; x + 2 <= width; x += 2) {
+        const unsigned char *yuyv = src + x * 2;
+        unsigned char *pixel = dst + x * 4;
+        const int r = swapRB ? 2 : 0;
+        const int b = swapRB ? 0 : 2;
+        yuvToRgb(yuyv[0], yuyv[1], yuyv[3], pixel[r], pixel[1], pixel[b]);
+        yuvToRgb(yuyv[2], yuyv[1], yuyv[3], pixel[r + 4], pixel[5], pixel[b + 4]);
+        pixel[3] = pixel[7] = 255;
+    }
+}
+
+inline void yuy2RowToRgb(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x = 0;
+#if defined(OFX_KINECT2_SSSE3)
+    const __m128i dropAlpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; x + 16 <= width; x += 16) {
+        __m128i rgba[4];
+        yuy2ToRgba16Pixels(src + x * 2, false, rgba);
+
+        // Each store writes 4 junk bytes that the next one overwrites, the last one must stay in the row.
+        unsigned char *pixel = dst + x * 3;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixel), _mm_shuffle_epi8(rgba[0], dropAlpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixel + 12), _mm_shuffle_epi8(rgba[1], dropAlpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixel + 24), _mm_shuffle_epi8(rgba[2], dropAlpha));
+        const __m128i last = _mm_shuffle_epi8(rgba[3], dropAlpha);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(pixel + 36), last);
+        const int lastWord = _mm_cvtsi128_si32(_mm_srli_si128(last, 8));
+        memcpy(pixel + 44, &lastWord, 4);
+    }
+#endif
+
+    for (; x + 2 <= width; x += 2) {
+        const unsigned char *yuyv = src + x * 2;
+        unsigned char *pixel = dst + x * 3;
+        yuvToRgb(yuyv[0], yuyv[1], yuyv[3], pixel[0], pixel[1], pixel[2]);
+        yuvToRgb(yuyv[2], yuyv[1], yuyv[3], pixel[3], pixel[4], pixel[5]);
+    }
+}
+
+inline void yuy2RowToLuma(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x = 0;
+#if defined(OFX_KINECT2_SSE2)
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    for (; x + 16 <= width; x += 16) {
+        const __m128i first = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2)), lowByte);
+        const __m128i second = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2 + 16)), lowByte);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(first, second));
+    }
+#endif
+
+    for (; x < width; x++) {
+        dst[x] = src[x * 2];
+    }
+}
+
+/**
+ * @brief Box-downsamples factor rows of YUY2 by factor (2 or 4) and writes dstWidth RGBA or BGRA pixels.
+ */
+inline void yuy2RowsDownsampleToRgba(const unsigned char *src, int srcStride, unsigned char *dst, int dstWidth, int factor, bool swapRB)
+{
+    int x = 0;
+#if defined(OFX_KINECT2_SSE2)
+    if (factor == 2) {
+        // 8 output pixels from 2 rows of 16 source pixels.
+        for (; x + 8 <= dstWidth; x += 8) {
+            const unsigned char *row = src + x * 4;
+            __m128i y[2], u[2], v[2];
+            for (int i = 0; i < 2; i++) {
+                sumYuy2Pairs(row + i * 16, srcStride, 2, y[i], u[i], v[i]);
+                y[i] = _mm_srli_epi32(_mm_add_epi32(y[i], _mm_set1_epi32(2)), 2);
+                u[i] = _mm_srli_epi32(_mm_add_epi32(u[i], _mm_set1_epi32(1)), 1);
+                v[i] = _mm_srli_epi32(_mm_add_epi32(v[i], _mm_set1_epi32(1)), 1);
+            }
+
+            __m128i r, g, b;
+            yuvToRgb16(_mm_packs_epi32(y[0], y[1]), _mm_packs_epi32(u[0], u[1]), _mm_packs_epi32(v[0], v[1]), r, g, b);
+            storeRgba8Pixels(dst + x * 4, r, g, b, swapRB);
+        }
+    }
+    else if (factor == 4) {
+        // 8 output pixels from 4 rows of 32 source pixels.
+        const __m128i ones = _mm_set1_epi16(1);
+        for (; x + 8 <= dstWidth; x += 8) {
+            const unsigned char *row = src + x * 8;
+            __m128i y[2], u[2], v[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i ySum[2], uPair[2], vPair[2];
+                for (int i = 0; i < 2; i++) {
+                    sumYuy2Pairs(row + (half * 2 + i) * 16, srcStride, 4, ySum[i], uPair[i], vPair[i]);
+                }
+
+                // Add neighbouring pairs so each lane covers 4 source pixels.
+                y[half] = _mm_madd_epi16(_mm_packs_epi32(ySum[0], ySum[1]), ones);
+                u[half] = _mm_madd_epi16(_mm_packs_epi32(uPair[0], uPair[1]), ones);
+                v[half] = _mm_madd_epi16(_mm_packs_epi32(vPair[0], vPair[1]), ones);
+                y[half] = _mm_srli_epi32(_mm_add_epi32(y[half], _mm_set1_epi32(8)), 4);
+                u[half] = _mm_srli_epi32(_mm_add_epi32(u[half], _mm_set1_epi32(4)), 3);
+                v[half] = _mm_srli_epi32(_mm_add_epi32(v[half], _mm_set1_epi32(4)), 3);
+            }
+
+            __m128i r, g, b;
+            yuvToRgb16(_mm_packs_epi32(y[0], y[1]), _mm_packs_epi32(u[0], u[1]), _mm_packs_epi32(v[0], v[1]), r, g, b);
+            storeRgba8Pixels(dst + x * 4, r, g, b, swapRB);
+        }
+    }
+#endif
+
+    const int numPixels = factor * factor;
+    const int numChroma = numPixels / 2;
+    for (; x < dstWidth; x++) {
+        int y = 0, u = 0, v = 0;
+        for (int row = 0; row < factor; row++) {
+            const unsigned char *yuyv = src + row * srcStride + x * factor * 2;
+            for (int i = 0; i < factor * 2; i += 4) {
+                y += yuyv[i] + yuyv[i + 2];
+                u += yuyv[i + 1];
+                v += yuyv[i + 3];
+            }
+        }
+
+        unsigned char *pixel = dst + x * 4;
+        const int r = swapRB ? 2 : 0;
+        const int b = swapRB ? 0 : 2;
+        yuvToRgb((y + numPixels / 2) / numPixels, (u + numChroma / 2) / numChroma, (v + numChroma / 2) / numChroma, pixel[r], pixel[1], pixel[b]);
+        pixel[3] = 255;
+    }
+}
+
+inline void rgbaRowConvert(const unsigned char *src, unsigned char *dst, int width, PixelFormat format)
+{
+    for (int x = 0; x < width; x++) {
+        const unsigned char *pixel = src + x * 4;
+        switch (format) {
+        case PIXEL_FORMAT_RGBA:
+            memcpy(dst + x * 4, pixel, 4);
+            break;
+        case PIXEL_FORMAT_BGRA:
+            dst[x * 4] = pixel[2];
+            dst[x * 4 + 1] = pixel[1];
+            dst[x * 4 + 2] = pixel[0];
+            dst[x * 4 + 3] = pixel[3];
+            break;
+        case PIXEL_FORMAT_RGB:
+            memcpy(dst + x * 3, pixel, 3);
+            break;
+        case PIXEL_FORMAT_GRAY:
+            dst[x] = (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Converts a raw YUY2 image (width * height * 2 bytes) to RGBA, BGRA, RGB or a luma plane. Rows are
+ * split over the scheduler's workers when one is given.
+ */
+inline void convertYuy2(const unsigned char *src, unsigned char *dst, int width, int height, PixelFormat format, Scheduler *scheduler = nullptr)
+{
+    const int dstChannels = getNumChannels(format);
+    parallelFor(scheduler, 0, height, [ = ](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const unsigned char *srcRow = src + y * width * 2;
+            unsigned char *dstRow = dst + y * width * dstChannels;
+            switch (format) {
+            case PIXEL_FORMAT_RGBA:
+                yuy2RowToRgba(srcRow, dstRow, width, false);
+                break;
+            case PIXEL_FORMAT_BGRA:
+                yuy2RowToRgba(srcRow, dstRow, width, true);
+                break;
+            case PIXEL_FORMAT_RGB:
+                yuy2RowToRgb(srcRow, dstRow, width);
+                break;
+            case PIXEL_FORMAT_GRAY:
+                yuy2RowToLuma(srcRow, dstRow, width);
+                break;
+            case PIXEL_FORMAT_YUY2:
+                memcpy(dstRow, srcRow, width * 2);
+                break;
+            default:
+                break;
+            }
+        }
+    }, 16);
+}
+
+/**
+ * @brief Converts a YUY2 image to RGBA or BGRA while box-downsampling it by factor (1, 2 or 4), in a single
+ * pass over the source. srcStride is the source row size in bytes.
+ */
+inline void downsampleYuy2(const unsigned char *src, int srcStride, unsigned char *dst, int dstWidth, int dstHeight, int factor, PixelFormat format, Scheduler *scheduler = nullptr)
+{
+    const bool swapRB = format == PIXEL_FORMAT_BGRA;
+    parallelFor(scheduler, 0, dstHeight, [ = ](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const unsigned char *srcRows = src + y * factor * srcStride;
+            unsigned char *dstRow = dst + y * dstWidth * 4;
+            if (factor == 1) {
+                yuy2RowToRgba(srcRows, dstRow, dstWidth, swapRB);
+            }
+            else {
+                yuy2RowsDownsampleToRgba(srcRows, srcStride, dstRow, dstWidth, factor, swapRB);
+            }
+        }
+    }, 8);
+}
+
+/**
+ * @brief Converts an RGBA or YUY2 image into dst, allocating it for the requested format.
+ * @return false if the conversion is not supported
+ */
+inline bool convertColor(const ofPixels &src, PixelFormat srcFormat, ofPixels &dst, PixelFormat dstFormat, Scheduler *scheduler = nullptr)
+{
+    const int dstChannels = getNumChannels(dstFormat);
+    if (!src.isAllocated() || dstChannels == 0 || (srcFormat != PIXEL_FORMAT_YUY2 && srcFormat != PIXEL_FORMAT_RGBA)) {
+        return false;
+    }
+
+    if (srcFormat == PIXEL_FORMAT_RGBA && dstFormat == PIXEL_FORMAT_YUY2) {
+        return false;
+    }
+
+    const int width = src.getWidth();
+    const int height = src.getHeight();
+    if (dst.getWidth() != width || dst.getHeight() != height || dst.getNumChannels() != dstChannels) {
+        dst.allocate(width, height, dstChannels);
+    }
+
+    const unsigned char *srcPixels = src.getPixels();
+    unsigned char *dstPixels = dst.getPixels();
+    if (srcFormat == PIXEL_FORMAT_YUY2) {
+        convertYuy2(srcPixels, dstPixels, width, height, dstFormat, scheduler);
+    }
+    else {
+        parallelFor(scheduler, 0, height, [ = ](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                rgbaRowConvert(srcPixels + y * width * 4, dstPixels + y * width * dstChannels, width, dstFormat);
+            }
+        }, 16);
+    }
+
+    return true;
+}
+} // namespace ofxKinect2
@@ -0,0 +1,317 @@
+#pragma once
+#include "ofMain.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+struct Blob;
+class ConnectedComponents;
+} // namespace ofxKinect2
+
+struct ofxKinect2::Blob {
+    Blob()
+        : id(-1)
+        , age(0)
+        , area(0)
+        , meanDepth(0)
+    {
+
+    }
+
+    /** @brief Tracking id, stays the same from frame to frame. -1 until a BlobTracker assigned one. */
+    int id;
+    /** @brief Number of frames the blob has been tracked for. */
+    int age;
+    int area;
+    ofRectangle boundingBox;
+    ofVec2f centroid;
+    /** @brief Average of the valid depths under the blob in millimeters, 0 without a depth image. */
+    float meanDepth;
+};
+
+/**
+ * @brief Finds the connected blobs of a mask, any non zero pixel is foreground. Works on runs of foreground pixels
+ * instead of single pixels: the first pass collects the runs of every row and unions each one with the runs it
+ * touches in the row above, the second pass resolves the union-find roots and accumulates the blob statistics per
+ * run. Blobs are sorted by area, largest first.
+ */
+class ofxKinect2::ConnectedComponents
+{
+public:
+    struct Run {
+        int y, begin, end;
+        /** @brief Index of the blob in getBlobs(), -1 if the blob was filtered out. */
+        int blob;
+    };
+
+    ConnectedComponents()
+        : m_MinArea(20)
+        , m_MaxBlobs(512)
+        , m_IsEightConnected(true)
+    {
+
+    }
+
+    /**
+     * @brief Labels the mask. With invert, zero pixels are the foreground, which is what BodyIndexStream gives.
+     */
+    template<typename PixelType>
+    void update(const ofPixels_<PixelType> &mask, const ofShortPixels *depth = nullptr, bool invert = false)
+    {
+        assert(mask.getNumChannels() == 1);
+        if (depth && (depth->getWidth() != mask.getWidth() || depth->getHeight() != mask.getHeight())) {
+            ofLogWarning("ofxKinect2::ConnectedComponents") << "The depth must be the same size as the mask.";
+            depth = nullptr;
+        }
+
+        const int width = mask.getWidth();
+        const int height = mask.getHeight();
+        m_Runs.clear();
+        m_Parents.clear();
+        m_Blobs.clear();
+
+        const PixelType *pixels = mask.getPixels();
+        size_t previousBegin = 0, previousEnd = 0;
+        for (int y = 0; y < height; y++) {
+            const size_t begin = m_Runs.size();
+            findRuns(pixels + y * width, width, y, invert);
+            connect(previousBegin, previousEnd, begin, m_Runs.size());
+            previousBegin = begin;
+            previousEnd = m_Runs.size();
+        }
+
+        resolve(depth ? depth->getPixels() : nullptr, width);
+    }
+
+    const std::vector<Blob> &getBlobs() const
+    {
+        return m_Blobs;
+    }
+
+    std::vector<Blob> &getBlobs()
+    {
+        return m_Blobs;
+    }
+
+    const std::vector<Run> &getRuns() const
+    {
+        return m_Runs;
+    }
+
+    /**
+     * @brief Blobs smaller than this many pixels are dropped.
+     */
+    void setMinArea(int area)
+    {
+        m_MinArea = area;
+    }
+
+    int getMinArea() const
+    {
+        return m_MinArea;
+    }
+
+    void setMaxBlobs(int maxBlobs)
+    {
+        m_MaxBlobs = maxBlobs;
+    }
+
+    int getMaxBlobs() const
+    {
+        return m_MaxBlobs;
+    }
+
+    /**
+     * @brief Whether diagonal neighbours are connected, true by default.
+     */
+    void setEightConnected(bool eightConnected)
+    {
+        m_IsEightConnected = eightConnected;
+    }
+
+    bool isEightConnected() const
+    {
+        return m_IsEightConnected;
+    }
+
+protected:
+    struct Accumulator {
+        int area, minX, minY, maxX, maxY, numDepths;
+        double sumX, sumY, sumDepth;
+    };
+
+    int m_MinArea, m_MaxBlobs;
+    bool m_IsEightConnected;
+    std::vector<Run> m_Runs;
+    std::vector<int> m_Parents;
+    std::vector<Accumulator> m_Accumulators;
+    std::vector<int> m_Order;
+    std::vector<int> m_BlobIndices;
+    std::vector<Blob> m_Blobs;
+
+protected:
+#if defined(OFX_KINECT2_SSE2)
+    /**
+     * @brief Skips 16 pixels at a time while they are all foreground, or all background.
+     */
+    static int skip(const unsigned char *row, int x, int width, bool foreground, bool invert)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        // All zero bytes give a full movemask, so the run continues while the mask equals the expected one.
+        const int expected = (foreground != invert) ? 0 : 0xFFFF;
+        while (x + 16 <= width && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x)), zero)) == expected) {
+            x += 16;
+        }
+
+        return x;
+    }
+#endif
+
+    template<typename PixelType>
+    static int skip(const PixelType *, int x, int, bool, bool)
+    {
+        return x;
+    }
+
+    template<typename PixelType>
+    void findRuns(const PixelType *row, int width, int y, bool invert)
+    {
+        int x = 0;
+        while (x < width) {
+            x = skip(row, x, width, false, invert);
+            while (x < width && (row[x] != 0) == invert) {
+                x++;
+            }
+            if (x >= width) {
+                break;
+            }
+
+            const int begin = x;
+            x = skip(row, x, width, true, invert);
+            while (x < width && (row[x] != 0) != invert) {
+                x++;
+            }
+
+            Run run = { y, begin, x, -1 };
+            m_Runs.push_back(run);
+            m_Parents.push_back(static_cast<int>(m_Parents.size()));
+        }
+    }
+
+    /**
+     * @brief Unions the runs of a row with the overlapping runs of the row above, both lists are sorted by x.
+     */
+    void connect(size_t previousBegin, size_t previousEnd, size_t begin, size_t end)
+    {
+        // Diagonal neighbours touch when the runs are one pixel apart.
+        const int reach = m_IsEightConnected ? 1 : 0;
+        size_t i = previousBegin;
+        for (size_t j = begin; j < end; j++) {
+            const Run &run = m_Runs[j];
+            while (i < previousEnd && m_Runs[i].end + reach <= run.begin) {
+                i++;
+            }
+
+            for (size_t k = i; k < previousEnd && m_Runs[k].begin < run.end + reach; k++) {
+                unite(static_cast<int>(k), static_cast<int>(j));
+            }
+        }
+    }
+
+    int find(int index)
+    {
+        while (m_Parents[index] != index) {
+            m_Parents[index] = m_Parents[m_Parents[index]];
+            index = m_Parents[index];
+        }
+
+        return index;
+    }
+
+    void unite(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        // The smaller index is the root so the roots come first in scan order.
+        if (a < b) {
+            m_Parents[b] = a;
+        }
+        else if (b < a) {
+            m_Parents[a] = b;
+        }
+    }
+
+    void resolve(const unsigned short *depth, int width)
+    {
+        // Roots get consecutive labels in scan order, every other run points at its root's label.
+        std::vector<int> &labels = m_Parents;
+        int numLabels = 0;
+        for (size_t i = 0; i < m_Runs.size(); i++) {
+            if (labels[i] == static_cast<int>(i)) {
+                labels[i] = -(++numLabels);
+            }
+            else {
+                labels[i] = labels[labels[i]];
+            }
+        }
+
+        const int maxInt = std::numeric_limits<int>::max();
+        Accumulator empty = { 0, maxInt, maxInt, -1, -1, 0, 0, 0, 0 };
+        m_Accumulators.assign(numLabels, empty);
+        for (size_t i = 0; i < m_Runs.size(); i++) {
+            const Run &run = m_Runs[i];
+            Accumulator &accumulator = m_Accumulators[-labels[i] - 1];
+            const int length = run.end - run.begin;
+            accumulator.area += length;
+            accumulator.minX = std::min(accumulator.minX, run.begin);
+            accumulator.maxX = std::max(accumulator.maxX, run.end - 1);
+            accumulator.minY = std::min(accumulator.minY, run.y);
+            accumulator.maxY = std::max(accumulator.maxY, run.y);
+            accumulator.sumX += (run.begin + run.end - 1) * 0.5 * length;
+            accumulator.sumY += static_cast<double>(run.y) * length;
+
+            if (depth) {
+                const unsigned short *row = depth + run.y * width;
+                int sum = 0, count = 0;
+                for (int x = run.begin; x < run.end; x++) {
+                    sum += row[x];
+                    count += row[x] != 0;
+                }
+                accumulator.sumDepth += sum;
+                accumulator.numDepths += count;
+            }
+        }
+
+        m_Order.clear();
+        for (int label = 0; label < numLabels; label++) {
+            if (m_Accumulators[label].area >= m_MinArea) {
+                m_Order.push_back(label);
+            }
+        }
+
+        const std::vector<Accumulator> &accumulators = m_Accumulators;
+        std::sort(m_Order.begin(), m_Order.end(), [&accumulators](int a, int b) {
+            return accumulators[a].area > accumulators[b].area;
+        });
+        if (m_Order.size() > static_cast<size_t>(m_MaxBlobs)) {
+            m_Order.resize(m_MaxBlobs);
+        }
+
+        // Maps the labels to blob indices for the runs, -1 for the dropped ones.
+        m_BlobIndices.assign(numLabels, -1);
+        m_Blobs.resize(m_Order.size());
+        for (size_t i = 0; i < m_Order.size(); i++) {
+            const Accumulator &accumulator = m_Accumulators[m_Order[i]];
+            Blob &blob = m_Blobs[i];
+            blob.area = accumulator.area;
+            blob.boundingBox.set(accumulator.minX, accumulator.minY, accumulator.maxX - accumulator.minX + 1, accumulator.maxY - accumulator.minY + 1);
+            blob.centroid.set(accumulator.sumX / accumulator.area, accumulator.sumY / accumulator.area);
+            blob.meanDepth = accumulator.numDepths > 0 ? static_cast<float>(accumulator.sumDepth / accumulator.numDepths) : 0.f;
+            m_BlobIndices[m_Order[i]] = static_cast<int>(i);
+        }
+
+        for (size_t i = 0; i < m_Runs.size(); i++) {
+            m_Runs[i].blob = m_BlobIndices[-labels[i] - 1];
+        }
+    }
+};
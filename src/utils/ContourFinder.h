@@ -0,0 +1,422 @@
+#pragma once
+#include "ofMain.h"
+
+namespace ofxKinect2
+{
+struct Contours;
+class ContourFinder;
+} // namespace ofxKinect2
+
+/**
+ * @brief The closed outlines of a frame. All the points live in one array, every contour is a range of it, so the
+ * buffers are reused from frame to frame.
+ */
+struct ofxKinect2::Contours {
+    struct Contour {
+        /** @brief The body index (0 - 5) the outline belongs to. */
+        int bodyIndex;
+        /** @brief Outlines of the holes in a region wind the other way. */
+        bool isHole;
+        size_t begin, size;
+        float area;
+    };
+
+    std::vector<Contour> contours;
+    std::vector<ofVec2f> points;
+
+    void clear()
+    {
+        contours.clear();
+        points.clear();
+    }
+
+    size_t size() const
+    {
+        return contours.size();
+    }
+
+    const ofVec2f *getPoints(size_t index) const
+    {
+        return &points[contours[index].begin];
+    }
+
+    /**
+     * @brief Fills the polyline with the contour, for drawing.
+     */
+    void getPolyline(size_t index, ofPolyline &polyline) const
+    {
+        polyline.clear();
+        const Contour &contour = contours[index];
+        for (size_t i = contour.begin; i < contour.begin + contour.size; i++) {
+            polyline.addVertex(points[i].x, points[i].y);
+        }
+        polyline.close();
+    }
+};
+
+/**
+ * @brief Traces the outlines of every body in a body index frame (one byte per pixel, 0 - 5 for the bodies) with
+ * marching squares and simplifies them with Douglas-Peucker. Each body is only scanned within its bounding box.
+ * With sub-pixel positions the iso line runs through the 3x3 box filtered mask instead of the pixel edges, which
+ * gives smoother outlines at the cost of a blur.
+ */
+class ofxKinect2::ContourFinder
+{
+public:
+    static const int NUM_BODIES = 6;
+
+    ContourFinder()
+        : m_Tolerance(1.f)
+        , m_MinArea(50.f)
+        , m_IsSubPixel(false)
+        , m_IsHoleEnabled(true)
+    {
+        buildSegmentTable();
+    }
+
+    void update(const unsigned char *bodyIndices, int width, int height, Contours &contours)
+    {
+        contours.clear();
+
+        // Bounding box of every body in one pass.
+        int minX[NUM_BODIES], minY[NUM_BODIES], maxX[NUM_BODIES], maxY[NUM_BODIES];
+        for (int i = 0; i < NUM_BODIES; i++) {
+            minX[i] = minY[i] = std::numeric_limits<int>::max();
+            maxX[i] = maxY[i] = -1;
+        }
+        for (int y = 0; y < height; y++) {
+            const unsigned char *row = bodyIndices + y * width;
+            for (int x = 0; x < width; x++) {
+                const int index = row[x];
+                if (index < NUM_BODIES) {
+                    minX[index] = std::min(minX[index], x);
+                    maxX[index] = std::max(maxX[index], x);
+                    minY[index] = std::min(minY[index], y);
+                    maxY[index] = std::max(maxY[index], y);
+                }
+            }
+        }
+
+        for (int i = 0; i < NUM_BODIES; i++) {
+            if (maxX[i] >= 0) {
+                traceBody(bodyIndices, width, i, minX[i], minY[i], maxX[i], maxY[i], contours);
+            }
+        }
+    }
+
+    /**
+     * @brief Maximum distance in pixels between the simplified and the traced outline, 0 keeps every point.
+     */
+    void setTolerance(float pixels)
+    {
+        m_Tolerance = pixels;
+    }
+
+    float getTolerance() const
+    {
+        return m_Tolerance;
+    }
+
+    /**
+     * @brief Outlines enclosing fewer pixels are dropped.
+     */
+    void setMinArea(float area)
+    {
+        m_MinArea = area;
+    }
+
+    float getMinArea() const
+    {
+        return m_MinArea;
+    }
+
+    void setSubPixel(bool subPixel)
+    {
+        m_IsSubPixel = subPixel;
+    }
+
+    bool isSubPixel() const
+    {
+        return m_IsSubPixel;
+    }
+
+    void setHoleEnabled(bool enabled)
+    {
+        m_IsHoleEnabled = enabled;
+    }
+
+    bool isHoleEnabled() const
+    {
+        return m_IsHoleEnabled;
+    }
+
+protected:
+    // Cell edges, the corners are 0 top left, 1 top right, 2 bottom right and 3 bottom left.
+    enum Edge {
+        EDGE_TOP = 0,
+        EDGE_RIGHT,
+        EDGE_BOTTOM,
+        EDGE_LEFT
+    };
+
+    struct Segment {
+        int from, to;
+    };
+
+    float m_Tolerance, m_MinArea;
+    bool m_IsSubPixel, m_IsHoleEnabled;
+    Segment m_Segments[16][2];
+    int m_NumSegments[16];
+
+    std::vector<unsigned char> m_Mask, m_Field;
+    std::vector<int> m_Next, m_Starts;
+    std::vector<ofVec2f> m_Traced;
+    std::vector<bool> m_IsKept;
+    std::vector<std::pair<int, int> > m_Stack;
+
+protected:
+    /**
+     * @brief Every directed segment keeps the inside on the same side, so consecutive segments chain into loops
+     * through the edge they share. The saddles connect the diagonal inside corners, like the 8-connected labelling.
+     */
+    void buildSegmentTable()
+    {
+        const ofVec2f corners[4] = { ofVec2f(0, 0), ofVec2f(1, 0), ofVec2f(1, 1), ofVec2f(0, 1) };
+        const ofVec2f midpoints[4] = { ofVec2f(0.5f, 0), ofVec2f(1, 0.5f), ofVec2f(0.5f, 1), ofVec2f(0, 0.5f) };
+        for (int type = 0; type < 16; type++) {
+            m_NumSegments[type] = 0;
+            int crossings[4], numCrossings = 0;
+            for (int edge = 0; edge < 4; edge++) {
+                if (((type >> edge) & 1) != ((type >> ((edge + 1) % 4)) & 1)) {
+                    crossings[numCrossings++] = edge;
+                }
+            }
+
+            std::pair<int, int> pairs[2];
+            if (numCrossings == 2) {
+                pairs[0] = std::make_pair(crossings[0], crossings[1]);
+            }
+            else if (numCrossings == 4) {
+                // Cut off the two outside corners, edge e and e + 1 share corner e + 1.
+                const int outside = (type & 2) ? 0 : 1;
+                pairs[0] = std::make_pair((outside + 3) % 4, outside);
+                pairs[1] = std::make_pair((outside + 1) % 4, (outside + 2) % 4);
+            }
+
+            for (int i = 0; i < numCrossings / 2; i++) {
+                int from = pairs[i].first, to = pairs[i].second;
+                // The corner both edges touch when they are adjacent, any corner otherwise.
+                const int corner = (to == (from + 1) % 4) ? to : ((from == (to + 1) % 4) ? from : 0);
+                const ofVec2f direction = midpoints[to] - midpoints[from];
+                const ofVec2f toCorner = corners[corner] - midpoints[from];
+                const bool isLeft = direction.x * toCorner.y - direction.y * toCorner.x > 0;
+                if (isLeft != (((type >> corner) & 1) != 0)) {
+                    std::swap(from, to);
+                }
+
+                Segment segment = { from, to };
+                m_Segments[type][m_NumSegments[type]++] = segment;
+            }
+        }
+    }
+
+    void traceBody(const unsigned char *bodyIndices, int width, int body, int minX, int minY, int maxX, int maxY, Contours &contours)
+    {
+        // The field has an empty border so every outline closes, two pixels wide for the blur.
+        const int pad = m_IsSubPixel ? 2 : 1;
+        const int fieldWidth = maxX - minX + 1 + 2 * pad;
+        const int fieldHeight = maxY - minY + 1 + 2 * pad;
+        m_Field.assign(fieldWidth * fieldHeight, 0);
+        for (int y = minY; y <= maxY; y++) {
+            const unsigned char *row = bodyIndices + y * width;
+            unsigned char *field = &m_Field[(y - minY + pad) * fieldWidth + pad];
+            for (int x = minX; x <= maxX; x++) {
+                field[x - minX] = row[x] == body ? 9 : 0;
+            }
+        }
+
+        if (m_IsSubPixel) {
+            boxFilter(fieldWidth, fieldHeight);
+        }
+
+        const unsigned char *field = &m_Field[0];
+        const int numEdges = fieldWidth * fieldHeight;
+        m_Next.assign(numEdges * 2, -1);
+        m_Starts.clear();
+        for (int y = 0; y + 1 < fieldHeight; y++) {
+            for (int x = 0; x + 1 < fieldWidth; x++) {
+                const int type = isInside(field[y * fieldWidth + x]) | (isInside(field[y * fieldWidth + x + 1]) << 1)
+                                 | (isInside(field[(y + 1) * fieldWidth + x + 1]) << 2) | (isInside(field[(y + 1) * fieldWidth + x]) << 3);
+                if (type == 0 || type == 15) {
+                    continue;
+                }
+
+                // Horizontal edges first, then the vertical ones: top, right, bottom, left.
+                const int edges[4] = { y * fieldWidth + x, numEdges + y * fieldWidth + x + 1, (y + 1) * fieldWidth + x, numEdges + y * fieldWidth + x };
+                for (int i = 0; i < m_NumSegments[type]; i++) {
+                    const Segment &segment = m_Segments[type][i];
+                    m_Next[edges[segment.from]] = edges[segment.to];
+                    m_Starts.push_back(edges[segment.from]);
+                }
+            }
+        }
+
+        const float offsetX = static_cast<float>(minX - pad);
+        const float offsetY = static_cast<float>(minY - pad);
+        for (size_t i = 0; i < m_Starts.size(); i++) {
+            int edge = m_Starts[i];
+            if (m_Next[edge] < 0) {
+                continue;
+            }
+
+            m_Traced.clear();
+            do {
+                m_Traced.push_back(getEdgePoint(edge, fieldWidth, numEdges) + ofVec2f(offsetX, offsetY));
+                const int next = m_Next[edge];
+                m_Next[edge] = -1;
+                edge = next;
+            } while (edge >= 0 && m_Next[edge] >= 0);
+
+            addContour(body, contours);
+        }
+    }
+
+    static int isInside(unsigned char value)
+    {
+        return value >= 5 ? 1 : 0;
+    }
+
+    /**
+     * @brief Replaces the 0 / 9 mask by the number of set pixels in every 3x3 neighbourhood.
+     */
+    void boxFilter(int width, int height)
+    {
+        m_Mask.assign(width * height, 0);
+        for (int y = 0; y < height; y++) {
+            const unsigned char *src = &m_Field[y * width];
+            unsigned char *dst = &m_Mask[y * width];
+            for (int x = 1; x + 1 < width; x++) {
+                dst[x] = (src[x - 1] + src[x] + src[x + 1]) / 9;
+            }
+        }
+        std::fill(m_Field.begin(), m_Field.end(), 0);
+        for (int y = 1; y + 1 < height; y++) {
+            const unsigned char *above = &m_Mask[(y - 1) * width];
+            const unsigned char *row = &m_Mask[y * width];
+            const unsigned char *below = &m_Mask[(y + 1) * width];
+            unsigned char *dst = &m_Field[y * width];
+            for (int x = 1; x + 1 < width; x++) {
+                dst[x] = above[x] + row[x] + below[x];
+            }
+        }
+    }
+
+    /**
+     * @brief Where the iso line crosses the edge, the middle of it for the binary mask.
+     */
+    ofVec2f getEdgePoint(int edge, int fieldWidth, int numEdges) const
+    {
+        const bool isVertical = edge >= numEdges;
+        const int index = isVertical ? edge - numEdges : edge;
+        const int x = index % fieldWidth;
+        const int y = index / fieldWidth;
+        const float a = m_Field[index];
+        const float b = m_Field[isVertical ? index + fieldWidth : index + 1];
+        const float t = (4.5f - a) / (b - a);
+        return isVertical ? ofVec2f(static_cast<float>(x), y + t) : ofVec2f(x + t, static_cast<float>(y));
+    }
+
+    void addContour(int body, Contours &contours)
+    {
+        const size_t numPoints = m_Traced.size();
+        if (numPoints < 3) {
+            return;
+        }
+
+        float area = 0;
+        for (size_t i = 0, j = numPoints - 1; i < numPoints; j = i++) {
+            area += m_Traced[j].x * m_Traced[i].y - m_Traced[i].x * m_Traced[j].y;
+        }
+        area *= 0.5f;
+
+        // Outer outlines wind with a positive area in image coordinates.
+        const bool isHole = area < 0;
+        if (std::abs(area) < m_MinArea || (isHole && !m_IsHoleEnabled)) {
+            return;
+        }
+
+        Contours::Contour contour;
+        contour.bodyIndex = body;
+        contour.isHole = isHole;
+        contour.area = std::abs(area);
+        contour.begin = contours.points.size();
+        simplify(contours.points);
+        contour.size = contours.points.size() - contour.begin;
+        contours.contours.push_back(contour);
+    }
+
+    /**
+     * @brief Douglas-Peucker on the closed outline: split at the point farthest from the first one and simplify
+     * both halves, without recursion.
+     */
+    void simplify(std::vector<ofVec2f> &points)
+    {
+        const int numPoints = static_cast<int>(m_Traced.size());
+        if (m_Tolerance <= 0) {
+            points.insert(points.end(), m_Traced.begin(), m_Traced.end());
+            return;
+        }
+
+        int farthest = 0;
+        float maxDistance = -1;
+        for (int i = 1; i < numPoints; i++) {
+            const float distance = m_Traced[0].squareDistance(m_Traced[i]);
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                farthest = i;
+            }
+        }
+
+        m_IsKept.assign(numPoints, false);
+        m_IsKept[0] = m_IsKept[farthest] = true;
+        m_Stack.clear();
+        m_Stack.push_back(std::make_pair(0, farthest));
+        m_Stack.push_back(std::make_pair(farthest, numPoints));
+
+        const float tolerance = m_Tolerance * m_Tolerance;
+        while (!m_Stack.empty()) {
+            const int first = m_Stack.back().first;
+            const int last = m_Stack.back().second;
+            m_Stack.pop_back();
+
+            // The last index wraps around to the first point.
+            const ofVec2f &a = m_Traced[first];
+            const ofVec2f &b = m_Traced[last % numPoints];
+            const ofVec2f ab = b - a;
+            const float length = ab.x * ab.x + ab.y * ab.y;
+            int split = -1;
+            float splitDistance = tolerance;
+            for (int i = first + 1; i < last; i++) {
+                const ofVec2f ap = m_Traced[i] - a;
+                const float cross = ab.x * ap.y - ab.y * ap.x;
+                const float distance = length > 0 ? cross * cross / length : ap.x * ap.x + ap.y * ap.y;
+                if (distance > splitDistance) {
+                    splitDistance = distance;
+                    split = i;
+                }
+            }
+
+            if (split >= 0) {
+                m_IsKept[split] = true;
+                m_Stack.push_back(std::make_pair(first, split));
+                m_Stack.push_back(std::make_pair(split, last));
+            }
+        }
+
+        for (int i = 0; i < numPoints; i++) {
+            if (m_IsKept[i]) {
+                points.push_back(m_Traced[i]);
+            }
+        }
+    }
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include "ofMain.h"
+
+namespace ofxKinect2
+{
+/**
+ * @brief Copies the width x height window at (x, y) of an image srcWidth pixels wide into dst, one row at a time.
+ * dst is reallocated when its size differs.
+ */
+template <typename PixelType>
+inline void copyWindow(const PixelType *src, int srcWidth, int x, int y, int width, int height, int channels, ofPixels_<PixelType> &dst)
+{
+    if (!dst.isAllocated() || dst.getWidth() != width || dst.getHeight() != height || dst.getNumChannels() != channels) {
+        dst.allocate(width, height, channels);
+    }
+
+    const size_t rowSize = width * channels;
+    PixelType *dstPixels = dst.getPixels();
+    if (x == 0 && width == srcWidth) {
+        memcpy(dstPixels, src + y * rowSize, rowSize * height * sizeof(PixelType));
+        return;
+    }
+    for (int row = 0; row < height; row++) {
+        memcpy(dstPixels + row * rowSize, src + ((y + row) * srcWidth + x) * channels, rowSize * sizeof(PixelType));
+    }
+}
+} // namespace ofxKinect2
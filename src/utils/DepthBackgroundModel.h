@@ -0,0 +1,257 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class DepthBackgroundModel;
+} // namespace ofxKinect2
+
+/**
+ * @brief Per pixel running mean and variance of the empty scene's depth. The first learningFrames frames build the
+ * model, after that every pixel closer than the background by more than max(minDifference, threshold * sigma) is
+ * foreground, and the background pixels keep adapting slowly unless the model is frozen. Pixels the sensor never
+ * saw in the background count as foreground once they get a depth.
+ */
+class ofxKinect2::DepthBackgroundModel
+{
+public:
+    DepthBackgroundModel()
+        : m_LearningFrames(60)
+        , m_NumLearnedFrames(0)
+        , m_LearningRate(0.005f)
+        , m_Threshold(3.f)
+        , m_MinDifference(40.f)
+        , m_IsFrozen(false)
+    {
+
+    }
+
+    /**
+     * @brief Updates the model with the depth and writes the 0/255 foreground mask and the depth with the background
+     * zeroed out. Everything is background while the model is still learning.
+     */
+    void update(const ofShortPixels &depth, ofPixels &mask, ofShortPixels &foreground, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        const int width = depth.getWidth();
+        const int height = depth.getHeight();
+        const size_t numPixels = width * height;
+        if (m_Mean.size() != numPixels) {
+            m_Mean.assign(numPixels, 0.f);
+            m_Variance.assign(numPixels, 0.f);
+            m_NumLearnedFrames = 0;
+        }
+
+        if (!mask.isAllocated() || mask.getWidth() != width || mask.getHeight() != height || mask.getNumChannels() != 1) {
+            mask.allocate(width, height, 1);
+        }
+        if (!foreground.isAllocated() || foreground.getWidth() != width || foreground.getHeight() != height || foreground.getNumChannels() != 1) {
+            foreground.allocate(width, height, 1);
+        }
+
+        Pass pass;
+        pass.isLearning = isLearning();
+        // Plain average while learning, exponential afterwards.
+        pass.rate = pass.isLearning ? 1.f / (m_NumLearnedFrames + 1) : (m_IsFrozen ? 0.f : m_LearningRate);
+        pass.threshold = m_Threshold * m_Threshold;
+        pass.minDifference = m_MinDifference * m_MinDifference;
+
+        const unsigned short *depthPixels = depth.getPixels();
+        unsigned char *maskPixels = mask.getPixels();
+        unsigned short *foregroundPixels = foreground.getPixels();
+        parallelFor(scheduler, 0, height, [this, &pass, depthPixels, maskPixels, foregroundPixels, width](int begin, int end) {
+            const int offset = begin * width;
+            process(pass, depthPixels + offset, maskPixels + offset, foregroundPixels + offset, offset, (end - begin) * width);
+        }, 16);
+
+        if (pass.isLearning) {
+            m_NumLearnedFrames++;
+        }
+    }
+
+    /**
+     * @brief Forgets the background and learns it again from the next learningFrames frames.
+     */
+    void relearn()
+    {
+        std::fill(m_Mean.begin(), m_Mean.end(), 0.f);
+        std::fill(m_Variance.begin(), m_Variance.end(), 0.f);
+        m_NumLearnedFrames = 0;
+    }
+
+    bool isLearning() const
+    {
+        return m_NumLearnedFrames < m_LearningFrames;
+    }
+
+    /**
+     * @brief Stops the background from adapting after the warm-up, so people standing still don't fade into it.
+     */
+    void setFrozen(bool frozen = true)
+    {
+        m_IsFrozen = frozen;
+    }
+
+    bool isFrozen() const
+    {
+        return m_IsFrozen;
+    }
+
+    void setLearningFrames(int numFrames)
+    {
+        m_LearningFrames = std::max(numFrames, 1);
+    }
+
+    int getLearningFrames() const
+    {
+        return m_LearningFrames;
+    }
+
+    /**
+     * @brief How fast the background adapts after the warm-up, the weight of the new frame.
+     */
+    void setLearningRate(float rate)
+    {
+        m_LearningRate = ofClamp(rate, 0.f, 1.f);
+    }
+
+    float getLearningRate() const
+    {
+        return m_LearningRate;
+    }
+
+    /**
+     * @brief Distance from the background in standard deviations above which a pixel is foreground.
+     */
+    void setThreshold(float sigmas)
+    {
+        m_Threshold = sigmas;
+    }
+
+    float getThreshold() const
+    {
+        return m_Threshold;
+    }
+
+    void setMinDifference(float millimeters)
+    {
+        m_MinDifference = millimeters;
+    }
+
+    float getMinDifference() const
+    {
+        return m_MinDifference;
+    }
+
+    const std::vector<float> &getMean() const
+    {
+        return m_Mean;
+    }
+
+    const std::vector<float> &getVariance() const
+    {
+        return m_Variance;
+    }
+
+protected:
+    struct Pass {
+        bool isLearning;
+        float rate, threshold, minDifference;
+    };
+
+    int m_LearningFrames, m_NumLearnedFrames;
+    float m_LearningRate, m_Threshold, m_MinDifference;
+    bool m_IsFrozen;
+    // Kept as separate arrays so the SIMD loop reads 4 means and 4 variances with one load each.
+    std::vector<float> m_Mean, m_Variance;
+
+protected:
+    void process(const Pass &pass, const unsigned short *depth, unsigned char *mask, unsigned short *foreground, int offset, int count)
+    {
+        float *mean = &m_Mean[offset];
+        float *variance = &m_Variance[offset];
+        int i = 0;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 rate = _mm_set1_ps(pass.rate);
+        const __m128 threshold = _mm_set1_ps(pass.threshold);
+        const __m128 minDifference = _mm_set1_ps(pass.minDifference);
+        const __m128 isLearning = pass.isLearning ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+        for (; i + 8 <= count; i += 8) {
+            const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + i));
+            const __m128i isForeground16 = _mm_packs_epi32(
+                _mm_castps_si128(process4(_mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128())), mean + i, variance + i,
+                                          rate, threshold, minDifference, isLearning)),
+                _mm_castps_si128(process4(_mm_cvtepi32_ps(_mm_unpackhi_epi16(packed, _mm_setzero_si128())), mean + i + 4, variance + i + 4,
+                                          rate, threshold, minDifference, isLearning)));
+
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(mask + i), _mm_packs_epi16(isForeground16, isForeground16));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(foreground + i), _mm_and_si128(packed, isForeground16));
+        }
+#endif
+
+        for (; i < count; i++) {
+            const bool isForeground = processPixel(pass, depth[i], mean[i], variance[i]);
+            mask[i] = isForeground ? 255 : 0;
+            foreground[i] = isForeground ? depth[i] : 0;
+        }
+    }
+
+    bool processPixel(const Pass &pass, float depth, float &mean, float &variance) const
+    {
+        if (depth == 0) {
+            return false;
+        }
+
+        const float difference = depth - mean;
+        const bool isForeground = !pass.isLearning
+                                  && (mean == 0 || (difference < 0 && difference * difference > std::max(pass.minDifference, pass.threshold * variance)));
+        if (!isForeground) {
+            if (mean == 0) {
+                mean = depth;
+                variance = 0;
+            }
+            else {
+                mean += pass.rate * difference;
+                variance = (1.f - pass.rate) * (variance + pass.rate * difference * difference);
+            }
+        }
+
+        return isForeground;
+    }
+
+#if defined(OFX_KINECT2_SSE2)
+    /**
+     * @brief Same as processPixel for 4 pixels, returns the foreground lanes as all ones.
+     */
+    static __m128 process4(__m128 depth, float *meanPointer, float *variancePointer,
+                           __m128 rate, __m128 threshold, __m128 minDifference, __m128 isLearning)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 mean = _mm_loadu_ps(meanPointer);
+        const __m128 variance = _mm_loadu_ps(variancePointer);
+
+        const __m128 isValid = _mm_cmpneq_ps(depth, zero);
+        const __m128 isUnknown = _mm_cmpeq_ps(mean, zero);
+        const __m128 difference = _mm_sub_ps(depth, mean);
+        const __m128 squared = _mm_mul_ps(difference, difference);
+        const __m128 isCloser = _mm_and_ps(_mm_cmplt_ps(difference, zero),
+                                           _mm_cmpgt_ps(squared, _mm_max_ps(minDifference, _mm_mul_ps(threshold, variance))));
+        const __m128 isForeground = _mm_andnot_ps(isLearning, _mm_and_ps(isValid, _mm_or_ps(isUnknown, isCloser)));
+
+        // Background pixels update the model, unknown ones start it from the current depth.
+        const __m128 isBackground = _mm_andnot_ps(isForeground, isValid);
+        const __m128 updatedMean = _mm_add_ps(mean, _mm_mul_ps(rate, difference));
+        const __m128 updatedVariance = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.f), rate), _mm_add_ps(variance, _mm_mul_ps(rate, squared)));
+        const __m128 newMean = _mm_or_ps(_mm_and_ps(isUnknown, depth), _mm_andnot_ps(isUnknown, updatedMean));
+        const __m128 newVariance = _mm_andnot_ps(isUnknown, updatedVariance);
+
+        _mm_storeu_ps(meanPointer, _mm_or_ps(_mm_and_ps(isBackground, newMean), _mm_andnot_ps(isBackground, mean)));
+        _mm_storeu_ps(variancePointer, _mm_or_ps(_mm_and_ps(isBackground, newVariance), _mm_andnot_ps(isBackground, variance)));
+        return isForeground;
+    }
+#endif
+};
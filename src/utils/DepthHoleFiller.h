@@ -0,0 +1,202 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class DepthHoleFiller;
+} // namespace ofxKinect2
+
+/**
+ * @brief Fills the zero valued holes of a depth image in place. A hole is filled with the nearer of the two
+ * valid depths that bound it, first along the rows and then along the columns, but only if it's at most
+ * maxHoleSize pixels long and the two depths are within maxDiscontinuity of each other, so holes on object
+ * edges stay open.
+ */
+class ofxKinect2::DepthHoleFiller
+{
+public:
+    DepthHoleFiller()
+        : m_MaxHoleSize(16)
+        , m_MaxDiscontinuity(100)
+    {
+
+    }
+
+    void update(ofShortPixels &depth, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        const int width = depth.getWidth();
+        const int height = depth.getHeight();
+        unsigned short *pixels = depth.getPixels();
+
+        parallelFor(scheduler, 0, height, [this, pixels, width](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                fillRow(pixels + y * width, width);
+            }
+        }, 16);
+
+        // The column pass keeps the nearest valid depth above every pixel, 8 columns at a time.
+        m_Above.resize(width * height);
+        m_AboveDistance.resize(width * height);
+        const int numBlocks = (width + 7) / 8;
+        parallelFor(scheduler, 0, numBlocks, [this, pixels, width, height](int begin, int end) {
+            for (int block = begin; block < end; block++) {
+                const int x = block * 8;
+                if (x + 8 <= width) {
+                    fillColumns8(pixels, x, width, height);
+                }
+                else {
+                    for (int column = x; column < width; column++) {
+                        fillColumn(pixels + column, width, height);
+                    }
+                }
+            }
+        }, 4);
+    }
+
+    void setMaxHoleSize(int size)
+    {
+        m_MaxHoleSize = size;
+    }
+
+    int getMaxHoleSize() const
+    {
+        return m_MaxHoleSize;
+    }
+
+    void setMaxDiscontinuity(unsigned short millimeters)
+    {
+        m_MaxDiscontinuity = millimeters;
+    }
+
+    unsigned short getMaxDiscontinuity() const
+    {
+        return m_MaxDiscontinuity;
+    }
+
+protected:
+    int m_MaxHoleSize;
+    unsigned short m_MaxDiscontinuity;
+    std::vector<unsigned short> m_Above, m_AboveDistance;
+
+protected:
+    bool canFill(unsigned short before, unsigned short after, int holeSize) const
+    {
+        const int difference = before > after ? before - after : after - before;
+        return before != 0 && after != 0 && holeSize <= m_MaxHoleSize && difference <= m_MaxDiscontinuity;
+    }
+
+    void fillRow(unsigned short *row, int width) const
+    {
+        int x = 0;
+        while (x < width) {
+#if defined(OFX_KINECT2_SSE2)
+            // Skip 8 pixels at a time while there is no hole.
+            const __m128i zero = _mm_setzero_si128();
+            while (x + 8 <= width && _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x)), zero)) == 0) {
+                x += 8;
+            }
+#endif
+            if (x >= width) {
+                break;
+            }
+
+            if (row[x] != 0) {
+                x++;
+                continue;
+            }
+
+            const int start = x;
+            while (x < width && row[x] == 0) {
+                x++;
+            }
+
+            if (start > 0 && x < width && canFill(row[start - 1], row[x], x - start)) {
+                const unsigned short value = std::min(row[start - 1], row[x]);
+                std::fill(row + start, row + x, value);
+            }
+        }
+    }
+
+    void fillColumn(unsigned short *column, int stride, int height) const
+    {
+        int y = 0;
+        while (y < height) {
+            if (column[y * stride] != 0) {
+                y++;
+                continue;
+            }
+
+            const int start = y;
+            while (y < height && column[y * stride] == 0) {
+                y++;
+            }
+
+            if (start > 0 && y < height && canFill(column[(start - 1) * stride], column[y * stride], y - start)) {
+                const unsigned short value = std::min(column[(start - 1) * stride], column[y * stride]);
+                for (int i = start; i < y; i++) {
+                    column[i * stride] = value;
+                }
+            }
+        }
+    }
+
+    void fillColumns8(unsigned short *pixels, int x, int stride, int height)
+    {
+        unsigned short *columns = pixels + x;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i maxHoleSize = _mm_set1_epi16(static_cast<short>(std::min(m_MaxHoleSize, 0x7FFF)));
+        const __m128i maxDiscontinuity = _mm_set1_epi16(static_cast<short>(m_MaxDiscontinuity));
+        unsigned short *above = &m_Above[x];
+        unsigned short *aboveDistance = &m_AboveDistance[x];
+
+        // Top-down: the nearest valid depth above each pixel and how far it is.
+        __m128i lastValid = zero;
+        __m128i distance = zero;
+        for (int y = 0; y < height; y++) {
+            const __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i *>(columns + y * stride));
+            const __m128i isHole = _mm_cmpeq_epi16(depth, zero);
+            distance = _mm_and_si128(isHole, _mm_adds_epu16(distance, one));
+            lastValid = _mm_or_si128(_mm_and_si128(isHole, lastValid), _mm_andnot_si128(isHole, depth));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(above + y * stride), lastValid);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(aboveDistance + y * stride), distance);
+        }
+
+        // Bottom-up: fill where the depths on both ends of the hole are close and the hole is short.
+        lastValid = zero;
+        distance = zero;
+        for (int y = height - 1; y >= 0; y--) {
+            __m128i *pixel = reinterpret_cast<__m128i *>(columns + y * stride);
+            const __m128i depth = _mm_loadu_si128(pixel);
+            const __m128i isHole = _mm_cmpeq_epi16(depth, zero);
+            distance = _mm_and_si128(isHole, _mm_adds_epu16(distance, one));
+
+            const __m128i before = _mm_loadu_si128(reinterpret_cast<const __m128i *>(above + y * stride));
+            const __m128i beforeDistance = _mm_loadu_si128(reinterpret_cast<const __m128i *>(aboveDistance + y * stride));
+
+            // Unsigned compares through saturating subtraction: a <= b <=> (a - b) saturates to 0.
+            const __m128i holeSize = _mm_subs_epu16(_mm_adds_epu16(beforeDistance, distance), one);
+            const __m128i isShort = _mm_cmpeq_epi16(_mm_subs_epu16(holeSize, maxHoleSize), zero);
+            const __m128i difference = _mm_or_si128(_mm_subs_epu16(before, lastValid), _mm_subs_epu16(lastValid, before));
+            const __m128i isContinuous = _mm_cmpeq_epi16(_mm_subs_epu16(difference, maxDiscontinuity), zero);
+            const __m128i isBounded = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(before, zero), _mm_cmpeq_epi16(lastValid, zero)),
+                                                       _mm_cmpeq_epi16(zero, zero));
+
+            const __m128i nearer = _mm_sub_epi16(before, _mm_subs_epu16(before, lastValid));
+            const __m128i fill = _mm_and_si128(_mm_and_si128(isHole, isShort), _mm_and_si128(isContinuous, isBounded));
+            _mm_storeu_si128(pixel, _mm_or_si128(depth, _mm_and_si128(fill, nearer)));
+
+            lastValid = _mm_or_si128(_mm_and_si128(isHole, lastValid), _mm_andnot_si128(isHole, depth));
+        }
+#else
+        for (int column = 0; column < 8; column++) {
+            fillColumn(columns + column, stride, height);
+        }
+#endif
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class DepthTemporalFilter;
+} // namespace ofxKinect2
+
+/**
+ * @brief Per pixel exponential average of the depth frames, applied in place. A pixel starts over from the new
+ * depth when it moved more than the sensor noise at that depth, modelled as
+ * baseNoise + noiseScale * (depth in meters)^2 millimeters, so moving objects don't leave trails. The average
+ * keeps FRACTION_BITS below the millimeter and is rounded to the nearest, so it settles on the mean depth.
+ */
+class ofxKinect2::DepthTemporalFilter
+{
+public:
+    static const int FRACTION_BITS = 3;
+    /** @brief Kinect depth fits in 13 bits, deeper pixels are averaged as this depth. */
+    static const int MAX_DEPTH = (1 << (16 - FRACTION_BITS)) - 1;
+    static const unsigned short MAX_BASE_NOISE = 1000;
+
+    DepthTemporalFilter()
+        : m_Alpha(0.3f)
+        , m_BaseNoise(8)
+        , m_NoiseScale(4)
+    {
+
+    }
+
+    void update(ofShortPixels &depth, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        const int width = depth.getWidth();
+        const int height = depth.getHeight();
+        const size_t numPixels = width * height;
+        if (m_State.size() != numPixels) {
+            m_State.assign(numPixels, 0);
+        }
+
+        unsigned short *pixels = depth.getPixels();
+        unsigned short *state = &m_State[0];
+        parallelFor(scheduler, 0, height, [this, pixels, state, width](int begin, int end) {
+            filter(pixels + begin * width, state + begin * width, (end - begin) * width);
+        }, 16);
+    }
+
+    /**
+     * @brief Forgets the history, the next frame is passed through.
+     */
+    void reset()
+    {
+        std::fill(m_State.begin(), m_State.end(), 0);
+    }
+
+    /**
+     * @brief Weight of the new frame, 1 disables the filter.
+     */
+    void setAlpha(float alpha)
+    {
+        m_Alpha = ofClamp(alpha, 1.f / 32768.f, 1.f);
+    }
+
+    float getAlpha() const
+    {
+        return m_Alpha;
+    }
+
+    /**
+     * @brief In millimeters, baseNoise is capped at MAX_BASE_NOISE and noiseScale at 15.
+     */
+    void setNoiseModel(unsigned short baseNoise, unsigned short noiseScale)
+    {
+        m_BaseNoise = std::min(baseNoise, static_cast<unsigned short>(MAX_BASE_NOISE));
+        m_NoiseScale = std::min<unsigned short>(noiseScale, 15);
+    }
+
+    unsigned short getBaseNoise() const
+    {
+        return m_BaseNoise;
+    }
+
+    unsigned short getNoiseScale() const
+    {
+        return m_NoiseScale;
+    }
+
+protected:
+    float m_Alpha;
+    unsigned short m_BaseNoise, m_NoiseScale;
+    /** @brief The average with FRACTION_BITS, 0 where there is none. */
+    std::vector<unsigned short> m_State;
+
+protected:
+    void filter(unsigned short *depth, unsigned short *state, int count) const
+    {
+        // The depth is clamped to 13 bits so the average fits in 16 bit lanes with its fraction, and the thresholds
+        // keep the differences of averaged pixels within signed 16 bits. The squared depth term is two high
+        // multiplies: (d * (d * K >> 16)) >> 16 with K = noiseScale * 2^32 / 10^6.
+        const int alpha = std::min(static_cast<int>(m_Alpha * 32768.f + 0.5f), 32767);
+        const unsigned short noiseFactor = static_cast<unsigned short>(m_NoiseScale * 4295);
+        const int half = 1 << (FRACTION_BITS - 1);
+        int i = 0;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaQ15 = _mm_set1_epi16(static_cast<short>(alpha));
+        const __m128i baseNoise = _mm_set1_epi16(static_cast<short>(m_BaseNoise));
+        const __m128i factor = _mm_set1_epi16(static_cast<short>(noiseFactor));
+        const __m128i maxDepth = _mm_set1_epi16(MAX_DEPTH);
+        const __m128i halfUnit = _mm_set1_epi16(static_cast<short>(half));
+        for (; i + 8 <= count; i += 8) {
+            const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + i));
+            const __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + i));
+            const __m128i clamped = _mm_sub_epi16(current, _mm_subs_epu16(current, maxDepth));
+            const __m128i previousDepth = _mm_srli_epi16(_mm_add_epi16(previous, halfUnit), FRACTION_BITS);
+            const __m128i target = _mm_slli_epi16(clamped, FRACTION_BITS);
+
+            const __m128i distance = _mm_or_si128(_mm_subs_epu16(clamped, previousDepth), _mm_subs_epu16(previousDepth, clamped));
+            const __m128i threshold = _mm_adds_epu16(baseNoise, _mm_mulhi_epu16(clamped, _mm_mulhi_epu16(clamped, factor)));
+            const __m128i isMoving = _mm_xor_si128(_mm_cmpeq_epi16(_mm_subs_epu16(distance, threshold), zero), _mm_cmpeq_epi16(zero, zero));
+            const __m128i restart = _mm_or_si128(isMoving, _mm_or_si128(_mm_cmpeq_epi16(previous, zero), _mm_cmpeq_epi16(current, zero)));
+
+            // (2 * difference * alpha + 2^15) >> 16, the rounding bit is the top bit of the low half of the product.
+            const __m128i difference = _mm_slli_epi16(_mm_sub_epi16(target, previous), 1);
+            const __m128i step = _mm_add_epi16(_mm_mulhi_epi16(difference, alphaQ15), _mm_srli_epi16(_mm_mullo_epi16(difference, alphaQ15), 15));
+            const __m128i averaged = _mm_add_epi16(previous, step);
+            const __m128i filtered = _mm_srli_epi16(_mm_add_epi16(averaged, halfUnit), FRACTION_BITS);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state + i), _mm_or_si128(_mm_and_si128(restart, target), _mm_andnot_si128(restart, averaged)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(depth + i), _mm_or_si128(_mm_and_si128(restart, current), _mm_andnot_si128(restart, filtered)));
+        }
+#endif
+
+        for (; i < count; i++) {
+            const int current = depth[i];
+            const int clamped = std::min(current, static_cast<int>(MAX_DEPTH));
+            const int previous = state[i];
+            const int target = clamped << FRACTION_BITS;
+            const int threshold = m_BaseNoise + ((clamped * ((clamped * noiseFactor) >> 16)) >> 16);
+            if (current != 0 && previous != 0 && std::abs(clamped - ((previous + half) >> FRACTION_BITS)) <= threshold) {
+                const int averaged = previous + ((2 * (target - previous) * alpha + 32768) >> 16);
+                state[i] = static_cast<unsigned short>(averaged);
+                depth[i] = static_cast<unsigned short>((averaged + half) >> FRACTION_BITS);
+            }
+            else {
+                state[i] = static_cast<unsigned short>(target);
+            }
+        }
+    }
+};
@@ -0,0 +1,458 @@
+#pragma once
+#include "ofMain.h"
+
+namespace ofxKinect2
+{
+struct BodyData;
+class FrameCodec;
+} // namespace ofxKinect2
+
+/**
+ * @brief A tracked body as it goes over the wire: joint positions in camera space meters, the tracking state of
+ * every joint and the hand states, with the values of the SDK enums.
+ */
+struct ofxKinect2::BodyData
+{
+    static const int NUM_JOINTS = 25;
+
+    uint64_t id;
+    unsigned char leftHandState;
+    unsigned char rightHandState;
+    unsigned char trackingStates[NUM_JOINTS];
+    ofVec3f positions[NUM_JOINTS];
+
+    BodyData()
+        : id(0)
+        , leftHandState(0)
+        , rightHandState(0)
+    {
+        std::fill(trackingStates, trackingStates + NUM_JOINTS, 0);
+    }
+};
+
+/**
+ * @brief Wire format of FrameStreamServer. A message is a fixed header followed by its payload:
+ * - depth and IR are compressed losslessly with RVL (Wilson 2017): runs of zeros and of valid pixels, the valid
+ *   ones as the zigzag difference to the previous valid pixel, all in 3 bit + continuation nibbles.
+ * - body index is run length coded, one byte for the index and a varint for the length.
+ * - bodies are quantized to millimeters and every joint is the varint difference to the same body in the
+ *   previous message, bodies seen for the first time and keyframes are coded against 0.
+ * Encoders append at an offset of a buffer they grow but never shrink, so a reused buffer stops allocating.
+ */
+class ofxKinect2::FrameCodec
+{
+public:
+    static const int HEADER_SIZE = 28;
+    static const unsigned int MAGIC = 0x5346324b; // "K2FS"
+    static const unsigned char FLAG_KEYFRAME = 0x1;
+
+    /**
+     * @brief A delta coded body message refers to the one with the previous sequence number of its type.
+     */
+    struct Header
+    {
+        unsigned char sensorType;
+        unsigned char flags;
+        unsigned short width;
+        unsigned short height;
+        unsigned int sequence;
+        uint64_t timestamp;
+        unsigned int payloadSize;
+    };
+
+    static void writeHeader(const Header &header, unsigned char *data)
+    {
+        const unsigned int magic = MAGIC;
+        const unsigned short reserved = 0;
+        memcpy(data, &magic, 4);
+        data[4] = header.sensorType;
+        data[5] = header.flags;
+        memcpy(data + 6, &header.width, 2);
+        memcpy(data + 8, &header.height, 2);
+        memcpy(data + 10, &reserved, 2);
+        memcpy(data + 12, &header.sequence, 4);
+        memcpy(data + 16, &header.timestamp, 8);
+        memcpy(data + 24, &header.payloadSize, 4);
+    }
+
+    static bool readHeader(const unsigned char *data, Header &header)
+    {
+        unsigned int magic;
+        memcpy(&magic, data, 4);
+        if (magic != MAGIC) {
+            return false;
+        }
+        header.sensorType = data[4];
+        header.flags = data[5];
+        memcpy(&header.width, data + 6, 2);
+        memcpy(&header.height, data + 8, 2);
+        memcpy(&header.sequence, data + 12, 4);
+        memcpy(&header.timestamp, data + 16, 8);
+        memcpy(&header.payloadSize, data + 24, 4);
+        return true;
+    }
+
+    /**
+     * @brief RVL, 0 is the invalid depth.
+     * @return The offset past the encoded data
+     */
+    static size_t encodePixels(const unsigned short *pixels, int numPixels, std::vector<unsigned char> &buffer, size_t offset)
+    {
+        NibbleWriter writer(buffer, offset);
+        int previous = 0;
+        int i = 0;
+        while (i < numPixels) {
+            const int zerosBegin = i;
+            while (i < numPixels && pixels[i] == 0) {
+                i++;
+            }
+            writer.write(i - zerosBegin);
+
+            const int valuesBegin = i;
+            while (i < numPixels && pixels[i] != 0) {
+                i++;
+            }
+            writer.write(i - valuesBegin);
+
+            for (int j = valuesBegin; j < i; j++) {
+                writer.write(zigzag(pixels[j] - previous));
+                previous = pixels[j];
+            }
+        }
+        return writer.finish();
+    }
+
+    static bool decodePixels(const unsigned char *data, size_t size, unsigned short *pixels, int numPixels)
+    {
+        NibbleReader reader(data, size);
+        int previous = 0;
+        int i = 0;
+        while (i < numPixels) {
+            const unsigned int numZeros = reader.read();
+            const unsigned int numValues = reader.read();
+            if (!reader.isValid() || static_cast<uint64_t>(numZeros) + numValues > static_cast<uint64_t>(numPixels - i)) {
+                return false;
+            }
+
+            std::fill(pixels + i, pixels + i + numZeros, 0);
+            i += numZeros;
+            for (const int end = i + numValues; i < end; i++) {
+                previous += unzigzag(reader.read());
+                pixels[i] = static_cast<unsigned short>(previous);
+            }
+        }
+        return reader.isValid();
+    }
+
+    /**
+     * @brief Run length coding of the body index, 255 is the background.
+     * @return The offset past the encoded data
+     */
+    static size_t encodeLabels(const unsigned char *labels, int numPixels, std::vector<unsigned char> &buffer, size_t offset)
+    {
+        int i = 0;
+        while (i < numPixels) {
+            const unsigned char label = labels[i];
+            const int begin = i;
+            while (i < numPixels && labels[i] == label) {
+                i++;
+            }
+
+            unsigned char *data = reserve(buffer, offset, 6);
+            data[0] = label;
+            offset += 1 + writeVarint(i - begin - 1, data + 1);
+        }
+        return offset;
+    }
+
+    static bool decodeLabels(const unsigned char *data, size_t size, unsigned char *labels, int numPixels)
+    {
+        const unsigned char *end = data + size;
+        int i = 0;
+        while (i < numPixels) {
+            if (data == end) {
+                return false;
+            }
+            const unsigned char label = *data++;
+            unsigned int length;
+            if (!readVarint(data, end, length) || length >= static_cast<unsigned int>(numPixels - i)) {
+                return false;
+            }
+            std::fill(labels + i, labels + i + length + 1, label);
+            i += length + 1;
+        }
+        return data == end;
+    }
+
+    /**
+     * @brief Codes the bodies against the bodies with the same id in reference, or against 0 when reference is
+     * nullptr (a keyframe).
+     * @return The offset past the encoded data
+     */
+    static size_t encodeBodies(const std::vector<BodyData> &bodies, const std::vector<BodyData> *reference,
+                               std::vector<unsigned char> &buffer, size_t offset)
+    {
+        const int maxBodySize = 8 + 2 + TRACKING_STATE_BYTES + BodyData::NUM_JOINTS * 3 * 5;
+        const int numBodies = std::min<int>(bodies.size(), 255);
+        unsigned char *data = reserve(buffer, offset, 1 + numBodies * maxBodySize);
+        unsigned char *begin = data;
+
+        *data++ = static_cast<unsigned char>(numBodies);
+        for (int b = 0; b < numBodies; b++) {
+            const BodyData &body = bodies[b];
+            const BodyData *previous = reference ? findBody(*reference, body.id) : nullptr;
+
+            memcpy(data, &body.id, 8);
+            data[8] = static_cast<unsigned char>((body.leftHandState & 0xf) | (body.rightHandState << 4));
+            data[9] = previous ? 1 : 0;
+            data += 10;
+
+            std::fill(data, data + TRACKING_STATE_BYTES, 0);
+            for (int j = 0; j < BodyData::NUM_JOINTS; j++) {
+                data[j / 4] |= (body.trackingStates[j] & 0x3) << (j % 4 * 2);
+            }
+            data += TRACKING_STATE_BYTES;
+
+            for (int j = 0; j < BodyData::NUM_JOINTS; j++) {
+                for (int k = 0; k < 3; k++) {
+                    const int value = quantize(body.positions[j][k]);
+                    const int base = previous ? quantize(previous->positions[j][k]) : 0;
+                    data += writeVarint(zigzag(value - base), data);
+                }
+            }
+        }
+        return offset + (data - begin);
+    }
+
+    /**
+     * @brief reference must be the bodies decoded from the previous message unless this one is a keyframe.
+     */
+    static bool decodeBodies(const unsigned char *data, size_t size, const std::vector<BodyData> *reference,
+                             std::vector<BodyData> &bodies)
+    {
+        const unsigned char *end = data + size;
+        if (data == end) {
+            return false;
+        }
+        const int numBodies = *data++;
+
+        bodies.resize(numBodies);
+        for (int b = 0; b < numBodies; b++) {
+            BodyData &body = bodies[b];
+            if (end - data < 10 + TRACKING_STATE_BYTES) {
+                return false;
+            }
+
+            memcpy(&body.id, data, 8);
+            body.leftHandState = data[8] & 0xf;
+            body.rightHandState = data[8] >> 4;
+            const BodyData *previous = nullptr;
+            if (data[9]) {
+                previous = reference ? findBody(*reference, body.id) : nullptr;
+                if (!previous) {
+                    return false;
+                }
+            }
+            data += 10;
+
+            for (int j = 0; j < BodyData::NUM_JOINTS; j++) {
+                body.trackingStates[j] = (data[j / 4] >> (j % 4 * 2)) & 0x3;
+            }
+            data += TRACKING_STATE_BYTES;
+
+            for (int j = 0; j < BodyData::NUM_JOINTS; j++) {
+                for (int k = 0; k < 3; k++) {
+                    unsigned int delta;
+                    if (!readVarint(data, end, delta)) {
+                        return false;
+                    }
+                    const int base = previous ? quantize(previous->positions[j][k]) : 0;
+                    body.positions[j][k] = (base + unzigzag(delta)) * 0.001f;
+                }
+            }
+        }
+        return data == end;
+    }
+
+protected:
+    static const int TRACKING_STATE_BYTES = (BodyData::NUM_JOINTS + 3) / 4;
+
+    /**
+     * @brief Packs 3 bit + continuation nibbles into 32 bit words, the first nibble in the high bits.
+     */
+    class NibbleWriter
+    {
+    public:
+        NibbleWriter(std::vector<unsigned char> &buffer, size_t offset)
+            : m_Buffer(&buffer)
+            , m_Offset(offset)
+            , m_Word(0)
+            , m_NumNibbles(0)
+        {
+
+        }
+
+        void write(unsigned int value)
+        {
+            do {
+                unsigned int nibble = value & 0x7;
+                value >>= 3;
+                if (value) {
+                    nibble |= 0x8;
+                }
+                m_Word = (m_Word << 4) | nibble;
+                if (++m_NumNibbles == 8) {
+                    flushWord();
+                }
+            } while (value);
+        }
+
+        size_t finish()
+        {
+            if (m_NumNibbles > 0) {
+                m_Word <<= (8 - m_NumNibbles) * 4;
+                flushWord();
+            }
+            return m_Offset;
+        }
+
+    protected:
+        std::vector<unsigned char> *m_Buffer;
+        size_t m_Offset;
+        unsigned int m_Word;
+        int m_NumNibbles;
+
+    protected:
+        void flushWord()
+        {
+            memcpy(reserve(*m_Buffer, m_Offset, 4), &m_Word, 4);
+            m_Offset += 4;
+            m_Word = 0;
+            m_NumNibbles = 0;
+        }
+    };
+
+    /**
+     * @brief Reads past the end as zeros and remembers it, check isValid() once done.
+     */
+    class NibbleReader
+    {
+    public:
+        NibbleReader(const unsigned char *data, size_t size)
+            : m_Data(data)
+            , m_End(data + size / 4 * 4)
+            , m_Word(0)
+            , m_NumNibbles(0)
+            , m_IsValid(size % 4 == 0)
+        {
+
+        }
+
+        unsigned int read()
+        {
+            unsigned int value = 0;
+            unsigned int nibble;
+            int shift = 0;
+            do {
+                if (shift > 30) {
+                    m_IsValid = false;
+                    return 0;
+                }
+                if (m_NumNibbles == 0) {
+                    if (m_Data == m_End) {
+                        m_IsValid = false;
+                        return 0;
+                    }
+                    memcpy(&m_Word, m_Data, 4);
+                    m_Data += 4;
+                    m_NumNibbles = 8;
+                }
+                nibble = m_Word >> 28;
+                m_Word <<= 4;
+                m_NumNibbles--;
+                value |= (nibble & 0x7) << shift;
+                shift += 3;
+            } while (nibble & 0x8);
+            return value;
+        }
+
+        bool isValid() const
+        {
+            return m_IsValid;
+        }
+
+    protected:
+        const unsigned char *m_Data;
+        const unsigned char *m_End;
+        unsigned int m_Word;
+        int m_NumNibbles;
+        bool m_IsValid;
+    };
+
+protected:
+    static unsigned char *reserve(std::vector<unsigned char> &buffer, size_t offset, size_t numBytes)
+    {
+        if (offset + numBytes > buffer.size()) {
+            buffer.resize(std::max(buffer.size() * 2, offset + numBytes + 4096));
+        }
+        return &buffer[offset];
+    }
+
+    static unsigned int zigzag(int value)
+    {
+        return (static_cast<unsigned int>(value) << 1) ^ static_cast<unsigned int>(value >> 31);
+    }
+
+    static int unzigzag(unsigned int value)
+    {
+        return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+    }
+
+    static int writeVarint(unsigned int value, unsigned char *data)
+    {
+        int size = 0;
+        while (value >= 0x80) {
+            data[size++] = static_cast<unsigned char>(value | 0x80);
+            value >>= 7;
+        }
+        data[size++] = static_cast<unsigned char>(value);
+        return size;
+    }
+
+    static bool readVarint(const unsigned char *&data, const unsigned char *end, unsigned int &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (data == end) {
+                return false;
+            }
+            const unsigned char byte = *data++;
+            value |= static_cast<unsigned int>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Meters to millimeters, non finite values to 0 and the rest clamped to a kilometer.
+     */
+    static int quantize(float meters)
+    {
+        if (!(meters > -1000.f && meters < 1000.f)) {
+            return meters >= 1000.f ? 1000000 : meters <= -1000.f ? -1000000 : 0;
+        }
+        return static_cast<int>(floorf(meters * 1000.f + 0.5f));
+    }
+
+    static const BodyData *findBody(const std::vector<BodyData> &bodies, uint64_t id)
+    {
+        for (size_t i = 0; i < bodies.size(); i++) {
+            if (bodies[i].id == id) {
+                return &bodies[i];
+            }
+        }
+        return nullptr;
+    }
+};
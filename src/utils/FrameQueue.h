@@ -0,0 +1,314 @@
+#pragma once
+#include "ofMain.h"
+#include "ofxKinect2Enums.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace ofxKinect2
+{
+class FrameQueueBase;
+template <typename PixelType>
+class FrameQueue;
+} // namespace ofxKinect2
+
+/**
+ * @brief The bookkeeping of FrameQueue that doesn't depend on the pixel type: a ring of slot indices, the drop
+ * policy and the counters. One thread pushes and one pops.
+ */
+class ofxKinect2::FrameQueueBase
+{
+public:
+    static const int DEFAULT_CAPACITY = 8;
+
+    struct Info {
+        /** @brief Capture time of the frame in the stream's 100 ns ticks. */
+        uint64_t timestamp;
+        /** @brief Counts every pushed frame, dropped or not, so a gap shows what was lost. */
+        uint64_t sequence;
+    };
+
+    FrameQueueBase()
+        : m_Capacity(DEFAULT_CAPACITY)
+        , m_DropPolicy(DROP_POLICY_OLDEST)
+        , m_BlockTimeout(100)
+        , m_Head(0)
+        , m_Size(0)
+        , m_Generation(0)
+        , m_NumPushed(0)
+        , m_NumDropped(0)
+        , m_MaxSize(0)
+        , m_NumSlots(0)
+    {
+
+    }
+
+    virtual ~FrameQueueBase()
+    {
+
+    }
+
+    /**
+     * @brief Empties the queue and resets the counters. The pooled frames are kept.
+     */
+    void setup(int capacity, DropPolicy policy)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Capacity = std::max(capacity, 1);
+        m_DropPolicy = policy;
+        m_Head = 0;
+        m_Size = 0;
+        m_Generation++;
+        m_NumPushed = 0;
+        m_NumDropped = 0;
+        m_MaxSize = 0;
+        m_Condition.notify_all();
+    }
+
+    int getCapacity() const
+    {
+        return m_Capacity;
+    }
+
+    /**
+     * @brief When the queue is full:
+     * - DROP_POLICY_OLDEST (default) drops the oldest queued frame, the queue keeps the latest ones.
+     * - DROP_POLICY_NEWEST drops the pushed frame, the queue keeps the first ones.
+     * - DROP_POLICY_BLOCK holds the pushing thread until a frame is popped or the block timeout passes, then
+     *   drops the pushed frame. Nothing is lost as long as the consumer keeps up on average.
+     */
+    DropPolicy getDropPolicy() const
+    {
+        return m_DropPolicy;
+    }
+
+    /**
+     * @brief How long DROP_POLICY_BLOCK holds the pushing thread, in milliseconds.
+     */
+    void setBlockTimeout(int millis)
+    {
+        m_BlockTimeout = std::max(millis, 0);
+    }
+
+    int getBlockTimeout() const
+    {
+        return m_BlockTimeout;
+    }
+
+    /**
+     * @brief Consumer side, drops every queued frame without counting them.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Head = 0;
+        m_Size = 0;
+        m_Generation++;
+        m_Condition.notify_all();
+    }
+
+    /**
+     * @brief True while a DROP_POLICY_BLOCK push() would wait.
+     */
+    bool isFull()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Size >= m_Capacity;
+    }
+
+    int getSize()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Size;
+    }
+
+    /**
+     * @brief The most frames that were queued at once, close to the capacity means the consumer falls behind.
+     */
+    int getMaxSize()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_MaxSize;
+    }
+
+    uint64_t getNumPushed()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_NumPushed;
+    }
+
+    uint64_t getNumDropped()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_NumDropped;
+    }
+
+protected:
+    int m_Capacity;
+    DropPolicy m_DropPolicy;
+    int m_BlockTimeout;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    int m_Head, m_Size;
+    /** @brief Changes with every setup() and clear(), a slot reserved before is then given up. */
+    uint64_t m_Generation;
+    uint64_t m_NumPushed, m_NumDropped;
+    int m_MaxSize;
+    int m_NumSlots;
+
+protected:
+    /**
+     * @brief Grows or shrinks the pool, called with the lock held by the producer.
+     */
+    virtual void resizeSlots(int numSlots) = 0;
+
+    /**
+     * @brief Producer side, the slot to write the next frame into or -1 if it's dropped. The slot is only queued
+     * by commitSlot(), so the frame is copied without holding the lock. A full DROP_POLICY_BLOCK queue only waits
+     * for room when canWait.
+     */
+    int reserveSlot(Info &info, uint64_t &generation, bool canWait)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        info.sequence = m_NumPushed++;
+        if (m_Size >= m_Capacity && m_DropPolicy == DROP_POLICY_BLOCK && canWait) {
+            m_Condition.wait_for(lock, std::chrono::milliseconds(m_BlockTimeout), [this]() {
+                return m_Size < m_Capacity;
+            });
+        }
+        if (m_Size >= m_Capacity) {
+            m_NumDropped++;
+            if (m_DropPolicy != DROP_POLICY_OLDEST) {
+                return -1;
+            }
+            m_Head = (m_Head + 1) % m_Capacity;
+            m_Size--;
+        }
+        if (m_NumSlots != m_Capacity) {
+            // The consumer only touches a slot with the lock held, it can't be holding one.
+            resizeSlots(m_Capacity);
+            m_NumSlots = m_Capacity;
+        }
+        generation = m_Generation;
+        return (m_Head + m_Size) % m_Capacity;
+    }
+
+    void commitSlot(uint64_t generation)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (generation != m_Generation) {
+            return;
+        }
+        m_Size++;
+        m_MaxSize = std::max(m_MaxSize, m_Size);
+        m_Condition.notify_all();
+    }
+
+    /**
+     * @brief Consumer side, waits up to timeoutMillis for a frame and calls take(slot) on the oldest one before it
+     * leaves the queue.
+     */
+    template <typename Function>
+    bool popSlot(int timeoutMillis, Function take)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (m_Size == 0 && timeoutMillis > 0) {
+            m_Condition.wait_for(lock, std::chrono::milliseconds(timeoutMillis), [this]() {
+                return m_Size > 0;
+            });
+        }
+        if (m_Size == 0) {
+            return false;
+        }
+
+        take(m_Head);
+        m_Head = (m_Head + 1) % m_Capacity;
+        m_Size--;
+        m_Condition.notify_all();
+        return true;
+    }
+};
+
+/**
+ * @brief Bounded FIFO of pooled frames between the acquisition thread and one consumer thread, for the frames
+ * the double buffer of a stream would overwrite. push() copies into a pooled frame, pop() swaps the oldest
+ * frame with the caller's, which goes back to the pool, so nothing is allocated once every slot has been used
+ * with frames of the same size.
+ */
+template <typename PixelType>
+class ofxKinect2::FrameQueue : public ofxKinect2::FrameQueueBase
+{
+public:
+    /**
+     * @brief Producer side, false when the frame is dropped.
+     */
+    bool push(const PixelType &pixels, uint64_t timestamp)
+    {
+        Info info;
+        info.timestamp = timestamp;
+        uint64_t generation = 0;
+        const int slot = reserveSlot(info, generation, true);
+        if (slot < 0) {
+            return false;
+        }
+
+        Slot &dst = m_Slots[slot];
+        dst.info = info;
+        if (!dst.pixels.isAllocated() || dst.pixels.getWidth() != pixels.getWidth() || dst.pixels.getHeight() != pixels.getHeight()
+                || dst.pixels.getNumChannels() != pixels.getNumChannels()) {
+            dst.pixels.allocate(pixels.getWidth(), pixels.getHeight(), pixels.getNumChannels());
+        }
+        memcpy(dst.pixels.getPixels(), pixels.getPixels(), pixels.getWidth() * pixels.getHeight() * pixels.getNumChannels() * sizeof(pixels.getPixels()[0]));
+        commitSlot(generation);
+        return true;
+    }
+
+    /**
+     * @brief Producer side, like push() but swaps pixels with a pooled frame instead of copying them, pixels gets
+     * the pooled buffer back for the next frame. It never waits: a full DROP_POLICY_BLOCK queue drops the frame,
+     * check isFull() first to hold on to it.
+     */
+    bool pushSwap(PixelType &pixels, uint64_t timestamp)
+    {
+        Info info;
+        info.timestamp = timestamp;
+        uint64_t generation = 0;
+        const int slot = reserveSlot(info, generation, false);
+        if (slot < 0) {
+            return false;
+        }
+
+        m_Slots[slot].info = info;
+        m_Slots[slot].pixels.swap(pixels);
+        commitSlot(generation);
+        return true;
+    }
+
+    /**
+     * @brief Consumer side, swaps the oldest frame into pixels, waiting up to timeoutMillis for one. Reuse the same
+     * pixels from call to call, their buffer goes back to the pool.
+     */
+    bool pop(PixelType &pixels, int timeoutMillis = 0, Info *info = nullptr)
+    {
+        return popSlot(timeoutMillis, [&](int slot) {
+            pixels.swap(m_Slots[slot].pixels);
+            if (info) {
+                *info = m_Slots[slot].info;
+            }
+        });
+    }
+
+protected:
+    struct Slot {
+        PixelType pixels;
+        Info info;
+    };
+    std::vector<Slot> m_Slots;
+
+protected:
+    void resizeSlots(int numSlots)
+    {
+        m_Slots.resize(numSlots);
+    }
+};
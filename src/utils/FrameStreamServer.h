@@ -0,0 +1,1121 @@
+#pragma once
+#include "ofMain.h"
+#include "ofxKinect2Enums.h"
+#include "DoubleBuffer.h"
+#include "FrameCodec.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(TARGET_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace ofxKinect2
+{
+class TcpSocket;
+class FrameStreamServer;
+class FrameStreamClient;
+} // namespace ofxKinect2
+
+/**
+ * @brief Blocking TCP socket over Winsock or BSD sockets, just what the frame streaming needs.
+ */
+class ofxKinect2::TcpSocket
+{
+public:
+#if defined(TARGET_WIN32)
+    typedef SOCKET Handle;
+#else
+    typedef int Handle;
+#endif
+
+    TcpSocket()
+        : m_Handle(getInvalidHandle())
+    {
+
+    }
+
+    ~TcpSocket()
+    {
+        close();
+    }
+
+    /**
+     * @brief Winsock needs to be started once per user, calls must be paired with cleanup().
+     */
+    static bool startup()
+    {
+#if defined(TARGET_WIN32)
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+        return true;
+#endif
+    }
+
+    static void cleanup()
+    {
+#if defined(TARGET_WIN32)
+        WSACleanup();
+#endif
+    }
+
+    bool listen(int port, int backlog = 8)
+    {
+        close();
+        m_Handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (!isOpen()) {
+            return false;
+        }
+
+        const int reuse = 1;
+        setsockopt(m_Handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(static_cast<unsigned short>(port));
+        if (bind(m_Handle, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(m_Handle, backlog) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Takes the next pending connection, call when waitReadable() says there is one.
+     */
+    bool accept(TcpSocket &client, string &clientAddress)
+    {
+        sockaddr_in address;
+        socklen_t addressSize = sizeof(address);
+        const Handle handle = ::accept(m_Handle, reinterpret_cast<sockaddr *>(&address), &addressSize);
+        if (handle == getInvalidHandle()) {
+            return false;
+        }
+
+        client.close();
+        client.m_Handle = handle;
+        // inet_ntoa is deprecated by Winsock and returns a shared static buffer.
+        char host[INET_ADDRSTRLEN] = "";
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        clientAddress = string(host) + ":" + ofToString(ntohs(address.sin_port));
+        return true;
+    }
+
+    bool connect(const string &host, int port)
+    {
+        close();
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        addrinfo *addresses = nullptr;
+        if (getaddrinfo(host.c_str(), ofToString(port).c_str(), &hints, &addresses) != 0) {
+            return false;
+        }
+
+        for (addrinfo *address = addresses; address && !isOpen(); address = address->ai_next) {
+            m_Handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (isOpen() && ::connect(m_Handle, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0) {
+                close();
+            }
+        }
+        freeaddrinfo(addresses);
+        return isOpen();
+    }
+
+    bool waitReadable(int timeoutMillis)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(m_Handle, &readable);
+        timeval timeout;
+        timeout.tv_sec = timeoutMillis / 1000;
+        timeout.tv_usec = timeoutMillis % 1000 * 1000;
+        return select(static_cast<int>(m_Handle) + 1, &readable, nullptr, nullptr, &timeout) > 0;
+    }
+
+    bool sendAll(const unsigned char *data, size_t size)
+    {
+        while (size > 0) {
+            const int sent = send(m_Handle, reinterpret_cast<const char *>(data), static_cast<int>(std::min<size_t>(size, 1 << 20)), SEND_FLAGS);
+            if (sent <= 0) {
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool receiveAll(unsigned char *data, size_t size)
+    {
+        while (size > 0) {
+            const int received = recv(m_Handle, reinterpret_cast<char *>(data), static_cast<int>(std::min<size_t>(size, 1 << 20)), 0);
+            if (received <= 0) {
+                return false;
+            }
+            data += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Small messages (bodies) leave right away instead of waiting to be merged with the next ones.
+     */
+    void setNoDelay(bool noDelay = true)
+    {
+        const int value = noDelay ? 1 : 0;
+        setsockopt(m_Handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void setSendBufferSize(int size)
+    {
+        setsockopt(m_Handle, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char *>(&size), sizeof(size));
+    }
+
+    /**
+     * @brief Wakes up the threads blocked in send or receive, close once they are done.
+     */
+    void shutdown()
+    {
+        if (isOpen()) {
+#if defined(TARGET_WIN32)
+            ::shutdown(m_Handle, SD_BOTH);
+#else
+            ::shutdown(m_Handle, SHUT_RDWR);
+#endif
+        }
+    }
+
+    void close()
+    {
+        if (isOpen()) {
+#if defined(TARGET_WIN32)
+            closesocket(m_Handle);
+#else
+            ::close(m_Handle);
+#endif
+            m_Handle = getInvalidHandle();
+        }
+    }
+
+    bool isOpen() const
+    {
+        return m_Handle != getInvalidHandle();
+    }
+
+protected:
+#if defined(TARGET_WIN32)
+    typedef int socklen_t;
+    static const int SEND_FLAGS = 0;
+#else
+    static const int SEND_FLAGS = MSG_NOSIGNAL;
+#endif
+
+    Handle m_Handle;
+
+protected:
+    static Handle getInvalidHandle()
+    {
+#if defined(TARGET_WIN32)
+        return INVALID_SOCKET;
+#else
+        return -1;
+#endif
+    }
+
+private:
+    TcpSocket(const TcpSocket &);
+    TcpSocket &operator=(const TcpSocket &);
+};
+
+/**
+ * @brief Publishes depth, IR, body index and body frames to the subscribers connected over TCP. Every frame is
+ * encoded once with FrameCodec, only for the types someone subscribed to, and shared by all the queues.
+ *
+ * Each subscriber has its own sender thread and a bounded queue per frame type, so a backlog of depth doesn't
+ * push the bodies out, and the queues are sent in publishing order. When a queue is full the subscriber's drop
+ * policy applies:
+ * - DROP_POLICY_OLDEST drops the queued frame, for the lowest latency.
+ * - DROP_POLICY_NEWEST drops the published frame, the queued ones go out in order.
+ * - DROP_POLICY_BLOCK makes the publisher wait up to the block timeout, holding back the acquisition thread,
+ *   then drops the published frame. The streams publish once their lock is released, so update() and draw()
+ *   don't wait.
+ * A subscriber that missed a body message gets the next one as a keyframe, the others keep the deltas.
+ *
+ * Protocol: the subscriber sends a 12 byte hello (FrameStreamServer::HELLO_MAGIC, the SensorType mask it wants,
+ * a DropPolicy byte and a queue size byte, 0 for the server's default, then 2 reserved bytes), then reads
+ * FrameCodec messages until it closes the connection, which the server notices on the next send. See
+ * FrameStreamClient.
+ */
+class ofxKinect2::FrameStreamServer
+{
+    friend class ofxKinect2::FrameStreamClient;
+
+public:
+    static const int DEFAULT_PORT = 7100;
+    static const unsigned int HELLO_MAGIC = 0x4346324b; // "K2FC"
+    static const int HELLO_SIZE = 12;
+    static const unsigned int STREAMABLE_SENSORS = SENSOR_IR | SENSOR_DEPTH | SENSOR_BODY_INDEX | SENSOR_BODY;
+
+    struct SubscriberInfo
+    {
+        string address;
+        unsigned int sensorMask;
+        DropPolicy dropPolicy;
+        int queueSize;
+        int numQueued;
+        uint64_t numSent;
+        uint64_t numDropped;
+        uint64_t numBytesSent;
+    };
+
+    FrameStreamServer()
+        : m_IsRunning(false)
+        , m_Port(0)
+        , m_DropPolicy(DROP_POLICY_OLDEST)
+        , m_QueueSize(2)
+        , m_BlockTimeout(100)
+        , m_KeyframeInterval(30)
+        , m_SubscribedMask(0)
+        , m_NextOrder(0)
+        , m_HasPreviousBodies(false)
+    {
+        for (int i = 0; i < NUM_SLOTS; i++) {
+            m_Sequences[i] = 0;
+            m_NumRawBytes[i] = 0;
+            m_NumEncodedBytes[i] = 0;
+        }
+    }
+
+    ~FrameStreamServer()
+    {
+        exit();
+    }
+
+    /**
+     * @brief Listens on all the interfaces and accepts subscribers on a thread of its own.
+     */
+    bool setup(int port = DEFAULT_PORT)
+    {
+        exit();
+        if (!TcpSocket::startup()) {
+            ofLogError("ofxKinect2::FrameStreamServer") << "Can't start the sockets.";
+            return false;
+        }
+        if (!m_ListenSocket.listen(port)) {
+            ofLogError("ofxKinect2::FrameStreamServer") << "Can't listen on port " << port << ".";
+            TcpSocket::cleanup();
+            return false;
+        }
+
+        m_Port = port;
+        m_IsRunning = true;
+        m_AcceptThread = std::thread(&FrameStreamServer::acceptFunction, this);
+        return true;
+    }
+
+    void exit()
+    {
+        if (!m_IsRunning) {
+            return;
+        }
+
+        m_IsRunning = false;
+        m_AcceptThread.join();
+        m_ListenSocket.close();
+
+        std::vector<SubscriberRef> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(m_SubscribersMutex);
+            subscribers.swap(m_Subscribers);
+            m_SubscribedMask = 0;
+        }
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            stopSubscriber(*subscribers[i]);
+        }
+
+        std::lock_guard<std::mutex> lock(m_BodiesMutex);
+        m_HasPreviousBodies = false;
+        TcpSocket::cleanup();
+    }
+
+    bool isRunning() const
+    {
+        return m_IsRunning;
+    }
+
+    int getPort() const
+    {
+        return m_Port;
+    }
+
+    /**
+     * @brief The policy of the subscribers that don't ask for one.
+     */
+    void setDropPolicy(DropPolicy policy)
+    {
+        m_DropPolicy = policy;
+    }
+
+    DropPolicy getDropPolicy() const
+    {
+        return m_DropPolicy;
+    }
+
+    /**
+     * @brief Frames queued per type and subscriber when the subscriber doesn't ask for a size, at least 1.
+     */
+    void setQueueSize(int size)
+    {
+        m_QueueSize = ofClamp(size, 1, MAX_QUEUE_SIZE);
+    }
+
+    int getQueueSize() const
+    {
+        return m_QueueSize;
+    }
+
+    /**
+     * @brief How long DROP_POLICY_BLOCK holds the publisher before it drops, in milliseconds.
+     */
+    void setBlockTimeout(int millis)
+    {
+        m_BlockTimeout = std::max(millis, 0);
+    }
+
+    int getBlockTimeout() const
+    {
+        return m_BlockTimeout;
+    }
+
+    /**
+     * @brief Every nth body message is a keyframe so a client that lost one recovers, 0 disables.
+     */
+    void setKeyframeInterval(int interval)
+    {
+        m_KeyframeInterval = std::max(interval, 0);
+    }
+
+    int getKeyframeInterval() const
+    {
+        return m_KeyframeInterval;
+    }
+
+    bool hasSubscribers(SensorType type) const
+    {
+        return (m_SubscribedMask & type) != 0;
+    }
+
+    int getNumSubscribers()
+    {
+        std::lock_guard<std::mutex> lock(m_SubscribersMutex);
+        removeStoppedSubscribers();
+        return static_cast<int>(m_Subscribers.size());
+    }
+
+    std::vector<SubscriberInfo> getSubscriberInfos()
+    {
+        std::lock_guard<std::mutex> lock(m_SubscribersMutex);
+        removeStoppedSubscribers();
+
+        std::vector<SubscriberInfo> infos(m_Subscribers.size());
+        for (size_t i = 0; i < m_Subscribers.size(); i++) {
+            Subscriber &subscriber = *m_Subscribers[i];
+            std::lock_guard<std::mutex> subscriberLock(subscriber.mutex);
+            SubscriberInfo &info = infos[i];
+            info.address = subscriber.address;
+            info.sensorMask = subscriber.sensorMask;
+            info.dropPolicy = subscriber.dropPolicy;
+            info.queueSize = subscriber.queueSize;
+            info.numQueued = 0;
+            for (int s = 0; s < NUM_SLOTS; s++) {
+                info.numQueued += static_cast<int>(subscriber.queues[s].size());
+            }
+            info.numSent = subscriber.numSent;
+            info.numDropped = subscriber.numDropped;
+            info.numBytesSent = subscriber.numBytesSent;
+        }
+        return infos;
+    }
+
+    /**
+     * @brief Raw size over encoded size of everything published for the type so far.
+     */
+    float getCompressionRatio(SensorType type) const
+    {
+        const int slot = getSlot(type);
+        return slot >= 0 && m_NumEncodedBytes[slot] > 0 ? static_cast<float>(m_NumRawBytes[slot]) / m_NumEncodedBytes[slot] : 0.f;
+    }
+
+    /**
+     * @brief Depth (SENSOR_DEPTH) or IR (SENSOR_IR) in the sensor's 16 bit units, lossless.
+     */
+    void publishPixels(SensorType type, const unsigned short *pixels, int width, int height, uint64_t timestamp)
+    {
+        if (!hasSubscribers(type) || (type != SENSOR_DEPTH && type != SENSOR_IR)) {
+            return;
+        }
+
+        PacketRef packet = acquirePacket();
+        const size_t end = FrameCodec::encodePixels(pixels, width * height, packet->data, FrameCodec::HEADER_SIZE);
+        finishPacket(*packet, type, m_Sequences[getSlot(type)]++, 0, width, height, timestamp, end);
+        publish(getSlot(type), packet, width * height * 2);
+    }
+
+    /**
+     * @brief The body index of every pixel, 255 where there is no body.
+     */
+    void publishBodyIndex(const unsigned char *labels, int width, int height, uint64_t timestamp)
+    {
+        if (!hasSubscribers(SENSOR_BODY_INDEX)) {
+            return;
+        }
+
+        PacketRef packet = acquirePacket();
+        const size_t end = FrameCodec::encodeLabels(labels, width * height, packet->data, FrameCodec::HEADER_SIZE);
+        finishPacket(*packet, SENSOR_BODY_INDEX, m_Sequences[getSlot(SENSOR_BODY_INDEX)]++, 0, width, height, timestamp, end);
+        publish(getSlot(SENSOR_BODY_INDEX), packet, width * height);
+    }
+
+    void publishBodies(const std::vector<BodyData> &bodies, uint64_t timestamp)
+    {
+        if (!hasSubscribers(SENSOR_BODY)) {
+            std::lock_guard<std::mutex> lock(m_BodiesMutex);
+            m_HasPreviousBodies = false;
+            return;
+        }
+
+        const int slot = getSlot(SENSOR_BODY);
+        PacketRef keyframe = acquirePacket();
+        PacketRef packet;
+        {
+            // The bodies stream publishes from one thread at a time, the lock only guards against exit().
+            std::lock_guard<std::mutex> lock(m_BodiesMutex);
+            const unsigned int sequence = m_Sequences[slot]++;
+            const bool isKeyframe = !m_HasPreviousBodies || (m_KeyframeInterval > 0 && sequence % m_KeyframeInterval == 0);
+            size_t end = FrameCodec::encodeBodies(bodies, nullptr, keyframe->data, FrameCodec::HEADER_SIZE);
+            finishPacket(*keyframe, SENSOR_BODY, sequence, FrameCodec::FLAG_KEYFRAME, 0, 0, timestamp, end);
+            if (isKeyframe) {
+                packet = keyframe;
+            }
+            else {
+                packet = acquirePacket();
+                end = FrameCodec::encodeBodies(bodies, &m_PreviousBodies, packet->data, FrameCodec::HEADER_SIZE);
+                finishPacket(*packet, SENSOR_BODY, sequence, 0, 0, 0, timestamp, end);
+                packet->keyframe = keyframe;
+            }
+            m_PreviousBodies = bodies;
+            m_HasPreviousBodies = true;
+        }
+        publish(slot, packet, bodies.size() * sizeof(BodyData));
+    }
+
+protected:
+    static const int NUM_SLOTS = 4;
+    static const int MAX_QUEUE_SIZE = 64;
+    static const int MAX_POOLED_PACKETS = 32;
+    static const int HELLO_TIMEOUT = 2000;
+
+    struct Packet
+    {
+        std::vector<unsigned char> data;
+        size_t size;
+        SensorType type;
+        int slot;
+        unsigned int sequence;
+        uint64_t order;
+        // The same bodies coded as a keyframe, sent instead when the subscriber missed the previous message.
+        std::shared_ptr<Packet> keyframe;
+    };
+    typedef std::shared_ptr<Packet> PacketRef;
+
+    struct Subscriber
+    {
+        TcpSocket socket;
+        string address;
+        unsigned int sensorMask;
+        DropPolicy dropPolicy;
+        int queueSize;
+        std::deque<PacketRef> queues[NUM_SLOTS];
+        bool isBodyChainBroken;
+        uint64_t numSent;
+        uint64_t numDropped;
+        uint64_t numBytesSent;
+
+        std::atomic<bool> isRunning;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::thread thread;
+    };
+    typedef std::shared_ptr<Subscriber> SubscriberRef;
+
+    std::atomic<bool> m_IsRunning;
+    int m_Port;
+    TcpSocket m_ListenSocket;
+    std::thread m_AcceptThread;
+
+    DropPolicy m_DropPolicy;
+    int m_QueueSize;
+    int m_BlockTimeout;
+    int m_KeyframeInterval;
+
+    std::mutex m_SubscribersMutex;
+    std::vector<SubscriberRef> m_Subscribers;
+    std::atomic<unsigned int> m_SubscribedMask;
+
+    std::mutex m_PoolMutex;
+    std::vector<PacketRef> m_PacketPool;
+    std::atomic<uint64_t> m_NextOrder;
+    unsigned int m_Sequences[NUM_SLOTS];
+    uint64_t m_NumRawBytes[NUM_SLOTS];
+    uint64_t m_NumEncodedBytes[NUM_SLOTS];
+
+    std::mutex m_BodiesMutex;
+    std::vector<BodyData> m_PreviousBodies;
+    bool m_HasPreviousBodies;
+
+protected:
+    static int getSlot(SensorType type)
+    {
+        switch (type) {
+        case SENSOR_IR:
+            return 0;
+        case SENSOR_DEPTH:
+            return 1;
+        case SENSOR_BODY_INDEX:
+            return 2;
+        case SENSOR_BODY:
+            return 3;
+        default:
+            return -1;
+        }
+    }
+
+    /**
+     * @brief A pooled packet nobody holds anymore, so its buffer is already grown to the frame size.
+     */
+    PacketRef acquirePacket()
+    {
+        std::lock_guard<std::mutex> lock(m_PoolMutex);
+        for (size_t i = 0; i < m_PacketPool.size(); i++) {
+            if (m_PacketPool[i].use_count() == 1) {
+                m_PacketPool[i]->keyframe.reset();
+                return m_PacketPool[i];
+            }
+        }
+
+        PacketRef packet(new Packet());
+        if (m_PacketPool.size() < MAX_POOLED_PACKETS) {
+            m_PacketPool.push_back(packet);
+        }
+        return packet;
+    }
+
+    void finishPacket(Packet &packet, SensorType type, unsigned int sequence, unsigned char flags, int width, int height,
+                      uint64_t timestamp, size_t end)
+    {
+        FrameCodec::Header header;
+        header.sensorType = static_cast<unsigned char>(type);
+        header.flags = flags;
+        header.width = static_cast<unsigned short>(width);
+        header.height = static_cast<unsigned short>(height);
+        header.sequence = sequence;
+        header.timestamp = timestamp;
+        header.payloadSize = static_cast<unsigned int>(end - FrameCodec::HEADER_SIZE);
+        FrameCodec::writeHeader(header, &packet.data[0]);
+
+        packet.size = end;
+        packet.type = type;
+        packet.slot = getSlot(type);
+        packet.sequence = header.sequence;
+        packet.order = m_NextOrder++;
+    }
+
+    void publish(int slot, PacketRef packet, size_t numRawBytes)
+    {
+        m_NumRawBytes[slot] += numRawBytes;
+        m_NumEncodedBytes[slot] += packet->size;
+
+        std::vector<SubscriberRef> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(m_SubscribersMutex);
+            removeStoppedSubscribers();
+            subscribers = m_Subscribers;
+        }
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            push(*subscribers[i], packet);
+        }
+    }
+
+    void push(Subscriber &subscriber, PacketRef packet)
+    {
+        const bool isBody = packet->type == SENSOR_BODY;
+        std::unique_lock<std::mutex> lock(subscriber.mutex);
+        if (!(subscriber.sensorMask & packet->type)) {
+            return;
+        }
+
+        std::deque<PacketRef> &queue = subscriber.queues[packet->slot];
+        const size_t queueSize = subscriber.queueSize;
+        if (queue.size() >= queueSize && subscriber.dropPolicy == DROP_POLICY_BLOCK) {
+            subscriber.condition.wait_for(lock, std::chrono::milliseconds(m_BlockTimeout), [&]() {
+                return queue.size() < queueSize || !subscriber.isRunning;
+            });
+        }
+        if (!subscriber.isRunning) {
+            return;
+        }
+
+        if (queue.size() >= queueSize) {
+            subscriber.numDropped++;
+            if (subscriber.dropPolicy != DROP_POLICY_OLDEST) {
+                if (isBody) {
+                    subscriber.isBodyChainBroken = true;
+                }
+                return;
+            }
+
+            queue.pop_front();
+            if (isBody) {
+                // The message after the dropped one now has nothing to refer to.
+                if (queue.empty()) {
+                    subscriber.isBodyChainBroken = true;
+                }
+                else if (queue.front()->keyframe) {
+                    queue.front() = queue.front()->keyframe;
+                }
+            }
+        }
+
+        if (isBody && subscriber.isBodyChainBroken) {
+            if (packet->keyframe) {
+                packet = packet->keyframe;
+            }
+            subscriber.isBodyChainBroken = false;
+        }
+        queue.push_back(packet);
+        subscriber.condition.notify_all();
+    }
+
+    /**
+     * @brief The slot whose first packet was published first, -1 when all the queues are empty.
+     */
+    static int getOldestSlot(const Subscriber &subscriber)
+    {
+        int oldest = -1;
+        for (int s = 0; s < NUM_SLOTS; s++) {
+            if (!subscriber.queues[s].empty() && (oldest < 0 || subscriber.queues[s].front()->order < subscriber.queues[oldest].front()->order)) {
+                oldest = s;
+            }
+        }
+        return oldest;
+    }
+
+    void stopSubscriber(Subscriber &subscriber)
+    {
+        subscriber.isRunning = false;
+        subscriber.socket.shutdown();
+        subscriber.condition.notify_all();
+        if (subscriber.thread.joinable()) {
+            subscriber.thread.join();
+        }
+        subscriber.socket.close();
+    }
+
+    /**
+     * @brief Call with m_SubscribersMutex held. The threads of the stopped subscribers are done, joining is
+     * immediate.
+     */
+    void removeStoppedSubscribers()
+    {
+        unsigned int mask = 0;
+        for (size_t i = 0; i < m_Subscribers.size();) {
+            if (!m_Subscribers[i]->isRunning) {
+                stopSubscriber(*m_Subscribers[i]);
+                m_Subscribers.erase(m_Subscribers.begin() + i);
+            }
+            else {
+                std::lock_guard<std::mutex> lock(m_Subscribers[i]->mutex);
+                mask |= m_Subscribers[i]->sensorMask;
+                i++;
+            }
+        }
+        m_SubscribedMask = mask;
+    }
+
+    void acceptFunction()
+    {
+        while (m_IsRunning) {
+            if (!m_ListenSocket.waitReadable(100)) {
+                continue;
+            }
+
+            SubscriberRef subscriber(new Subscriber());
+            if (!m_ListenSocket.accept(subscriber->socket, subscriber->address)) {
+                continue;
+            }
+            subscriber->socket.setNoDelay();
+            subscriber->sensorMask = 0;
+            subscriber->dropPolicy = m_DropPolicy;
+            subscriber->queueSize = m_QueueSize;
+            subscriber->isBodyChainBroken = true;
+            subscriber->numSent = 0;
+            subscriber->numDropped = 0;
+            subscriber->numBytesSent = 0;
+            subscriber->isRunning = true;
+
+            std::lock_guard<std::mutex> lock(m_SubscribersMutex);
+            removeStoppedSubscribers();
+            m_Subscribers.push_back(subscriber);
+            subscriber->thread = std::thread(&FrameStreamServer::subscriberFunction, this, subscriber.get());
+        }
+    }
+
+    bool receiveHello(Subscriber &subscriber)
+    {
+        unsigned char hello[HELLO_SIZE];
+        if (!subscriber.socket.waitReadable(HELLO_TIMEOUT) || !subscriber.socket.receiveAll(hello, HELLO_SIZE)) {
+            return false;
+        }
+
+        unsigned int magic, sensorMask;
+        memcpy(&magic, hello, 4);
+        memcpy(&sensorMask, hello + 4, 4);
+        if (magic != HELLO_MAGIC) {
+            ofLogWarning("ofxKinect2::FrameStreamServer") << "Unknown hello from " << subscriber.address << ".";
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(subscriber.mutex);
+        subscriber.sensorMask = sensorMask & STREAMABLE_SENSORS;
+        if (hello[8] <= DROP_POLICY_BLOCK) {
+            subscriber.dropPolicy = static_cast<DropPolicy>(hello[8]);
+        }
+        if (hello[9] > 0) {
+            subscriber.queueSize = ofClamp(hello[9], 1, MAX_QUEUE_SIZE);
+        }
+        return true;
+    }
+
+    void subscriberFunction(Subscriber *subscriber)
+    {
+        if (receiveHello(*subscriber)) {
+            ofLogNotice("ofxKinect2::FrameStreamServer") << "Subscriber " << subscriber->address << " connected.";
+            {
+                std::lock_guard<std::mutex> lock(m_SubscribersMutex);
+                removeStoppedSubscribers();
+            }
+
+            while (subscriber->isRunning) {
+                PacketRef packet;
+                {
+                    std::unique_lock<std::mutex> lock(subscriber->mutex);
+                    subscriber->condition.wait(lock, [&]() {
+                        return !subscriber->isRunning || getOldestSlot(*subscriber) >= 0;
+                    });
+                    const int slot = getOldestSlot(*subscriber);
+                    if (!subscriber->isRunning || slot < 0) {
+                        break;
+                    }
+                    packet = subscriber->queues[slot].front();
+                    subscriber->queues[slot].pop_front();
+                }
+                // Room in the queue for a blocked publisher.
+                subscriber->condition.notify_all();
+
+                if (!subscriber->socket.sendAll(&packet->data[0], packet->size)) {
+                    break;
+                }
+
+                std::lock_guard<std::mutex> lock(subscriber->mutex);
+                subscriber->numSent++;
+                subscriber->numBytesSent += packet->size;
+            }
+            ofLogNotice("ofxKinect2::FrameStreamServer") << "Subscriber " << subscriber->address << " disconnected.";
+        }
+
+        subscriber->isRunning = false;
+        subscriber->condition.notify_all();
+    }
+};
+
+/**
+ * @brief Subscribes to a FrameStreamServer and decodes the frames on a thread of its own, the getters copy the
+ * latest ones. Body messages that refer to one that never arrived are skipped until the next keyframe.
+ */
+class ofxKinect2::FrameStreamClient
+{
+public:
+    FrameStreamClient()
+        : m_IsConnected(false)
+        , m_NumBytesReceived(0)
+        , m_NumLostFrames(0)
+        , m_LastBodySequence(0)
+        , m_HasBodies(false)
+    {
+        for (int i = 0; i < FrameStreamServer::NUM_SLOTS; i++) {
+            m_Timestamps[i] = 0;
+            m_NumFrames[i] = 0;
+        }
+    }
+
+    ~FrameStreamClient()
+    {
+        exit();
+    }
+
+    /**
+     * @brief queueSize 0 takes the server's default.
+     */
+    bool setup(const string &host, int port = FrameStreamServer::DEFAULT_PORT, unsigned int sensorMask = FrameStreamServer::STREAMABLE_SENSORS,
+               DropPolicy dropPolicy = DROP_POLICY_OLDEST, int queueSize = 0)
+    {
+        exit();
+        if (!TcpSocket::startup()) {
+            ofLogError("ofxKinect2::FrameStreamClient") << "Can't start the sockets.";
+            return false;
+        }
+
+        unsigned char hello[FrameStreamServer::HELLO_SIZE] = { 0 };
+        const unsigned int magic = FrameStreamServer::HELLO_MAGIC;
+        memcpy(hello, &magic, 4);
+        memcpy(hello + 4, &sensorMask, 4);
+        hello[8] = static_cast<unsigned char>(dropPolicy);
+        hello[9] = static_cast<unsigned char>(ofClamp(queueSize, 0, FrameStreamServer::MAX_QUEUE_SIZE));
+        if (!m_Socket.connect(host, port) || !m_Socket.sendAll(hello, FrameStreamServer::HELLO_SIZE)) {
+            ofLogError("ofxKinect2::FrameStreamClient") << "Can't connect to " << host << ":" << port << ".";
+            m_Socket.close();
+            TcpSocket::cleanup();
+            return false;
+        }
+        m_Socket.setNoDelay();
+
+        m_IsConnected = true;
+        m_HasBodies = false;
+        m_Thread = std::thread(&FrameStreamClient::receiveFunction, this);
+        return true;
+    }
+
+    void exit()
+    {
+        if (!m_Thread.joinable()) {
+            return;
+        }
+
+        m_Socket.shutdown();
+        m_Thread.join();
+        m_Socket.close();
+        m_IsConnected = false;
+        TcpSocket::cleanup();
+    }
+
+    /**
+     * @brief False once the server closed the connection.
+     */
+    bool isConnected() const
+    {
+        return m_IsConnected;
+    }
+
+    /**
+     * @brief The latest depth (SENSOR_DEPTH) or IR (SENSOR_IR) frame, false if none arrived yet.
+     */
+    bool getPixels(SensorType type, ofShortPixels &pixels, uint64_t *timestamp = nullptr)
+    {
+        if (type != SENSOR_DEPTH && type != SENSOR_IR) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return copyFrame(type, type == SENSOR_DEPTH ? m_DepthPixels.getFrontBuffer() : m_IrPixels.getFrontBuffer(), pixels, timestamp);
+    }
+
+    /**
+     * @brief The latest body index frame, 255 where there is no body.
+     */
+    bool getBodyIndex(ofPixels &labels, uint64_t *timestamp = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return copyFrame(SENSOR_BODY_INDEX, m_BodyIndex.getFrontBuffer(), labels, timestamp);
+    }
+
+    bool getBodies(std::vector<BodyData> &bodies, uint64_t *timestamp = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return copyFrame(SENSOR_BODY, m_Bodies.getFrontBuffer(), bodies, timestamp);
+    }
+
+    /**
+     * @brief Frames of the type decoded so far, compare with the last value to know if there is a new one.
+     */
+    uint64_t getNumFrames(SensorType type)
+    {
+        const int slot = FrameStreamServer::getSlot(type);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return slot >= 0 ? m_NumFrames[slot] : 0;
+    }
+
+    uint64_t getNumBytesReceived() const
+    {
+        return m_NumBytesReceived;
+    }
+
+    /**
+     * @brief Messages that couldn't be decoded, body deltas whose reference was dropped by the server included.
+     */
+    uint64_t getNumLostFrames() const
+    {
+        return m_NumLostFrames;
+    }
+
+protected:
+    static const unsigned int MAX_PAYLOAD_SIZE = 64 << 20;
+
+    TcpSocket m_Socket;
+    std::thread m_Thread;
+    std::atomic<bool> m_IsConnected;
+    std::atomic<uint64_t> m_NumBytesReceived;
+    std::atomic<uint64_t> m_NumLostFrames;
+    std::vector<unsigned char> m_Payload;
+
+    std::mutex m_Mutex;
+    DoubleBuffer<ofShortPixels> m_DepthPixels;
+    DoubleBuffer<ofShortPixels> m_IrPixels;
+    DoubleBuffer<ofPixels> m_BodyIndex;
+    DoubleBuffer<std::vector<BodyData> > m_Bodies;
+    uint64_t m_Timestamps[FrameStreamServer::NUM_SLOTS];
+    uint64_t m_NumFrames[FrameStreamServer::NUM_SLOTS];
+    unsigned int m_LastBodySequence;
+    bool m_HasBodies;
+
+protected:
+    template<typename T>
+    bool copyFrame(SensorType type, const T &frame, T &copy, uint64_t *timestamp)
+    {
+        const int slot = FrameStreamServer::getSlot(type);
+        if (m_NumFrames[slot] == 0) {
+            return false;
+        }
+        copy = frame;
+        if (timestamp) {
+            *timestamp = m_Timestamps[slot];
+        }
+        return true;
+    }
+
+    template<typename PixelsType>
+    void reallocate(DoubleBuffer<PixelsType> &buffer, int width, int height)
+    {
+        if (buffer.getBackBuffer().getWidth() != width || buffer.getBackBuffer().getHeight() != height) {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            buffer.deallocate();
+            buffer.allocate(width, height, 1);
+        }
+    }
+
+    void receiveFunction()
+    {
+        unsigned char headerData[FrameCodec::HEADER_SIZE];
+        FrameCodec::Header header;
+        while (m_Socket.receiveAll(headerData, FrameCodec::HEADER_SIZE)) {
+            if (!FrameCodec::readHeader(headerData, header) || header.payloadSize > MAX_PAYLOAD_SIZE) {
+                ofLogError("ofxKinect2::FrameStreamClient") << "Lost the message boundaries, disconnecting.";
+                break;
+            }
+
+            if (m_Payload.size() < header.payloadSize) {
+                m_Payload.resize(header.payloadSize);
+            }
+            if (header.payloadSize > 0 && !m_Socket.receiveAll(&m_Payload[0], header.payloadSize)) {
+                break;
+            }
+            m_NumBytesReceived += FrameCodec::HEADER_SIZE + header.payloadSize;
+            decode(header);
+        }
+        m_IsConnected = false;
+    }
+
+    void decode(const FrameCodec::Header &header)
+    {
+        const SensorType type = static_cast<SensorType>(header.sensorType);
+        const int slot = FrameStreamServer::getSlot(type);
+        if (slot < 0) {
+            return;
+        }
+
+        const unsigned char *payload = m_Payload.empty() ? nullptr : &m_Payload[0];
+        const int numPixels = header.width * header.height;
+        bool isDecoded = false;
+        switch (type) {
+        case SENSOR_IR:
+        case SENSOR_DEPTH: {
+            DoubleBuffer<ofShortPixels> &buffer = type == SENSOR_DEPTH ? m_DepthPixels : m_IrPixels;
+            reallocate(buffer, header.width, header.height);
+            isDecoded = FrameCodec::decodePixels(payload, header.payloadSize, buffer.getBackBuffer().getPixels(), numPixels);
+            break;
+        }
+        case SENSOR_BODY_INDEX:
+            reallocate(m_BodyIndex, header.width, header.height);
+            isDecoded = FrameCodec::decodeLabels(payload, header.payloadSize, m_BodyIndex.getBackBuffer().getPixels(), numPixels);
+            break;
+        case SENSOR_BODY: {
+            // Only this thread writes the front buffer, reading it as the reference needs no lock.
+            const bool isKeyframe = (header.flags & FrameCodec::FLAG_KEYFRAME) != 0;
+            if (isKeyframe || (m_HasBodies && header.sequence == m_LastBodySequence + 1)) {
+                isDecoded = FrameCodec::decodeBodies(payload, header.payloadSize, isKeyframe ? nullptr : &m_Bodies.getFrontBuffer(),
+                                                     m_Bodies.getBackBuffer());
+            }
+            m_HasBodies = isDecoded;
+            m_LastBodySequence = header.sequence;
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (!isDecoded) {
+            m_NumLostFrames++;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        switch (type) {
+        case SENSOR_IR:
+            m_IrPixels.swap();
+            break;
+        case SENSOR_DEPTH:
+            m_DepthPixels.swap();
+            break;
+        case SENSOR_BODY_INDEX:
+            m_BodyIndex.swap();
+            break;
+        default:
+            m_Bodies.swap();
+            break;
+        }
+        m_Timestamps[slot] = header.timestamp;
+        m_NumFrames[slot]++;
+    }
+};
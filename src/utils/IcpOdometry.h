@@ -0,0 +1,632 @@
+#pragma once
+#include "ofMain.h"
+#include "RigidTransform.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class DepthStream;
+class IcpOdometry;
+} // namespace ofxKinect2
+
+/**
+ * @brief Tracks a moving sensor by aligning every depth frame to the previous one with point-to-plane ICP, and
+ * chains the motions into a camera to world pose.
+ *
+ * The frames are organized grids, so a point is matched to the previous frame's pixel it projects onto instead of
+ * searching for its nearest neighbour. Matches further apart than setMaxDistance() or whose normals differ by more
+ * than setMaxAngle() are dropped. Each iteration linearizes the distances along the previous frame's normals into
+ * the 6x6 normal equations of a small motion, summed in parallel over bands of rows, and solves them. The alignment
+ * runs coarse to fine on a depth pyramid, the coarse levels catch the large motions cheaply.
+ *
+ * Points are those of MeshGenerator: millimeters, y up and -z in front of the camera. The pose maps them to world
+ * space like TsdfVolume expects, world space being the camera space of the first frame.
+ */
+class ofxKinect2::IcpOdometry
+{
+public:
+    static const int MAX_LEVELS = 4;
+
+    IcpOdometry()
+        : m_NumLevels(3)
+        , m_MaxDistance(100)
+        , m_MaxAngle(30)
+        , m_MinInlierRatio(0.3f)
+        , m_IsTracking(false)
+        , m_HasModel(false)
+        , m_NumInliers(0)
+        , m_Error(0)
+    {
+        const int iterations[MAX_LEVELS] = { 4, 5, 10, 10 };
+        std::copy(iterations, iterations + MAX_LEVELS, m_NumIterations);
+        setup(70.6f, 60.f);
+    }
+
+    /**
+     * @brief Takes the field of view from the stream, defined in ofxKinect2.cpp. Needs the whole frame: with a
+     * region of interest it warns and keeps the field of view it had.
+     */
+    void setup(DepthStream &depthStream);
+
+    /**
+     * @brief Field of view in degrees, as given by Stream::getHorizontalFieldOfView().
+     */
+    void setup(float fovH, float fovV)
+    {
+        m_xzFactor = tan(ofDegToRad(fovH) * 0.5) * 2;
+        m_yzFactor = tan(ofDegToRad(fovV) * 0.5) * -2;
+    }
+
+    /**
+     * @brief Aligns the frame to the previous one and moves the pose by the motion in between. Returns false when
+     * the frames don't match well enough, the pose is then kept and the next frame is aligned to this one.
+     */
+    bool update(const ofShortPixels &depth, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        buildPyramid(depth, scheduler);
+        m_IsTracking = false;
+        m_NumInliers = 0;
+        if (m_HasModel && m_Model[0].width == m_Current[0].width && m_Model[0].height == m_Current[0].height) {
+            RigidTransform motion;
+            if (align(motion, scheduler)) {
+                m_Motion = motion;
+                m_Pose = m_Pose * motion;
+                m_Pose.orthonormalize();
+                m_IsTracking = true;
+            }
+        }
+
+        for (int level = 0; level < MAX_LEVELS; level++) {
+            std::swap(m_Model[level], m_Current[level]);
+        }
+        m_HasModel = true;
+        return m_IsTracking;
+    }
+
+    /**
+     * @brief Forgets the previous frame and puts the pose back to identity.
+     */
+    void reset()
+    {
+        m_Pose = RigidTransform();
+        m_Motion = RigidTransform();
+        m_HasModel = false;
+        m_IsTracking = false;
+    }
+
+    /**
+     * @brief Camera to world transform of the last frame.
+     */
+    ofMatrix4x4 getPose() const
+    {
+        return m_Pose.getMatrix();
+    }
+
+    /**
+     * @brief Starts the chain from a known pose instead of identity, e.g. one levelled with PlaneDetector.
+     */
+    void setPose(const ofMatrix4x4 &pose)
+    {
+        m_Pose = RigidTransform(pose);
+    }
+
+    /**
+     * @brief The last frame's camera to the previous frame's camera.
+     */
+    ofMatrix4x4 getMotion() const
+    {
+        return m_Motion.getMatrix();
+    }
+
+    bool isTracking() const
+    {
+        return m_IsTracking;
+    }
+
+    /**
+     * @brief Matched points at the finest level in the last iteration.
+     */
+    int getNumInliers() const
+    {
+        return m_NumInliers;
+    }
+
+    /**
+     * @brief RMS point to plane distance of the matches in millimeters.
+     */
+    float getError() const
+    {
+        return m_Error;
+    }
+
+    /**
+     * @brief Pyramid levels, each half the size of the previous one.
+     */
+    void setNumLevels(int numLevels)
+    {
+        m_NumLevels = ofClamp(numLevels, 1, MAX_LEVELS);
+        m_HasModel = false;
+    }
+    int getNumLevels() const
+    {
+        return m_NumLevels;
+    }
+
+    /**
+     * @brief Iterations at a level, 0 being full resolution.
+     */
+    void setNumIterations(int level, int numIterations)
+    {
+        if (level >= 0 && level < MAX_LEVELS) {
+            m_NumIterations[level] = std::max(numIterations, 0);
+        }
+    }
+    int getNumIterations(int level) const
+    {
+        return level >= 0 && level < MAX_LEVELS ? m_NumIterations[level] : 0;
+    }
+
+    /**
+     * @brief Matches further apart in millimeters are dropped, bounds the motion between two frames.
+     */
+    void setMaxDistance(float distance)
+    {
+        m_MaxDistance = std::max(distance, 1.f);
+    }
+    float getMaxDistance() const
+    {
+        return m_MaxDistance;
+    }
+
+    /**
+     * @brief Matches whose normals differ by more degrees are dropped.
+     */
+    void setMaxAngle(float angle)
+    {
+        m_MaxAngle = ofClamp(angle, 0.f, 180.f);
+    }
+    float getMaxAngle() const
+    {
+        return m_MaxAngle;
+    }
+
+    /**
+     * @brief Part of the frame's points that must match for the motion to be accepted.
+     */
+    void setMinInlierRatio(float ratio)
+    {
+        m_MinInlierRatio = ofClamp(ratio, 0.f, 1.f);
+    }
+    float getMinInlierRatio() const
+    {
+        return m_MinInlierRatio;
+    }
+
+protected:
+    /** @brief The upper triangle of JtJ, Jtr, the squared residuals and the count. */
+    static const int NUM_SUMS = 21 + 6 + 2;
+    static const int NUM_BANDS = 32;
+
+    /**
+     * @brief A pyramid level: the depth, the camera space points and their normals. The pixel centers sit at
+     * offset in the pixels of the level, (2^level - 1) / 2 full resolution pixels from the corner. A zero normal
+     * marks the pixels without one.
+     */
+    struct Level {
+        int width, height;
+        float offset;
+        std::vector<float> depth;
+        std::vector<float> x, y, z;
+        std::vector<float> normalX, normalY, normalZ;
+        int numValid;
+
+        Level()
+            : width(0)
+            , height(0)
+            , offset(0)
+            , numValid(0)
+        {
+
+        }
+    };
+
+    int m_NumLevels;
+    int m_NumIterations[MAX_LEVELS];
+    float m_MaxDistance, m_MaxAngle, m_MinInlierRatio;
+    float m_xzFactor, m_yzFactor;
+    bool m_IsTracking, m_HasModel;
+    int m_NumInliers;
+    float m_Error;
+
+    RigidTransform m_Pose, m_Motion;
+    Level m_Model[MAX_LEVELS], m_Current[MAX_LEVELS];
+    double m_Sums[NUM_BANDS][NUM_SUMS];
+    /** @brief A row of matches per band, see sumBand(). */
+    std::vector<float> m_Matches;
+
+protected:
+    void buildPyramid(const ofShortPixels &depth, Scheduler *scheduler)
+    {
+        for (int level = 0; level < m_NumLevels; level++) {
+            Level &current = m_Current[level];
+            const int width = level == 0 ? depth.getWidth() : m_Current[level - 1].width / 2;
+            const int height = level == 0 ? depth.getHeight() : m_Current[level - 1].height / 2;
+            if (current.width != width || current.height != height) {
+                const size_t numPixels = width * height;
+                current.width = width;
+                current.height = height;
+                current.offset = 0.5f - 0.5f / (1 << level);
+                current.depth.assign(numPixels, 0.f);
+                current.x.assign(numPixels, 0.f);
+                current.y.assign(numPixels, 0.f);
+                current.z.assign(numPixels, 0.f);
+                current.normalX.assign(numPixels, 0.f);
+                current.normalY.assign(numPixels, 0.f);
+                current.normalZ.assign(numPixels, 0.f);
+            }
+
+            Level *levelPointer = &current;
+            if (level == 0) {
+                const unsigned short *depthPixels = depth.getPixels();
+                parallelFor(scheduler, 0, height, [levelPointer, depthPixels, width](int begin, int end) {
+                    float *dst = &levelPointer->depth[0];
+                    for (int i = begin * width; i < end * width; i++) {
+                        dst[i] = depthPixels[i];
+                    }
+                }, 32);
+            }
+            else {
+                const Level *previous = &m_Current[level - 1];
+                parallelFor(scheduler, 0, height, [levelPointer, previous](int begin, int end) {
+                    downsampleRows(*previous, *levelPointer, begin, end);
+                }, 16);
+            }
+
+            parallelFor(scheduler, 0, height, [this, levelPointer](int begin, int end) {
+                computePoints(*levelPointer, begin, end);
+            }, 16);
+            parallelFor(scheduler, 0, height, [this, levelPointer](int begin, int end) {
+                computeNormals(*levelPointer, begin, end);
+            }, 16);
+
+            current.numValid = 0;
+            for (size_t i = 0; i < current.depth.size(); i++) {
+                current.numValid += current.depth[i] != 0;
+            }
+        }
+    }
+
+    /**
+     * @brief The average of each 2x2 square, leaving out the depths more than 3 cm behind the nearest so edges
+     * don't get points floating between the foreground and the background.
+     */
+    static void downsampleRows(const Level &src, Level &dst, int begin, int end)
+    {
+        for (int y = begin; y < end; y++) {
+            const float *top = &src.depth[y * 2 * src.width];
+            const float *bottom = top + src.width;
+            float *row = &dst.depth[y * dst.width];
+            for (int x = 0; x < dst.width; x++) {
+                const float depths[4] = { top[x * 2], top[x * 2 + 1], bottom[x * 2], bottom[x * 2 + 1] };
+                float nearest = std::numeric_limits<float>::max();
+                for (int i = 0; i < 4; i++) {
+                    if (depths[i] != 0) {
+                        nearest = std::min(nearest, depths[i]);
+                    }
+                }
+
+                float sum = 0;
+                int count = 0;
+                for (int i = 0; i < 4; i++) {
+                    if (depths[i] != 0 && depths[i] < nearest + 30) {
+                        sum += depths[i];
+                        count++;
+                    }
+                }
+                row[x] = count > 0 ? sum / count : 0;
+            }
+        }
+    }
+
+    void computePoints(Level &level, int begin, int end) const
+    {
+        const float invW = 1.f / level.width;
+        const float invH = 1.f / level.height;
+        for (int y = begin; y < end; y++) {
+            const float normY = ((y + level.offset) * invH - 0.5f) * m_yzFactor;
+            for (int x = 0; x < level.width; x++) {
+                const int i = y * level.width + x;
+                const float Z = level.depth[i];
+                level.x[i] = ((x + level.offset) * invW - 0.5f) * m_xzFactor * Z;
+                level.y[i] = normY * Z;
+                level.z[i] = -Z;
+            }
+        }
+    }
+
+    /**
+     * @brief Cross product of the central differences, towards the camera. None at depth edges, where the
+     * neighbours are more than 5% of the depth apart.
+     */
+    static void computeNormals(Level &level, int begin, int end)
+    {
+        const int width = level.width;
+        for (int y = begin; y < end; y++) {
+            for (int x = 0; x < width; x++) {
+                const int i = y * width + x;
+                level.normalX[i] = level.normalY[i] = level.normalZ[i] = 0;
+                if (x == 0 || y == 0 || x == width - 1 || y == level.height - 1) {
+                    continue;
+                }
+
+                const float Z = level.depth[i];
+                const float maxStep = Z * 0.05f;
+                const int left = i - 1, right = i + 1, up = i - width, down = i + width;
+                if (Z == 0 || fabs(level.depth[left] - Z) > maxStep || fabs(level.depth[right] - Z) > maxStep
+                    || fabs(level.depth[up] - Z) > maxStep || fabs(level.depth[down] - Z) > maxStep) {
+                    continue;
+                }
+
+                const ofVec3f dx(level.x[right] - level.x[left], level.y[right] - level.y[left], level.z[right] - level.z[left]);
+                const ofVec3f dy(level.x[down] - level.x[up], level.y[down] - level.y[up], level.z[down] - level.z[up]);
+                ofVec3f normal = dx.getCrossed(dy);
+                const float length = normal.length();
+                if (length == 0) {
+                    continue;
+                }
+                normal /= length;
+                if (normal.x * level.x[i] + normal.y * level.y[i] + normal.z * level.z[i] > 0) {
+                    normal = -normal;
+                }
+
+                level.normalX[i] = normal.x;
+                level.normalY[i] = normal.y;
+                level.normalZ[i] = normal.z;
+            }
+        }
+    }
+
+    /**
+     * @brief Gauss-Newton from the coarsest level down, the motion maps the current camera to the previous one.
+     */
+    bool align(RigidTransform &motion, Scheduler *scheduler)
+    {
+        double sums[NUM_SUMS] = { 0 };
+        bool hasFinestSums = false;
+        for (int level = m_NumLevels - 1; level >= 0; level--) {
+            for (int iteration = 0; iteration < m_NumIterations[level]; iteration++) {
+                sumEquations(level, motion, sums, scheduler);
+                hasFinestSums = level == 0;
+                if (sums[NUM_SUMS - 1] < 6) {
+                    break;
+                }
+
+                double twist[6];
+                if (!solve(sums, twist)) {
+                    return false;
+                }
+                motion = RigidTransform::fromTwist(twist, twist + 3) * motion;
+
+                // Below a hundredth of a degree and of a millimeter, the next iteration won't change a thing.
+                const double rotation = twist[0] * twist[0] + twist[1] * twist[1] + twist[2] * twist[2];
+                const double translation = twist[3] * twist[3] + twist[4] * twist[4] + twist[5] * twist[5];
+                if (rotation < 3e-8 && translation < 1e-4) {
+                    break;
+                }
+            }
+        }
+
+        // The matches of the last full resolution iteration decide whether the motion is accepted, it moved the
+        // points by a fraction of a millimeter since.
+        if (!hasFinestSums) {
+            sumEquations(0, motion, sums, scheduler);
+        }
+        m_NumInliers = static_cast<int>(sums[NUM_SUMS - 1]);
+        m_Error = m_NumInliers > 0 ? static_cast<float>(sqrt(sums[NUM_SUMS - 2] / m_NumInliers)) : 0;
+        return m_NumInliers >= 6 && m_NumInliers >= m_MinInlierRatio * m_Current[0].numValid;
+    }
+
+    /**
+     * @brief The normal equations of the point to plane distances at the motion, each band of rows summed by one
+     * task into its own slot so the result doesn't depend on the scheduling.
+     */
+    void sumEquations(int levelIndex, const RigidTransform &motion, double *sums, Scheduler *scheduler)
+    {
+        const Level &level = m_Current[levelIndex];
+        const int numBands = std::min(NUM_BANDS, level.height);
+        m_Matches.resize(NUM_BANDS * m_Current[0].width * 7);
+        parallelFor(scheduler, 0, numBands, [this, levelIndex, &motion, numBands](int begin, int end) {
+            const int width = m_Current[levelIndex].width;
+            const int height = m_Current[levelIndex].height;
+            for (int band = begin; band < end; band++) {
+                sumBand(levelIndex, motion, height * band / numBands, height * (band + 1) / numBands, m_Sums[band], &m_Matches[band * width * 7]);
+            }
+        });
+
+        std::fill(sums, sums + NUM_SUMS, 0.);
+        for (int band = 0; band < numBands; band++) {
+            for (int i = 0; i < NUM_SUMS; i++) {
+                sums[i] += m_Sums[band][i];
+            }
+        }
+    }
+
+    /**
+     * @brief Matches the points of a row first, then sums the equations of the matches four at a time.
+     */
+    void sumBand(int levelIndex, const RigidTransform &motion, int begin, int end, double *sums, float *matches) const
+    {
+        const Level &current = m_Current[levelIndex];
+        const Level &model = m_Model[levelIndex];
+        const int width = model.width, height = model.height;
+        const float maxDistanceSquared = m_MaxDistance * m_MaxDistance;
+        const float minCosine = cos(ofDegToRad(m_MaxAngle));
+        const float uScale = width / m_xzFactor, uOffset = width * 0.5f - model.offset + 0.5f;
+        const float vScale = height / m_yzFactor, vOffset = height * 0.5f - model.offset + 0.5f;
+
+        // The Jacobian rows and the residuals of the row's matches.
+        float *jacobian[6];
+        for (int a = 0; a < 6; a++) {
+            jacobian[a] = matches + current.width * a;
+        }
+        float *residuals = matches + current.width * 6;
+
+        std::fill(sums, sums + NUM_SUMS, 0.);
+        for (int y = begin; y < end; y++) {
+            int numMatches = 0;
+            for (int x = 0; x < current.width; x++) {
+                const int i = y * current.width + x;
+                if (current.normalX[i] == 0 && current.normalY[i] == 0 && current.normalZ[i] == 0) {
+                    continue;
+                }
+
+                // Projects the point into the previous frame, rounding to the nearest pixel.
+                const ofVec3f p = motion.apply(ofVec3f(current.x[i], current.y[i], current.z[i]));
+                const float Z = -p.z;
+                if (Z <= 0) {
+                    continue;
+                }
+                const float invZ = 1.f / Z;
+                const float u = p.x * invZ * uScale + uOffset;
+                const float v = p.y * invZ * vScale + vOffset;
+                if (!(u >= 0 && u < width && v >= 0 && v < height)) {
+                    continue;
+                }
+
+                const int j = static_cast<int>(v) * width + static_cast<int>(u);
+                const ofVec3f n(model.normalX[j], model.normalY[j], model.normalZ[j]);
+                if (n.x == 0 && n.y == 0 && n.z == 0) {
+                    continue;
+                }
+                const ofVec3f difference = p - ofVec3f(model.x[j], model.y[j], model.z[j]);
+                if (difference.lengthSquared() > maxDistanceSquared) {
+                    continue;
+                }
+                if (motion.rotate(ofVec3f(current.normalX[i], current.normalY[i], current.normalZ[i])).dot(n) < minCosine) {
+                    continue;
+                }
+
+                // d(n . (p + omega x p + t - q)) = (p x n) . omega + n . t
+                const ofVec3f c = p.getCrossed(n);
+                jacobian[0][numMatches] = c.x;
+                jacobian[1][numMatches] = c.y;
+                jacobian[2][numMatches] = c.z;
+                jacobian[3][numMatches] = n.x;
+                jacobian[4][numMatches] = n.y;
+                jacobian[5][numMatches] = n.z;
+                residuals[numMatches] = n.dot(difference);
+                numMatches++;
+            }
+
+            // A row's sums fit floats, the band's go in doubles.
+            float rowSums[NUM_SUMS - 1] = { 0 };
+            int m = 0;
+#if defined(OFX_KINECT2_SSE2)
+            __m128 vectorSums[NUM_SUMS - 1];
+            for (int k = 0; k < NUM_SUMS - 1; k++) {
+                vectorSums[k] = _mm_setzero_ps();
+            }
+            for (; m + 4 <= numMatches; m += 4) {
+                __m128 J[7];
+                for (int a = 0; a < 6; a++) {
+                    J[a] = _mm_loadu_ps(jacobian[a] + m);
+                }
+                J[6] = _mm_loadu_ps(residuals + m);
+                int k = 0;
+                for (int a = 0; a < 6; a++) {
+                    for (int b = a; b < 6; b++, k++) {
+                        vectorSums[k] = _mm_add_ps(vectorSums[k], _mm_mul_ps(J[a], J[b]));
+                    }
+                }
+                for (int a = 0; a < 7; a++, k++) {
+                    vectorSums[k] = _mm_add_ps(vectorSums[k], _mm_mul_ps(J[a], J[6]));
+                }
+            }
+            for (int k = 0; k < NUM_SUMS - 1; k++) {
+                float lanes[4];
+                _mm_storeu_ps(lanes, vectorSums[k]);
+                rowSums[k] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            }
+#endif
+            for (; m < numMatches; m++) {
+                const float J[7] = { jacobian[0][m], jacobian[1][m], jacobian[2][m], jacobian[3][m], jacobian[4][m], jacobian[5][m], residuals[m] };
+                int k = 0;
+                for (int a = 0; a < 6; a++) {
+                    for (int b = a; b < 6; b++) {
+                        rowSums[k++] += J[a] * J[b];
+                    }
+                }
+                for (int a = 0; a < 7; a++) {
+                    rowSums[k++] += J[a] * J[6];
+                }
+            }
+
+            for (int k = 0; k < NUM_SUMS - 1; k++) {
+                sums[k] += rowSums[k];
+            }
+            sums[NUM_SUMS - 1] += numMatches;
+        }
+    }
+
+    /**
+     * @brief Solves JtJ * twist = -Jtr by Cholesky decomposition. A little damping keeps the directions the
+     * scene doesn't constrain, sliding along a wall, from drifting.
+     */
+    static bool solve(const double *sums, double *twist)
+    {
+        double A[6][6], b[6];
+        int k = 0;
+        for (int i = 0; i < 6; i++) {
+            for (int j = i; j < 6; j++) {
+                A[i][j] = A[j][i] = sums[k++];
+            }
+            b[i] = -sums[21 + i];
+        }
+
+        double trace = 0;
+        for (int i = 0; i < 6; i++) {
+            trace += A[i][i];
+        }
+        for (int i = 0; i < 6; i++) {
+            A[i][i] += trace * 1e-9 + 1e-9;
+        }
+
+        // A = L * Lt, L in the lower triangle of A.
+        for (int j = 0; j < 6; j++) {
+            double diagonal = A[j][j];
+            for (int m = 0; m < j; m++) {
+                diagonal -= A[j][m] * A[j][m];
+            }
+            if (diagonal <= 0) {
+                return false;
+            }
+            A[j][j] = sqrt(diagonal);
+            for (int i = j + 1; i < 6; i++) {
+                double value = A[i][j];
+                for (int m = 0; m < j; m++) {
+                    value -= A[i][m] * A[j][m];
+                }
+                A[i][j] = value / A[j][j];
+            }
+        }
+
+        for (int i = 0; i < 6; i++) {
+            double value = b[i];
+            for (int m = 0; m < i; m++) {
+                value -= A[i][m] * twist[m];
+            }
+            twist[i] = value / A[i][i];
+        }
+        for (int i = 5; i >= 0; i--) {
+            double value = twist[i];
+            for (int m = i + 1; m < 6; m++) {
+                value -= A[m][i] * twist[m];
+            }
+            twist[i] = value / A[i][i];
+        }
+        return true;
+    }
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class IrToneMapper;
+} // namespace ofxKinect2
+
+/**
+ * @brief Maps 16 bit IR to 8 bit: the range between two percentiles of the frame is stretched over 0 - 255 through
+ * a gamma curve. The stretch runs in 16 bit integers to a 10 bit index and the curve is a 1024 entry table, no pixel
+ * goes through float.
+ */
+class ofxKinect2::IrToneMapper
+{
+public:
+    static const int LUT_SIZE = 1024;
+    static const int HISTOGRAM_SHIFT = 6;
+    static const int HISTOGRAM_SIZE = 65536 >> HISTOGRAM_SHIFT;
+
+    IrToneMapper()
+        : m_LowPercentile(0.01f)
+        , m_HighPercentile(0.995f)
+        , m_Gamma(2.2f)
+        , m_LutGamma(0)
+        , m_Smoothing(0.8f)
+        , m_IsAutoGainEnabled(true)
+        , m_Low(0)
+        , m_High(65535)
+        , m_IsRangeValid(false)
+    {
+
+    }
+
+    /**
+     * @brief Fractions (0 - 1) of the pixels that end black and white, the auto gain follows them.
+     */
+    void setPercentiles(float low, float high)
+    {
+        m_LowPercentile = ofClamp(low, 0.f, 1.f);
+        m_HighPercentile = ofClamp(high, m_LowPercentile, 1.f);
+    }
+
+    float getLowPercentile() const
+    {
+        return m_LowPercentile;
+    }
+
+    float getHighPercentile() const
+    {
+        return m_HighPercentile;
+    }
+
+    /**
+     * @brief Above 1 lifts the dark parts, IR falls off with the square of the distance.
+     */
+    void setGamma(float gamma)
+    {
+        m_Gamma = std::max(gamma, 0.01f);
+    }
+
+    float getGamma() const
+    {
+        return m_Gamma;
+    }
+
+    /**
+     * @brief How much of the previous range carries over to the next frame, 0 follows every frame.
+     */
+    void setSmoothing(float smoothing)
+    {
+        m_Smoothing = ofClamp(smoothing, 0.f, 0.99f);
+    }
+
+    float getSmoothing() const
+    {
+        return m_Smoothing;
+    }
+
+    /**
+     * @brief Off, the range set with setRange() stays.
+     */
+    void setAutoGainEnabled(bool enabled)
+    {
+        m_IsAutoGainEnabled = enabled;
+    }
+
+    bool isAutoGainEnabled() const
+    {
+        return m_IsAutoGainEnabled;
+    }
+
+    void setRange(int low, int high)
+    {
+        m_Low = ofClamp(low, 0, 65534);
+        m_High = ofClamp(high, m_Low + 1, 65535);
+        m_IsRangeValid = true;
+    }
+
+    /**
+     * @brief The IR values that map to 0 and 255.
+     */
+    int getLow() const
+    {
+        return static_cast<int>(m_Low);
+    }
+
+    int getHigh() const
+    {
+        return static_cast<int>(m_High);
+    }
+
+    void update(const ofShortPixels &src, ofPixels &dst, Scheduler *scheduler = nullptr)
+    {
+        const int width = src.getWidth();
+        const int height = src.getHeight();
+        if (!dst.isAllocated() || dst.getWidth() != width || dst.getHeight() != height || dst.getNumChannels() != 1) {
+            dst.allocate(width, height, 1);
+        }
+        if (m_LutGamma != m_Gamma) {
+            updateLut();
+        }
+        if (m_IsAutoGainEnabled) {
+            updateRange(src);
+        }
+
+        const int low = getLow();
+        const int range = std::min(std::max(getHigh() - low, 1), 65535);
+        // Shift the range up to 15 or 16 bits so the 16 bit scale to the table keeps its precision.
+        int shift = 0;
+        while ((range << (shift + 1)) <= 65535) {
+            shift++;
+        }
+        const int scale = (LUT_SIZE - 1) * 65536 / (range << shift);
+
+        const unsigned short *srcPixels = src.getPixels();
+        unsigned char *dstPixels = dst.getPixels();
+        const unsigned char *lut = &m_Lut[0];
+        parallelFor(scheduler, 0, height, [ = ](int begin, int end) {
+            mapRows(srcPixels + begin * width, dstPixels + begin * width, (end - begin) * width, low, range, shift, scale, lut);
+        }, 16);
+    }
+
+protected:
+    float m_LowPercentile, m_HighPercentile;
+    float m_Gamma, m_LutGamma;
+    float m_Smoothing;
+    bool m_IsAutoGainEnabled;
+    float m_Low, m_High;
+    bool m_IsRangeValid;
+
+    unsigned char m_Lut[LUT_SIZE];
+    std::vector<int> m_Histogram;
+
+protected:
+    void updateLut()
+    {
+        m_LutGamma = m_Gamma;
+        for (int i = 0; i < LUT_SIZE; i++) {
+            m_Lut[i] = static_cast<unsigned char>(255.f * powf(i / (LUT_SIZE - 1.f), 1.f / m_LutGamma) + 0.5f);
+        }
+    }
+
+    /**
+     * @brief Percentiles of every other pixel of every other row, in buckets of 64 IR levels.
+     */
+    void updateRange(const ofShortPixels &src)
+    {
+        const int width = src.getWidth();
+        const int height = src.getHeight();
+        const unsigned short *pixels = src.getPixels();
+        m_Histogram.assign(HISTOGRAM_SIZE, 0);
+        int numSamples = 0;
+        for (int y = 0; y < height; y += 2) {
+            const unsigned short *row = pixels + y * width;
+            for (int x = 0; x < width; x += 2) {
+                m_Histogram[row[x] >> HISTOGRAM_SHIFT]++;
+            }
+            numSamples += (width + 1) / 2;
+        }
+        if (numSamples == 0) {
+            return;
+        }
+
+        const int lowRank = static_cast<int>(m_LowPercentile * (numSamples - 1));
+        const int highRank = static_cast<int>(m_HighPercentile * (numSamples - 1));
+        int seen = 0, lowBucket = -1, highBucket = HISTOGRAM_SIZE - 1;
+        for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+            seen += m_Histogram[i];
+            if (lowBucket < 0 && seen > lowRank) {
+                lowBucket = i;
+            }
+            if (seen > highRank) {
+                highBucket = i;
+                break;
+            }
+        }
+
+        const float low = static_cast<float>(lowBucket << HISTOGRAM_SHIFT);
+        // The last bucket ends at 65536, one past what mapRows() takes in 16 bit.
+        const float high = static_cast<float>(std::min((highBucket + 1) << HISTOGRAM_SHIFT, 65535));
+        const float smoothing = m_IsRangeValid ? m_Smoothing : 0.f;
+        m_Low = m_Low * smoothing + low * (1 - smoothing);
+        m_High = std::min(std::max(m_High * smoothing + high * (1 - smoothing), m_Low + 1), 65535.f);
+        m_IsRangeValid = true;
+    }
+
+    static void mapRows(const unsigned short *src, unsigned char *dst, int numPixels, int low, int range, int shift, int scale,
+                        const unsigned char *lut)
+    {
+        int i = 0;
+#if defined(OFX_KINECT2_SSE2)
+        // The stretch works on unsigned 16 bit: saturating subtractions clamp to [low, low + range] and the high half
+        // of the product with the scale gives the table index.
+        const __m128i lows = _mm_set1_epi16(static_cast<short>(low));
+        const __m128i ranges = _mm_set1_epi16(static_cast<short>(range));
+        const __m128i scales = _mm_set1_epi16(static_cast<short>(scale));
+        const __m128i shifts = _mm_cvtsi32_si128(shift);
+        unsigned short indices[8];
+        for (; i + 8 <= numPixels; i += 8) {
+            __m128i values = _mm_subs_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)), lows);
+            values = _mm_sub_epi16(values, _mm_subs_epu16(values, ranges));
+            values = _mm_mulhi_epu16(_mm_sll_epi16(values, shifts), scales);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices), values);
+            for (int j = 0; j < 8; j++) {
+                dst[i + j] = lut[indices[j]];
+            }
+        }
+#endif
+
+        for (; i < numPixels; i++) {
+            const int value = std::min(std::max(src[i] - low, 0), range);
+            dst[i] = lut[((value << shift) * scale) >> 16];
+        }
+    }
+};
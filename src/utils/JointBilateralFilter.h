@@ -0,0 +1,234 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class JointBilateralFilter;
+} // namespace ofxKinect2
+
+/**
+ * @brief Smooths depth in place using a pixel aligned guide image (the IR frame) for the edges: neighbours
+ * whose IR intensity differs a lot from the center get a small weight, so the filter doesn't blur across object
+ * boundaries. It's the separable approximation, a horizontal pass followed by a vertical one, with the range
+ * kernel 1 / (1 + (dI / sigma)^2) so the weights can be computed 4 pixels at a time without a lookup. Holes and
+ * neighbours further than maxDepthDifference from the center are ignored.
+ */
+class ofxKinect2::JointBilateralFilter
+{
+public:
+    JointBilateralFilter()
+        : m_Radius(3)
+        , m_SpatialSigma(2.f)
+        , m_RangeSigma(1500.f)
+        , m_MaxDepthDifference(80.f)
+    {
+        updateSpatialWeights();
+    }
+
+    void update(ofShortPixels &depth, const ofShortPixels &guide, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1 && guide.getNumChannels() == 1);
+        if (depth.getWidth() != guide.getWidth() || depth.getHeight() != guide.getHeight()) {
+            ofLogWarning("ofxKinect2::JointBilateralFilter") << "The guide must be the same size as the depth.";
+            return;
+        }
+
+        const int width = depth.getWidth();
+        const int height = depth.getHeight();
+        m_Temp.resize(width * height);
+        unsigned short *depthPixels = depth.getPixels();
+        const unsigned short *guidePixels = guide.getPixels();
+        float *temp = &m_Temp[0];
+
+        parallelFor(scheduler, 0, height, [ = ](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                filterRow(depthPixels + y * width, guidePixels + y * width, temp + y * width, width);
+            }
+        }, 8);
+
+        parallelFor(scheduler, 0, height, [ = ](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                filterColumns(temp, guidePixels, depthPixels, width, height, y);
+            }
+        }, 8);
+    }
+
+    void setRadius(int radius)
+    {
+        m_Radius = ofClamp(radius, 1, MAX_RADIUS);
+        updateSpatialWeights();
+    }
+
+    int getRadius() const
+    {
+        return m_Radius;
+    }
+
+    void setSpatialSigma(float sigma)
+    {
+        m_SpatialSigma = sigma;
+        updateSpatialWeights();
+    }
+
+    float getSpatialSigma() const
+    {
+        return m_SpatialSigma;
+    }
+
+    /**
+     * @brief The IR difference at which a neighbour's weight halves.
+     */
+    void setRangeSigma(float sigma)
+    {
+        m_RangeSigma = sigma;
+    }
+
+    float getRangeSigma() const
+    {
+        return m_RangeSigma;
+    }
+
+    void setMaxDepthDifference(float millimeters)
+    {
+        m_MaxDepthDifference = millimeters;
+    }
+
+    float getMaxDepthDifference() const
+    {
+        return m_MaxDepthDifference;
+    }
+
+protected:
+    static const int MAX_RADIUS = 8;
+
+    int m_Radius;
+    float m_SpatialSigma, m_RangeSigma, m_MaxDepthDifference;
+    float m_SpatialWeights[MAX_RADIUS * 2 + 1];
+    std::vector<float> m_Temp;
+
+protected:
+    void updateSpatialWeights()
+    {
+        for (int i = -m_Radius; i <= m_Radius; i++) {
+            m_SpatialWeights[i + m_Radius] = std::exp(-(i * i) / (2.f * m_SpatialSigma * m_SpatialSigma));
+        }
+    }
+
+    float weight(float centerDepth, float centerGuide, float depth, float guide, int tap) const
+    {
+        if (depth == 0 || std::abs(depth - centerDepth) > m_MaxDepthDifference) {
+            return 0;
+        }
+
+        const float difference = (guide - centerGuide) / m_RangeSigma;
+        return m_SpatialWeights[tap] / (1.f + difference * difference);
+    }
+
+    template<typename DepthType>
+    float filterPixel(const DepthType *depth, const unsigned short *guide, int x, int step, int begin, int end) const
+    {
+        const float center = depth[x * step];
+        if (center == 0) {
+            return 0;
+        }
+
+        float sum = 0, weights = 0;
+        for (int i = std::max(x - m_Radius, begin); i <= std::min(x + m_Radius, end - 1); i++) {
+            const float w = weight(center, guide[x * step], depth[i * step], guide[i * step], i - x + m_Radius);
+            sum += w * depth[i * step];
+            weights += w;
+        }
+
+        return sum / weights;
+    }
+
+#if defined(OFX_KINECT2_SSE2)
+    static __m128 loadFloat4(const unsigned short *values)
+    {
+        const __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(values));
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+    }
+
+    /**
+     * @brief Filters 4 neighbouring pixels, the taps are step elements apart.
+     */
+    template<typename DepthType>
+    __m128 filter4(const DepthType *depth, const unsigned short *guide, int step) const
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 inverseSigma = _mm_set1_ps(1.f / m_RangeSigma);
+        const __m128 maxDifference = _mm_set1_ps(m_MaxDepthDifference);
+
+        const __m128 centerDepth = load4(depth);
+        const __m128 centerGuide = loadFloat4(guide);
+        __m128 sum = zero, weights = zero;
+        for (int i = -m_Radius; i <= m_Radius; i++) {
+            const __m128 neighbourDepth = load4(depth + i * step);
+            const __m128 difference = _mm_mul_ps(_mm_sub_ps(loadFloat4(guide + i * step), centerGuide), inverseSigma);
+            __m128 w = _mm_div_ps(_mm_set1_ps(m_SpatialWeights[i + m_Radius]), _mm_add_ps(one, _mm_mul_ps(difference, difference)));
+
+            const __m128 depthDifference = _mm_and_ps(_mm_sub_ps(neighbourDepth, centerDepth), absMask);
+            w = _mm_and_ps(w, _mm_and_ps(_mm_cmple_ps(depthDifference, maxDifference), _mm_cmpneq_ps(neighbourDepth, zero)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(w, neighbourDepth));
+            weights = _mm_add_ps(weights, w);
+        }
+
+        // Holes have no weight at all and stay holes.
+        const __m128 result = _mm_div_ps(sum, _mm_max_ps(weights, _mm_set1_ps(1e-6f)));
+        return _mm_and_ps(result, _mm_cmpneq_ps(centerDepth, zero));
+    }
+
+    static __m128 load4(const unsigned short *values)
+    {
+        return loadFloat4(values);
+    }
+
+    static __m128 load4(const float *values)
+    {
+        return _mm_loadu_ps(values);
+    }
+#endif
+
+    void filterRow(const unsigned short *depth, const unsigned short *guide, float *dst, int width) const
+    {
+        // The scalar path takes the borders, where the kernel is clipped.
+        int x = 0;
+        for (; x < std::min(m_Radius, width); x++) {
+            dst[x] = filterPixel(depth, guide, x, 1, 0, width);
+        }
+
+#if defined(OFX_KINECT2_SSE2)
+        for (; x + 4 + m_Radius <= width; x += 4) {
+            _mm_storeu_ps(dst + x, filter4(depth + x, guide + x, 1));
+        }
+#endif
+
+        for (; x < width; x++) {
+            dst[x] = filterPixel(depth, guide, x, 1, 0, width);
+        }
+    }
+
+    void filterColumns(const float *src, const unsigned short *guide, unsigned short *dst, int width, int height, int y) const
+    {
+        const bool isBorder = y < m_Radius || y + m_Radius >= height;
+        int x = 0;
+#if defined(OFX_KINECT2_SSE2)
+        if (!isBorder) {
+            for (; x + 4 <= width; x += 4) {
+                const __m128i filtered = _mm_cvtps_epi32(filter4(src + y * width + x, guide + y * width + x, width));
+                const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(filtered, _mm_set1_epi32(32768)), _mm_setzero_si128());
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + y * width + x), _mm_add_epi16(packed, _mm_set1_epi16(-32768)));
+            }
+        }
+#endif
+
+        for (; x < width; x++) {
+            const float filtered = filterPixel(src + x, guide + x, y, width, 0, height);
+            dst[y * width + x] = static_cast<unsigned short>(filtered + 0.5f);
+        }
+    }
+};
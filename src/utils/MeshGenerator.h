@@ -3,10 +3,13 @@
 // modified from utils/DepthRemapToRange.h of ofxNI2 by @satoruhiga
 
 #pragma once
-#include "ofxKinect2.h"
+#include "ofMain.h"
+#include "NormalEstimator.h"
+#include "Scheduler.h"
 
 namespace ofxKinect2
 {
+class DepthStream;
 class MeshGenerator;
 } // namespace ofxKinect2
 
@@ -15,49 +18,86 @@ class ofxKinect2::MeshGenerator
 public:
     MeshGenerator()
         : m_DownsamplingLevel(1)
+        , m_IsNormalsEnabled(false)
+        , m_RoiX(0)
+        , m_RoiY(0)
+        , m_FrameWidth(0)
+        , m_FrameHeight(0)
     {
 
     }
 
-    void setup(DepthStream &depthStream)
+    /**
+     * @brief Takes the field of view and the region of interest from the stream, defined in ofxKinect2.cpp. Call it
+     * again when the region moves.
+     */
+    void setup(DepthStream &depthStream);
+
+    /**
+     * @brief Same as setup(DepthStream &) without a stream, e.g. for recorded or synthetic frames. The field of view
+     * is in degrees, as given by Stream::getHorizontalFieldOfView().
+     */
+    void setup(float fovH, float fovV)
     {
-        const float fovH = depthStream.getHorizontalFieldOfView();
-        const float fovV = depthStream.getVerticalFieldOfView();
+        m_xzFactor = tan(ofDegToRad(fovH) * 0.5) * 2;
+        m_yzFactor = tan(ofDegToRad(fovV) * 0.5) * -2;
+        m_NormalEstimator.setup(fovH, fovV);
+    }
 
-        m_xzFactor = tan(fovH * 0.5) * 2;
-        m_yzFactor = tan(fovV * 0.5) * -2;
+    /**
+     * @brief Where the depth given to update() sits in the frame the field of view covers, e.g. Stream::getRoi()
+     * in a frame of the stream's size. A frameWidth of 0 takes the depth as the whole frame.
+     */
+    void setRoi(int x, int y, int frameWidth, int frameHeight)
+    {
+        m_RoiX = x;
+        m_RoiY = y;
+        m_FrameWidth = frameWidth;
+        m_FrameHeight = frameHeight;
+        m_NormalEstimator.setRoi(x, y, frameWidth, frameHeight);
     }
 
-    const ofMesh &update(const ofShortPixels &depth, const ofPixels &color = ofPixels())
+    /**
+     * @brief The scheduler is used for the normals only.
+     */
+    const ofMesh &update(const ofShortPixels &depth, const ofPixels &color = ofPixels(), Scheduler *scheduler = nullptr)
     {
         assert(depth.getNumChannels() == 1);
 
         const int depthWidth = depth.getWidth();
         const int depthHeight = depth.getHeight();
-        const float invW = 1. / depthWidth;
-        const float invH = 1. / depthHeight;
+        const bool hasRoi = m_FrameWidth > 0 && m_FrameHeight > 0;
+        const float invW = 1. / (hasRoi ? m_FrameWidth : depthWidth);
+        const float invH = 1. / (hasRoi ? m_FrameHeight : depthHeight);
+        // x * invW + offsetX runs from -0.5 to 0.5 over the frame, not only over the region.
+        const float offsetX = hasRoi ? m_RoiX * invW - 0.5 : -0.5;
+        const float offsetY = hasRoi ? m_RoiY * invH - 0.5 : -0.5;
         const unsigned short *depthPixels = depth.getPixels();
 
         const bool hasColor = color.isAllocated();
         const float invByte = 1. / 255.;
         m_Mesh.setMode(OF_PRIMITIVE_POINTS);
 
+        // The loops below take every pixel whose coordinates are multiples of the level.
+        const int numColumns = (depthWidth + m_DownsamplingLevel - 1) / m_DownsamplingLevel;
+        const int numRows = (depthHeight + m_DownsamplingLevel - 1) / m_DownsamplingLevel;
+        const int numVertices = numColumns * numRows;
         vector<ofVec3f> &verts = m_Mesh.getVertices();
-        verts.resize((depthWidth / m_DownsamplingLevel) * (depthHeight / m_DownsamplingLevel));
+        verts.resize(numVertices);
         int vertIndex = 0;
 
         if (hasColor) {
             const unsigned char *colorPixel = color.getPixels();
             vector<ofFloatColor> &colors = m_Mesh.getColors();
-            colors.resize((depthWidth / m_DownsamplingLevel) * (depthHeight / m_DownsamplingLevel));
+            colors.resize(numVertices);
 
             if (color.getNumChannels() == 1) {
                 for (int y = 0; y < depthHeight; y += m_DownsamplingLevel) {
                     for (int x = 0; x < depthWidth; x += m_DownsamplingLevel) {
                         const int idx = y * depthWidth + x;
                         const float Z = depthPixels[idx];
-                        const float normX = x * invW - 0.5;
-                        const float normY = y * invH - 0.5;
+                        const float normX = x * invW + offsetX;
+                        const float normY = y * invH + offsetY;
                         const float X = normX * m_xzFactor * Z;
                         const float Y = normY * m_yzFactor * Z;
                         verts[vertIndex].set(X, Y, -Z);
@@ -73,8 +113,8 @@ public:
                     for (int x = 0; x < depthWidth; x += m_DownsamplingLevel) {
                         const int idx = y * depthWidth + x;
                         const float Z = depthPixels[idx];
-                        const float normX = x * invW - 0.5;
-                        const float normY = y * invH - 0.5;
+                        const float normX = x * invW + offsetX;
+                        const float normY = y * invH + offsetY;
                         const float X = normX * m_xzFactor * Z;
                         const float Y = normY * m_yzFactor * Z;
                         verts[vertIndex].set(X, Y, -Z);
@@ -88,22 +128,41 @@ public:
             else {
                 throw;
             }
-
-            m_Mesh.addColors(colors);
         }
         else {
+            m_Mesh.getColors().clear();
             for (int y = 0; y < depthHeight; y += m_DownsamplingLevel) {
                 for (int x = 0; x < depthWidth; x += m_DownsamplingLevel) {
                     int idx = y * depthWidth + x;
 
                     float Z = depthPixels[idx];
-                    float X = (x * invW - 0.5) * m_xzFactor * Z;
-                    float Y = (y * invH - 0.5) * m_yzFactor * Z;
+                    float X = (x * invW + offsetX) * m_xzFactor * Z;
+                    float Y = (y * invH + offsetY) * m_yzFactor * Z;
                     verts[vertIndex].set(X, Y, -Z);
                     vertIndex++;
                 }
             }
         }
+
+        vector<ofVec3f> &normals = m_Mesh.getNormals();
+        if (m_IsNormalsEnabled) {
+            m_NormalEstimator.update(depth, scheduler);
+            const vector<float> &normalX = m_NormalEstimator.getNormalX();
+            const vector<float> &normalY = m_NormalEstimator.getNormalY();
+            const vector<float> &normalZ = m_NormalEstimator.getNormalZ();
+            normals.resize(numVertices);
+            int normalIndex = 0;
+            for (int y = 0; y < depthHeight; y += m_DownsamplingLevel) {
+                for (int x = 0; x < depthWidth; x += m_DownsamplingLevel) {
+                    const int idx = y * depthWidth + x;
+                    normals[normalIndex].set(normalX[idx], normalY[idx], normalZ[idx]);
+                    normalIndex++;
+                }
+            }
+        }
+        else {
+            normals.clear();
+        }
         return m_Mesh;
     }
 
@@ -121,6 +180,23 @@ public:
         return m_DownsamplingLevel;
     }
 
+    /**
+     * @brief Adds the normals of the full resolution depth to the mesh, for lighting. See NormalEstimator.
+     */
+    void setNormalsEnabled(bool isEnabled)
+    {
+        m_IsNormalsEnabled = isEnabled;
+    }
+    bool isNormalsEnabled() const
+    {
+        return m_IsNormalsEnabled;
+    }
+
+    NormalEstimator &getNormalEstimator()
+    {
+        return m_NormalEstimator;
+    }
+
     ofMesh &getMesh()
     {
         return m_Mesh;
@@ -128,7 +204,11 @@ public:
 
 protected:
     int m_DownsamplingLevel;
+    bool m_IsNormalsEnabled;
+    NormalEstimator m_NormalEstimator;
     ofMesh m_Mesh;
     float m_xzFactor, m_yzFactor;
+    int m_RoiX, m_RoiY;
+    int m_FrameWidth, m_FrameHeight;
 
 };
@@ -0,0 +1,285 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "SmallestEigenvector.h"
+
+namespace ofxKinect2
+{
+class DepthStream;
+class NormalEstimator;
+} // namespace ofxKinect2
+
+/**
+ * @brief Surface normals of every depth pixel from the covariance of the camera space points in a square window
+ * around it. The sums the covariance needs (the points, their products and the number of valid pixels) are kept
+ * in integral images, so a window costs four reads per sum whatever its size. The normal is the eigenvector of the
+ * smallest eigenvalue, turned towards the camera. The points are those of MeshGenerator: millimeters, y up and
+ * -z in front of the camera.
+ */
+class ofxKinect2::NormalEstimator
+{
+public:
+    NormalEstimator()
+        : m_WindowRadius(4)
+        , m_MinValidFraction(0.5f)
+        , m_Width(0)
+        , m_Height(0)
+        , m_RoiX(0)
+        , m_RoiY(0)
+        , m_FrameWidth(0)
+        , m_FrameHeight(0)
+    {
+        setup(70.6f, 60.f);
+    }
+
+    /**
+     * @brief Takes the field of view and the region of interest from the stream, defined in ofxKinect2.cpp. Call it
+     * again when the region moves.
+     */
+    void setup(DepthStream &depthStream);
+
+    /**
+     * @brief Field of view in degrees, as given by Stream::getHorizontalFieldOfView().
+     */
+    void setup(float fovH, float fovV)
+    {
+        m_xzFactor = tan(ofDegToRad(fovH) * 0.5) * 2;
+        m_yzFactor = tan(ofDegToRad(fovV) * 0.5) * -2;
+    }
+
+    /**
+     * @brief Where the depth sits in the frame the field of view covers, see MeshGenerator::setRoi().
+     */
+    void setRoi(int x, int y, int frameWidth, int frameHeight)
+    {
+        m_RoiX = x;
+        m_RoiY = y;
+        m_FrameWidth = frameWidth;
+        m_FrameHeight = frameHeight;
+    }
+
+    void update(const ofShortPixels &depth, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        const int width = depth.getWidth();
+        const int height = depth.getHeight();
+        const size_t numPixels = width * height;
+        const size_t integralSize = (width + 1) * (height + 1) * NUM_SUMS;
+        if (m_Width != width || m_Height != height) {
+            m_Width = width;
+            m_Height = height;
+            // Row and column 0 stay 0, the sums start at 1.
+            m_Integrals.assign(integralSize, 0.);
+            m_NormalX.assign(numPixels, 0.f);
+            m_NormalY.assign(numPixels, 0.f);
+            m_NormalZ.assign(numPixels, 0.f);
+            m_Curvature.assign(numPixels, 0.f);
+        }
+        const bool hasRoi = m_FrameWidth > 0 && m_FrameHeight > 0;
+        m_InvFrameWidth = 1.f / (hasRoi ? m_FrameWidth : width);
+        m_InvFrameHeight = 1.f / (hasRoi ? m_FrameHeight : height);
+        m_OffsetX = hasRoi ? m_RoiX * m_InvFrameWidth - 0.5f : -0.5f;
+        m_OffsetY = hasRoi ? m_RoiY * m_InvFrameHeight - 0.5f : -0.5f;
+
+        // Row sums, then column sums of the rows.
+        const unsigned short *depthPixels = depth.getPixels();
+        double *integrals = &m_Integrals[0];
+        const int rowSize = (width + 1) * NUM_SUMS;
+        parallelFor(scheduler, 0, height, [this, depthPixels, integrals, width, rowSize](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                sumRow(depthPixels + y * width, y, width, integrals + (y + 1) * rowSize + NUM_SUMS);
+            }
+        }, 16);
+
+        parallelFor(scheduler, NUM_SUMS, rowSize, [integrals, height, rowSize](int begin, int end) {
+            for (int y = 1; y <= height; y++) {
+                double *row = integrals + y * rowSize;
+                const double *previous = row - rowSize;
+                for (int i = begin; i < end; i++) {
+                    row[i] += previous[i];
+                }
+            }
+        }, 640);
+
+        parallelFor(scheduler, 0, height, [this, depthPixels, width](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                estimateRow(depthPixels + y * width, y);
+            }
+        }, 8);
+    }
+
+    /**
+     * @brief The normal components of every pixel, row by row. 0 where there is no depth or too few valid
+     * neighbours.
+     */
+    const vector<float> &getNormalX() const
+    {
+        return m_NormalX;
+    }
+    const vector<float> &getNormalY() const
+    {
+        return m_NormalY;
+    }
+    const vector<float> &getNormalZ() const
+    {
+        return m_NormalZ;
+    }
+
+    /**
+     * @brief Surface variation, the smallest eigenvalue over their sum: 0 on a plane, up to 1/3 on scattered points.
+     */
+    const vector<float> &getCurvature() const
+    {
+        return m_Curvature;
+    }
+
+    ofVec3f getNormal(int x, int y) const
+    {
+        const int index = y * m_Width + x;
+        return ofVec3f(m_NormalX[index], m_NormalY[index], m_NormalZ[index]);
+    }
+
+    int getWidth() const
+    {
+        return m_Width;
+    }
+
+    int getHeight() const
+    {
+        return m_Height;
+    }
+
+    /**
+     * @brief The window is 2 * radius + 1 pixels wide, larger windows give smoother normals and rounder edges.
+     */
+    void setWindowRadius(int radius)
+    {
+        m_WindowRadius = std::max(radius, 1);
+    }
+    int getWindowRadius() const
+    {
+        return m_WindowRadius;
+    }
+
+    /**
+     * @brief Part of the window that must have depth for a normal.
+     */
+    void setMinValidFraction(float fraction)
+    {
+        m_MinValidFraction = ofClamp(fraction, 0.f, 1.f);
+    }
+    float getMinValidFraction() const
+    {
+        return m_MinValidFraction;
+    }
+
+protected:
+    /** @brief count, x, y, z, xx, xy, xz, yy, yz, zz, interleaved so the sums of a corner share cache lines. */
+    static const int NUM_SUMS = 10;
+
+    int m_WindowRadius;
+    float m_MinValidFraction;
+    float m_xzFactor, m_yzFactor;
+    int m_Width, m_Height;
+    int m_RoiX, m_RoiY;
+    int m_FrameWidth, m_FrameHeight;
+    /** @brief x * m_InvFrameWidth + m_OffsetX runs from -0.5 to 0.5 over the frame. */
+    float m_InvFrameWidth, m_InvFrameHeight, m_OffsetX, m_OffsetY;
+    std::vector<double> m_Integrals;
+    std::vector<float> m_NormalX, m_NormalY, m_NormalZ, m_Curvature;
+
+protected:
+    void sumRow(const unsigned short *depth, int y, int width, double *integrals) const
+    {
+        const float normY = (y * m_InvFrameHeight + m_OffsetY) * m_yzFactor;
+        double sums[NUM_SUMS] = { 0 };
+        for (int x = 0; x < width; x++) {
+            const float Z = depth[x];
+            if (Z != 0) {
+                const double px = (x * m_InvFrameWidth + m_OffsetX) * m_xzFactor * Z;
+                const double py = normY * Z;
+                const double pz = -Z;
+                sums[0] += 1;
+                sums[1] += px;
+                sums[2] += py;
+                sums[3] += pz;
+                sums[4] += px * px;
+                sums[5] += px * py;
+                sums[6] += px * pz;
+                sums[7] += py * py;
+                sums[8] += py * pz;
+                sums[9] += pz * pz;
+            }
+
+            std::copy(sums, sums + NUM_SUMS, integrals + x * NUM_SUMS);
+        }
+    }
+
+    void estimateRow(const unsigned short *depth, int y)
+    {
+        const int width = m_Width;
+        const size_t rowSize = (width + 1) * NUM_SUMS;
+        const int top = std::max(y - m_WindowRadius, 0);
+        const int bottom = std::min(y + m_WindowRadius + 1, m_Height);
+        const double *integrals = &m_Integrals[0];
+        const double *topRow = integrals + top * rowSize;
+        const double *bottomRow = integrals + bottom * rowSize;
+
+        const int windowSize = 2 * m_WindowRadius + 1;
+        const double minCount = std::max(3.f, m_MinValidFraction * windowSize * windowSize);
+        float *normalX = &m_NormalX[y * width];
+        float *normalY = &m_NormalY[y * width];
+        float *normalZ = &m_NormalZ[y * width];
+        float *curvature = &m_Curvature[y * width];
+        for (int x = 0; x < width; x++) {
+            normalX[x] = normalY[x] = normalZ[x] = curvature[x] = 0;
+            if (depth[x] == 0) {
+                continue;
+            }
+
+            const int left = std::max(x - m_WindowRadius, 0);
+            const int right = std::min(x + m_WindowRadius + 1, width);
+            const double *topLeft = topRow + left * NUM_SUMS;
+            const double *topRight = topRow + right * NUM_SUMS;
+            const double *bottomLeft = bottomRow + left * NUM_SUMS;
+            const double *bottomRight = bottomRow + right * NUM_SUMS;
+            double sums[NUM_SUMS];
+            for (int sum = 0; sum < NUM_SUMS; sum++) {
+                sums[sum] = bottomRight[sum] - bottomLeft[sum] - topRight[sum] + topLeft[sum];
+            }
+            if (sums[0] < minCount) {
+                continue;
+            }
+
+            const double invCount = 1. / sums[0];
+            const double mx = sums[1] * invCount;
+            const double my = sums[2] * invCount;
+            const double mz = sums[3] * invCount;
+            float covariance[6] = {
+                static_cast<float>(sums[4] * invCount - mx * mx), static_cast<float>(sums[5] * invCount - mx * my),
+                static_cast<float>(sums[6] * invCount - mx * mz), static_cast<float>(sums[7] * invCount - my * my),
+                static_cast<float>(sums[8] * invCount - my * mz), static_cast<float>(sums[9] * invCount - mz * mz)
+            };
+
+            ofVec3f normal;
+            float surfaceVariation;
+            if (!getSmallestEigenvector(covariance, normal, surfaceVariation)) {
+                continue;
+            }
+
+            // Towards the camera at the origin.
+            const float Z = depth[x];
+            const float px = (x * m_InvFrameWidth + m_OffsetX) * m_xzFactor * Z;
+            const float py = (y * m_InvFrameHeight + m_OffsetY) * m_yzFactor * Z;
+            if (normal.x * px + normal.y * py - normal.z * Z > 0) {
+                normal = -normal;
+            }
+
+            normalX[x] = normal.x;
+            normalY[x] = normal.y;
+            normalZ[x] = normal.z;
+            curvature[x] = surfaceVariation;
+        }
+    }
+};
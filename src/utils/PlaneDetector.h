@@ -0,0 +1,472 @@
+#pragma once
+#include "ofMain.h"
+#include "Simd.h"
+#include "SmallestEigenvector.h"
+
+namespace ofxKinect2
+{
+class DepthStream;
+class PlaneDetector;
+} // namespace ofxKinect2
+
+/**
+ * @brief Finds the dominant plane, typically the floor, in a subsampled depth frame with PROSAC: RANSAC that draws
+ * its hypotheses from the locally flattest samples first and widens to all of them. It stops as soon as the best
+ * inlier ratio makes a better plane unlikely, refits the winner by least squares and keeps it for the next frame,
+ * where it is only refitted while it still explains the scene. The points are those of MeshGenerator: millimeters,
+ * y up and -z in front of the camera. The normal faces the camera, so for the floor getDistance() is the height of
+ * the sensor.
+ */
+class ofxKinect2::PlaneDetector
+{
+public:
+    PlaneDetector()
+        : m_SampleStep(8)
+        , m_InlierThreshold(20)
+        , m_MaxIterations(500)
+        , m_Confidence(0.99f)
+        , m_MinInlierRatio(0.1f)
+        , m_ExpectedNormal(0, 1, 0)
+        , m_MaxAngle(180)
+        , m_RoiX(0)
+        , m_RoiY(0)
+        , m_FrameWidth(0)
+        , m_FrameHeight(0)
+        , m_HasPlane(false)
+        , m_Distance(0)
+        , m_InlierRatio(0)
+        , m_NumIterations(0)
+        , m_Random(0x2545f491)
+    {
+        setup(70.6f, 60.f);
+    }
+
+    /**
+     * @brief Takes the field of view and the region of interest from the stream, defined in ofxKinect2.cpp. Call it
+     * again when the region moves.
+     */
+    void setup(DepthStream &depthStream);
+
+    /**
+     * @brief Field of view in degrees, as given by Stream::getHorizontalFieldOfView().
+     */
+    void setup(float fovH, float fovV)
+    {
+        m_xzFactor = tan(ofDegToRad(fovH) * 0.5) * 2;
+        m_yzFactor = tan(ofDegToRad(fovV) * 0.5) * -2;
+    }
+
+    /**
+     * @brief Where the depth given to update() sits in the frame the field of view covers, see
+     * MeshGenerator::setRoi(). A frameWidth of 0 takes the depth as the whole frame.
+     */
+    void setRoi(int x, int y, int frameWidth, int frameHeight)
+    {
+        m_RoiX = x;
+        m_RoiY = y;
+        m_FrameWidth = frameWidth;
+        m_FrameHeight = frameHeight;
+    }
+
+    /**
+     * @brief Returns whether a plane with enough inliers was found.
+     */
+    bool update(const ofShortPixels &depth)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        collectSamples(depth);
+        const int numSamples = m_X.size();
+        const int minInliers = std::max(3, static_cast<int>(m_MinInlierRatio * numSamples));
+        m_NumIterations = 0;
+
+        // The plane of the last frame only needs a refit while it keeps most of its inliers.
+        int bestCount = 0;
+        if (m_HasPlane) {
+            bestCount = countInliers(m_Normal, m_Distance);
+            if (bestCount >= minInliers && bestCount >= 0.8f * m_InlierRatio * numSamples) {
+                refit();
+                return true;
+            }
+        }
+
+        ofVec3f bestNormal = m_Normal;
+        float bestDistance = m_Distance;
+        const float minCosine = cosf(ofDegToRad(m_MaxAngle));
+        const int minSubset = std::min(numSamples, std::max(3, numSamples / 10));
+        const int growIterations = std::max(m_MaxIterations / 4, 1);
+        int requiredIterations = m_MaxIterations;
+        for (int i = 0; i < requiredIterations && numSamples >= 3; i++) {
+            m_NumIterations++;
+
+            // PROSAC: the subset of the flattest samples grows linearly to all of them.
+            const int subset = std::min(numSamples, minSubset + (numSamples - minSubset) * i / growIterations);
+            const int a = random(subset);
+            int b = random(subset - 1);
+            b += b >= a;
+            int c = random(subset - 2);
+            c += c >= std::min(a, b);
+            c += c >= std::max(a, b);
+
+            const ofVec3f p0(m_X[a], m_Y[a], m_Z[a]);
+            ofVec3f normal = (ofVec3f(m_X[b], m_Y[b], m_Z[b]) - p0).getCrossed(ofVec3f(m_X[c], m_Y[c], m_Z[c]) - p0);
+            const float length = normal.length();
+            if (length <= 0) {
+                continue;
+            }
+
+            normal /= length;
+            if (std::abs(normal.dot(m_ExpectedNormal)) < minCosine) {
+                continue;
+            }
+
+            const float distance = -normal.dot(p0);
+            const int count = countInliers(normal, distance);
+            if (count > bestCount) {
+                bestCount = count;
+                bestNormal = normal;
+                bestDistance = distance;
+
+                // Iterations for the confidence that one hypothesis drew 3 inliers, at the best ratio so far.
+                const double ratio = static_cast<double>(count) / numSamples;
+                const double missProbability = 1. - ratio * ratio * ratio;
+                if (missProbability <= 0) {
+                    break;
+                }
+                const double needed = log(1. - m_Confidence) / log(missProbability);
+                requiredIterations = static_cast<int>(std::min<double>(needed, m_MaxIterations));
+            }
+        }
+
+        if (bestCount < minInliers) {
+            m_HasPlane = false;
+            m_InlierRatio = 0;
+            return false;
+        }
+
+        m_Normal = bestNormal;
+        m_Distance = bestDistance;
+        m_HasPlane = true;
+        refit();
+        return true;
+    }
+
+    /**
+     * @brief Forgets the plane, the next update() starts from scratch.
+     */
+    void reset()
+    {
+        m_HasPlane = false;
+        m_InlierRatio = 0;
+    }
+
+    bool hasPlane() const
+    {
+        return m_HasPlane;
+    }
+
+    /**
+     * @brief Unit normal towards the camera.
+     */
+    const ofVec3f &getNormal() const
+    {
+        return m_Normal;
+    }
+
+    /**
+     * @brief Distance from the camera to the plane in millimeters, normal.dot(point) + distance is 0 on the plane.
+     */
+    float getDistance() const
+    {
+        return m_Distance;
+    }
+
+    /**
+     * @brief Positive in front of the plane, on the camera side.
+     */
+    float getSignedDistance(const ofVec3f &point) const
+    {
+        return m_Normal.dot(point) + m_Distance;
+    }
+
+    /**
+     * @brief For the floor, the pitch of the sensor in degrees, positive when it looks down.
+     */
+    float getTiltAngle() const
+    {
+        return ofRadToDeg(atan2(m_Normal.z, m_Normal.y));
+    }
+
+    float getInlierRatio() const
+    {
+        return m_InlierRatio;
+    }
+
+    /**
+     * @brief Hypotheses tested in the last update(), 0 when the previous plane was kept.
+     */
+    int getNumIterations() const
+    {
+        return m_NumIterations;
+    }
+
+    int getNumSamples() const
+    {
+        return m_X.size();
+    }
+
+    /**
+     * @brief Every step-th pixel of every step-th row is sampled.
+     */
+    void setSampleStep(int step)
+    {
+        m_SampleStep = std::max(step, 1);
+    }
+    int getSampleStep() const
+    {
+        return m_SampleStep;
+    }
+
+    /**
+     * @brief Maximum distance of an inlier to the plane in millimeters.
+     */
+    void setInlierThreshold(float threshold)
+    {
+        m_InlierThreshold = std::max(threshold, 0.f);
+    }
+    float getInlierThreshold() const
+    {
+        return m_InlierThreshold;
+    }
+
+    void setMaxIterations(int maxIterations)
+    {
+        m_MaxIterations = std::max(maxIterations, 1);
+    }
+    int getMaxIterations() const
+    {
+        return m_MaxIterations;
+    }
+
+    /**
+     * @brief Probability that the search found the best plane before it stops early, 0 - 1.
+     */
+    void setConfidence(float confidence)
+    {
+        m_Confidence = ofClamp(confidence, 0.f, 0.9999f);
+    }
+    float getConfidence() const
+    {
+        return m_Confidence;
+    }
+
+    /**
+     * @brief Part of the samples a plane must explain to be accepted.
+     */
+    void setMinInlierRatio(float ratio)
+    {
+        m_MinInlierRatio = ofClamp(ratio, 0.f, 1.f);
+    }
+    float getMinInlierRatio() const
+    {
+        return m_MinInlierRatio;
+    }
+
+    /**
+     * @brief Only accepts planes whose normal is within maxAngle degrees of the given one, e.g. (0, 1, 0) and 30
+     * for the floor of a level sensor. 180 accepts any plane.
+     */
+    void setExpectedNormal(const ofVec3f &normal, float maxAngle)
+    {
+        m_ExpectedNormal = normal.getNormalized();
+        m_MaxAngle = ofClamp(maxAngle, 0.f, 180.f);
+    }
+
+protected:
+    int m_SampleStep;
+    float m_InlierThreshold;
+    int m_MaxIterations;
+    float m_Confidence, m_MinInlierRatio;
+    ofVec3f m_ExpectedNormal;
+    float m_MaxAngle;
+    float m_xzFactor, m_yzFactor;
+    int m_RoiX, m_RoiY;
+    int m_FrameWidth, m_FrameHeight;
+
+    bool m_HasPlane;
+    ofVec3f m_Normal;
+    float m_Distance, m_InlierRatio;
+    int m_NumIterations;
+    uint32_t m_Random;
+
+    /** @brief The samples, flattest first. */
+    std::vector<float> m_X, m_Y, m_Z;
+    std::vector<unsigned char> m_Buckets;
+    std::vector<int> m_Pixels;
+
+protected:
+    /**
+     * @brief The camera space points of the sampled pixels, ranked by how much the depth bends around them: the
+     * second differences over the sample step relative to the depth, counting sorted into buckets.
+     */
+    void collectSamples(const ofShortPixels &depth)
+    {
+        static const int NUM_BUCKETS = 32;
+
+        const int width = depth.getWidth();
+        const int height = depth.getHeight();
+        const int step = m_SampleStep;
+        const int half = std::max(step / 2, 1);
+        const unsigned short *pixels = depth.getPixels();
+        const bool hasRoi = m_FrameWidth > 0 && m_FrameHeight > 0;
+        const float invW = 1.f / (hasRoi ? m_FrameWidth : width);
+        const float invH = 1.f / (hasRoi ? m_FrameHeight : height);
+        // x * invW + offsetX runs from -0.5 to 0.5 over the frame, not only over the region.
+        const float offsetX = hasRoi ? m_RoiX * invW - 0.5f : -0.5f;
+        const float offsetY = hasRoi ? m_RoiY * invH - 0.5f : -0.5f;
+
+        m_Buckets.clear();
+        m_Pixels.clear();
+        int counts[NUM_BUCKETS + 1] = { 0 };
+        for (int y = half; y < height - half; y += step) {
+            const unsigned short *row = pixels + y * width;
+            for (int x = half; x < width - half; x += step) {
+                const int center = row[x];
+                const int left = row[x - half], right = row[x + half];
+                const int up = row[x - half * width], down = row[x + half * width];
+                if (center == 0 || left == 0 || right == 0 || up == 0 || down == 0) {
+                    continue;
+                }
+
+                // Flat within about 0.2 % of the depth goes to the first bucket.
+                const float bend = static_cast<float>(std::abs(left + right - 2 * center) + std::abs(up + down - 2 * center)) / center;
+                const int bucket = std::min(static_cast<int>(bend * 500.f), NUM_BUCKETS - 1);
+                counts[bucket + 1]++;
+                m_Buckets.push_back(static_cast<unsigned char>(bucket));
+                m_Pixels.push_back(y * width + x);
+            }
+        }
+
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            counts[i + 1] += counts[i];
+        }
+
+        const int numSamples = m_Pixels.size();
+        m_X.resize(numSamples);
+        m_Y.resize(numSamples);
+        m_Z.resize(numSamples);
+        for (int i = 0; i < numSamples; i++) {
+            const int index = counts[m_Buckets[i]]++;
+            const int x = m_Pixels[i] % width;
+            const int y = m_Pixels[i] / width;
+            const float Z = pixels[m_Pixels[i]];
+            m_X[index] = (x * invW + offsetX) * m_xzFactor * Z;
+            m_Y[index] = (y * invH + offsetY) * m_yzFactor * Z;
+            m_Z[index] = -Z;
+        }
+    }
+
+    int countInliers(const ofVec3f &normal, float distance) const
+    {
+        const int numSamples = m_X.size();
+        const float *xs = numSamples > 0 ? &m_X[0] : nullptr;
+        const float *ys = numSamples > 0 ? &m_Y[0] : nullptr;
+        const float *zs = numSamples > 0 ? &m_Z[0] : nullptr;
+        int count = 0;
+        int i = 0;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128 nx = _mm_set1_ps(normal.x);
+        const __m128 ny = _mm_set1_ps(normal.y);
+        const __m128 nz = _mm_set1_ps(normal.z);
+        const __m128 d = _mm_set1_ps(distance);
+        const __m128 threshold = _mm_set1_ps(m_InlierThreshold);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128i counts = _mm_setzero_si128();
+        for (; i + 4 <= numSamples; i += 4) {
+            const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(xs + i)), _mm_mul_ps(ny, _mm_loadu_ps(ys + i))),
+                                          _mm_add_ps(_mm_mul_ps(nz, _mm_loadu_ps(zs + i)), d));
+            // The comparison gives -1 for the inliers.
+            counts = _mm_sub_epi32(counts, _mm_castps_si128(_mm_cmple_ps(_mm_and_ps(dot, absMask), threshold)));
+        }
+        counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(1, 0, 3, 2)));
+        counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(2, 3, 0, 1)));
+        count = _mm_cvtsi128_si32(counts);
+#endif
+
+        for (; i < numSamples; i++) {
+            if (std::abs(normal.x * xs[i] + normal.y * ys[i] + normal.z * zs[i] + distance) <= m_InlierThreshold) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Least squares plane of the inliers of the current plane, twice as the inliers change with it. Then
+     * turns the normal towards the camera.
+     */
+    void refit()
+    {
+        const int numSamples = m_X.size();
+        for (int round = 0; round < 2; round++) {
+            double sums[9] = { 0 };
+            int count = 0;
+            for (int i = 0; i < numSamples; i++) {
+                const float x = m_X[i], y = m_Y[i], z = m_Z[i];
+                if (std::abs(m_Normal.x * x + m_Normal.y * y + m_Normal.z * z + m_Distance) > m_InlierThreshold) {
+                    continue;
+                }
+
+                sums[0] += x;
+                sums[1] += y;
+                sums[2] += z;
+                sums[3] += x * x;
+                sums[4] += x * y;
+                sums[5] += x * z;
+                sums[6] += y * y;
+                sums[7] += y * z;
+                sums[8] += z * z;
+                count++;
+            }
+            if (count < 3) {
+                break;
+            }
+
+            const double invCount = 1. / count;
+            const ofVec3f mean(sums[0] * invCount, sums[1] * invCount, sums[2] * invCount);
+            float covariance[6] = {
+                static_cast<float>(sums[3] * invCount - mean.x * static_cast<double>(mean.x)),
+                static_cast<float>(sums[4] * invCount - mean.x * static_cast<double>(mean.y)),
+                static_cast<float>(sums[5] * invCount - mean.x * static_cast<double>(mean.z)),
+                static_cast<float>(sums[6] * invCount - mean.y * static_cast<double>(mean.y)),
+                static_cast<float>(sums[7] * invCount - mean.y * static_cast<double>(mean.z)),
+                static_cast<float>(sums[8] * invCount - mean.z * static_cast<double>(mean.z))
+            };
+
+            ofVec3f normal;
+            float surfaceVariation;
+            if (!getSmallestEigenvector(covariance, normal, surfaceVariation)) {
+                break;
+            }
+            m_Normal = normal;
+            m_Distance = -normal.dot(mean);
+        }
+
+        if (m_Distance < 0) {
+            m_Normal = -m_Normal;
+            m_Distance = -m_Distance;
+        }
+        m_InlierRatio = numSamples > 0 ? static_cast<float>(countInliers(m_Normal, m_Distance)) / numSamples : 0;
+    }
+
+    /**
+     * @brief xorshift32, uniform in [0, range).
+     */
+    int random(int range)
+    {
+        m_Random ^= m_Random << 13;
+        m_Random ^= m_Random >> 17;
+        m_Random ^= m_Random << 5;
+        return static_cast<int>((static_cast<uint64_t>(m_Random) * range) >> 32);
+    }
+};
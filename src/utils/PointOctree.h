@@ -0,0 +1,597 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include "Simd.h"
+
+namespace ofxKinect2
+{
+class PointOctree;
+} // namespace ofxKinect2
+
+/**
+ * @brief Spatial index over a point cloud, e.g. the vertices of MeshGenerator, to count the points in many boxes or
+ * spheres, test them for occupancy or find the nearest point every frame without going over the whole cloud.
+ *
+ * The octree is linear: the points are sorted by the Morton code of their cell in a 2^depth grid over their bounds,
+ * so every node is a contiguous range of the sorted points and the nodes only store their range and first child.
+ * Each update() rebuilds it, the cloud of a moving depth frame changes everywhere. The codes and the radix sort run
+ * in parallel, and all the buffers are kept so a rebuild allocates nothing once they reached the cloud's size.
+ */
+class ofxKinect2::PointOctree
+{
+public:
+    static const int MAX_DEPTH = 10;
+
+    struct Box {
+        ofVec3f min, max;
+
+        Box()
+        {
+
+        }
+
+        Box(const ofVec3f &min, const ofVec3f &max)
+            : min(min)
+            , max(max)
+        {
+
+        }
+    };
+
+    struct Sphere {
+        ofVec3f center;
+        float radius;
+
+        Sphere()
+            : radius(0)
+        {
+
+        }
+
+        Sphere(const ofVec3f &center, float radius)
+            : center(center)
+            , radius(radius)
+        {
+
+        }
+    };
+
+    PointOctree()
+        : m_Depth(MAX_DEPTH)
+        , m_LeafSize(16)
+        , m_NumPoints(0)
+        , m_RootSize(0)
+    {
+
+    }
+
+    /**
+     * @brief Indexes the vertices of the mesh, the points at the origin (no depth) are left out.
+     */
+    void update(const ofMesh &mesh, Scheduler *scheduler = nullptr)
+    {
+        update(mesh.getVertices(), scheduler);
+    }
+
+    void update(const vector<ofVec3f> &points, Scheduler *scheduler = nullptr)
+    {
+        m_Nodes.clear();
+        const int numPoints = points.size();
+        const int numChunks = std::max(std::min(NUM_CHUNKS, numPoints / 1024), 1);
+        const ofVec3f *pointData = numPoints > 0 ? &points[0] : nullptr;
+
+        // The bounds and the number of valid points of every chunk.
+        parallelFor(scheduler, 0, numChunks, [this, pointData, numPoints, numChunks](int begin, int end) {
+            for (int chunk = begin; chunk < end; chunk++) {
+                ofVec3f &chunkMin = m_ChunkMin[chunk];
+                ofVec3f &chunkMax = m_ChunkMax[chunk];
+                chunkMin.set(std::numeric_limits<float>::max());
+                chunkMax.set(-std::numeric_limits<float>::max());
+                int count = 0;
+                for (int i = numPoints * chunk / numChunks; i < numPoints * (chunk + 1) / numChunks; i++) {
+                    const ofVec3f &p = pointData[i];
+                    if (p.z == 0) {
+                        continue;
+                    }
+                    chunkMin.set(std::min(chunkMin.x, p.x), std::min(chunkMin.y, p.y), std::min(chunkMin.z, p.z));
+                    chunkMax.set(std::max(chunkMax.x, p.x), std::max(chunkMax.y, p.y), std::max(chunkMax.z, p.z));
+                    count++;
+                }
+                m_ChunkOffsets[chunk + 1] = count;
+            }
+        });
+
+        ofVec3f boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+        m_ChunkOffsets[0] = 0;
+        for (int chunk = 0; chunk < numChunks; chunk++) {
+            boundsMin.set(std::min(boundsMin.x, m_ChunkMin[chunk].x), std::min(boundsMin.y, m_ChunkMin[chunk].y), std::min(boundsMin.z, m_ChunkMin[chunk].z));
+            boundsMax.set(std::max(boundsMax.x, m_ChunkMax[chunk].x), std::max(boundsMax.y, m_ChunkMax[chunk].y), std::max(boundsMax.z, m_ChunkMax[chunk].z));
+            m_ChunkOffsets[chunk + 1] += m_ChunkOffsets[chunk];
+        }
+        m_NumPoints = m_ChunkOffsets[numChunks];
+        if (m_NumPoints == 0) {
+            return;
+        }
+
+        // A cube a little larger than the bounds, so the points on the max faces still fall in the grid.
+        const ofVec3f extent = boundsMax - boundsMin;
+        m_RootMin = boundsMin;
+        m_RootSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f)) * 1.0001f;
+
+        if (m_Keys.size() < static_cast<size_t>(m_NumPoints)) {
+            m_Keys.resize(m_NumPoints);
+            m_SortKeys.resize(m_NumPoints);
+            m_X.resize(m_NumPoints);
+            m_Y.resize(m_NumPoints);
+            m_Z.resize(m_NumPoints);
+        }
+
+        const float scale = (1 << m_Depth) / m_RootSize;
+        parallelFor(scheduler, 0, numChunks, [this, pointData, numPoints, numChunks, scale](int begin, int end) {
+            const int maxCell = (1 << m_Depth) - 1;
+            for (int chunk = begin; chunk < end; chunk++) {
+                int index = m_ChunkOffsets[chunk];
+                for (int i = numPoints * chunk / numChunks; i < numPoints * (chunk + 1) / numChunks; i++) {
+                    const ofVec3f &p = pointData[i];
+                    if (p.z == 0) {
+                        continue;
+                    }
+                    const int x = std::min(static_cast<int>((p.x - m_RootMin.x) * scale), maxCell);
+                    const int y = std::min(static_cast<int>((p.y - m_RootMin.y) * scale), maxCell);
+                    const int z = std::min(static_cast<int>((p.z - m_RootMin.z) * scale), maxCell);
+                    const uint64_t code = spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+                    m_Keys[index++] = (code << 32) | i;
+                }
+            }
+        });
+
+        sortKeys(scheduler);
+
+        // The points in Morton order, so the nodes' points are read in sequence.
+        parallelFor(scheduler, 0, m_NumPoints, [this, pointData](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                const ofVec3f &p = pointData[static_cast<uint32_t>(m_Keys[i])];
+                m_X[i] = p.x;
+                m_Y[i] = p.y;
+                m_Z[i] = p.z;
+            }
+        }, 4096);
+
+        buildNodes();
+    }
+
+    /**
+     * @brief The number of points in each box, counts is resized to the number of boxes.
+     */
+    void countPoints(const vector<Box> &boxes, vector<int> &counts, Scheduler *scheduler = nullptr) const
+    {
+        runQueries(boxes, counts, std::numeric_limits<int>::max(), scheduler);
+    }
+    void countPoints(const vector<Sphere> &spheres, vector<int> &counts, Scheduler *scheduler = nullptr) const
+    {
+        runQueries(spheres, counts, std::numeric_limits<int>::max(), scheduler);
+    }
+
+    /**
+     * @brief 1 for the boxes with at least minPoints points in, 0 for the others. Stops counting at minPoints, so
+     * it's cheaper than countPoints() on dense clouds.
+     */
+    void getOccupancy(const vector<Box> &boxes, vector<int> &occupied, int minPoints = 1, Scheduler *scheduler = nullptr) const
+    {
+        runQueries(boxes, occupied, minPoints, scheduler);
+        for (size_t i = 0; i < occupied.size(); i++) {
+            occupied[i] = occupied[i] >= minPoints;
+        }
+    }
+    void getOccupancy(const vector<Sphere> &spheres, vector<int> &occupied, int minPoints = 1, Scheduler *scheduler = nullptr) const
+    {
+        runQueries(spheres, occupied, minPoints, scheduler);
+        for (size_t i = 0; i < occupied.size(); i++) {
+            occupied[i] = occupied[i] >= minPoints;
+        }
+    }
+
+    /**
+     * @brief The index in the updated points of the nearest one to each query and its distance, -1 and maxDistance
+     * when there is none closer than maxDistance.
+     */
+    void findNearest(const vector<ofVec3f> &queries, vector<int> &indices, vector<float> &distances,
+                     float maxDistance = std::numeric_limits<float>::max(), Scheduler *scheduler = nullptr) const
+    {
+        indices.resize(queries.size());
+        distances.resize(queries.size());
+        if (queries.empty()) {
+            return;
+        }
+
+        const ofVec3f *queryData = &queries[0];
+        int *indexData = &indices[0];
+        float *distanceData = &distances[0];
+        parallelFor(scheduler, 0, queries.size(), [this, queryData, indexData, distanceData, maxDistance](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                indexData[i] = findNearest(queryData[i], maxDistance, &distanceData[i]);
+            }
+        }, 16);
+    }
+
+    int countPoints(const Box &box) const
+    {
+        return count(box, std::numeric_limits<int>::max());
+    }
+    int countPoints(const Sphere &sphere) const
+    {
+        return count(sphere, std::numeric_limits<int>::max());
+    }
+
+    bool isOccupied(const Box &box, int minPoints = 1) const
+    {
+        return count(box, minPoints) >= minPoints;
+    }
+    bool isOccupied(const Sphere &sphere, int minPoints = 1) const
+    {
+        return count(sphere, minPoints) >= minPoints;
+    }
+
+    /**
+     * @brief Depth first, the nearest child first, skipping the nodes further than the best point so far.
+     */
+    int findNearest(const ofVec3f &query, float maxDistance = std::numeric_limits<float>::max(), float *distance = nullptr) const
+    {
+        float bestSquared = maxDistance < std::numeric_limits<float>::max() ? maxDistance * maxDistance : maxDistance;
+        int best = -1;
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        if (!m_Nodes.empty()) {
+            stack[stackSize++] = 0;
+        }
+
+        while (stackSize > 0) {
+            const Node &node = m_Nodes[stack[--stackSize]];
+            if (getSquaredDistance(query, node) >= bestSquared) {
+                continue;
+            }
+
+            if (node.numChildren == 0) {
+                for (int i = node.begin; i < node.end; i++) {
+                    const float dx = m_X[i] - query.x, dy = m_Y[i] - query.y, dz = m_Z[i] - query.z;
+                    const float squared = dx * dx + dy * dy + dz * dz;
+                    if (squared < bestSquared) {
+                        bestSquared = squared;
+                        best = i;
+                    }
+                }
+                continue;
+            }
+
+            // Pushed furthest first so the nearest is visited first.
+            int children[8];
+            float childDistances[8];
+            for (int c = 0; c < node.numChildren; c++) {
+                const float childDistance = getSquaredDistance(query, m_Nodes[node.firstChild + c]);
+                int j = c;
+                for (; j > 0 && childDistances[j - 1] < childDistance; j--) {
+                    children[j] = children[j - 1];
+                    childDistances[j] = childDistances[j - 1];
+                }
+                children[j] = node.firstChild + c;
+                childDistances[j] = childDistance;
+            }
+            for (int c = 0; c < node.numChildren; c++) {
+                if (childDistances[c] < bestSquared) {
+                    stack[stackSize++] = children[c];
+                }
+            }
+        }
+
+        if (distance) {
+            *distance = best >= 0 ? sqrt(bestSquared) : maxDistance;
+        }
+        return best >= 0 ? static_cast<uint32_t>(m_Keys[best]) : -1;
+    }
+
+    /**
+     * @brief Points indexed by the last update(), without those at the origin.
+     */
+    int getNumPoints() const
+    {
+        return m_Nodes.empty() ? 0 : m_NumPoints;
+    }
+
+    int getNumNodes() const
+    {
+        return m_Nodes.size();
+    }
+
+    /**
+     * @brief The levels of the grid, the finest cells are the bounds over 2^depth.
+     */
+    void setDepth(int depth)
+    {
+        m_Depth = ofClamp(depth, 1, MAX_DEPTH);
+    }
+    int getDepth() const
+    {
+        return m_Depth;
+    }
+
+    /**
+     * @brief Nodes with as few points aren't split further, their points are tested one by one.
+     */
+    void setLeafSize(int leafSize)
+    {
+        m_LeafSize = std::max(leafSize, 1);
+    }
+    int getLeafSize() const
+    {
+        return m_LeafSize;
+    }
+
+protected:
+    static const int NUM_CHUNKS = 32;
+    static const int RADIX_BITS = 10;
+    static const int RADIX_SIZE = 1 << RADIX_BITS;
+    /** @brief A node pops once and pushes at most 8 children per level. */
+    static const int STACK_SIZE = 7 * MAX_DEPTH + 8;
+
+    /** @brief The points of a node are m_X[begin, end), its children are contiguous. */
+    struct Node {
+        float minX, minY, minZ;
+        int level;
+        int begin, end;
+        int firstChild, numChildren;
+    };
+
+    enum Overlap {
+        OVERLAP_NONE,
+        OVERLAP_PARTIAL,
+        OVERLAP_FULL
+    };
+
+    int m_Depth, m_LeafSize;
+    int m_NumPoints;
+    ofVec3f m_RootMin;
+    float m_RootSize;
+
+    std::vector<Node> m_Nodes;
+    /** @brief The Morton code in the high 32 bits, the index of the point in the low ones. */
+    std::vector<uint64_t> m_Keys, m_SortKeys;
+    std::vector<float> m_X, m_Y, m_Z;
+
+    ofVec3f m_ChunkMin[NUM_CHUNKS], m_ChunkMax[NUM_CHUNKS];
+    int m_ChunkOffsets[NUM_CHUNKS + 1];
+    int m_Histograms[NUM_CHUNKS][RADIX_SIZE];
+
+protected:
+    /**
+     * @brief Inserts two 0 bits between the 10 bits of the value, the Morton code interleaves three of them.
+     */
+    static uint32_t spreadBits(uint32_t value)
+    {
+        value = (value | (value << 16)) & 0x030000FF;
+        value = (value | (value << 8)) & 0x0300F00F;
+        value = (value | (value << 4)) & 0x030C30C3;
+        value = (value | (value << 2)) & 0x09249249;
+        return value;
+    }
+
+    /**
+     * @brief LSD radix sort of the keys on their codes, RADIX_BITS per pass. The points are split in chunks that
+     * histogram in parallel, then scatter in parallel to the offsets the histograms give, which keeps every pass
+     * stable.
+     */
+    void sortKeys(Scheduler *scheduler)
+    {
+        const int numPoints = m_NumPoints;
+        const int numChunks = std::max(std::min(NUM_CHUNKS, numPoints / 1024), 1);
+        const int numBits = m_Depth * 3;
+        for (int shift = 32; shift < 32 + numBits; shift += RADIX_BITS) {
+            const uint64_t *keys = &m_Keys[0];
+            uint64_t *sortedKeys = &m_SortKeys[0];
+
+            parallelFor(scheduler, 0, numChunks, [this, keys, numPoints, numChunks, shift](int begin, int end) {
+                for (int chunk = begin; chunk < end; chunk++) {
+                    int *histogram = m_Histograms[chunk];
+                    std::fill(histogram, histogram + RADIX_SIZE, 0);
+                    for (int i = numPoints * chunk / numChunks; i < numPoints * (chunk + 1) / numChunks; i++) {
+                        histogram[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+                    }
+                }
+            });
+
+            // Bucket by bucket, chunk by chunk: the first index each chunk writes its bucket to.
+            int offset = 0;
+            for (int bucket = 0; bucket < RADIX_SIZE; bucket++) {
+                for (int chunk = 0; chunk < numChunks; chunk++) {
+                    const int count = m_Histograms[chunk][bucket];
+                    m_Histograms[chunk][bucket] = offset;
+                    offset += count;
+                }
+            }
+
+            parallelFor(scheduler, 0, numChunks, [this, keys, sortedKeys, numPoints, numChunks, shift](int begin, int end) {
+                for (int chunk = begin; chunk < end; chunk++) {
+                    int *offsets = m_Histograms[chunk];
+                    for (int i = numPoints * chunk / numChunks; i < numPoints * (chunk + 1) / numChunks; i++) {
+                        sortedKeys[offsets[(keys[i] >> shift) & (RADIX_SIZE - 1)]++] = keys[i];
+                    }
+                }
+            });
+
+            m_Keys.swap(m_SortKeys);
+        }
+    }
+
+    /**
+     * @brief Splits the nodes breadth first, so the children of a node are appended next to each other. The
+     * children's ranges are found by binary search on the sorted codes.
+     */
+    void buildNodes()
+    {
+        const Node root = { m_RootMin.x, m_RootMin.y, m_RootMin.z, 0, 0, m_NumPoints, 0, 0 };
+        m_Nodes.push_back(root);
+        const uint64_t *keys = &m_Keys[0];
+        for (size_t n = 0; n < m_Nodes.size(); n++) {
+            const Node node = m_Nodes[n];
+            if (node.end - node.begin <= m_LeafSize || node.level == m_Depth) {
+                continue;
+            }
+
+            const int shift = 3 * (m_Depth - node.level - 1);
+            const float childSize = getSize(node.level + 1);
+            const int firstChild = m_Nodes.size();
+            for (int begin = node.begin; begin < node.end;) {
+                const uint64_t prefix = keys[begin] >> (shift + 32);
+                const int end = std::lower_bound(keys + begin, keys + node.end, (prefix + 1) << (shift + 32)) - keys;
+                const int octant = static_cast<int>(prefix & 7);
+                const Node child = { node.minX + (octant & 1) * childSize, node.minY + ((octant >> 1) & 1) * childSize,
+                                     node.minZ + (octant >> 2) * childSize, node.level + 1, begin, end, 0, 0 };
+                m_Nodes.push_back(child);
+                begin = end;
+            }
+            m_Nodes[n].firstChild = firstChild;
+            m_Nodes[n].numChildren = m_Nodes.size() - firstChild;
+        }
+    }
+
+    float getSize(int level) const
+    {
+        return m_RootSize / (1 << level);
+    }
+
+    float getSquaredDistance(const ofVec3f &point, const Node &node) const
+    {
+        const float size = getSize(node.level);
+        const float dx = std::max(std::max(node.minX - point.x, point.x - node.minX - size), 0.f);
+        const float dy = std::max(std::max(node.minY - point.y, point.y - node.minY - size), 0.f);
+        const float dz = std::max(std::max(node.minZ - point.z, point.z - node.minZ - size), 0.f);
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    Overlap getOverlap(const Box &box, const Node &node) const
+    {
+        const float size = getSize(node.level);
+        if (box.max.x < node.minX || box.min.x > node.minX + size || box.max.y < node.minY || box.min.y > node.minY + size
+            || box.max.z < node.minZ || box.min.z > node.minZ + size) {
+            return OVERLAP_NONE;
+        }
+        if (box.min.x <= node.minX && box.max.x >= node.minX + size && box.min.y <= node.minY && box.max.y >= node.minY + size
+            && box.min.z <= node.minZ && box.max.z >= node.minZ + size) {
+            return OVERLAP_FULL;
+        }
+        return OVERLAP_PARTIAL;
+    }
+
+    Overlap getOverlap(const Sphere &sphere, const Node &node) const
+    {
+        const float radiusSquared = sphere.radius * sphere.radius;
+        if (getSquaredDistance(sphere.center, node) > radiusSquared) {
+            return OVERLAP_NONE;
+        }
+
+        // Inside when the farthest corner is.
+        const float size = getSize(node.level);
+        const float dx = std::max(sphere.center.x - node.minX, node.minX + size - sphere.center.x);
+        const float dy = std::max(sphere.center.y - node.minY, node.minY + size - sphere.center.y);
+        const float dz = std::max(sphere.center.z - node.minZ, node.minZ + size - sphere.center.z);
+        return dx * dx + dy * dy + dz * dz <= radiusSquared ? OVERLAP_FULL : OVERLAP_PARTIAL;
+    }
+
+    int countLeaf(const Box &box, int begin, int end) const
+    {
+        int count = 0;
+        int i = begin;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128 minX = _mm_set1_ps(box.min.x), minY = _mm_set1_ps(box.min.y), minZ = _mm_set1_ps(box.min.z);
+        const __m128 maxX = _mm_set1_ps(box.max.x), maxY = _mm_set1_ps(box.max.y), maxZ = _mm_set1_ps(box.max.z);
+        for (; i + 4 <= end; i += 4) {
+            const __m128 x = _mm_loadu_ps(&m_X[i]), y = _mm_loadu_ps(&m_Y[i]), z = _mm_loadu_ps(&m_Z[i]);
+            const __m128 inX = _mm_and_ps(_mm_cmpge_ps(x, minX), _mm_cmple_ps(x, maxX));
+            const __m128 inY = _mm_and_ps(_mm_cmpge_ps(y, minY), _mm_cmple_ps(y, maxY));
+            const __m128 inZ = _mm_and_ps(_mm_cmpge_ps(z, minZ), _mm_cmple_ps(z, maxZ));
+            const int mask = _mm_movemask_ps(_mm_and_ps(_mm_and_ps(inX, inY), inZ));
+            count += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+        }
+#endif
+        for (; i < end; i++) {
+            count += m_X[i] >= box.min.x && m_X[i] <= box.max.x && m_Y[i] >= box.min.y && m_Y[i] <= box.max.y
+                     && m_Z[i] >= box.min.z && m_Z[i] <= box.max.z;
+        }
+        return count;
+    }
+
+    int countLeaf(const Sphere &sphere, int begin, int end) const
+    {
+        const float radiusSquared = sphere.radius * sphere.radius;
+        int count = 0;
+        int i = begin;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128 cx = _mm_set1_ps(sphere.center.x), cy = _mm_set1_ps(sphere.center.y), cz = _mm_set1_ps(sphere.center.z);
+        const __m128 r2 = _mm_set1_ps(radiusSquared);
+        for (; i + 4 <= end; i += 4) {
+            const __m128 dx = _mm_sub_ps(_mm_loadu_ps(&m_X[i]), cx);
+            const __m128 dy = _mm_sub_ps(_mm_loadu_ps(&m_Y[i]), cy);
+            const __m128 dz = _mm_sub_ps(_mm_loadu_ps(&m_Z[i]), cz);
+            const __m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            const int mask = _mm_movemask_ps(_mm_cmple_ps(squared, r2));
+            count += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+        }
+#endif
+        for (; i < end; i++) {
+            const float dx = m_X[i] - sphere.center.x, dy = m_Y[i] - sphere.center.y, dz = m_Z[i] - sphere.center.z;
+            count += dx * dx + dy * dy + dz * dz <= radiusSquared;
+        }
+        return count;
+    }
+
+    /**
+     * @brief The points in the shape, stopping once limit is reached. Whole nodes count at once when the shape
+     * contains them.
+     */
+    template<class Shape>
+    int count(const Shape &shape, int limit) const
+    {
+        int total = 0;
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        if (!m_Nodes.empty()) {
+            stack[stackSize++] = 0;
+        }
+
+        while (stackSize > 0 && total < limit) {
+            const Node &node = m_Nodes[stack[--stackSize]];
+            const Overlap overlap = getOverlap(shape, node);
+            if (overlap == OVERLAP_NONE) {
+                continue;
+            }
+            if (overlap == OVERLAP_FULL) {
+                total += node.end - node.begin;
+            }
+            else if (node.numChildren == 0) {
+                total += countLeaf(shape, node.begin, node.end);
+            }
+            else {
+                for (int c = node.numChildren - 1; c >= 0; c--) {
+                    stack[stackSize++] = node.firstChild + c;
+                }
+            }
+        }
+        return total;
+    }
+
+    template<class Shape>
+    void runQueries(const vector<Shape> &shapes, vector<int> &counts, int limit, Scheduler *scheduler) const
+    {
+        counts.resize(shapes.size());
+        if (shapes.empty()) {
+            return;
+        }
+
+        const Shape *shapeData = &shapes[0];
+        int *countData = &counts[0];
+        parallelFor(scheduler, 0, shapes.size(), [this, shapeData, countData, limit](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                countData[i] = count(shapeData[i], limit);
+            }
+        }, 16);
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+#include <memory>
+#include <mutex>
+
+namespace ofxKinect2
+{
+class ProcessingNodeBase;
+template<typename Pixels>
+class ProcessingNode;
+template<typename Pixels>
+class ProcessingSource;
+template<typename Input, typename Output>
+class ProcessingStage;
+template<typename Pixels>
+class ProcessingOutput;
+class ProcessingGraph;
+} // namespace ofxKinect2
+
+/**
+ * @brief What every node of a ProcessingGraph has: a name and timings.
+ */
+class ofxKinect2::ProcessingNodeBase
+{
+public:
+    struct Stats {
+        Stats()
+            : numFrames(0)
+            , numDropped(0)
+            , lastMillis(0)
+            , averageMillis(0)
+        {
+
+        }
+
+        int numFrames;
+        /** @brief Frames that were replaced by a newer one while the node was busy, or found no free buffer. */
+        int numDropped;
+        float lastMillis, averageMillis;
+    };
+
+    explicit ProcessingNodeBase(const string &name)
+        : m_Name(name)
+    {
+
+    }
+
+    virtual ~ProcessingNodeBase()
+    {
+
+    }
+
+    const string &getName() const
+    {
+        return m_Name;
+    }
+
+    Stats getStats()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Stats;
+    }
+
+    /**
+     * @brief Drops the frames in flight, called before the scheduler stops so the tasks it still runs skip them.
+     */
+    virtual void reset()
+    {
+
+    }
+
+protected:
+    string m_Name;
+    std::mutex m_Mutex;
+    Stats m_Stats;
+
+protected:
+    void addTiming(unsigned long long startMicros)
+    {
+        const float millis = (ofGetElapsedTimeMicros() - startMicros) / 1000.f;
+        m_Stats.lastMillis = millis;
+        m_Stats.averageMillis = m_Stats.numFrames == 0 ? millis : ofLerp(m_Stats.averageMillis, millis, 0.1f);
+        m_Stats.numFrames++;
+    }
+};
+
+/**
+ * @brief A node that takes frames of the given pixel type. The frames are shared between the nodes read only.
+ */
+template<typename Pixels>
+class ofxKinect2::ProcessingNode : public ofxKinect2::ProcessingNodeBase
+{
+public:
+    typedef std::shared_ptr<const Pixels> Frame;
+
+    explicit ProcessingNode(const string &name)
+        : ProcessingNodeBase(name)
+    {
+
+    }
+
+    virtual void push(const Frame &frame) = 0;
+};
+
+namespace ofxKinect2
+{
+/**
+ * @brief Hands out buffers that no node holds anymore, so the frames are allocated once and recycled. At most
+ * maxBuffers are allocated, consumers that hold on to frames make acquire() fail instead of growing the pool.
+ */
+template<typename Pixels>
+class ProcessingBufferPool
+{
+public:
+    explicit ProcessingBufferPool(size_t maxBuffers = 4)
+        : m_MaxBuffers(maxBuffers)
+    {
+
+    }
+
+    /**
+     * @brief A free buffer, nullptr when all maxBuffers are held.
+     */
+    std::shared_ptr<Pixels> acquire()
+    {
+        // Only the pool copies these pointers, so a buffer the pool alone holds is free.
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (size_t i = 0; i < m_Buffers.size(); i++) {
+            if (m_Buffers[i].use_count() == 1) {
+                return m_Buffers[i];
+            }
+        }
+        if (m_Buffers.size() >= m_MaxBuffers) {
+            return std::shared_ptr<Pixels>();
+        }
+
+        m_Buffers.push_back(std::make_shared<Pixels>());
+        return m_Buffers.back();
+    }
+
+private:
+    std::mutex m_Mutex;
+    std::vector<std::shared_ptr<Pixels> > m_Buffers;
+    size_t m_MaxBuffers;
+};
+
+template<typename Pixels>
+void deliver(const std::vector<ProcessingNode<Pixels> *> &nodes, const std::shared_ptr<const Pixels> &frame)
+{
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]->push(frame);
+    }
+}
+} // namespace ofxKinect2
+
+/**
+ * @brief Where the frames of a stream enter the graph, see the streams' setProcessingSource().
+ */
+template<typename Pixels>
+class ofxKinect2::ProcessingSource : public ofxKinect2::ProcessingNodeBase
+{
+public:
+    typedef typename ProcessingNode<Pixels>::Frame Frame;
+
+    explicit ProcessingSource(const string &name)
+        : ProcessingNodeBase(name)
+    {
+
+    }
+
+    void connect(ProcessingNode<Pixels> &node)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Nodes.push_back(&node);
+    }
+
+    /**
+     * @brief Copies the pixels into a recycled buffer, the streams call it under their lock. Returns nullptr and
+     * counts a dropped frame while the nodes hold every buffer of the pool.
+     */
+    Frame stage(const Pixels &pixels)
+    {
+        const unsigned long long start = ofGetElapsedTimeMicros();
+        std::shared_ptr<Pixels> buffer = m_Pool.acquire();
+        if (buffer) {
+            *buffer = pixels;
+        }
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (buffer) {
+            addTiming(start);
+        }
+        else {
+            m_Stats.numDropped++;
+        }
+        return buffer;
+    }
+
+    /**
+     * @brief Passes a staged frame on, the streams call it on the acquisition thread once their lock is released.
+     */
+    void push(const Frame &frame)
+    {
+        std::vector<ProcessingNode<Pixels> *> nodes;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            nodes = m_Nodes;
+        }
+        deliver<Pixels>(nodes, frame);
+    }
+
+    void push(const Pixels &pixels)
+    {
+        const Frame frame = stage(pixels);
+        if (frame) {
+            push(frame);
+        }
+    }
+
+protected:
+    std::vector<ProcessingNode<Pixels> *> m_Nodes;
+    ProcessingBufferPool<Pixels> m_Pool;
+};
+
+/**
+ * @brief Runs the function on every frame as a scheduler task and passes the result on. A stage works on one frame
+ * at a time, but different stages run at the same time on different frames, so a chain is pipelined. When a frame
+ * arrives while the stage is busy it waits, and a newer one replaces it.
+ */
+template<typename Input, typename Output>
+class ofxKinect2::ProcessingStage : public ofxKinect2::ProcessingNode<Input>
+{
+public:
+    typedef std::function<void(const Input &, Output &)> Function;
+    typedef typename ProcessingNode<Input>::Frame Frame;
+
+    ProcessingStage(const string &name, Function function, Scheduler *scheduler)
+        : ProcessingNode<Input>(name)
+        , m_Function(function)
+        , m_Scheduler(scheduler)
+        , m_IsBusy(false)
+        , m_Generation(0)
+    {
+
+    }
+
+    void connect(ProcessingNode<Output> &node)
+    {
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        m_Nodes.push_back(&node);
+    }
+
+    void push(const Frame &frame)
+    {
+        int generation;
+        {
+            std::lock_guard<std::mutex> lock(this->m_Mutex);
+            if (m_IsBusy) {
+                if (m_Pending) {
+                    this->m_Stats.numDropped++;
+                }
+                m_Pending = frame;
+                return;
+            }
+            m_IsBusy = true;
+            generation = m_Generation;
+        }
+
+        if (m_Scheduler) {
+            m_Scheduler->submit([this, frame, generation]() {
+                run(frame, generation);
+            });
+        }
+        else {
+            run(frame, generation);
+        }
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        m_Pending.reset();
+        m_IsBusy = false;
+        m_Generation++;
+    }
+
+protected:
+    Function m_Function;
+    Scheduler *m_Scheduler;
+    std::vector<ProcessingNode<Output> *> m_Nodes;
+    ProcessingBufferPool<Output> m_Pool;
+    bool m_IsBusy;
+    Frame m_Pending;
+    /** @brief Bumped by reset(), the tasks submitted before it drop their frame. */
+    int m_Generation;
+
+protected:
+    void run(Frame frame, int generation)
+    {
+        while (frame) {
+            const unsigned long long start = ofGetElapsedTimeMicros();
+            std::shared_ptr<Output> output = m_Pool.acquire();
+            if (output) {
+                m_Function(*frame, *output);
+            }
+
+            std::vector<ProcessingNode<Output> *> nodes;
+            {
+                std::lock_guard<std::mutex> lock(this->m_Mutex);
+                if (generation != m_Generation) {
+                    return;
+                }
+                if (output) {
+                    this->addTiming(start);
+                    nodes = m_Nodes;
+                }
+                else {
+                    this->m_Stats.numDropped++;
+                }
+            }
+            deliver<Output>(nodes, output);
+
+            // Keep going with the frame that came in meanwhile, if any.
+            std::lock_guard<std::mutex> lock(this->m_Mutex);
+            if (generation != m_Generation) {
+                return;
+            }
+            frame = m_Pending;
+            m_Pending.reset();
+            m_IsBusy = frame != nullptr;
+        }
+    }
+};
+
+/**
+ * @brief The end of a chain, keeps the latest frame for the app and optionally calls back on the worker thread.
+ */
+template<typename Pixels>
+class ofxKinect2::ProcessingOutput : public ofxKinect2::ProcessingNode<Pixels>
+{
+public:
+    typedef std::function<void(const Pixels &)> Callback;
+    typedef typename ProcessingNode<Pixels>::Frame Frame;
+
+    explicit ProcessingOutput(const string &name)
+        : ProcessingNode<Pixels>(name)
+        , m_IsFrameNew(false)
+    {
+
+    }
+
+    void push(const Frame &frame)
+    {
+        const unsigned long long start = ofGetElapsedTimeMicros();
+        Callback callback;
+        {
+            std::lock_guard<std::mutex> lock(this->m_Mutex);
+            if (m_IsFrameNew) {
+                this->m_Stats.numDropped++;
+            }
+            m_Frame = frame;
+            m_IsFrameNew = true;
+            callback = m_Callback;
+        }
+
+        if (callback) {
+            callback(*frame);
+        }
+
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        this->addTiming(start);
+    }
+
+    /**
+     * @brief Copies the latest frame, returns false if there is none newer than the last one copied.
+     */
+    bool getFrame(Pixels &pixels)
+    {
+        Frame frame;
+        {
+            std::lock_guard<std::mutex> lock(this->m_Mutex);
+            if (!m_IsFrameNew) {
+                return false;
+            }
+            frame = m_Frame;
+            m_IsFrameNew = false;
+        }
+
+        pixels = *frame;
+        return true;
+    }
+
+    void setCallback(Callback callback)
+    {
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        m_Callback = callback;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        m_Frame.reset();
+        m_IsFrameNew = false;
+    }
+
+protected:
+    Frame m_Frame;
+    bool m_IsFrameNew;
+    Callback m_Callback;
+};
+
+/**
+ * @brief Owns the sources, stages and outputs of a device's processing chains and runs the stages on its scheduler.
+ * Build the graph after Device::setup() and before opening the streams, nodes are never removed.
+ */
+class ofxKinect2::ProcessingGraph
+{
+public:
+    ProcessingGraph()
+        : m_Scheduler(nullptr)
+    {
+
+    }
+
+    void setScheduler(Scheduler *scheduler)
+    {
+        m_Scheduler = scheduler;
+    }
+
+    template<typename Pixels>
+    ProcessingSource<Pixels> &addSource(const string &name)
+    {
+        return add(new ProcessingSource<Pixels>(name));
+    }
+
+    template<typename Input, typename Output>
+    ProcessingStage<Input, Output> &addStage(const string &name, typename ProcessingStage<Input, Output>::Function function)
+    {
+        return add(new ProcessingStage<Input, Output>(name, function, m_Scheduler));
+    }
+
+    template<typename Pixels>
+    ProcessingOutput<Pixels> &addOutput(const string &name)
+    {
+        return add(new ProcessingOutput<Pixels>(name));
+    }
+
+    size_t getNumNodes() const
+    {
+        return m_Nodes.size();
+    }
+
+    ProcessingNodeBase &getNode(size_t index)
+    {
+        return *m_Nodes[index];
+    }
+
+    void reset()
+    {
+        for (size_t i = 0; i < m_Nodes.size(); i++) {
+            m_Nodes[i]->reset();
+        }
+    }
+
+protected:
+    Scheduler *m_Scheduler;
+    std::vector<std::shared_ptr<ProcessingNodeBase> > m_Nodes;
+
+protected:
+    template<typename Node>
+    Node &add(Node *node)
+    {
+        m_Nodes.push_back(std::shared_ptr<ProcessingNodeBase>(node));
+        return *node;
+    }
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include "ofMain.h"
+
+namespace ofxKinect2
+{
+struct RigidTransform;
+} // namespace ofxKinect2
+
+/**
+ * @brief A rotation and a translation, p' = rotation * p + translation with the rotation row major. Converts from
+ * and to ofMatrix4x4, which transforms row vectors (p * M) and so stores the transpose.
+ */
+struct ofxKinect2::RigidTransform
+{
+    float rotation[9];
+    float translation[3];
+
+    RigidTransform()
+    {
+        for (int i = 0; i < 9; i++) {
+            rotation[i] = i % 4 == 0 ? 1.f : 0.f;
+        }
+        translation[0] = translation[1] = translation[2] = 0;
+    }
+
+    explicit RigidTransform(const ofMatrix4x4 &matrix)
+    {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                rotation[i * 3 + j] = matrix(j, i);
+            }
+            translation[i] = matrix(3, i);
+        }
+    }
+
+    /**
+     * @brief The rotation of angle |omega| around omega (Rodrigues' formula), then the translation.
+     */
+    static RigidTransform fromTwist(const double *omega, const double *translation)
+    {
+        RigidTransform transform;
+        const double angle = sqrt(omega[0] * omega[0] + omega[1] * omega[1] + omega[2] * omega[2]);
+        if (angle > 1e-12) {
+            const double x = omega[0] / angle, y = omega[1] / angle, z = omega[2] / angle;
+            const double c = cos(angle), s = sin(angle), t = 1 - c;
+            const double rotation[9] = {
+                t * x * x + c, t * x * y - s * z, t * x * z + s * y,
+                t * x * y + s * z, t * y * y + c, t * y * z - s * x,
+                t * x * z - s * y, t * y * z + s * x, t * z * z + c
+            };
+            for (int i = 0; i < 9; i++) {
+                transform.rotation[i] = static_cast<float>(rotation[i]);
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            transform.translation[i] = static_cast<float>(translation[i]);
+        }
+        return transform;
+    }
+
+    ofMatrix4x4 getMatrix() const
+    {
+        ofMatrix4x4 matrix;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                matrix(j, i) = rotation[i * 3 + j];
+            }
+            matrix(3, i) = translation[i];
+            matrix(i, 3) = 0;
+        }
+        matrix(3, 3) = 1;
+        return matrix;
+    }
+
+    RigidTransform getInverse() const
+    {
+        RigidTransform inverse;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                inverse.rotation[i * 3 + j] = rotation[j * 3 + i];
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            inverse.translation[i] = -(inverse.rotation[i * 3] * translation[0] + inverse.rotation[i * 3 + 1] * translation[1] + inverse.rotation[i * 3 + 2] * translation[2]);
+        }
+        return inverse;
+    }
+
+    /**
+     * @brief Applies other first, then this.
+     */
+    RigidTransform operator*(const RigidTransform &other) const
+    {
+        RigidTransform result;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                result.rotation[i * 3 + j] = rotation[i * 3] * other.rotation[j] + rotation[i * 3 + 1] * other.rotation[3 + j] + rotation[i * 3 + 2] * other.rotation[6 + j];
+            }
+            result.translation[i] = rotation[i * 3] * other.translation[0] + rotation[i * 3 + 1] * other.translation[1] + rotation[i * 3 + 2] * other.translation[2] + translation[i];
+        }
+        return result;
+    }
+
+    ofVec3f apply(const ofVec3f &p) const
+    {
+        return ofVec3f(rotation[0] * p.x + rotation[1] * p.y + rotation[2] * p.z + translation[0],
+                       rotation[3] * p.x + rotation[4] * p.y + rotation[5] * p.z + translation[1],
+                       rotation[6] * p.x + rotation[7] * p.y + rotation[8] * p.z + translation[2]);
+    }
+
+    ofVec3f rotate(const ofVec3f &v) const
+    {
+        return ofVec3f(rotation[0] * v.x + rotation[1] * v.y + rotation[2] * v.z,
+                       rotation[3] * v.x + rotation[4] * v.y + rotation[5] * v.z,
+                       rotation[6] * v.x + rotation[7] * v.y + rotation[8] * v.z);
+    }
+
+    /**
+     * @brief Makes the rotation orthonormal again, rounding errors add up when poses are chained for long.
+     */
+    void orthonormalize()
+    {
+        ofVec3f x(rotation[0], rotation[3], rotation[6]);
+        ofVec3f y(rotation[1], rotation[4], rotation[7]);
+        x.normalize();
+        ofVec3f z = x.getCrossed(y).normalize();
+        y = z.getCrossed(x);
+        const ofVec3f columns[3] = { x, y, z };
+        for (int j = 0; j < 3; j++) {
+            rotation[j] = columns[j].x;
+            rotation[3 + j] = columns[j].y;
+            rotation[6 + j] = columns[j].z;
+        }
+    }
+};
@@ -0,0 +1,512 @@
+#pragma once
+#include "ofMain.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ofxKinect2
+{
+class Scheduler;
+} // namespace ofxKinect2
+
+/**
+ * @brief Small worker pool owned by the Device. Streams register poll jobs (frame acquisition) that are
+ * round-robined across the workers, and heavy one-shot tasks (conversion, remap, mesh) are pushed to
+ * per-worker deques from which idle workers steal. The pixel kernels split their frames with parallelFor(),
+ * which doesn't allocate.
+ */
+class ofxKinect2::Scheduler
+{
+public:
+    // Returns true when it did some work, false when there was nothing to do.
+    typedef std::function<bool()> PollJob;
+    typedef std::function<void()> Task;
+    typedef std::function<void(int, int)> RangeTask;
+
+    Scheduler()
+        : m_IsRunning(false)
+        , m_IsStarted(false)
+        , m_NextJobId(0)
+        , m_NextWorker(0)
+        , m_PendingTasks(0)
+        , m_NumRangeJobs(0)
+    {
+
+    }
+
+    ~Scheduler()
+    {
+        exit();
+    }
+
+    /**
+     * @brief Starts numThreads workers. If affinityMask is not zero, worker i is pinned to the i-th set bit
+     * of the mask.
+     */
+    bool setup(int numThreads, uint64_t affinityMask = 0)
+    {
+        if (m_IsRunning) {
+            return false;
+        }
+
+        if (numThreads < 1) {
+            return false;
+        }
+
+        for (int i = 0; i < numThreads; i++) {
+            m_Workers.push_back(new Worker());
+        }
+
+        // The workers wait for every thread to be assigned, getCurrentWorkerIndex() reads them all.
+        for (int i = 0; i < numThreads; i++) {
+            m_Workers[i]->thread = std::thread(&Scheduler::workerFunction, this, i);
+            if (affinityMask != 0) {
+                setAffinity(m_Workers[i]->thread, nthSetBit(affinityMask, i));
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_WakeMutex);
+            m_IsRunning = true;
+            m_IsStarted = true;
+        }
+        m_WakeCondition.notify_all();
+        return true;
+    }
+
+    void exit()
+    {
+        if (!m_IsRunning) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_WakeMutex);
+            m_IsRunning = false;
+        }
+        m_WakeCondition.notify_all();
+
+        // Join everyone before deleting anything, the workers steal from each other's deques until they stop.
+        for (size_t i = 0; i < m_Workers.size(); i++) {
+            if (m_Workers[i]->thread.joinable()) {
+                m_Workers[i]->thread.join();
+            }
+        }
+
+        // Run what is still queued here, tasks they submit run right away now.
+        Task task;
+        while (popTask(-1, task)) {
+            runTask(task);
+        }
+
+        for (size_t i = 0; i < m_Workers.size(); i++) {
+            delete m_Workers[i];
+        }
+        m_Workers.clear();
+        m_IsStarted = false;
+
+        std::lock_guard<std::mutex> lock(m_JobsMutex);
+        m_PollJobs.clear();
+    }
+
+    bool isRunning() const
+    {
+        return m_IsRunning;
+    }
+
+    int getNumThreads() const
+    {
+        return static_cast<int>(m_Workers.size());
+    }
+
+    /**
+     * @brief Registers a job that is polled repeatedly by the workers. A job never runs on two workers at
+     * the same time.
+     * @return The id to pass to removePollJob()
+     */
+    int addPollJob(PollJob job)
+    {
+        std::shared_ptr<PollEntry> entry(new PollEntry());
+        entry->job = job;
+
+        std::lock_guard<std::mutex> lock(m_JobsMutex);
+        entry->id = m_NextJobId++;
+        m_PollJobs.push_back(entry);
+        return entry->id;
+    }
+
+    /**
+     * @brief Unregisters the job and blocks until no worker is executing it.
+     */
+    void removePollJob(int id)
+    {
+        std::shared_ptr<PollEntry> entry;
+        {
+            std::lock_guard<std::mutex> lock(m_JobsMutex);
+            for (std::vector<std::shared_ptr<PollEntry> >::iterator it = m_PollJobs.begin(); it != m_PollJobs.end(); ++it) {
+                if ((*it)->id == id) {
+                    entry = *it;
+                    m_PollJobs.erase(it);
+                    break;
+                }
+            }
+        }
+
+        if (entry) {
+            while (entry->isBusy.exchange(true)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /**
+     * @brief Queues a one-shot task. When called from a worker the task goes to that worker's own deque,
+     * otherwise the deques are filled round-robin.
+     */
+    void submit(Task task)
+    {
+        if (!m_IsRunning) {
+            task();
+            return;
+        }
+
+        int index = getCurrentWorkerIndex();
+        if (index < 0) {
+            index = m_NextWorker.fetch_add(1) % m_Workers.size();
+        }
+
+        m_PendingTasks++;
+        {
+            std::lock_guard<std::mutex> lock(m_Workers[index]->mutex);
+            m_Workers[index]->tasks.push_back(task);
+        }
+        m_WakeCondition.notify_one();
+    }
+
+    /**
+     * @brief Splits [begin, end) into chunks of at least grainSize and runs function(chunkBegin, chunkEnd) on
+     * the pool. The calling thread takes part in the work and returns once every chunk is done.
+     *
+     * The range is published in one of MAX_RANGE_JOBS fixed slots and the workers claim its chunks with an
+     * atomic counter, so nothing is allocated. When every slot is taken the range runs on the calling thread.
+     */
+    template <typename Function>
+    void parallelFor(int begin, int end, const Function &function, int grainSize = 1)
+    {
+        const int count = end - begin;
+        if (count <= 0) {
+            return;
+        }
+
+        const int numChunks = std::min(count / std::max(grainSize, 1), (getNumThreads() + 1) * 4);
+        RangeSlot *slot = m_IsRunning && numChunks > 1 ? acquireRangeSlot() : nullptr;
+        if (!slot) {
+            function(begin, end);
+            return;
+        }
+
+        RangeJob job;
+        job.function = &function;
+        job.invoke = &invokeRange<Function>;
+        job.begin = begin;
+        job.end = end;
+        job.chunkSize = count / numChunks;
+        job.numChunks = numChunks;
+        job.nextChunk = 0;
+        job.remaining = numChunks;
+
+        slot->job = &job;
+        m_NumRangeJobs++;
+        m_WakeCondition.notify_all();
+
+        runRangeJob(job);
+        while (job.remaining > 0) {
+            std::this_thread::yield();
+        }
+
+        m_NumRangeJobs--;
+        releaseRangeSlot(slot);
+    }
+
+private:
+    struct Worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /** @brief A range being run by parallelFor(), it lives on the caller's stack. */
+    struct RangeJob {
+        const void *function;
+        void (*invoke)(const void *, int, int);
+        int begin, end;
+        int chunkSize, numChunks;
+        std::atomic<int> nextChunk;
+        std::atomic<int> remaining;
+    };
+
+    /** @brief The workers count themselves in numUsers before reading job, so the owner knows when they let go. */
+    struct RangeSlot {
+        RangeSlot()
+            : job(nullptr)
+            , numUsers(0)
+            , isUsed(false)
+        {
+
+        }
+
+        std::atomic<RangeJob *> job;
+        std::atomic<int> numUsers;
+        std::atomic<bool> isUsed;
+    };
+
+    struct PollEntry {
+        PollEntry()
+            : id(-1)
+            , isBusy(false)
+        {
+
+        }
+
+        int id;
+        PollJob job;
+        std::atomic<bool> isBusy;
+    };
+
+    std::atomic<bool> m_IsRunning;
+    /** @brief Set by setup() once every worker thread is assigned, guarded by m_WakeMutex. */
+    bool m_IsStarted;
+    std::vector<Worker *> m_Workers;
+
+    std::mutex m_JobsMutex;
+    std::vector<std::shared_ptr<PollEntry> > m_PollJobs;
+    int m_NextJobId;
+
+    std::mutex m_WakeMutex;
+    std::condition_variable m_WakeCondition;
+    std::atomic<unsigned int> m_NextWorker;
+    std::atomic<int> m_PendingTasks;
+
+    static const int MAX_RANGE_JOBS = 16;
+    RangeSlot m_RangeSlots[MAX_RANGE_JOBS];
+    std::atomic<int> m_NumRangeJobs;
+
+private:
+    int getCurrentWorkerIndex() const
+    {
+        const std::thread::id id = std::this_thread::get_id();
+        for (size_t i = 0; i < m_Workers.size(); i++) {
+            if (m_Workers[i]->thread.get_id() == id) {
+                return static_cast<int>(i);
+            }
+        }
+
+        return -1;
+    }
+
+    /**
+     * @brief Pops from the back of the worker's own deque, otherwise steals from the front of another one.
+     */
+    bool popTask(int index, Task &task)
+    {
+        if (index >= 0) {
+            Worker *worker = m_Workers[index];
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            if (!worker->tasks.empty()) {
+                task = worker->tasks.back();
+                worker->tasks.pop_back();
+                return true;
+            }
+        }
+
+        const int numWorkers = getNumThreads();
+        for (int i = 1; i <= numWorkers; i++) {
+            Worker *victim = m_Workers[(std::max(index, 0) + i) % numWorkers];
+            std::lock_guard<std::mutex> lock(victim->mutex);
+            if (!victim->tasks.empty()) {
+                task = victim->tasks.front();
+                victim->tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void runTask(Task &task)
+    {
+        task();
+        m_PendingTasks--;
+    }
+
+    template <typename Function>
+    static void invokeRange(const void *function, int begin, int end)
+    {
+        (*static_cast<const Function *>(function))(begin, end);
+    }
+
+    RangeSlot *acquireRangeSlot()
+    {
+        for (int i = 0; i < MAX_RANGE_JOBS; i++) {
+            if (!m_RangeSlots[i].isUsed.exchange(true)) {
+                return &m_RangeSlots[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * @brief Unpublishes the job and waits for the workers that may still hold it, it goes out of scope next.
+     */
+    void releaseRangeSlot(RangeSlot *slot)
+    {
+        slot->job = nullptr;
+        while (slot->numUsers > 0) {
+            std::this_thread::yield();
+        }
+        slot->isUsed = false;
+    }
+
+    /**
+     * @brief Claims and runs chunks of the job until none is left, true when it ran one.
+     */
+    static bool runRangeJob(RangeJob &job)
+    {
+        bool didWork = false;
+        for (int chunk = job.nextChunk++; chunk < job.numChunks; chunk = job.nextChunk++) {
+            const int chunkBegin = job.begin + chunk * job.chunkSize;
+            const int chunkEnd = chunk == job.numChunks - 1 ? job.end : chunkBegin + job.chunkSize;
+            job.invoke(job.function, chunkBegin, chunkEnd);
+            job.remaining--;
+            didWork = true;
+        }
+
+        return didWork;
+    }
+
+    bool runRangeJobs()
+    {
+        if (m_NumRangeJobs == 0) {
+            return false;
+        }
+
+        bool didWork = false;
+        for (int i = 0; i < MAX_RANGE_JOBS; i++) {
+            RangeSlot &slot = m_RangeSlots[i];
+            slot.numUsers++;
+            RangeJob *job = slot.job;
+            if (job) {
+                didWork |= runRangeJob(*job);
+            }
+            slot.numUsers--;
+        }
+
+        return didWork;
+    }
+
+    bool runPollJobs(int index)
+    {
+        std::vector<std::shared_ptr<PollEntry> > jobs;
+        {
+            std::lock_guard<std::mutex> lock(m_JobsMutex);
+            jobs = m_PollJobs;
+        }
+
+        bool didWork = false;
+        const size_t numJobs = jobs.size();
+        for (size_t i = 0; i < numJobs; i++) {
+            // Start at a different job on each worker so they do not all contend on the first one.
+            PollEntry *entry = jobs[(i + index) % numJobs].get();
+            if (entry->isBusy.exchange(true)) {
+                continue;
+            }
+
+            didWork |= entry->job();
+            entry->isBusy = false;
+        }
+
+        return didWork;
+    }
+
+    void workerFunction(int index)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_WakeMutex);
+            while (!m_IsStarted) {
+                m_WakeCondition.wait(lock);
+            }
+        }
+
+        while (m_IsRunning) {
+            Task task;
+            bool didWork = false;
+            if (popTask(index, task)) {
+                runTask(task);
+                didWork = true;
+            }
+
+            didWork |= runRangeJobs();
+            didWork |= runPollJobs(index);
+
+            if (!didWork) {
+                // Nothing to acquire and nothing to steal, sleep until a task arrives or the next poll.
+                std::unique_lock<std::mutex> lock(m_WakeMutex);
+                if (m_IsRunning && m_PendingTasks == 0 && m_NumRangeJobs == 0) {
+                    m_WakeCondition.wait_for(lock, std::chrono::milliseconds(1));
+                }
+            }
+        }
+    }
+
+    static int nthSetBit(uint64_t mask, int n)
+    {
+        int count = 0;
+        for (int bit = 0; bit < 64; bit++) {
+            if (mask & (uint64_t(1) << bit)) {
+                if (count == n) {
+                    return bit;
+                }
+                count++;
+            }
+        }
+
+        // More workers than cores in the mask, wrap around.
+        return nthSetBit(mask, n % std::max(count, 1));
+    }
+
+    static void setAffinity(std::thread &thread, int core)
+    {
+#if defined(TARGET_WIN32)
+        SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#elif defined(TARGET_LINUX)
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(core, &cpuSet);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet);
+#else
+        ofLogWarning("ofxKinect2::Scheduler") << "Thread affinity is not supported on this platform.";
+#endif
+    }
+};
+
+namespace ofxKinect2
+{
+/**
+ * @brief Runs the range on the scheduler when there is one, otherwise on the calling thread.
+ */
+template <typename Function>
+inline void parallelFor(Scheduler *scheduler, int begin, int end, const Function &function, int grainSize = 1)
+{
+    if (scheduler) {
+        scheduler->parallelFor(begin, end, function, grainSize);
+    }
+    else if (begin < end) {
+        function(begin, end);
+    }
+}
+} // namespace ofxKinect2
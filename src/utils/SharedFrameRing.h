@@ -0,0 +1,517 @@
+#pragma once
+#include "ofMain.h"
+#include <atomic>
+
+#if !defined(TARGET_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(TARGET_LINUX)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ofxKinect2
+{
+class SharedFrameRing;
+} // namespace ofxKinect2
+
+/**
+ * @brief A ring of frame slots in named shared memory, written by one process and read by any number of others
+ * straight from the mapping.
+ *
+ * Every slot is a seqlock: the writer marks it odd while it writes frame n and 2n once it's published, a reader
+ * checks with release() that the slot still holds the frame it acquired. Readers sleep in waitForFrame() on a
+ * futex (Linux) or a named semaphore (Windows) that the writer signals on every frame.
+ */
+class ofxKinect2::SharedFrameRing
+{
+public:
+    static const int DEFAULT_NUM_SLOTS = 4;
+
+    /**
+     * @brief sequence is set by endWrite(), 1 for the first frame. dataSize is in bytes.
+     */
+    struct FrameInfo
+    {
+        uint64_t sequence;
+        uint64_t timestamp;
+        int width;
+        int height;
+        int stride;
+        int pixelFormat;
+        unsigned int dataSize;
+        float horizontalFieldOfView;
+        float verticalFieldOfView;
+        float diagonalFieldOfView;
+    };
+
+    SharedFrameRing()
+        : m_Memory(nullptr)
+        , m_MemorySize(0)
+        , m_IsWriter(false)
+        , m_LastSequence(0)
+        , m_NumDroppedFrames(0)
+        , m_NumTornFrames(0)
+#if defined(TARGET_WIN32)
+        , m_Mapping(nullptr)
+        , m_WakeSemaphore(nullptr)
+#else
+        , m_File(-1)
+#endif
+    {
+
+    }
+
+    ~SharedFrameRing()
+    {
+        close();
+    }
+
+    /**
+     * @brief Creates the ring as its writer, replacing a ring with the same name left by a process that died.
+     */
+    bool create(const string &name, size_t maxDataSize, int numSlots = DEFAULT_NUM_SLOTS)
+    {
+        close();
+        const size_t slotSize = (maxDataSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        const size_t memorySize = getDataOffset(numSlots) + slotSize * numSlots;
+        if (!map(name, memorySize, true)) {
+            ofLogError("ofxKinect2::SharedFrameRing") << "Can't create the shared memory " << name << ".";
+            return false;
+        }
+
+        Header *header = new (m_Memory) Header();
+        header->magic = MAGIC;
+        header->numSlots = numSlots;
+        header->slotSize = slotSize;
+        header->latestSequence = 0;
+        header->wakeCounter = 0;
+        header->numWaiters = 0;
+        header->isClosed = 0;
+        for (int i = 0; i < numSlots; i++) {
+            new (getSlot(i)) Slot();
+            getSlot(i)->version = 0;
+        }
+
+        m_Name = name;
+        m_IsWriter = true;
+        return true;
+    }
+
+    /**
+     * @brief Opens an existing ring as a reader, fails until the writer created it.
+     */
+    bool open(const string &name)
+    {
+        close();
+        if (!map(name, 0, false)) {
+            return false;
+        }
+
+        const Header *header = getHeader();
+        if (m_MemorySize < sizeof(Header) || header->magic != MAGIC ||
+            m_MemorySize < getDataOffset(header->numSlots) + header->slotSize * header->numSlots) {
+            unmap();
+            return false;
+        }
+
+        m_Name = name;
+        m_IsWriter = false;
+        m_LastSequence = 0;
+        return true;
+    }
+
+    void close()
+    {
+        if (!m_Memory) {
+            return;
+        }
+
+        if (m_IsWriter) {
+            getHeader()->isClosed = 1;
+            wakeReaders();
+        }
+        unmap();
+        m_IsWriter = false;
+    }
+
+    bool isOpen() const
+    {
+        return m_Memory != nullptr;
+    }
+
+    bool isWriter() const
+    {
+        return m_IsWriter;
+    }
+
+    const string &getName() const
+    {
+        return m_Name;
+    }
+
+    size_t getMaxDataSize() const
+    {
+        return m_Memory ? static_cast<size_t>(getHeader()->slotSize) : 0;
+    }
+
+    int getNumSlots() const
+    {
+        return m_Memory ? getHeader()->numSlots : 0;
+    }
+
+    /**
+     * @brief Writer side: the slot of the next frame, fill up to getMaxDataSize() bytes then call endWrite().
+     */
+    unsigned char *beginWrite()
+    {
+        const uint64_t sequence = getHeader()->latestSequence.load(std::memory_order_relaxed) + 1;
+        Slot *slot = getSlot(getSlotIndex(sequence));
+        slot->version.store(sequence * 2 - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return getSlotData(getSlotIndex(sequence));
+    }
+
+    /**
+     * @brief Publishes the frame written since beginWrite() and wakes the readers up.
+     */
+    void endWrite(FrameInfo &info)
+    {
+        Header *header = getHeader();
+        info.sequence = header->latestSequence.load(std::memory_order_relaxed) + 1;
+        Slot *slot = getSlot(getSlotIndex(info.sequence));
+        slot->info = info;
+        slot->version.store(info.sequence * 2, std::memory_order_release);
+        header->latestSequence.store(info.sequence, std::memory_order_release);
+        wakeReaders();
+    }
+
+    /**
+     * @brief Copies the frame in. A frame larger than the slots replaces the ring with a larger one, the readers
+     * find the old one closed and open the new one. False if it can't be replaced yet, on Windows readers still
+     * holding the old ring keep its name, try again with the next frame.
+     */
+    bool write(FrameInfo &info, const void *data)
+    {
+        if (!m_IsWriter) {
+            return false;
+        }
+        if (info.dataSize > getMaxDataSize()) {
+            const string name = m_Name;
+            if (!create(name, info.dataSize, getNumSlots())) {
+                return false;
+            }
+        }
+        memcpy(beginWrite(), data, info.dataSize);
+        endWrite(info);
+        return true;
+    }
+
+    /**
+     * @brief Reader side: the latest frame if it's newer than the last one acquired, nullptr otherwise. The
+     * data stays in the ring, call release() once done with it.
+     */
+    const unsigned char *acquireLatest(FrameInfo &info)
+    {
+        if (!m_Memory || m_IsWriter) {
+            return nullptr;
+        }
+
+        const Header *header = getHeader();
+        for (int attempt = 0; attempt < 4; attempt++) {
+            const uint64_t sequence = header->latestSequence.load(std::memory_order_acquire);
+            if (sequence == 0 || sequence == m_LastSequence) {
+                return nullptr;
+            }
+
+            const Slot *slot = getSlot(getSlotIndex(sequence));
+            if (slot->version.load(std::memory_order_acquire) != sequence * 2) {
+                // The writer went round the ring since, take the newer frame.
+                continue;
+            }
+            info = slot->info;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->version.load(std::memory_order_relaxed) != sequence * 2) {
+                continue;
+            }
+
+            if (m_LastSequence != 0 && sequence > m_LastSequence + 1) {
+                m_NumDroppedFrames += sequence - m_LastSequence - 1;
+            }
+            m_LastSequence = sequence;
+            return getSlotData(getSlotIndex(sequence));
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief False if the writer started overwriting the frame while it was in use, the data read may be torn.
+     */
+    bool release(const FrameInfo &info)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const bool isValid = getSlot(getSlotIndex(info.sequence))->version.load(std::memory_order_relaxed) == info.sequence * 2;
+        if (!isValid) {
+            m_NumTornFrames++;
+        }
+        return isValid;
+    }
+
+    /**
+     * @brief Sleeps until a frame newer than the last one acquired is published, or the timeout.
+     */
+    bool waitForFrame(int timeoutMillis)
+    {
+        if (!m_Memory || m_IsWriter) {
+            return false;
+        }
+
+        Header *header = getHeader();
+#if defined(TARGET_WIN32)
+        if (hasNewFrame()) {
+            return true;
+        }
+
+        // Counted before the last check, so a frame published in between releases the semaphore for us.
+        header->numWaiters++;
+        if (!hasNewFrame() && WaitForSingleObject(m_WakeSemaphore, timeoutMillis) == WAIT_OBJECT_0) {
+            return hasNewFrame();
+        }
+
+        // Didn't wait or timed out: leave the count, or take the release the writer already counted us in so it
+        // doesn't wake the next reader for nothing.
+        unsigned int numWaiters = header->numWaiters.load();
+        while (numWaiters > 0 && !header->numWaiters.compare_exchange_weak(numWaiters, numWaiters - 1)) {
+        }
+        if (numWaiters == 0) {
+            WaitForSingleObject(m_WakeSemaphore, timeoutMillis);
+        }
+#elif defined(TARGET_LINUX)
+        const unsigned int counter = header->wakeCounter.load(std::memory_order_acquire);
+        if (!hasNewFrame()) {
+            timespec timeout;
+            timeout.tv_sec = timeoutMillis / 1000;
+            timeout.tv_nsec = timeoutMillis % 1000 * 1000000L;
+            syscall(SYS_futex, reinterpret_cast<int *>(&header->wakeCounter), FUTEX_WAIT, counter, &timeout, nullptr, 0);
+        }
+#else
+        for (int i = 0; i < timeoutMillis && !hasNewFrame(); i++) {
+            ofSleepMillis(1);
+        }
+#endif
+        return hasNewFrame();
+    }
+
+    bool hasNewFrame() const
+    {
+        return m_Memory && getHeader()->latestSequence.load(std::memory_order_acquire) != m_LastSequence;
+    }
+
+    /**
+     * @brief True once the writer closed the ring, reopen to follow a new writer.
+     */
+    bool isWriterClosed() const
+    {
+        return m_Memory && getHeader()->isClosed.load(std::memory_order_acquire) != 0;
+    }
+
+    /**
+     * @brief Frames published that this reader never acquired.
+     */
+    uint64_t getNumDroppedFrames() const
+    {
+        return m_NumDroppedFrames;
+    }
+
+    /**
+     * @brief Frames that release() found overwritten, give the ring more slots if it's not 0.
+     */
+    uint64_t getNumTornFrames() const
+    {
+        return m_NumTornFrames;
+    }
+
+protected:
+    static const unsigned int MAGIC = 0x5246324b; // "K2FR"
+    static const size_t ALIGNMENT = 64;
+    static const size_t SLOT_HEADER_SIZE = 128;
+
+    struct Header
+    {
+        unsigned int magic;
+        int numSlots;
+        uint64_t slotSize;
+        std::atomic<uint64_t> latestSequence;
+        // Futex word, bumped on every frame.
+        std::atomic<unsigned int> wakeCounter;
+        // Readers about to wait on the semaphore, the writer releases it that many times.
+        std::atomic<unsigned int> numWaiters;
+        std::atomic<unsigned int> isClosed;
+    };
+
+    struct Slot
+    {
+        std::atomic<uint64_t> version;
+        FrameInfo info;
+    };
+
+    string m_Name;
+    unsigned char *m_Memory;
+    size_t m_MemorySize;
+    bool m_IsWriter;
+    uint64_t m_LastSequence;
+    uint64_t m_NumDroppedFrames;
+    uint64_t m_NumTornFrames;
+
+#if defined(TARGET_WIN32)
+    HANDLE m_Mapping;
+    HANDLE m_WakeSemaphore;
+#else
+    int m_File;
+#endif
+
+protected:
+    static size_t getDataOffset(int numSlots)
+    {
+        return (SLOT_HEADER_SIZE * (numSlots + 1) + 4095) / 4096 * 4096;
+    }
+
+    Header *getHeader()
+    {
+        return reinterpret_cast<Header *>(m_Memory);
+    }
+
+    const Header *getHeader() const
+    {
+        return reinterpret_cast<const Header *>(m_Memory);
+    }
+
+    int getSlotIndex(uint64_t sequence) const
+    {
+        return static_cast<int>((sequence - 1) % getHeader()->numSlots);
+    }
+
+    Slot *getSlot(int index)
+    {
+        return reinterpret_cast<Slot *>(m_Memory + SLOT_HEADER_SIZE * (index + 1));
+    }
+
+    const Slot *getSlot(int index) const
+    {
+        return reinterpret_cast<const Slot *>(m_Memory + SLOT_HEADER_SIZE * (index + 1));
+    }
+
+    unsigned char *getSlotData(int index)
+    {
+        const Header *header = getHeader();
+        return m_Memory + getDataOffset(header->numSlots) + static_cast<size_t>(header->slotSize) * index;
+    }
+
+    void wakeReaders()
+    {
+        Header *header = getHeader();
+        header->wakeCounter++;
+#if defined(TARGET_WIN32)
+        const unsigned int numWaiters = header->numWaiters.exchange(0);
+        if (numWaiters > 0) {
+            ReleaseSemaphore(m_WakeSemaphore, numWaiters, nullptr);
+        }
+#elif defined(TARGET_LINUX)
+        syscall(SYS_futex, reinterpret_cast<int *>(&header->wakeCounter), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    /**
+     * @brief size 0 maps the whole existing object.
+     */
+    bool map(const string &name, size_t size, bool isWriter)
+    {
+#if defined(TARGET_WIN32)
+        if (isWriter) {
+            m_Mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t(size) >> 32),
+                                           static_cast<DWORD>(size), name.c_str());
+            m_WakeSemaphore = CreateSemaphoreA(nullptr, 0, LONG_MAX, (name + "_wake").c_str());
+        }
+        else {
+            m_Mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+            m_WakeSemaphore = OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, (name + "_wake").c_str());
+        }
+        if (m_Mapping) {
+            m_Memory = static_cast<unsigned char *>(MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        }
+        if (m_Memory) {
+            MEMORY_BASIC_INFORMATION info;
+            VirtualQuery(m_Memory, &info, sizeof(info));
+            m_MemorySize = isWriter ? size : info.RegionSize;
+        }
+        if (!m_Memory || !m_WakeSemaphore || (isWriter && m_MemorySize < size)) {
+            unmap();
+            return false;
+        }
+        return true;
+#else
+        const string path = "/" + name;
+        if (isWriter) {
+            shm_unlink(path.c_str());
+            m_File = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+            if (m_File >= 0 && ftruncate(m_File, size) != 0) {
+                ::close(m_File);
+                m_File = -1;
+            }
+        }
+        else {
+            m_File = shm_open(path.c_str(), O_RDWR, 0);
+            struct stat status;
+            size = m_File >= 0 && fstat(m_File, &status) == 0 ? status.st_size : 0;
+        }
+        if (m_File < 0 || size == 0) {
+            unmap();
+            return false;
+        }
+
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+        if (memory == MAP_FAILED) {
+            unmap();
+            return false;
+        }
+        m_Memory = static_cast<unsigned char *>(memory);
+        m_MemorySize = size;
+        return true;
+#endif
+    }
+
+    void unmap()
+    {
+#if defined(TARGET_WIN32)
+        if (m_Memory) {
+            UnmapViewOfFile(m_Memory);
+        }
+        if (m_Mapping) {
+            CloseHandle(m_Mapping);
+        }
+        if (m_WakeSemaphore) {
+            CloseHandle(m_WakeSemaphore);
+        }
+        m_Mapping = nullptr;
+        m_WakeSemaphore = nullptr;
+#else
+        if (m_Memory) {
+            munmap(m_Memory, m_MemorySize);
+        }
+        if (m_File >= 0) {
+            ::close(m_File);
+            if (m_IsWriter) {
+                // Readers keep their mapping, the name goes away with the writer.
+                shm_unlink(("/" + m_Name).c_str());
+            }
+        }
+        m_File = -1;
+#endif
+        m_Memory = nullptr;
+        m_MemorySize = 0;
+    }
+};
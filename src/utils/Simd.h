@@ -0,0 +1,23 @@
+#pragma once
+
+// Instruction sets the pixel kernels may use. MSVC doesn't define __SSE2__ and friends, every CPU that can
+// drive a Kinect v2 (USB 3.0, Windows 8) has SSSE3 so both are enabled there.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define OFX_KINECT2_SSE2 1
+#define OFX_KINECT2_SSSE3 1
+#else
+#if defined(__SSE2__)
+#define OFX_KINECT2_SSE2 1
+#endif
+#if defined(__SSSE3__)
+#define OFX_KINECT2_SSSE3 1
+#endif
+#endif
+
+#if defined(OFX_KINECT2_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(OFX_KINECT2_SSSE3)
+#include <tmmintrin.h>
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+#include "ofMain.h"
+
+namespace ofxKinect2
+{
+/**
+ * @brief The eigenvector of the smallest eigenvalue of the symmetric matrix (xx, xy, xz, yy, yz, zz), which is
+ * scaled in place. The eigenvalue comes from Newton's method on the characteristic polynomial: from 0, left of every
+ * root, it climbs monotonically to the smallest one, in one or two steps on a plane where that root is far from the
+ * others and within 12 when they are close. The eigenvector is the longest cross product of two rows of
+ * (A - lambda I). surfaceVariation is the smallest eigenvalue over their sum. False for degenerate matrices, e.g.
+ * the covariance of collinear points.
+ */
+inline bool getSmallestEigenvector(float *covariance, ofVec3f &eigenvector, float &surfaceVariation)
+{
+    // Scaled to the largest entry to keep the products of three entries in float precision.
+    float scale = 0;
+    for (int i = 0; i < 6; i++) {
+        scale = std::max(scale, std::abs(covariance[i]));
+    }
+    if (scale <= 0) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        covariance[i] /= scale;
+    }
+
+    const float a00 = covariance[0], a01 = covariance[1], a02 = covariance[2];
+    const float a11 = covariance[3], a12 = covariance[4], a22 = covariance[5];
+    const float trace = a00 + a11 + a22;
+    const float minors = a00 * a11 + a00 * a22 + a11 * a22 - a01 * a01 - a02 * a02 - a12 * a12;
+    const float determinant = a00 * (a11 * a22 - a12 * a12) - a01 * (a01 * a22 - a12 * a02) + a02 * (a01 * a12 - a11 * a02);
+
+    float smallest = 0;
+    for (int i = 0; i < 12; i++) {
+        const float value = ((smallest - trace) * smallest + minors) * smallest - determinant;
+        const float slope = (3 * smallest - 2 * trace) * smallest + minors;
+        if (slope <= 0) {
+            break;
+        }
+
+        const float step = value / slope;
+        smallest -= step;
+        if (std::abs(step) < 1e-6f * trace) {
+            break;
+        }
+    }
+
+    const ofVec3f row0(a00 - smallest, a01, a02);
+    const ofVec3f row1(a01, a11 - smallest, a12);
+    const ofVec3f row2(a02, a12, a22 - smallest);
+    const ofVec3f cross01 = row0.getCrossed(row1);
+    const ofVec3f cross02 = row0.getCrossed(row2);
+    const ofVec3f cross12 = row1.getCrossed(row2);
+    const float length01 = cross01.lengthSquared();
+    const float length02 = cross02.lengthSquared();
+    const float length12 = cross12.lengthSquared();
+    if (!(std::max(length01, std::max(length02, length12)) > 0)) {
+        return false;
+    }
+
+    if (length01 >= length02 && length01 >= length12) {
+        eigenvector = cross01 / sqrtf(length01);
+    }
+    else if (length02 >= length12) {
+        eigenvector = cross02 / sqrtf(length02);
+    }
+    else {
+        eigenvector = cross12 / sqrtf(length12);
+    }
+
+    surfaceVariation = trace > 0 ? std::max(smallest, 0.f) / trace : 0;
+    return true;
+}
+} // namespace ofxKinect2
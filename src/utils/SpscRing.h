@@ -0,0 +1,118 @@
+#pragma once
+#include "ofMain.h"
+#include <atomic>
+
+namespace ofxKinect2
+{
+template <typename T>
+class SpscRing;
+} // namespace ofxKinect2
+
+/**
+ * @brief Lock-free ring between one producer thread and one consumer thread. Each side only writes its own index
+ * and keeps a copy of the other one, so the cache line of the other side is only fetched when the ring looks full
+ * or empty.
+ */
+template <typename T>
+class ofxKinect2::SpscRing
+{
+public:
+    SpscRing()
+        : m_Mask(0)
+        , m_Head(0)
+        , m_CachedTail(0)
+        , m_Tail(0)
+        , m_CachedHead(0)
+    {
+
+    }
+
+    /**
+     * @brief Rounds the capacity up to a power of 2 and empties the ring, neither side may be using it.
+     */
+    void allocate(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_Values.assign(size, T());
+        m_Mask = size - 1;
+        m_Head = 0;
+        m_CachedTail = 0;
+        m_Tail = 0;
+        m_CachedHead = 0;
+    }
+
+    size_t getCapacity() const
+    {
+        return m_Values.size();
+    }
+
+    /**
+     * @brief Producer side, returns how many values fit.
+     */
+    size_t push(const T *values, size_t count)
+    {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head - m_CachedTail + count > m_Values.size()) {
+            m_CachedTail = m_Tail.load(std::memory_order_acquire);
+        }
+        count = std::min(count, m_Values.size() - (head - m_CachedTail));
+
+        const size_t start = head & m_Mask;
+        const size_t first = std::min(count, m_Values.size() - start);
+        std::copy(values, values + first, m_Values.begin() + start);
+        std::copy(values + first, values + count, m_Values.begin());
+        m_Head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * @brief Consumer side, returns how many values were there.
+     */
+    size_t pop(T *values, size_t count)
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (m_CachedHead - tail < count) {
+            m_CachedHead = m_Head.load(std::memory_order_acquire);
+        }
+        count = std::min(count, m_CachedHead - tail);
+
+        const size_t start = tail & m_Mask;
+        const size_t first = std::min(count, m_Values.size() - start);
+        std::copy(m_Values.begin() + start, m_Values.begin() + start + first, values);
+        std::copy(m_Values.begin(), m_Values.begin() + (count - first), values + first);
+        m_Tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * @brief Consumer side, drops everything queued.
+     */
+    void clear()
+    {
+        m_Tail.store(m_Head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * @brief Values queued, exact from the consumer, a lower bound from the producer.
+     */
+    size_t getSize() const
+    {
+        return m_Head.load(std::memory_order_acquire) - m_Tail.load(std::memory_order_acquire);
+    }
+
+protected:
+    std::vector<T> m_Values;
+    size_t m_Mask;
+
+    // The producer's line, then the consumer's.
+    char m_Padding0[64];
+    std::atomic<size_t> m_Head;
+    size_t m_CachedTail;
+    char m_Padding1[64];
+    std::atomic<size_t> m_Tail;
+    size_t m_CachedHead;
+    char m_Padding2[64];
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include "ofMain.h"
+#include <chrono>
+#include <mutex>
+
+namespace ofxKinect2
+{
+class LatencyHistogram;
+class StreamMetrics;
+} // namespace ofxKinect2
+
+/**
+ * @brief Durations in 0.1 ms buckets up to 100 ms, the longer ones all land in the last bucket but still count
+ * towards the mean and the max.
+ */
+class ofxKinect2::LatencyHistogram
+{
+public:
+    static const int NUM_BUCKETS = 1000;
+    static const int BUCKET_MICROS = 100;
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void add(uint64_t micros)
+    {
+        m_Buckets[std::min<uint64_t>(micros / BUCKET_MICROS, NUM_BUCKETS - 1)]++;
+        m_Count++;
+        m_Sum += micros;
+        m_Max = std::max(m_Max, micros);
+    }
+
+    void reset()
+    {
+        std::fill(m_Buckets, m_Buckets + NUM_BUCKETS, 0);
+        m_Count = 0;
+        m_Sum = 0;
+        m_Max = 0;
+    }
+
+    uint64_t getCount() const
+    {
+        return m_Count;
+    }
+
+    float getMeanMillis() const
+    {
+        return m_Count > 0 ? m_Sum / 1000.f / m_Count : 0.f;
+    }
+
+    float getMaxMillis() const
+    {
+        return m_Max / 1000.f;
+    }
+
+    /**
+     * @brief The duration below which the given fraction (0 - 1) of the samples are, to the bucket's middle.
+     */
+    float getPercentileMillis(float fraction) const
+    {
+        if (m_Count == 0) {
+            return 0.f;
+        }
+
+        const uint64_t rank = static_cast<uint64_t>(ofClamp(fraction, 0.f, 1.f) * (m_Count - 1));
+        uint64_t seen = 0;
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            seen += m_Buckets[i];
+            if (seen > rank) {
+                return (i + 0.5f) * BUCKET_MICROS / 1000.f;
+            }
+        }
+
+        return getMaxMillis();
+    }
+
+protected:
+    uint32_t m_Buckets[NUM_BUCKETS];
+    uint64_t m_Count, m_Sum, m_Max;
+};
+
+/**
+ * @brief Counters and latency histograms of a stream, recorded by the acquisition thread and update(). Read them
+ * with getSnapshot() from any thread, or append them to a CSV file.
+ */
+class ofxKinect2::StreamMetrics
+{
+public:
+    /** @brief The SDK timestamps frames in 100 ns ticks, the sensors run at 30 fps. */
+    static const uint64_t TICKS_PER_SECOND = 10000000;
+    static const uint64_t NOMINAL_FRAME_TICKS = TICKS_PER_SECOND / 30;
+
+    struct Snapshot {
+        /** @brief Frames read from the SDK. */
+        uint64_t numAcquired;
+        /** @brief Frames the sensor produced that were never read, from the gaps between the timestamps. */
+        uint64_t numDropped;
+        /** @brief Frames replaced by a newer one before update() used them. */
+        uint64_t numOverwritten;
+        /** @brief Frames update() used. */
+        uint64_t numConsumed;
+        float fps;
+        /** @brief From the sensor timestamp to the frame being read. */
+        LatencyHistogram sensorLatency;
+        /** @brief From reading the frame to the end of setPixels(), the conversions and filters. */
+        LatencyHistogram processingTime;
+        /** @brief How long update() waited for the acquisition thread. */
+        LatencyHistogram lockWait;
+    };
+
+    StreamMetrics()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Snapshot.numAcquired = 0;
+        m_Snapshot.numDropped = 0;
+        m_Snapshot.numOverwritten = 0;
+        m_Snapshot.numConsumed = 0;
+        m_Snapshot.fps = 0;
+        m_Snapshot.sensorLatency.reset();
+        m_Snapshot.processingTime.reset();
+        m_Snapshot.lockWait.reset();
+        m_LastTimestamp = 0;
+        m_FpsWindowStart = 0;
+        m_FpsWindowFrames = 0;
+    }
+
+    /**
+     * @brief Records a frame whose reading started at acquireTicks (getHostTicks()) and whose processing just ended.
+     */
+    void addFrame(uint64_t timestamp, uint64_t acquireTicks, bool isOverwritten)
+    {
+        const uint64_t now = getHostTicks();
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Snapshot.numAcquired++;
+        if (isOverwritten) {
+            m_Snapshot.numOverwritten++;
+        }
+
+        if (m_LastTimestamp != 0 && timestamp > m_LastTimestamp) {
+            // A gap of 2 frame periods means 1 missed frame, rounded to absorb the jitter.
+            const uint64_t numPeriods = (timestamp - m_LastTimestamp + NOMINAL_FRAME_TICKS / 2) / NOMINAL_FRAME_TICKS;
+            if (numPeriods > 1) {
+                m_Snapshot.numDropped += numPeriods - 1;
+            }
+        }
+        m_LastTimestamp = timestamp;
+
+        // Frames stamped in the future come from a different clock, leave them out.
+        if (timestamp != 0 && acquireTicks >= timestamp) {
+            m_Snapshot.sensorLatency.add((acquireTicks - timestamp) / 10);
+        }
+        m_Snapshot.processingTime.add((now - acquireTicks) / 10);
+
+        if (m_FpsWindowFrames == 0) {
+            m_FpsWindowStart = now;
+        }
+        m_FpsWindowFrames++;
+        if (now - m_FpsWindowStart >= TICKS_PER_SECOND) {
+            m_Snapshot.fps = static_cast<float>((m_FpsWindowFrames - 1) * TICKS_PER_SECOND) / (now - m_FpsWindowStart);
+            m_FpsWindowFrames = 1;
+            m_FpsWindowStart = now;
+        }
+    }
+
+    void addConsumed()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Snapshot.numConsumed++;
+    }
+
+    void addLockWait(uint64_t micros)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Snapshot.lockWait.add(micros);
+    }
+
+    Snapshot getSnapshot()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Snapshot;
+    }
+
+    static string getCsvHeader()
+    {
+        string header = "time_ms,stream,acquired,dropped,overwritten,consumed,fps";
+        const char *histograms[] = { "sensor_latency", "processing", "lock_wait" };
+        for (int i = 0; i < 3; i++) {
+            header += string(",") + histograms[i] + "_mean_ms," + histograms[i] + "_p50_ms," + histograms[i] + "_p95_ms,"
+                      + histograms[i] + "_p99_ms," + histograms[i] + "_max_ms";
+        }
+        return header;
+    }
+
+    string getCsvRow(const string &streamName)
+    {
+        const Snapshot snapshot = getSnapshot();
+        std::ostringstream row;
+        row << ofGetElapsedTimeMillis() << "," << streamName << "," << snapshot.numAcquired << "," << snapshot.numDropped << ","
+            << snapshot.numOverwritten << "," << snapshot.numConsumed << "," << snapshot.fps;
+
+        const LatencyHistogram *histograms[] = { &snapshot.sensorLatency, &snapshot.processingTime, &snapshot.lockWait };
+        for (int i = 0; i < 3; i++) {
+            row << "," << histograms[i]->getMeanMillis() << "," << histograms[i]->getPercentileMillis(0.5f) << ","
+                << histograms[i]->getPercentileMillis(0.95f) << "," << histograms[i]->getPercentileMillis(0.99f) << ","
+                << histograms[i]->getMaxMillis();
+        }
+        return row.str();
+    }
+
+    /**
+     * @brief The host clock in the SDK's 100 ns ticks. The SDK stamps the frames with the performance counter.
+     */
+    static uint64_t getHostTicks()
+    {
+#if defined(TARGET_WIN32)
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return counter.QuadPart / frequency.QuadPart * TICKS_PER_SECOND + counter.QuadPart % frequency.QuadPart * TICKS_PER_SECOND / frequency.QuadPart;
+#else
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() * 10;
+#endif
+    }
+
+protected:
+    std::mutex m_Mutex;
+    Snapshot m_Snapshot;
+    uint64_t m_LastTimestamp, m_FpsWindowStart;
+    int m_FpsWindowFrames;
+};
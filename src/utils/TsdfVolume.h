@@ -0,0 +1,660 @@
+#pragma once
+#include "ofMain.h"
+#include "RigidTransform.h"
+#include "Scheduler.h"
+#include "Simd.h"
+#include <algorithm>
+
+namespace ofxKinect2
+{
+class DepthStream;
+class TsdfVolume;
+} // namespace ofxKinect2
+
+/**
+ * @brief KinectFusion style volumetric fusion on the CPU: every depth frame updates a truncated signed distance
+ * field, the running weighted average of the distance to the nearest surface in front of or behind each voxel. Only
+ * the 8x8x8 voxel blocks near a surface are allocated, in a hash table keyed by block coordinates, so a room needs
+ * memory for its surfaces rather than for its volume, capped by setMaxBlocks().
+ *
+ * Poses map camera space to world space (p * pose, as ofMatrix4x4 does) and must be rigid. Camera space is that of
+ * MeshGenerator: millimeters, y up and -z in front of the camera. Read the result back with raycast() as the depth
+ * a camera would see, or as points on the surface with getSurfacePoints().
+ */
+class ofxKinect2::TsdfVolume
+{
+public:
+    static const int BLOCK_SIZE = 8;
+    static const int BLOCK_VOXELS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+
+    TsdfVolume()
+        : m_VoxelSize(8)
+        , m_Truncation(30)
+        , m_MaxWeight(64)
+        , m_MaxBlocks(32768)
+        , m_Width(0)
+        , m_Height(0)
+        , m_FrameIndex(0)
+        , m_IsFull(false)
+    {
+        setup(70.6f, 60.f);
+        reset();
+    }
+
+    /**
+     * @brief Takes the field of view from the stream, defined in ofxKinect2.cpp. Needs the whole frame: with a
+     * region of interest it warns and keeps the field of view it had.
+     */
+    void setup(DepthStream &depthStream);
+
+    /**
+     * @brief Field of view in degrees, as given by Stream::getHorizontalFieldOfView().
+     */
+    void setup(float fovH, float fovV)
+    {
+        m_xzFactor = tan(ofDegToRad(fovH) * 0.5) * 2;
+        m_yzFactor = tan(ofDegToRad(fovV) * 0.5) * -2;
+    }
+
+    /**
+     * @brief Empties the volume.
+     */
+    void reset()
+    {
+        m_Blocks.clear();
+        m_Voxels.clear();
+        m_VisibleBlocks.clear();
+        const Slot empty = { EMPTY_KEY, 0 };
+        m_Table.assign(getTableSize(), empty);
+        m_IsFull = false;
+        m_MinBlock.set(std::numeric_limits<float>::max());
+        m_MaxBlock.set(-std::numeric_limits<float>::max());
+    }
+
+    /**
+     * @brief Fuses a depth frame seen from the given camera to world pose.
+     */
+    void integrate(const ofShortPixels &depth, const ofMatrix4x4 &cameraToWorld, Scheduler *scheduler = nullptr)
+    {
+        assert(depth.getNumChannels() == 1);
+
+        m_Width = depth.getWidth();
+        m_Height = depth.getHeight();
+        m_FrameIndex++;
+        const RigidTransform toWorld = RigidTransform(cameraToWorld);
+        const RigidTransform toCamera = toWorld.getInverse();
+
+        allocateBlocks(depth, toWorld, scheduler);
+
+        const unsigned short *depthPixels = depth.getPixels();
+        const int *visibleBlocks = m_VisibleBlocks.empty() ? nullptr : &m_VisibleBlocks[0];
+        parallelFor(scheduler, 0, m_VisibleBlocks.size(), [this, depthPixels, visibleBlocks, &toCamera](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                integrateBlock(visibleBlocks[i], depthPixels, toCamera);
+            }
+        }, 16);
+    }
+
+    /**
+     * @brief The depth in millimeters a camera at the pose would see of the volume, at the size of the integrated
+     * frames. 0 where the rays hit nothing within maxDepth.
+     */
+    void raycast(const ofMatrix4x4 &cameraToWorld, ofShortPixels &depth, Scheduler *scheduler = nullptr, float maxDepth = 5000)
+    {
+        if (m_Width == 0) {
+            return;
+        }
+        if (!depth.isAllocated() || depth.getWidth() != m_Width || depth.getHeight() != m_Height || depth.getNumChannels() != 1) {
+            depth.allocate(m_Width, m_Height, 1);
+        }
+
+        const RigidTransform toWorld = RigidTransform(cameraToWorld);
+        unsigned short *depthPixels = depth.getPixels();
+        parallelFor(scheduler, 0, m_Height, [this, depthPixels, &toWorld, maxDepth](int begin, int end) {
+            for (int y = begin; y < end; y++) {
+                for (int x = 0; x < m_Width; x++) {
+                    const float Z = castRay(x, y, toWorld, maxDepth);
+                    depthPixels[y * m_Width + x] = static_cast<unsigned short>(std::min(Z + 0.5f, 65535.f));
+                }
+            }
+        }, 8);
+    }
+
+    /**
+     * @brief Points where the distance changes sign between neighbouring observed voxels, in world space.
+     */
+    void getSurfacePoints(ofMesh &mesh) const
+    {
+        mesh.setMode(OF_PRIMITIVE_POINTS);
+        vector<ofVec3f> &vertices = mesh.getVertices();
+        vertices.clear();
+        for (size_t b = 0; b < m_Blocks.size(); b++) {
+            const Block &block = m_Blocks[b];
+            const Voxel *voxels = &m_Voxels[b * BLOCK_VOXELS];
+            for (int i = 0; i < BLOCK_VOXELS; i++) {
+                if (voxels[i].weight == 0) {
+                    continue;
+                }
+
+                const int x = block.x * BLOCK_SIZE + i % BLOCK_SIZE;
+                const int y = block.y * BLOCK_SIZE + i / BLOCK_SIZE % BLOCK_SIZE;
+                const int z = block.z * BLOCK_SIZE + i / (BLOCK_SIZE * BLOCK_SIZE);
+                const float value = voxels[i].tsdf / 32767.f;
+                const int neighbours[3][3] = { { x + 1, y, z }, { x, y + 1, z }, { x, y, z + 1 } };
+                for (int axis = 0; axis < 3; axis++) {
+                    const Voxel *neighbour = findVoxel(neighbours[axis][0], neighbours[axis][1], neighbours[axis][2]);
+                    if (!neighbour || neighbour->weight == 0 || (neighbour->tsdf < 0) == (voxels[i].tsdf < 0)) {
+                        continue;
+                    }
+
+                    // Where the linear interpolation between the two voxel centers crosses 0.
+                    const float t = value / (value - neighbour->tsdf / 32767.f);
+                    ofVec3f point((x + 0.5f) * m_VoxelSize, (y + 0.5f) * m_VoxelSize, (z + 0.5f) * m_VoxelSize);
+                    point[axis] += t * m_VoxelSize;
+                    vertices.push_back(point);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Edge length of the voxels in millimeters, resets the volume.
+     */
+    void setVoxelSize(float size)
+    {
+        m_VoxelSize = std::max(size, 0.5f);
+        reset();
+    }
+    float getVoxelSize() const
+    {
+        return m_VoxelSize;
+    }
+
+    /**
+     * @brief Distance to the surface in millimeters beyond which the field is cut, a few voxels. Larger values fill
+     * holes faster but round thin objects.
+     */
+    void setTruncation(float truncation)
+    {
+        m_Truncation = std::max(truncation, m_VoxelSize);
+    }
+    float getTruncation() const
+    {
+        return m_Truncation;
+    }
+
+    /**
+     * @brief Caps the number of frames averaged per voxel, so the volume keeps adapting to changes.
+     */
+    void setMaxWeight(int maxWeight)
+    {
+        m_MaxWeight = ofClamp(maxWeight, 1, 65535);
+    }
+    int getMaxWeight() const
+    {
+        return m_MaxWeight;
+    }
+
+    /**
+     * @brief The memory budget, BLOCK_VOXELS * 4 bytes per block. Resets the volume.
+     */
+    void setMaxBlocks(int maxBlocks)
+    {
+        m_MaxBlocks = std::max(maxBlocks, 1);
+        reset();
+    }
+    int getMaxBlocks() const
+    {
+        return m_MaxBlocks;
+    }
+
+    int getNumBlocks() const
+    {
+        return m_Blocks.size();
+    }
+
+    /**
+     * @brief Blocks the last frame updated.
+     */
+    int getNumVisibleBlocks() const
+    {
+        return m_VisibleBlocks.size();
+    }
+
+    /**
+     * @brief True once a frame needed more blocks than setMaxBlocks() allows, the surfaces beyond are dropped.
+     */
+    bool isFull() const
+    {
+        return m_IsFull;
+    }
+
+    size_t getMemoryUsage() const
+    {
+        return m_Voxels.capacity() * sizeof(Voxel) + m_Blocks.capacity() * sizeof(Block) + m_Table.capacity() * sizeof(Slot);
+    }
+
+protected:
+    static const uint64_t EMPTY_KEY = ~0ULL;
+    static const int COORD_BITS = 21;
+    static const int COORD_OFFSET = 1 << (COORD_BITS - 1);
+    /** @brief Sampled rows per chunk of allocateBlocks(), each chunk has its own key buffer. */
+    static const int KEY_CHUNK_ROWS = 8;
+
+    /** @brief The distance over the truncation in 1/32767 steps, and the number of frames averaged. */
+    struct Voxel {
+        short tsdf;
+        unsigned short weight;
+    };
+
+    struct Block {
+        int x, y, z;
+        /** @brief The last frame that listed the block as visible. */
+        int frameIndex;
+    };
+
+    struct Slot {
+        uint64_t key;
+        int block;
+    };
+
+    float m_VoxelSize, m_Truncation;
+    int m_MaxWeight, m_MaxBlocks;
+    float m_xzFactor, m_yzFactor;
+    int m_Width, m_Height;
+    int m_FrameIndex;
+    bool m_IsFull;
+    /** @brief Block coordinates of the allocated blocks' bounding box. */
+    ofVec3f m_MinBlock, m_MaxBlock;
+
+    std::vector<Slot> m_Table;
+    std::vector<Block> m_Blocks;
+    std::vector<Voxel> m_Voxels;
+    std::vector<int> m_VisibleBlocks;
+    std::vector<std::vector<uint64_t> > m_ChunkKeys;
+
+protected:
+    int getTableSize() const
+    {
+        int size = 1024;
+        while (size < m_MaxBlocks * 2) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    static uint64_t getKey(int x, int y, int z)
+    {
+        const uint64_t mask = (1 << COORD_BITS) - 1;
+        return (static_cast<uint64_t>(x + COORD_OFFSET) & mask) | ((static_cast<uint64_t>(y + COORD_OFFSET) & mask) << COORD_BITS)
+               | ((static_cast<uint64_t>(z + COORD_OFFSET) & mask) << (COORD_BITS * 2));
+    }
+
+    static uint64_t hash(uint64_t key)
+    {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return key ^ (key >> 31);
+    }
+
+    /**
+     * @brief The block index, -1 if the block isn't allocated.
+     */
+    int findBlock(uint64_t key) const
+    {
+        const size_t mask = m_Table.size() - 1;
+        for (size_t slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            if (m_Table[slot].key == key) {
+                return m_Table[slot].block;
+            }
+            if (m_Table[slot].key == EMPTY_KEY) {
+                return -1;
+            }
+        }
+    }
+
+    /**
+     * @brief The block index, allocated if needed, -1 when the budget is used up.
+     */
+    int findOrAddBlock(uint64_t key, int x, int y, int z)
+    {
+        const size_t mask = m_Table.size() - 1;
+        size_t slot = hash(key) & mask;
+        for (; m_Table[slot].key != EMPTY_KEY; slot = (slot + 1) & mask) {
+            if (m_Table[slot].key == key) {
+                return m_Table[slot].block;
+            }
+        }
+
+        if (static_cast<int>(m_Blocks.size()) >= m_MaxBlocks) {
+            m_IsFull = true;
+            return -1;
+        }
+
+        const Block block = { x, y, z, 0 };
+        const Voxel empty = { 0, 0 };
+        m_Table[slot].key = key;
+        m_Table[slot].block = m_Blocks.size();
+        m_Blocks.push_back(block);
+        m_MinBlock.set(std::min<float>(m_MinBlock.x, x), std::min<float>(m_MinBlock.y, y), std::min<float>(m_MinBlock.z, z));
+        m_MaxBlock.set(std::max<float>(m_MaxBlock.x, x), std::max<float>(m_MaxBlock.y, y), std::max<float>(m_MaxBlock.z, z));
+        m_Voxels.resize(m_Voxels.size() + BLOCK_VOXELS, empty);
+        return m_Table[slot].block;
+    }
+
+    const Voxel *findVoxel(int x, int y, int z) const
+    {
+        const int bx = floorDiv(x), by = floorDiv(y), bz = floorDiv(z);
+        const int block = findBlock(getKey(bx, by, bz));
+        if (block < 0) {
+            return nullptr;
+        }
+        const int i = (x - bx * BLOCK_SIZE) + (y - by * BLOCK_SIZE) * BLOCK_SIZE + (z - bz * BLOCK_SIZE) * BLOCK_SIZE * BLOCK_SIZE;
+        return &m_Voxels[block * BLOCK_VOXELS + i];
+    }
+
+    /**
+     * @brief floor() by truncation, the library call is much slower than the rest of a ray step.
+     */
+    static int fastFloor(float value)
+    {
+        const int truncated = static_cast<int>(value);
+        return truncated - (value < truncated);
+    }
+
+    static int floorDiv(int value)
+    {
+        return value >= 0 ? value / BLOCK_SIZE : -((-value + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+
+    /**
+     * @brief Lists the blocks the truncation band around every other depth pixel passes through, allocating the
+     * new ones. The chunks of rows collect and dedupe their block keys in parallel into buffers kept from frame to
+     * frame, the hash table is updated by this thread.
+     */
+    void allocateBlocks(const ofShortPixels &depth, const RigidTransform &toWorld, Scheduler *scheduler)
+    {
+        const int width = m_Width;
+        const unsigned short *depthPixels = depth.getPixels();
+        const float invBlockSize = 1.f / (m_VoxelSize * BLOCK_SIZE);
+        // Enough samples along the longest ray, the one of a corner, to land in every block of the band.
+        const float maxRayLength = ofVec3f(m_xzFactor * 0.5f, m_yzFactor * 0.5f, 1).length();
+        const int numSteps = static_cast<int>(ceilf(2 * m_Truncation * maxRayLength * invBlockSize)) + 1;
+
+        const int numRows = m_Height / 2;
+        const int numChunks = (numRows + KEY_CHUNK_ROWS - 1) / KEY_CHUNK_ROWS;
+        if (static_cast<int>(m_ChunkKeys.size()) != numChunks) {
+            m_ChunkKeys.resize(numChunks);
+        }
+        std::vector<uint64_t> *chunkKeys = numChunks > 0 ? &m_ChunkKeys[0] : nullptr;
+        parallelFor(scheduler, 0, numChunks, [this, chunkKeys, numRows, depthPixels, width, invBlockSize, numSteps, &toWorld](int begin, int end) {
+            for (int chunk = begin; chunk < end; chunk++) {
+                std::vector<uint64_t> &keys = chunkKeys[chunk];
+                keys.clear();
+                uint64_t lastKey = EMPTY_KEY;
+                for (int row = chunk * KEY_CHUNK_ROWS; row < std::min((chunk + 1) * KEY_CHUNK_ROWS, numRows); row++) {
+                    const int y = row * 2;
+                    for (int x = 0; x < width; x += 2) {
+                        const float Z = depthPixels[y * width + x];
+                        if (Z == 0) {
+                            continue;
+                        }
+
+                        const ofVec3f ray((x * (1.f / width) - 0.5f) * m_xzFactor, (static_cast<float>(y) / m_Height - 0.5f) * m_yzFactor, -1);
+                        for (int step = 0; step < numSteps; step++) {
+                            const float distance = Z - m_Truncation + 2 * m_Truncation * step / std::max(numSteps - 1, 1);
+                            const ofVec3f point = toWorld.apply(ray * std::max(distance, 1.f)) * invBlockSize;
+                            const uint64_t key = getKey(fastFloor(point.x), fastFloor(point.y), fastFloor(point.z));
+                            if (key != lastKey) {
+                                keys.push_back(key);
+                                lastKey = key;
+                            }
+                        }
+                    }
+                }
+
+                std::sort(keys.begin(), keys.end());
+                keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            }
+        }, 1);
+
+        // The chunks still share the blocks along their borders, frameIndex lists those once.
+        m_VisibleBlocks.clear();
+        const uint64_t mask = (1 << COORD_BITS) - 1;
+        for (int chunk = 0; chunk < numChunks; chunk++) {
+            const std::vector<uint64_t> &keys = m_ChunkKeys[chunk];
+            for (size_t i = 0; i < keys.size(); i++) {
+                const uint64_t key = keys[i];
+                const int x = static_cast<int>(key & mask) - COORD_OFFSET;
+                const int y = static_cast<int>((key >> COORD_BITS) & mask) - COORD_OFFSET;
+                const int z = static_cast<int>(key >> (COORD_BITS * 2)) - COORD_OFFSET;
+                const int block = findOrAddBlock(key, x, y, z);
+                if (block >= 0 && m_Blocks[block].frameIndex != m_FrameIndex) {
+                    m_Blocks[block].frameIndex = m_FrameIndex;
+                    m_VisibleBlocks.push_back(block);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Projects the voxel centers into the depth frame and averages in their truncated distance to the
+     * surface. The camera space positions and the projections run 4 voxels at a time along x.
+     */
+    void integrateBlock(int blockIndex, const unsigned short *depthPixels, const RigidTransform &toCamera)
+    {
+        const Block &block = m_Blocks[blockIndex];
+        Voxel *voxels = &m_Voxels[blockIndex * BLOCK_VOXELS];
+        const ofVec3f origin = toCamera.apply(ofVec3f((block.x * BLOCK_SIZE + 0.5f) * m_VoxelSize, (block.y * BLOCK_SIZE + 0.5f) * m_VoxelSize,
+                                                      (block.z * BLOCK_SIZE + 0.5f) * m_VoxelSize));
+        const ofVec3f stepX = toCamera.rotate(ofVec3f(m_VoxelSize, 0, 0));
+        const ofVec3f stepY = toCamera.rotate(ofVec3f(0, m_VoxelSize, 0));
+        const ofVec3f stepZ = toCamera.rotate(ofVec3f(0, 0, m_VoxelSize));
+        const float invTruncation = 1.f / m_Truncation;
+
+        for (int z = 0; z < BLOCK_SIZE; z++) {
+            for (int y = 0; y < BLOCK_SIZE; y++) {
+                const ofVec3f rowStart = origin + stepY * y + stepZ * z;
+                Voxel *row = voxels + (z * BLOCK_SIZE + y) * BLOCK_SIZE;
+                int pixels[BLOCK_SIZE];
+                float depths[BLOCK_SIZE];
+                projectRow(rowStart, stepX, pixels, depths);
+
+                for (int x = 0; x < BLOCK_SIZE; x++) {
+                    if (pixels[x] < 0) {
+                        continue;
+                    }
+                    const int measured = depthPixels[pixels[x]];
+                    if (measured == 0) {
+                        continue;
+                    }
+
+                    // Positive in front of the surface, nothing is known far behind it.
+                    const float distance = measured - depths[x];
+                    if (distance < -m_Truncation) {
+                        continue;
+                    }
+
+                    const float tsdf = std::min(distance * invTruncation, 1.f);
+                    Voxel &voxel = row[x];
+                    const int weight = voxel.weight;
+                    const float average = (voxel.tsdf * weight + tsdf * 32767.f) / (weight + 1);
+                    voxel.tsdf = static_cast<short>(average);
+                    voxel.weight = static_cast<unsigned short>(std::min(weight + 1, m_MaxWeight));
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief The depth pixel index and the depth of BLOCK_SIZE voxels along a row, -1 when outside the frame.
+     */
+    void projectRow(const ofVec3f &start, const ofVec3f &step, int *pixels, float *depths) const
+    {
+        int x = 0;
+#if defined(OFX_KINECT2_SSE2)
+        const __m128 steps = _mm_set_ps(3, 2, 1, 0);
+        const __m128 xFactor = _mm_set1_ps(m_xzFactor);
+        const __m128 yFactor = _mm_set1_ps(m_yzFactor);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 width = _mm_set1_ps(static_cast<float>(m_Width));
+        const __m128 height = _mm_set1_ps(static_cast<float>(m_Height));
+        const __m128 zero = _mm_setzero_ps();
+        for (; x + 4 <= BLOCK_SIZE; x += 4) {
+            const __m128 offset = _mm_add_ps(steps, _mm_set1_ps(static_cast<float>(x)));
+            const __m128 cx = _mm_add_ps(_mm_set1_ps(start.x), _mm_mul_ps(offset, _mm_set1_ps(step.x)));
+            const __m128 cy = _mm_add_ps(_mm_set1_ps(start.y), _mm_mul_ps(offset, _mm_set1_ps(step.y)));
+            const __m128 depth = _mm_sub_ps(zero, _mm_add_ps(_mm_set1_ps(start.z), _mm_mul_ps(offset, _mm_set1_ps(step.z))));
+
+            // Pixel coordinates rounded to the nearest, valid in [0, size) and in front of the camera.
+            const __m128 u = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(cx, _mm_mul_ps(depth, xFactor)), half), width), half);
+            const __m128 v = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(cy, _mm_mul_ps(depth, yFactor)), half), height), half);
+            const __m128 isValid = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(depth, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmplt_ps(u, width))),
+                                              _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmplt_ps(v, height)));
+            const __m128i index = _mm_add_epi32(_mm_cvttps_epi32(u), _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(v)), width)));
+            const __m128i result = _mm_or_si128(_mm_and_si128(_mm_castps_si128(isValid), index), _mm_andnot_si128(_mm_castps_si128(isValid), _mm_set1_epi32(-1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + x), result);
+            _mm_storeu_ps(depths + x, depth);
+        }
+#endif
+
+        for (; x < BLOCK_SIZE; x++) {
+            const ofVec3f point = start + step * x;
+            const float depth = -point.z;
+            depths[x] = depth;
+            pixels[x] = -1;
+            if (depth <= 0) {
+                continue;
+            }
+
+            const float u = (point.x / (depth * m_xzFactor) + 0.5f) * m_Width + 0.5f;
+            const float v = (point.y / (depth * m_yzFactor) + 0.5f) * m_Height + 0.5f;
+            if (u >= 0 && u < m_Width && v >= 0 && v < m_Height) {
+                pixels[x] = static_cast<int>(u) + static_cast<int>(v) * m_Width;
+            }
+        }
+    }
+
+    /**
+     * @brief The distance over the truncation at a world position, false where nothing was observed.
+     */
+    bool getValue(const ofVec3f &point, float &value, int &cachedBlock, uint64_t &cachedKey) const
+    {
+        const float invVoxelSize = 1.f / m_VoxelSize;
+        const int x = fastFloor(point.x * invVoxelSize);
+        const int y = fastFloor(point.y * invVoxelSize);
+        const int z = fastFloor(point.z * invVoxelSize);
+        const int bx = floorDiv(x), by = floorDiv(y), bz = floorDiv(z);
+        const uint64_t key = getKey(bx, by, bz);
+        if (key != cachedKey) {
+            cachedKey = key;
+            cachedBlock = findBlock(key);
+        }
+        if (cachedBlock < 0) {
+            return false;
+        }
+
+        const Voxel &voxel = m_Voxels[cachedBlock * BLOCK_VOXELS + (x - bx * BLOCK_SIZE) + (y - by * BLOCK_SIZE) * BLOCK_SIZE + (z - bz * BLOCK_SIZE) * BLOCK_SIZE * BLOCK_SIZE];
+        if (voxel.weight == 0) {
+            return false;
+        }
+        value = voxel.tsdf / 32767.f;
+        return true;
+    }
+
+    /**
+     * @brief Where the ray leaves the block that contains the point.
+     */
+    float getBlockExit(const ofVec3f &point, const ofVec3f &origin, const ofVec3f &direction) const
+    {
+        const float blockSize = m_VoxelSize * BLOCK_SIZE;
+        float exit = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; axis++) {
+            if (direction[axis] != 0) {
+                const float corner = floorf(point[axis] / blockSize) * blockSize;
+                const float plane = direction[axis] > 0 ? corner + blockSize : corner;
+                exit = std::min(exit, (plane - origin[axis]) / direction[axis]);
+            }
+        }
+        return exit;
+    }
+
+    /**
+     * @brief Marches along the ray of the pixel, a block at a time through unallocated space and by the distance
+     * the field gives near surfaces, up to the first crossing from in front to behind a surface. Returns its depth,
+     * or 0.
+     */
+    float castRay(int x, int y, const RigidTransform &toWorld, float maxDepth) const
+    {
+        // Per millimeter of depth, so t is the depth.
+        const ofVec3f direction = toWorld.rotate(ofVec3f((x * (1.f / m_Width) - 0.5f) * m_xzFactor, (static_cast<float>(y) / m_Height - 0.5f) * m_yzFactor, -1));
+        const ofVec3f origin(toWorld.translation[0], toWorld.translation[1], toWorld.translation[2]);
+        const float rayLength = direction.length();
+        const float blockStep = m_VoxelSize * BLOCK_SIZE / rayLength;
+        const float minStep = m_VoxelSize * 0.5f / rayLength;
+
+        // Only the part of the ray in the bounding box of the blocks.
+        float start = 400, end = maxDepth;
+        const float blockSize = m_VoxelSize * BLOCK_SIZE;
+        for (int axis = 0; axis < 3; axis++) {
+            const float lower = m_MinBlock[axis] * blockSize - origin[axis];
+            const float upper = (m_MaxBlock[axis] + 1) * blockSize - origin[axis];
+            if (direction[axis] == 0) {
+                if (lower > 0 || upper < 0) {
+                    return 0;
+                }
+                continue;
+            }
+            const float t0 = lower / direction[axis], t1 = upper / direction[axis];
+            start = std::max(start, std::min(t0, t1));
+            end = std::min(end, std::max(t0, t1));
+        }
+
+        int cachedBlock = -1;
+        uint64_t cachedKey = EMPTY_KEY;
+        float previousT = 0, previousValue = 0;
+        bool hasPrevious = false;
+        // Block steps until the first allocated block, then block by block from the last empty one, so the front of
+        // the surface isn't jumped over.
+        bool isWalking = false, hasBlockStep = false;
+        float emptyT = 0;
+        for (float t = start; t < end;) {
+            const ofVec3f point = origin + direction * t;
+            float value;
+            if (!getValue(point, value, cachedBlock, cachedKey)) {
+                hasPrevious = false;
+                if (cachedBlock >= 0) {
+                    t += minStep;
+                }
+                else if (isWalking) {
+                    t = std::max(getBlockExit(point, origin, direction), t) + minStep * 0.01f;
+                }
+                else {
+                    emptyT = t;
+                    hasBlockStep = true;
+                    t += blockStep;
+                }
+                continue;
+            }
+            if (hasBlockStep) {
+                hasBlockStep = false;
+                isWalking = true;
+                t = std::max(getBlockExit(origin + direction * emptyT, origin, direction), emptyT) + minStep * 0.01f;
+                continue;
+            }
+            if (value < 0) {
+                if (!hasPrevious) {
+                    // Started behind a surface, or came in from the side of it.
+                    return 0;
+                }
+                return previousT + (t - previousT) * previousValue / (previousValue - value);
+            }
+
+            previousT = t;
+            previousValue = value;
+            hasPrevious = true;
+            t += std::max(value * m_Truncation * 0.8f / rayLength, minStep);
+        }
+        return 0;
+    }
+};
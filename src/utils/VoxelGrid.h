@@ -0,0 +1,321 @@
+#pragma once
+#include "ofMain.h"
+#include "Scheduler.h"
+
+namespace ofxKinect2
+{
+class VoxelGrid;
+} // namespace ofxKinect2
+
+/**
+ * @brief Downsamples a point cloud, e.g. the one of MeshGenerator, to one point per cubic voxel: the centroid of
+ * the points that fell in it, with their average color. Unlike a pixel stride the density is uniform in world
+ * space, near surfaces lose many points and far ones almost none.
+ *
+ * The voxels live in open addressing hash tables keyed by their packed integer coordinates. The key space is split
+ * into partitions by hash, each one with its own table filled by a single task, so the points are accumulated in
+ * parallel without locks or merging. The tables are kept from frame to frame and only the used slots are cleared.
+ */
+class ofxKinect2::VoxelGrid
+{
+public:
+    VoxelGrid()
+        : m_VoxelSize(20)
+        , m_MinPoints(1)
+    {
+
+    }
+
+    /**
+     * @brief Downsamples the vertices and colors of the mesh, the points at the origin (no depth) are left out.
+     */
+    const ofMesh &update(const ofMesh &mesh, Scheduler *scheduler = nullptr)
+    {
+        return update(mesh.getVertices(), mesh.getNumColors() > 0 ? &mesh.getColors() : nullptr, scheduler);
+    }
+
+    /**
+     * @brief Same as update(const ofMesh &), colors are averaged when there is one per point.
+     */
+    const ofMesh &update(const vector<ofVec3f> &points, const vector<ofFloatColor> *colors, Scheduler *scheduler = nullptr)
+    {
+        const int numPoints = points.size();
+        const bool hasColor = colors && colors->size() >= points.size();
+        const int numPartitions = scheduler && scheduler->isRunning() ? scheduler->getNumThreads() * 2 : 1;
+        if (static_cast<int>(m_Partitions.size()) != numPartitions) {
+            m_Partitions.assign(numPartitions, Partition());
+        }
+
+        // Pass 1: the voxel key of every point.
+        m_Keys.resize(numPoints);
+        const ofVec3f *pointData = numPoints > 0 ? &points[0] : nullptr;
+        uint64_t *keys = numPoints > 0 ? &m_Keys[0] : nullptr;
+        const float invSize = 1.f / m_VoxelSize;
+        parallelFor(scheduler, 0, numPoints, [pointData, keys, invSize](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                keys[i] = getKey(pointData[i], invSize);
+            }
+        }, 4096);
+
+        // Pass 2: each partition accumulates the points whose key hashes to it.
+        Partition *partitions = &m_Partitions[0];
+        const ofFloatColor *colorData = hasColor && numPoints > 0 ? &(*colors)[0] : nullptr;
+        parallelFor(scheduler, 0, numPartitions, [=](int begin, int end) {
+            for (int p = begin; p < end; p++) {
+                accumulate(partitions[p], p, numPartitions, keys, pointData, colorData, numPoints);
+            }
+        });
+
+        // Pass 3: the averages, each partition writes its voxels at its offset.
+        m_Offsets.assign(numPartitions + 1, 0);
+        for (int p = 0; p < numPartitions; p++) {
+            m_Offsets[p + 1] = m_Offsets[p] + countVoxels(partitions[p]);
+        }
+
+        m_Mesh.setMode(OF_PRIMITIVE_POINTS);
+        vector<ofVec3f> &vertices = m_Mesh.getVertices();
+        vector<ofFloatColor> &meshColors = m_Mesh.getColors();
+        vertices.resize(m_Offsets[numPartitions]);
+        meshColors.resize(hasColor ? m_Offsets[numPartitions] : 0);
+        if (m_Offsets[numPartitions] == 0) {
+            return m_Mesh;
+        }
+
+        ofVec3f *vertexData = &vertices[0];
+        ofFloatColor *meshColorData = hasColor ? &meshColors[0] : nullptr;
+        const int *offsetData = &m_Offsets[0];
+        const int minPoints = m_MinPoints;
+        parallelFor(scheduler, 0, numPartitions, [=](int begin, int end) {
+            for (int p = begin; p < end; p++) {
+                const Partition &partition = partitions[p];
+                int index = offsetData[p];
+                for (size_t i = 0; i < partition.cells.size(); i++) {
+                    const Cell &cell = partition.cells[i];
+                    if (cell.count < minPoints) {
+                        continue;
+                    }
+
+                    const float invCount = 1.f / cell.count;
+                    vertexData[index].set(cell.x * invCount, cell.y * invCount, cell.z * invCount);
+                    if (meshColorData) {
+                        meshColorData[index].set(cell.r * invCount, cell.g * invCount, cell.b * invCount, cell.a * invCount);
+                    }
+                    index++;
+                }
+            }
+        });
+
+        return m_Mesh;
+    }
+
+    void draw()
+    {
+        m_Mesh.draw();
+    }
+
+    const ofMesh &getMesh() const
+    {
+        return m_Mesh;
+    }
+
+    int getNumVoxels() const
+    {
+        return m_Mesh.getNumVertices();
+    }
+
+    /**
+     * @brief Edge length of the voxels in the units of the points, millimeters for MeshGenerator.
+     */
+    void setVoxelSize(float size)
+    {
+        m_VoxelSize = std::max(size, 0.001f);
+    }
+    float getVoxelSize() const
+    {
+        return m_VoxelSize;
+    }
+
+    /**
+     * @brief Voxels with fewer points are dropped, which also removes the isolated flying pixels.
+     */
+    void setMinPoints(int minPoints)
+    {
+        m_MinPoints = std::max(minPoints, 1);
+    }
+    int getMinPoints() const
+    {
+        return m_MinPoints;
+    }
+
+protected:
+    static const uint64_t EMPTY_KEY = ~0ULL;
+    static const int COORD_BITS = 21;
+    static const int COORD_OFFSET = 1 << (COORD_BITS - 1);
+
+    struct Cell {
+        float x, y, z, r, g, b, a;
+        int count;
+    };
+
+    /** @brief A hash table entry, 16 bytes so a probe mostly stays in one cache line. */
+    struct Slot {
+        uint64_t key;
+        int cell;
+    };
+
+    /**
+     * @brief The table points into cells, which are packed in the order the voxels were first seen, so coherent
+     * points touch few cache lines and the output reads them in sequence. slots lists the table entries of the
+     * cells, to clear them for the next frame.
+     */
+    struct Partition {
+        std::vector<Slot> table;
+        std::vector<Cell> cells;
+        std::vector<int> slots;
+    };
+
+    float m_VoxelSize;
+    int m_MinPoints;
+    std::vector<uint64_t> m_Keys;
+    std::vector<Partition> m_Partitions;
+    std::vector<int> m_Offsets;
+    ofMesh m_Mesh;
+
+protected:
+    /**
+     * @brief 21 bits per axis, about +-20 km with 20 mm voxels.
+     */
+    static uint64_t getKey(const ofVec3f &point, float invSize)
+    {
+        if (point.z == 0) {
+            return EMPTY_KEY;
+        }
+
+        const uint64_t x = getCoord(point.x * invSize);
+        const uint64_t y = getCoord(point.y * invSize);
+        const uint64_t z = getCoord(point.z * invSize);
+        return x | (y << COORD_BITS) | (z << (COORD_BITS * 2));
+    }
+
+    /**
+     * @brief floor() by truncation, the library call is much slower than the rest of the key.
+     */
+    static uint64_t getCoord(float value)
+    {
+        value = ofClamp(value, -COORD_OFFSET, COORD_OFFSET - 1);
+        int coord = static_cast<int>(value);
+        coord -= value < coord;
+        return coord + COORD_OFFSET;
+    }
+
+    /**
+     * @brief splitmix64 finalizer, neighbouring voxels land far apart.
+     */
+    static uint64_t hash(uint64_t key)
+    {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return key ^ (key >> 31);
+    }
+
+    static void accumulate(Partition &partition, int index, int numPartitions, const uint64_t *keys, const ofVec3f *points,
+                           const ofFloatColor *colors, int numPoints)
+    {
+        for (size_t i = 0; i < partition.slots.size(); i++) {
+            partition.table[partition.slots[i]].key = EMPTY_KEY;
+        }
+        partition.slots.clear();
+        partition.cells.clear();
+        if (partition.table.empty()) {
+            resize(partition, 1024);
+        }
+
+        // Neighbouring pixels mostly share a voxel, remember the last one to skip the hash and the probe. The keys
+        // of other partitions are remembered too, with no cell, so their runs are skipped without hashing.
+        uint64_t lastKey = EMPTY_KEY;
+        int lastCell = -1;
+        for (int i = 0; i < numPoints; i++) {
+            const uint64_t key = keys[i];
+            if (key == EMPTY_KEY) {
+                continue;
+            }
+            if (key != lastKey) {
+                // The high bits pick the partition, scaled instead of a division, and the low ones the slot.
+                const uint64_t h = hash(key);
+                lastKey = key;
+                lastCell = static_cast<int>(((h >> 32) * numPartitions) >> 32) == index ? findCell(partition, key, h) : -1;
+            }
+            if (lastCell < 0) {
+                continue;
+            }
+
+            Cell &cell = partition.cells[lastCell];
+            cell.x += points[i].x;
+            cell.y += points[i].y;
+            cell.z += points[i].z;
+            if (colors) {
+                cell.r += colors[i].r;
+                cell.g += colors[i].g;
+                cell.b += colors[i].b;
+                cell.a += colors[i].a;
+            }
+            cell.count++;
+        }
+    }
+
+    static int findCell(Partition &partition, uint64_t key, uint64_t h)
+    {
+        // Keep the load under one half so the probes stay short.
+        if ((partition.cells.size() + 1) * 2 > partition.table.size()) {
+            resize(partition, partition.table.size() * 2);
+        }
+
+        const size_t mask = partition.table.size() - 1;
+        size_t slot = h & mask;
+        while (partition.table[slot].key != key) {
+            if (partition.table[slot].key == EMPTY_KEY) {
+                partition.table[slot].key = key;
+                partition.table[slot].cell = static_cast<int>(partition.cells.size());
+                partition.slots.push_back(static_cast<int>(slot));
+
+                const Cell cell = { 0, 0, 0, 0, 0, 0, 0, 0 };
+                partition.cells.push_back(cell);
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return partition.table[slot].cell;
+    }
+
+    static void resize(Partition &partition, size_t capacity)
+    {
+        const Slot empty = { EMPTY_KEY, 0 };
+        std::vector<Slot> table(capacity, empty);
+        const size_t mask = capacity - 1;
+        for (size_t i = 0; i < partition.slots.size(); i++) {
+            const Slot &entry = partition.table[partition.slots[i]];
+            size_t slot = hash(entry.key) & mask;
+            while (table[slot].key != EMPTY_KEY) {
+                slot = (slot + 1) & mask;
+            }
+            table[slot] = entry;
+            partition.slots[i] = static_cast<int>(slot);
+        }
+        partition.table.swap(table);
+    }
+
+    int countVoxels(const Partition &partition) const
+    {
+        if (m_MinPoints <= 1) {
+            return partition.cells.size();
+        }
+
+        int count = 0;
+        for (size_t i = 0; i < partition.cells.size(); i++) {
+            if (partition.cells[i].count >= m_MinPoints) {
+                count++;
+            }
+        }
+        return count;
+    }
+};